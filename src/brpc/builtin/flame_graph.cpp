@@ -0,0 +1,587 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <inttypes.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "butil/file_util.h"                   // ReadFileToString
+#include "butil/string_printf.h"
+#include "brpc/details/symbolizer.h"
+#include "brpc/builtin/flame_graph.h"
+
+namespace brpc {
+
+namespace {
+
+// A sample of a profile before symbolizing.
+struct RawSample {
+    int64_t value;
+    std::vector<uint64_t> pcs;    // innermost frame first
+};
+
+// Split `data' into lines without the trailing '\n'.
+class LineReader {
+public:
+    explicit LineReader(const butil::StringPiece& data)
+        : _data(data), _pos(0) {}
+
+    bool Next(butil::StringPiece* line) {
+        if (_pos >= _data.size()) {
+            return false;
+        }
+        size_t eol = _data.find('\n', _pos);
+        if (eol == butil::StringPiece::npos) {
+            eol = _data.size();
+        }
+        *line = _data.substr(_pos, eol - _pos);
+        _pos = eol + 1;
+        return true;
+    }
+
+private:
+    butil::StringPiece _data;
+    size_t _pos;
+};
+
+// Parse addresses like "@ 0x4a2b1c 0x4a2c00 ..." after `at'.
+void ParseAddresses(const char* at, std::vector<uint64_t>* pcs) {
+    pcs->clear();
+    const char* p = at;
+    while (true) {
+        char* endptr = NULL;
+        const unsigned long long pc = strtoull(p, &endptr, 16);
+        if (endptr == p) {
+            break;
+        }
+        pcs->push_back(pc);
+        p = endptr;
+    }
+}
+
+// Returns true if `line' looks like "start-end perms offset ..."
+bool IsMappingLine(const butil::StringPiece& line) {
+    size_t i = 0;
+    while (i < line.size() && isxdigit(line[i])) {
+        ++i;
+    }
+    return i > 0 && i < line.size() && line[i] == '-';
+}
+
+// Binary profile of gperftools' cpu profiler: a header of 5 slots
+// [0, 3, 0, sampling_period_us, 0], records of [count, depth, pc...],
+// a trailer of [0, 1, 0], followed by text of /proc/self/maps.
+int ParseCpuProfile(const butil::StringPiece& data,
+                    std::vector<RawSample>* samples,
+                    butil::StringPiece* maps, std::string* error) {
+    typedef uintptr_t Slot;
+    const size_t nslot = data.size() / sizeof(Slot);
+    std::vector<Slot> slots(nslot);
+    if (nslot) {
+        memcpy(&slots[0], data.data(), nslot * sizeof(Slot));
+    }
+    if (nslot < 5 || slots[0] != 0 || slots[1] < 3) {
+        *error = "Invalid header of cpu profile";
+        return -1;
+    }
+    size_t i = 2 + slots[1];
+    while (true) {
+        if (i + 2 > nslot) {
+            *error = "Truncated cpu profile";
+            return -1;
+        }
+        const Slot count = slots[i];
+        const Slot depth = slots[i + 1];
+        if (depth > nslot - i - 2) {
+            *error = "Truncated cpu profile";
+            return -1;
+        }
+        if (count == 0 && depth == 1 && slots[i + 2] == 0) {
+            i += 3;
+            break;
+        }
+        RawSample s;
+        s.value = count;
+        s.pcs.assign(slots.begin() + i + 2, slots.begin() + i + 2 + depth);
+        samples->push_back(s);
+        i += 2 + depth;
+    }
+    *maps = data.substr(i * sizeof(Slot));
+    return 0;
+}
+
+// Text profile of bthread's contention profiler:
+//   --- contention
+//   cycles/second=1000000000
+//   <duration_ns> <count> @ <pc>...
+//   <content of /proc/self/maps>
+void ParseContentionProfile(const butil::StringPiece& data, bool show_count,
+                            std::vector<RawSample>* samples,
+                            std::string* maps) {
+    LineReader reader(data);
+    butil::StringPiece line;
+    while (reader.Next(&line)) {
+        if (IsMappingLine(line)) {
+            line.AppendToString(maps);
+            maps->push_back('\n');
+            continue;
+        }
+        const std::string s = line.as_string();
+        long long duration = 0;
+        long long count = 0;
+        int at = 0;
+        if (sscanf(s.c_str(), "%lld %lld @%n", &duration, &count, &at) < 2 ||
+            at <= 0) {
+            continue;
+        }
+        RawSample sample;
+        sample.value = (show_count ? count : duration);
+        ParseAddresses(s.c_str() + at, &sample.pcs);
+        samples->push_back(sample);
+    }
+}
+
+// Text profile of tcmalloc's heap sample and growth stacks:
+//   heap profile: <objs>: <bytes> [<objs>: <bytes>] @ heap_v2/<rate>
+//   <objs>: <bytes> [<objs>: <bytes>] @ <pc>...
+//   MAPPED_LIBRARIES:
+//   <content of /proc/self/maps>
+int ParseHeapProfile(const butil::StringPiece& data, bool show_count,
+                     std::vector<RawSample>* samples,
+                     std::string* maps, std::string* error) {
+    LineReader reader(data);
+    butil::StringPiece line;
+    if (!reader.Next(&line) || !line.starts_with("heap profile:")) {
+        *error = "Invalid header of heap profile";
+        return -1;
+    }
+    // Samples of heap_v2 are taken every `rate' bytes in average, scale
+    // them back to estimations of all allocations like pprof does.
+    double rate = 0;
+    const size_t v2_pos = line.find("heap_v2/");
+    if (v2_pos != butil::StringPiece::npos) {
+        rate = strtod(line.substr(v2_pos + 8).as_string().c_str(), NULL);
+    }
+    while (reader.Next(&line)) {
+        if (IsMappingLine(line)) {
+            line.AppendToString(maps);
+            maps->push_back('\n');
+            continue;
+        }
+        const std::string s = line.as_string();
+        long long objs = 0;
+        long long bytes = 0;
+        int at = 0;
+        if (sscanf(s.c_str(), " %lld: %lld [ %*d: %*d] @%n",
+                   &objs, &bytes, &at) < 2 || at <= 0) {
+            continue;
+        }
+        double scale = 1;
+        if (rate > 0 && objs > 0 && bytes > 0) {
+            scale = 1 / (1 - exp(-(double)bytes / objs / rate));
+        }
+        RawSample sample;
+        sample.value = (int64_t)llround((show_count ? objs : bytes) * scale);
+        ParseAddresses(s.c_str() + at, &sample.pcs);
+        samples->push_back(sample);
+    }
+    return 0;
+}
+
+void AppendXmlEscaped(std::ostream& os, const butil::StringPiece& s) {
+    for (size_t i = 0; i < s.size(); ++i) {
+        switch (s[i]) {
+        case '&': os << "&amp;"; break;
+        case '<': os << "&lt;"; break;
+        case '>': os << "&gt;"; break;
+        case '"': os << "&quot;"; break;
+        case '\'': os << "&apos;"; break;
+        default: os << s[i]; break;
+        }
+    }
+}
+
+// Node of the call tree built from folded stacks.
+struct FrameNode {
+    butil::StringPiece name;
+    int64_t value;
+    std::map<butil::StringPiece, size_t> children;
+};
+
+// Layout of the flame graph in pixels.
+const int kImageWidth = 1200;
+const int kPadding = 10;
+const int kFrameHeight = 16;
+const int kTopHeight = 40;
+const int kBottomHeight = 30;
+const int kFontSize = 12;
+const double kCharWidth = 7;       // ~0.59 * kFontSize for Verdana
+const double kMinFrameWidth = 0.1; // frames narrower than this are omitted
+
+// Label of a frame fitting into `width', must be same with fg_fit() below.
+std::string FrameLabel(const butil::StringPiece& name, double width) {
+    const int nchar = (int)floor((width - 6) / kCharWidth);
+    if (nchar < 3) {
+        return std::string();
+    }
+    if ((int)name.size() > nchar) {
+        return name.substr(0, nchar - 2).as_string() + "..";
+    }
+    return name.as_string();
+}
+
+// Warm colors that depend only on names, so that a function has the same
+// color in different graphs.
+void FrameColor(const butil::StringPiece& name, int* r, int* g, int* b) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < name.size(); ++i) {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    }
+    *r = 205 + (int)(50 * ((h & 0xFF) / 255.0));
+    *g = (int)(230 * (((h >> 8) & 0xFF) / 255.0));
+    *b = (int)(55 * (((h >> 16) & 0xFF) / 255.0));
+}
+
+struct RenderContext {
+    const std::vector<FrameNode>* nodes;
+    double scale;       // pixels per unit of value
+    int64_t total;
+    const std::string* unit;
+    int max_depth;
+    int image_height;
+};
+
+void MeasureDepth(RenderContext* ctx, size_t idx, int depth) {
+    const FrameNode& node = (*ctx->nodes)[idx];
+    if (node.value * ctx->scale < kMinFrameWidth) {
+        return;
+    }
+    if (depth > ctx->max_depth) {
+        ctx->max_depth = depth;
+    }
+    for (std::map<butil::StringPiece, size_t>::const_iterator
+             it = node.children.begin(); it != node.children.end(); ++it) {
+        MeasureDepth(ctx, it->second, depth + 1);
+    }
+}
+
+void RenderFrames(const RenderContext& ctx, size_t idx, double x, int depth,
+                  std::ostream& os) {
+    const FrameNode& node = (*ctx.nodes)[idx];
+    const double width = node.value * ctx.scale;
+    if (width < kMinFrameWidth) {
+        return;
+    }
+    const int y = ctx.image_height - kBottomHeight - (depth + 1) * kFrameHeight;
+    int r = 0;
+    int g = 0;
+    int b = 0;
+    FrameColor(node.name, &r, &g, &b);
+    os << "<g data-d=\"" << depth << "\" data-n=\"";
+    AppendXmlEscaped(os, node.name);
+    os << "\" onmouseover=\"fg_s(this)\" onmouseout=\"fg_c()\""
+        " onclick=\"fg_zoom(this)\"><title>";
+    AppendXmlEscaped(os, node.name);
+    os << butil::string_printf(" (%" PRId64 " %s, %.2f%%)",
+                               node.value, ctx.unit->c_str(),
+                               node.value * 100.0 / ctx.total)
+       << "</title>"
+       << butil::string_printf(
+           "<rect x=\"%.1f\" y=\"%d\" width=\"%.1f\" height=\"%d\""
+           " fill=\"rgb(%d,%d,%d)\" rx=\"2\" ry=\"2\""
+           " data-x=\"%.3f\" data-w=\"%.3f\"/>",
+           kPadding + x, y, width, kFrameHeight - 1, r, g, b, x, width)
+       << butil::string_printf("<text x=\"%.1f\" y=\"%.1f\">",
+                               kPadding + x + 3, y + 10.5);
+    AppendXmlEscaped(os, FrameLabel(node.name, width));
+    os << "</text></g>\n";
+    double child_x = x;
+    for (std::map<butil::StringPiece, size_t>::const_iterator
+             it = node.children.begin(); it != node.children.end(); ++it) {
+        RenderFrames(ctx, it->second, child_x, depth + 1, os);
+        child_x += (*ctx.nodes)[it->second].value * ctx.scale;
+    }
+}
+
+const char* const g_flame_graph_script =
+    "var fg_width = 1200, fg_pad = 10, fg_cw = 7;\n"
+    // Called by pages inlining the graph, nothing to initialize.
+    "function init(evt) {}\n"
+    "function fg_s(g) {\n"
+    "  document.getElementById('fg_details').textContent =\n"
+    "    g.getElementsByTagName('title')[0].textContent;\n"
+    "}\n"
+    "function fg_c() {\n"
+    "  document.getElementById('fg_details').textContent = ' ';\n"
+    "}\n"
+    "function fg_fit(g, x, w) {\n"
+    "  var r = g.getElementsByTagName('rect')[0];\n"
+    "  var t = g.getElementsByTagName('text')[0];\n"
+    "  r.setAttribute('x', x.toFixed(1));\n"
+    "  r.setAttribute('width', w.toFixed(1));\n"
+    "  t.setAttribute('x', (x + 3).toFixed(1));\n"
+    "  var n = g.getAttribute('data-n');\n"
+    "  var c = Math.floor((w - 6) / fg_cw);\n"
+    "  if (c < 3) { t.textContent = ''; }\n"
+    "  else if (n.length > c) { t.textContent = n.substring(0, c - 2) + '..'; }\n"
+    "  else { t.textContent = n; }\n"
+    "  g.style.display = '';\n"
+    "}\n"
+    "function fg_frames() {\n"
+    "  return document.getElementById('fg_frames').getElementsByTagName('g');\n"
+    "}\n"
+    "function fg_zoom(g) {\n"
+    "  var r = g.getElementsByTagName('rect')[0];\n"
+    "  var x0 = parseFloat(r.getAttribute('data-x'));\n"
+    "  var w0 = parseFloat(r.getAttribute('data-w'));\n"
+    "  var d0 = parseInt(g.getAttribute('data-d'));\n"
+    "  var scale = (fg_width - 2 * fg_pad) / w0;\n"
+    "  var fs = fg_frames();\n"
+    "  for (var i = 0; i < fs.length; ++i) {\n"
+    "    var f = fs[i];\n"
+    "    var fr = f.getElementsByTagName('rect')[0];\n"
+    "    var x = parseFloat(fr.getAttribute('data-x'));\n"
+    "    var w = parseFloat(fr.getAttribute('data-w'));\n"
+    "    var d = parseInt(f.getAttribute('data-d'));\n"
+    "    if (d < d0 && x <= x0 + 0.001 && x + w >= x0 + w0 - 0.001) {\n"
+    "      fg_fit(f, fg_pad, fg_width - 2 * fg_pad);\n"
+    "      f.style.opacity = 0.5;\n"
+    "    } else if (d >= d0 && x >= x0 - 0.001 && x + w <= x0 + w0 + 0.001) {\n"
+    "      fg_fit(f, fg_pad + (x - x0) * scale, w * scale);\n"
+    "      f.style.opacity = '';\n"
+    "    } else {\n"
+    "      f.style.display = 'none';\n"
+    "    }\n"
+    "  }\n"
+    "  document.getElementById('fg_unzoom').style.opacity = 1;\n"
+    "}\n"
+    "function fg_unzoom() {\n"
+    "  var fs = fg_frames();\n"
+    "  for (var i = 0; i < fs.length; ++i) {\n"
+    "    var fr = fs[i].getElementsByTagName('rect')[0];\n"
+    "    fg_fit(fs[i], fg_pad + parseFloat(fr.getAttribute('data-x')),\n"
+    "           parseFloat(fr.getAttribute('data-w')));\n"
+    "    fs[i].style.opacity = '';\n"
+    "  }\n"
+    "  document.getElementById('fg_unzoom').style.opacity = 0;\n"
+    "}\n";
+
+} // namespace
+
+int FoldedStacks::LoadProfile(const std::string& path, bool show_count,
+                              std::string* error) {
+    std::string data;
+    if (!butil::ReadFileToString(butil::FilePath(path), &data)) {
+        *error = "Fail to read " + path;
+        return -1;
+    }
+    Symbolizer symbolizer;
+    return ParseProfile(data, show_count, &symbolizer, error);
+}
+
+int FoldedStacks::ParseProfile(const butil::StringPiece& data,
+                               bool show_count, Symbolizer* symbolizer,
+                               std::string* error) {
+    std::vector<RawSample> samples;
+    std::string maps_buf;
+    butil::StringPiece maps;
+    // Frames of cpu profiles start with the interrupted pc, other frames
+    // (and all frames of other profiles) are return addresses.
+    bool first_is_pc = false;
+    if (data.starts_with("--- contention")) {
+        ParseContentionProfile(data, show_count, &samples, &maps_buf);
+        maps = maps_buf;
+        _unit = (show_count ? "contentions" : "nanoseconds");
+    } else if (data.starts_with("heap profile:")) {
+        if (ParseHeapProfile(data, show_count, &samples,
+                             &maps_buf, error) != 0) {
+            return -1;
+        }
+        maps = maps_buf;
+        _unit = (show_count ? "objects" : "bytes");
+    } else {
+        if (ParseCpuProfile(data, &samples, &maps, error) != 0) {
+            return -1;
+        }
+        first_is_pc = true;
+        _unit = "samples";
+    }
+    symbolizer->SetMappings(maps);
+    std::string stack;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const RawSample& s = samples[i];
+        if (s.value == 0 || s.pcs.empty()) {
+            continue;
+        }
+        stack.clear();
+        for (size_t j = s.pcs.size(); j > 0; --j) {
+            if (!stack.empty()) {
+                stack.push_back(';');
+            }
+            stack.append(symbolizer->Symbolize(
+                             s.pcs[j - 1], !(first_is_pc && j == 1)));
+        }
+        Add(stack, s.value);
+    }
+    return 0;
+}
+
+void FoldedStacks::ParseFolded(const butil::StringPiece& text) {
+    LineReader reader(text);
+    butil::StringPiece line;
+    while (reader.Next(&line)) {
+        const size_t sp = line.rfind(' ');
+        if (sp == butil::StringPiece::npos || sp == 0) {
+            continue;
+        }
+        const std::string value_str = line.substr(sp + 1).as_string();
+        char* endptr = NULL;
+        const long long value = strtoll(value_str.c_str(), &endptr, 10);
+        if (endptr == value_str.c_str() || *endptr != '\0') {
+            continue;
+        }
+        Add(line.substr(0, sp).as_string(), value);
+    }
+}
+
+void FoldedStacks::Add(const std::string& stack, int64_t value) {
+    _stacks[stack] += value;
+}
+
+void FoldedStacks::Subtract(const FoldedStacks& base) {
+    for (std::map<std::string, int64_t>::const_iterator
+             it = base._stacks.begin(); it != base._stacks.end(); ++it) {
+        std::map<std::string, int64_t>::iterator it2 = _stacks.find(it->first);
+        if (it2 != _stacks.end()) {
+            it2->second -= it->second;
+        }
+    }
+    for (std::map<std::string, int64_t>::iterator
+             it = _stacks.begin(); it != _stacks.end();) {
+        if (it->second <= 0) {
+            _stacks.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+int64_t FoldedStacks::total() const {
+    int64_t sum = 0;
+    for (std::map<std::string, int64_t>::const_iterator
+             it = _stacks.begin(); it != _stacks.end(); ++it) {
+        if (it->second > 0) {
+            sum += it->second;
+        }
+    }
+    return sum;
+}
+
+void FoldedStacks::PrintFolded(std::ostream& os) const {
+    for (std::map<std::string, int64_t>::const_iterator
+             it = _stacks.begin(); it != _stacks.end(); ++it) {
+        os << it->first << ' ' << it->second << '\n';
+    }
+}
+
+void FoldedStacks::RenderFlameGraph(std::ostream& os,
+                                    const std::string& title) const {
+    std::vector<FrameNode> nodes;
+    nodes.reserve(_stacks.size() * 4 + 1);
+    FrameNode root;
+    root.name = "all";
+    root.value = 0;
+    nodes.push_back(root);
+    for (std::map<std::string, int64_t>::const_iterator
+             it = _stacks.begin(); it != _stacks.end(); ++it) {
+        if (it->second <= 0) {
+            continue;
+        }
+        const butil::StringPiece stack(it->first);
+        size_t cur = 0;
+        nodes[cur].value += it->second;
+        size_t pos = 0;
+        while (pos <= stack.size()) {
+            size_t end = stack.find(';', pos);
+            if (end == butil::StringPiece::npos) {
+                end = stack.size();
+            }
+            const butil::StringPiece frame = stack.substr(pos, end - pos);
+            pos = end + 1;
+            std::map<butil::StringPiece, size_t>::iterator
+                child = nodes[cur].children.find(frame);
+            if (child == nodes[cur].children.end()) {
+                FrameNode node;
+                node.name = frame;
+                node.value = 0;
+                nodes.push_back(node);
+                child = nodes[cur].children.insert(
+                    std::make_pair(frame, nodes.size() - 1)).first;
+            }
+            cur = child->second;
+            nodes[cur].value += it->second;
+        }
+    }
+
+    RenderContext ctx;
+    ctx.nodes = &nodes;
+    ctx.total = nodes[0].value;
+    ctx.scale = (ctx.total > 0 ?
+                 (kImageWidth - 2 * kPadding) / (double)ctx.total : 0);
+    ctx.unit = &_unit;
+    ctx.max_depth = 0;
+    MeasureDepth(&ctx, 0, 0);
+    ctx.image_height = kTopHeight + (ctx.max_depth + 1) * kFrameHeight
+        + kBottomHeight;
+
+    os << "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+       << butil::string_printf(
+           "<svg version=\"1.1\" width=\"%d\" height=\"%d\""
+           " viewBox=\"0 0 %d %d\" xmlns=\"http://www.w3.org/2000/svg\">\n",
+           kImageWidth, ctx.image_height, kImageWidth, ctx.image_height)
+       << "<!-- FlameGraph rendered by brpc -->\n"
+       << "<style type=\"text/css\">\n"
+          "text { font-family: Verdana; font-size: " << kFontSize << "px;"
+          " fill: rgb(0,0,0); }\n"
+          "#fg_frames g:hover { stroke: black; stroke-width: 0.5;"
+          " cursor: pointer; }\n"
+          "</style>\n"
+       << "<script type=\"text/ecmascript\"><![CDATA[\n"
+       << g_flame_graph_script
+       << "]]></script>\n"
+       << "<rect x=\"0\" y=\"0\" width=\"100%\" height=\"100%\""
+          " fill=\"rgb(248,248,248)\"/>\n"
+       << "<text x=\"" << kImageWidth / 2 << "\" y=\"24\""
+          " text-anchor=\"middle\" style=\"font-size:17px\">";
+    AppendXmlEscaped(os, title);
+    os << "</text>\n"
+       << "<text id=\"fg_unzoom\" x=\"" << kPadding << "\" y=\"24\""
+          " onclick=\"fg_unzoom()\" style=\"opacity:0;cursor:pointer\">"
+          "Reset Zoom</text>\n"
+       << "<text id=\"fg_details\" x=\"" << kPadding << "\" y=\""
+       << ctx.image_height - 10 << "\"> </text>\n"
+       << "<g id=\"fg_frames\">\n";
+    if (ctx.total > 0) {
+        RenderFrames(ctx, 0, 0, 0, os);
+    }
+    os << "</g>\n</svg>\n";
+}
+
+} // namespace brpc
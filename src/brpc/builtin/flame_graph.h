@@ -0,0 +1,87 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_BUILTIN_FLAME_GRAPH_H
+#define BRPC_BUILTIN_FLAME_GRAPH_H
+
+#include <stdint.h>
+#include <map>
+#include <ostream>
+#include <string>
+#include "butil/strings/string_piece.h"
+
+namespace brpc {
+
+class Symbolizer;
+
+// Samples of a profile aggregated by symbolized call stacks, namely the
+// "folded" format: one line for each distinct stack with frames from the
+// outermost to the innermost separated by ';', followed by a space and
+// the value. Lines are sorted by stacks so that outputs of two profiles
+// can be compared with diff directly.
+class FoldedStacks {
+public:
+    FoldedStacks() {}
+
+    // Load samples from profile `path' written by the cpu profiler, the
+    // contention profiler or tcmalloc (heap and growth). Values are
+    // contentions instead of waiting time for contention profiles and
+    // objects instead of bytes for heap profiles when `show_count' is true.
+    // Returns 0 on success, -1 otherwise and `error' is set.
+    int LoadProfile(const std::string& path, bool show_count,
+                    std::string* error);
+
+    // Same as above, but parse profile from `data' and symbolize frames
+    // with `symbolizer'.
+    int ParseProfile(const butil::StringPiece& data, bool show_count,
+                     Symbolizer* symbolizer, std::string* error);
+
+    // Add stacks in the folded format. Malformed lines are ignored.
+    void ParseFolded(const butil::StringPiece& text);
+
+    // Add `value' to `stack' whose frames are separated by ';'.
+    void Add(const std::string& stack, int64_t value);
+
+    // Remove samples in `base' to show what increased since `base'.
+    // Stacks that do not increase are dropped.
+    void Subtract(const FoldedStacks& base);
+
+    // Print in the folded format.
+    void PrintFolded(std::ostream& os) const;
+
+    // Render an interactive SVG: hovering a frame shows its value and
+    // clicking zooms into it. The output embeds its own script and can be
+    // viewed in browsers standalone or inlined into a html page.
+    void RenderFlameGraph(std::ostream& os, const std::string& title) const;
+
+    int64_t total() const;
+    size_t size() const { return _stacks.size(); }
+    bool empty() const { return _stacks.empty(); }
+
+    // Name of values, "samples", "nanoseconds", "bytes" etc.
+    const std::string& unit() const { return _unit; }
+    void set_unit(const std::string& unit) { _unit = unit; }
+
+private:
+    std::map<std::string, int64_t> _stacks;
+    std::string _unit;
+};
+
+} // namespace brpc
+
+#endif // BRPC_BUILTIN_FLAME_GRAPH_H
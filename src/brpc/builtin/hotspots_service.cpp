@@ -17,19 +17,23 @@
 
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <thread>
 #include <gflags/gflags.h>
 #include "butil/files/file_enumerator.h"
 #include "butil/file_util.h"                     // butil::FilePath
 #include "butil/popen.h"                         // butil::read_command_output
 #include "butil/fd_guard.h"                      // butil::fd_guard
+#include "butil/string_printf.h"                 // butil::string_appendf
 #include "brpc/log.h"
 #include "brpc/controller.h"
 #include "brpc/server.h"
 #include "brpc/reloadable_flags.h"
 #include "brpc/builtin/pprof_perl.h"
+#include "brpc/builtin/flame_graph.h"
 #include "brpc/builtin/hotspots_service.h"
 #include "brpc/details/tcmalloc_extension.h"
+#include "brpc/details/continuous_profiler.h"
 
 extern "C" {
 int __attribute__((weak)) ProfilerStart(const char* fname);
@@ -39,24 +43,25 @@ void __attribute__((weak)) ProfilerStop();
 namespace bthread {
 bool ContentionProfilerStart(const char* filename);
 void ContentionProfilerStop();
+int ContentionStatsPrintFolded(std::ostream& os, bool show_count);
+void ContentionStatsReset();
 }
 
 namespace brpc {
 enum class DisplayType{
     kUnknown,
     kDot,
-#if defined(OS_LINUX)
+    // Rendered natively without pprof.
     kFlameGraph,
-#endif
+    kFolded,
     kText
 };
 
 static const char* DisplayTypeToString(DisplayType type) {
     switch (type) {
         case DisplayType::kDot: return "dot";
-#if defined(OS_LINUX)
         case DisplayType::kFlameGraph: return "flame";
-#endif
+        case DisplayType::kFolded: return "folded";
         case DisplayType::kText: return "text";
         default: return "unknown";
     }
@@ -69,9 +74,8 @@ static DisplayType StringToDisplayType(const std::string& val) {
         display_type_map = new butil::CaseIgnoredFlatMap<DisplayType>;
         display_type_map->init(10);
         (*display_type_map)["dot"] = DisplayType::kDot;
-#if defined(OS_LINUX)
         (*display_type_map)["flame"] = DisplayType::kFlameGraph;
-#endif
+        (*display_type_map)["folded"] = DisplayType::kFolded;
         (*display_type_map)["text"] = DisplayType::kText;
     });
     auto type = display_type_map->seek(val);
@@ -85,7 +89,6 @@ static std::string DisplayTypeToPProfArgument(DisplayType type) {
     switch (type) {
 #if defined(OS_LINUX)
         case DisplayType::kDot: return " --dot ";
-        case DisplayType::kFlameGraph: return " --collapsed ";
         case DisplayType::kText: return " --text ";
 #elif defined(OS_MACOSX)
         case DisplayType::kDot: return " -dot ";
@@ -393,6 +396,42 @@ static bool has_GOOGLE_PPROF_BINARY_PATH() {
 }
 #endif
 
+// Aggregate stacks of the profile into folded stacks or a flame graph,
+// which is much faster than running pprof and does not depend on perl.
+static int MakeFoldedResult(const char* prof_name,
+                            const std::string* base_name,
+                            DisplayType display_type,
+                            bool show_ccount,
+                            butil::IOBuf* result,
+                            std::string* error) {
+    FoldedStacks stacks;
+    if (stacks.LoadProfile(prof_name, show_ccount, error) != 0) {
+        return -1;
+    }
+    if (base_name != NULL) {
+        FoldedStacks base;
+        if (base.LoadProfile(*base_name, show_ccount, error) != 0) {
+            return -1;
+        }
+        stacks.Subtract(base);
+    }
+    butil::IOBufBuilder os;
+    if (display_type == DisplayType::kFlameGraph) {
+        std::string title = GetBaseName(prof_name);
+        if (base_name != NULL) {
+            title.append(" - ");
+            title.append(GetBaseName(base_name));
+        }
+        butil::string_appendf(&title, " (%" PRId64 " %s)",
+                              stacks.total(), stacks.unit().c_str());
+        stacks.RenderFlameGraph(os, title);
+    } else {
+        stacks.PrintFolded(os);
+    }
+    os.move_to(*result);
+    return 0;
+}
+
 static void DisplayResult(Controller* cntl,
                           google::protobuf::Closure* done,
                           const char* prof_name,
@@ -409,20 +448,12 @@ static void DisplayResult(Controller* cntl,
     const bool show_ccount = cntl->http_request().uri().GetQuery("ccount");
     const std::string* base_name = cntl->http_request().uri().GetQuery("base");
     const std::string* display_type_query = cntl->http_request().uri().GetQuery("display_type");
-    const char* flamegraph_tool = getenv("FLAMEGRAPH_PL_PATH");
     DisplayType display_type = DisplayType::kDot;
     if (display_type_query) {
         display_type = StringToDisplayType(*display_type_query);
         if (display_type == DisplayType::kUnknown) {
             return cntl->SetFailed(EINVAL, "Invalid display_type=%s", display_type_query->c_str());
         }
-#if defined(OS_LINUX)
-        if (display_type == DisplayType::kFlameGraph && !flamegraph_tool) {
-            return cntl->SetFailed(EINVAL, "Failed to find environment variable "
-                "FLAMEGRAPH_PL_PATH, please read cpu_profiler doc"
-                "(https://github.com/brpc/brpc/blob/master/docs/cn/cpu_profiler.md)");
-        }
-#endif
     }
     if (base_name != NULL) {
         if (!ValidProfilePath(*base_name)) {
@@ -476,6 +507,32 @@ static void DisplayResult(Controller* cntl,
         }
     }
     
+    if (display_type == DisplayType::kFlameGraph ||
+        display_type == DisplayType::kFolded) {
+        std::string error;
+        if (MakeFoldedResult(prof_name, base_name, display_type, show_ccount,
+                             &prof_result, &error) != 0) {
+            os << error << (use_html ? "</body></html>" : "\n");
+            os.move_to(resp);
+            cntl->http_response().set_status_code(
+                HTTP_STATUS_INTERNAL_SERVER_ERROR);
+            return;
+        }
+        if (!WriteSmallFile(expected_result_name, prof_result)) {
+            LOG(ERROR) << "Fail to write " << expected_result_name;
+            CHECK(butil::DeleteFile(butil::FilePath(expected_result_name), false));
+        }
+        // Unlike outputs of pprof, the label is not cached and not put
+        // into the result which should be kept as a valid svg or folded
+        // stacks.
+        if (cntl->http_request().uri().GetQuery("view") == NULL) {
+            os << prof_name << "[addToProfEnd]";
+        }
+        os.move_to(resp);
+        resp.append(prof_result);
+        return;
+    }
+
     std::ostringstream cmd_builder;
 
     std::string pprof_tool{GeneratePerlScriptPath(PPROF_FILENAME)};
@@ -488,14 +545,7 @@ static void DisplayResult(Controller* cntl,
         cmd_builder << "--base " << *base_name << ' ';
     }
 
-    cmd_builder << GetProgramName() << " " << prof_name;
-
-    if (display_type == DisplayType::kFlameGraph) {
-        // For flamegraph, we don't care about pprof error msg, 
-        // which will cause confusing messages in the final result.
-        cmd_builder << " 2>/dev/null " << " | " << "perl " << flamegraph_tool;
-    }
-    cmd_builder << " 2>&1 ";
+    cmd_builder << GetProgramName() << " " << prof_name << " 2>&1 ";
 #elif defined(OS_MACOSX)
     cmd_builder << s_pprof_binary_path << " "
                 << DisplayTypeToPProfArgument(display_type)
@@ -746,7 +796,9 @@ static void DoProfiling(ProfilingType type,
                 HTTP_STATUS_INTERNAL_SERVER_ERROR);
             return NotifyWaiters(type, cntl, view);
         }
+        SuspendContinuousCpuProfiling();
         if (!ProfilerStart(prof_name)) {
+            ResumeContinuousCpuProfiling();
             os << "Another profiler (not via /hotspots/cpu) is running, "
                 "try again later" << (use_html ? "</body></html>" : "\n");
             os.move_to(resp);
@@ -757,6 +809,7 @@ static void DoProfiling(ProfilingType type,
             PLOG(WARNING) << "Profiling has been interrupted";
         }
         ProfilerStop();
+        ResumeContinuousCpuProfiling();
     } else if (type == PROFILING_CONTENTION) {
         if (!bthread::ContentionProfilerStart(prof_name)) {
             os << "Another profiler (not via /hotspots/contention) is running, "
@@ -887,13 +940,6 @@ static void StartProfiling(ProfilingType type,
         if (display_type == DisplayType::kUnknown) {
             return cntl->SetFailed(EINVAL, "Invalid display_type=%s", display_type_query->c_str());
         }
-#if defined(OS_LINUX)
-        if (display_type == DisplayType::kFlameGraph && !getenv("FLAMEGRAPH_PL_PATH")) {
-            return cntl->SetFailed(EINVAL, "Failed to find environment variable "
-                "FLAMEGRAPH_PL_PATH, please read cpu_profiler doc"
-                "(https://github.com/brpc/brpc/blob/master/docs/cn/cpu_profiler.md)");
-        }
-#endif
     }
 
     ProfilingClient profiling_client;
@@ -972,8 +1018,12 @@ static void StartProfiling(ProfilingType type,
         "      if (selEnd != -1) {\n"
         "        data = data.substring(selEnd + '[addToProfEnd]'.length);\n"
         "      }\n"
-        "      $(\"#profiling-result\").html('<pre>' + data + '</pre>');\n"
-        "      if (data.indexOf('FlameGraph') != -1) { init(); }"
+        "      if (data.indexOf('FlameGraph') != -1) {\n"
+        "        $(\"#profiling-result\").html(data);\n"
+        "        init();\n"
+        "      } else {\n"
+        "        $(\"#profiling-result\").html($('<pre>').text(data));\n"
+        "      }\n"
         "    } else {\n"
         "      $(\"#profiling-result\").html('Plotting ...');\n"
         "      var svg = Viz(data.substring(index), \"svg\");\n"
@@ -1076,9 +1126,8 @@ static void StartProfiling(ProfilingType type,
     os << "<div><pre style='display:inline'>Display: </pre>"
         "<select id='display_type' onchange='onSelectProf()'>"
         "<option value=dot" << (display_type == DisplayType::kDot ? " selected" : "") << ">dot</option>"
-#if defined(OS_LINUX)
         "<option value=flame" << (display_type == DisplayType::kFlameGraph ? " selected" : "") << ">flame</option>"
-#endif
+        "<option value=folded" << (display_type == DisplayType::kFolded ? " selected" : "") << ">folded</option>"
         "<option value=text" << (display_type == DisplayType::kText ? " selected" : "") << ">text</option></select>";
     if (type == PROFILING_CONTENTION) {
         os << "&nbsp;&nbsp;&nbsp;<label for='ccount_cb'>"
@@ -1220,6 +1269,98 @@ void HotspotsService::contention_non_responsive(
     return DoProfiling(PROFILING_CONTENTION, cntl_base, done);
 }
 
+void HotspotsService::contention_stats(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::HotspotsRequest*,
+    ::brpc::HotspotsResponse*,
+    ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller *cntl = static_cast<Controller*>(cntl_base);
+    cntl->http_response().set_content_type("text/plain");
+    const bool show_ccount = cntl->http_request().uri().GetQuery("ccount");
+    const std::string* display_type_query =
+        cntl->http_request().uri().GetQuery("display_type");
+    const bool flame = (display_type_query != NULL &&
+                        StringToDisplayType(*display_type_query) ==
+                        DisplayType::kFlameGraph);
+    std::ostringstream folded;
+    butil::IOBufBuilder os;
+    if (bthread::ContentionStatsPrintFolded(folded, show_ccount) != 0) {
+        os << "Contention stats is off, turn on -bthread_contention_stats "
+            "(via /flags) first\n";
+        cntl->http_response().set_status_code(HTTP_STATUS_FORBIDDEN);
+    } else {
+        if (flame) {
+            FoldedStacks stacks;
+            stacks.ParseFolded(folded.str());
+            stacks.set_unit(show_ccount ? "contentions" : "nanoseconds");
+            const std::string title = butil::string_printf(
+                "contention_stats (%" PRId64 " %s)",
+                stacks.total(), stacks.unit().c_str());
+            stacks.RenderFlameGraph(os, title);
+            cntl->http_response().set_content_type("image/svg+xml");
+        } else {
+            os << folded.str();
+        }
+        if (cntl->http_request().uri().GetQuery("reset")) {
+            bthread::ContentionStatsReset();
+        }
+    }
+    os.move_to(cntl->response_attachment());
+}
+
+void HotspotsService::cpu_continuous(
+    ::google::protobuf::RpcController* cntl_base,
+    const ::brpc::HotspotsRequest*,
+    ::brpc::HotspotsResponse*,
+    ::google::protobuf::Closure* done) {
+    ClosureGuard done_guard(done);
+    Controller *cntl = static_cast<Controller*>(cntl_base);
+    cntl->http_response().set_content_type("text/plain");
+    int seconds = 0;
+    const std::string* seconds_str =
+        cntl->http_request().uri().GetQuery("seconds");
+    if (seconds_str != NULL) {
+        char* endptr = NULL;
+        seconds = strtol(seconds_str->c_str(), &endptr, 10);
+        if (*endptr != '\0' || seconds < 0) {
+            cntl->SetFailed(EINVAL, "Invalid seconds=%s", seconds_str->c_str());
+            return;
+        }
+    }
+    const std::string* display_type_query =
+        cntl->http_request().uri().GetQuery("display_type");
+    DisplayType display_type = DisplayType::kFolded;
+    if (display_type_query != NULL) {
+        display_type = StringToDisplayType(*display_type_query);
+        if (display_type != DisplayType::kFolded &&
+            display_type != DisplayType::kFlameGraph) {
+            cntl->SetFailed(EINVAL, "Invalid display_type=%s",
+                            display_type_query->c_str());
+            return;
+        }
+    }
+    FoldedStacks stacks;
+    butil::IOBufBuilder os;
+    if (GetContinuousCpuProfile(seconds, &stacks) != 0) {
+        os << "Continuous cpu profiler is off, turn on "
+            "-cpu_continuous_profiling_hz (via /flags) first\n";
+        cntl->http_response().set_status_code(HTTP_STATUS_FORBIDDEN);
+    } else if (display_type == DisplayType::kFlameGraph) {
+        std::string title = "cpu_continuous";
+        if (seconds > 0) {
+            butil::string_appendf(&title, " of last %ds", seconds);
+        }
+        butil::string_appendf(&title, " (%" PRId64 " %s)",
+                              stacks.total(), stacks.unit().c_str());
+        stacks.RenderFlameGraph(os, title);
+        cntl->http_response().set_content_type("image/svg+xml");
+    } else {
+        stacks.PrintFolded(os);
+    }
+    os.move_to(cntl->response_attachment());
+}
+
 void HotspotsService::GetTabInfo(TabInfoList* info_list) const {
     TabInfo* info = info_list->add();
     info->path = "/hotspots/cpu";
@@ -70,6 +70,20 @@ public:
                                    ::brpc::HotspotsResponse* response,
                                    ::google::protobuf::Closure* done);
 
+    // Print contentions aggregated by -bthread_contention_stats as folded
+    // stacks.
+    void contention_stats(::google::protobuf::RpcController* cntl_base,
+                          const ::brpc::HotspotsRequest* request,
+                          ::brpc::HotspotsResponse* response,
+                          ::google::protobuf::Closure* done);
+
+    // Print samples of the continuous cpu profiler in the last `seconds'
+    // (the whole window by default) as folded stacks or a flame graph.
+    void cpu_continuous(::google::protobuf::RpcController* cntl_base,
+                        const ::brpc::HotspotsRequest* request,
+                        ::brpc::HotspotsResponse* response,
+                        ::google::protobuf::Closure* done);
+
     void GetTabInfo(brpc::TabInfoList*) const;
 };
 
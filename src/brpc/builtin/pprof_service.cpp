@@ -34,6 +34,7 @@
 #include "brpc/builtin/pprof_service.h"
 #include "brpc/builtin/common.h"
 #include "brpc/details/tcmalloc_extension.h"
+#include "brpc/details/continuous_profiler.h"
 #include "bthread/bthread.h"                // bthread_usleep
 #include "butil/fd_guard.h"
 
@@ -136,7 +137,9 @@ void PProfService::profile(
         cntl->SetFailed(EPERM, "Fail to create directory=`%s'",dir.value().c_str());
         return;
     }
+    SuspendContinuousCpuProfiling();
     if (!ProfilerStart(prof_name)) {
+        ResumeContinuousCpuProfiling();
         cntl->SetFailed(EAGAIN, "Another profiler is running, try again later");
         return;
     }
@@ -144,6 +147,7 @@ void PProfService::profile(
         PLOG(WARNING) << "Profiling has been interrupted";
     }
     ProfilerStop();
+    ResumeContinuousCpuProfiling();
 
     butil::fd_guard fd(open(prof_name, O_RDONLY));
     if (fd < 0) {
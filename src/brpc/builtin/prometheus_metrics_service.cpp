@@ -24,6 +24,7 @@
 #include "brpc/closure_guard.h"             // ClosureGuard
 #include "brpc/builtin/prometheus_metrics_service.h"
 #include "brpc/builtin/common.h"
+#include "butil/strings/string_number_conversions.h"
 #include "bvar/bvar.h"
 
 namespace bvar {
@@ -44,6 +45,8 @@ extern const char* const g_server_info_prefix;
 // more counter is just another gauge.
 // 2) Histogram and summary is equivalent except that histogram
 // calculates quantiles in the server side.
+// Histograms of LatencyRecorders(with -bvar_latency_histogram) are
+// exported as histograms as well.
 class PrometheusMetricsDumper : public bvar::Dumper {
 public:
     explicit PrometheusMetricsDumper(butil::IOBufBuilder* os,
@@ -57,6 +60,11 @@ public:
 private:
     DISALLOW_COPY_AND_ASSIGN(PrometheusMetricsDumper);
 
+    // Output histogram exposed by LatencyRecorder as <prefix>_latency_histogram.
+    // Return false if desc is not a valid histogram.
+    bool DumpLatencyHistogram(const std::string& name,
+                              const butil::StringPiece& desc);
+
     // Return true iff name ends with suffix output by LatencyRecorder.
     bool DumpLatencyRecorderSuffix(const butil::StringPiece& name,
                                    const butil::StringPiece& desc);
@@ -79,6 +87,8 @@ private:
     butil::IOBufBuilder* _os;
     const std::string _server_prefix;
     std::map<std::string, SummaryItems> _m;
+    // Reused to look up _m without allocating a key for each variable.
+    std::string _key;
 };
 
 bool PrometheusMetricsDumper::dump(const std::string& name,
@@ -87,6 +97,13 @@ bool PrometheusMetricsDumper::dump(const std::string& name,
         // there is no necessary to monitor string in prometheus
         return true;
     }
+    if (!desc.empty() && desc[0] == '{') {
+        // Only histograms are composite values understood by prometheus.
+        if (butil::StringPiece(name).ends_with("_latency_histogram")) {
+            DumpLatencyHistogram(name, desc);
+        }
+        return true;
+    }
     if (DumpLatencyRecorderSuffix(name, desc)) {
         // Has encountered name with suffix exposed by LatencyRecorder,
         // Leave it to DumpLatencyRecorderSuffix to output Summary.
@@ -98,6 +115,41 @@ bool PrometheusMetricsDumper::dump(const std::string& name,
     return true;
 }
 
+bool PrometheusMetricsDumper::DumpLatencyHistogram(
+    const std::string& name, const butil::StringPiece& desc) {
+    // desc is {"sum":S,"buckets":[c0,c1,...]} where c_i is the number of
+    // latencies less than 2^i.
+    const std::string desc_str = desc.as_string();
+    const char* p = strstr(desc_str.c_str(), "\"sum\":");
+    if (p == NULL) {
+        return false;
+    }
+    const long long sum = strtoll(p + 6, NULL, 10);
+    p = strchr(p, '[');
+    if (p == NULL) {
+        return false;
+    }
+    *_os << "# HELP " << name << '\n'
+         << "# TYPE " << name << " histogram\n";
+    unsigned long long count = 0;
+    ++p;
+    for (int i = 0; *p != ']' && *p != '\0'; ++i) {
+        char* endptr = NULL;
+        count = strtoull(p, &endptr, 10);
+        if (endptr == p) {
+            return false;
+        }
+        // Latencies are integers, "less than 2^i" is "not greater than 2^i-1".
+        *_os << name << "_bucket{le=\"" << ((1ULL << i) - 1) << "\"} "
+             << count << '\n';
+        p = (*endptr == ',' ? endptr + 1 : endptr);
+    }
+    *_os << name << "_bucket{le=\"+Inf\"} " << count << '\n'
+         << name << "_sum " << sum << '\n'
+         << name << "_count " << count << '\n';
+    return true;
+}
+
 const PrometheusMetricsDumper::SummaryItems*
 PrometheusMetricsDumper::ProcessLatencyRecorderSuffix(const butil::StringPiece& name,
                                                       const butil::StringPiece& desc) {
@@ -108,34 +160,37 @@ PrometheusMetricsDumper::ProcessLatencyRecorderSuffix(const butil::StringPiece&
         "_latency_999", "_latency_9999", "_max_latency"
     };
     CHECK(NPERCENTILES == arraysize(latency_names));
-    const std::string desc_str = desc.as_string();
     butil::StringPiece metric_name(name);
     for (int i = 0; i < NPERCENTILES; ++i) {
         if (!metric_name.ends_with(latency_names[i])) {
             continue;
         }
         metric_name.remove_suffix(latency_names[i].size());
-        SummaryItems* si = &_m[metric_name.as_string()];
-        si->latency_percentiles[i] = desc_str;
+        metric_name.CopyToString(&_key);
+        SummaryItems* si = &_m[_key];
+        desc.CopyToString(&si->latency_percentiles[i]);
         if (i == NPERCENTILES - 1) {
             // '_max_latency' is the last suffix name that appear in the sorted bvar
             // list, which means all related percentiles have been gathered and we are
             // ready to output a Summary.
-            si->metric_name = metric_name.as_string();
+            si->metric_name = _key;
         }
         return si;
     }
     // Get the average of latency in recent window size
     if (metric_name.ends_with("_latency")) {
         metric_name.remove_suffix(8);
-        SummaryItems* si = &_m[metric_name.as_string()];
-        si->latency_avg = strtoll(desc_str.data(), NULL, 10);
+        metric_name.CopyToString(&_key);
+        SummaryItems* si = &_m[_key];
+        // Best-effort conversion like strtoll, desc is not null-terminated.
+        butil::StringToInt64(desc, &si->latency_avg);
         return si;
     }
     if (metric_name.ends_with("_count")) {
         metric_name.remove_suffix(6);
-        SummaryItems* si = &_m[metric_name.as_string()];
-        si->count = strtoll(desc_str.data(), NULL, 10);
+        metric_name.CopyToString(&_key);
+        SummaryItems* si = &_m[_key];
+        butil::StringToInt64(desc, &si->count);
         return si;
     }
     return NULL;
@@ -200,7 +200,9 @@ void PutVarsHeading(std::ostream& os, bool expand_all) {
         "  }\n"
         "}\n"
         "function describeX(x, series) {\n"
-        "  if (series.data[series.data.length-1][0] == 173) {\n"
+        "  if (series.label == 'high_resolution') {\n"
+        "    return x + 's';\n"
+        "  } else if (series.data[series.data.length-1][0] == 173) {\n"
         "    if (series.label != null) {\n"
         "      return series.label + ' ' + describeTrendX(x);\n"
         "    } else {\n"
@@ -216,7 +218,7 @@ void PutVarsHeading(std::ostream& os, bool expand_all) {
         "function fetchData(var_name) {\n"
         "  function onDataReceived(series) {\n"
         "    if (hovering_var != var_name) {\n"
-        "      if (series.label == 'trend') {\n"
+        "      if (series.label == 'trend' || series.label == 'high_resolution') {\n"
         "        lastPlot[var_name] = $.plot(\"#\" + var_name, [series.data], trendOptions);\n"
         "        $(\"#value-\" + var_name).html(series.data[series.data.length - 1][1]);\n"
         "      } else if (series.label == 'cdf') {\n"
@@ -241,7 +243,9 @@ void PutVarsHeading(std::ostream& os, bool expand_all) {
         "    }\n"
         "  }\n"
         "  $.ajax({\n"
-        "    url: \"/vars/\" + var_name + \"?series\",\n"
+        "    url: \"/vars/\" + var_name + \"?series\" +\n"
+        "         ($(\"#\" + var_name).attr(\"data-series\") == \"high_resolution\" ?\n"
+        "          \"&high_resolution\" : \"\"),\n"
         "    type: \"GET\",\n"
         "    dataType: \"json\",\n"
         "    success: onDataReceived\n"
@@ -265,12 +269,19 @@ public:
     
     bool dump(const std::string& name, const butil::StringPiece& desc) {
         bool plot = false;
+        bool high_resolution = false;
         if (_use_html) {
             bvar::SeriesOptions series_options;
             series_options.test_only = true;
             const int rc = bvar::Variable::describe_series_exposed(
                 name, _os, series_options);
             plot = (rc == 0);
+            if (plot) {
+                // Plot the high-resolution series instead if it's enabled.
+                series_options.high_resolution = true;
+                high_resolution = (bvar::Variable::describe_series_exposed(
+                                       name, _os, series_options) == 0);
+            }
             if (plot) {
                 _os << "<p class=\"variable\">";
             } else {
@@ -286,7 +297,9 @@ public:
             _os << "</span></p>\n";
             if (plot) {
                 _os << "<div class=\"detail\"><div id=\"" << name
-                     << "\" class=\"flot-placeholder\"></div></div>\n";
+                    << "\" class=\"flot-placeholder\""
+                    << (high_resolution ? " data-series=\"high_resolution\"" : "")
+                    << "></div></div>\n";
             }
         } else {
             _os << "\r\n";
@@ -314,6 +327,8 @@ void VarsService::default_method(::google::protobuf::RpcController* cntl_base,
     if (cntl->http_request().uri().GetQuery("series") != NULL) {
         butil::IOBufBuilder os;
         bvar::SeriesOptions series_options;
+        series_options.high_resolution =
+            (cntl->http_request().uri().GetQuery("high_resolution") != NULL);
         const int rc = bvar::Variable::describe_series_exposed(
             cntl->http_request().unresolved_path(), os, series_options);
         if (rc == 0) {
@@ -29,9 +29,11 @@
 #include "brpc/global.h"
 #include "brpc/span.h"
 #include "brpc/details/load_balancer_with_naming.h"
+#include "brpc/details/controller_private_accessor.h" // ScopedServerDeadline
 #include "brpc/controller.h"
 #include "brpc/channel.h"
 #include "brpc/details/usercode_backup_pool.h"       // TooManyUserCode
+#include "brpc/details/client_concurrency_limiter.h"
 #include "brpc/policy/esp_authenticator.h"
 
 namespace brpc {
@@ -52,6 +54,9 @@ ChannelOptions::ChannelOptions()
     , auth(NULL)
     , retry_policy(NULL)
     , ns_filter(NULL)
+    , idle_timeout_s(-1)
+    , max_idle_connections(-1)
+    , http_max_pipelined_requests(1)
 {}
 
 ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
@@ -62,9 +67,13 @@ ChannelSSLOptions* ChannelOptions::mutable_ssl_options() {
 }
 
 static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
+    const bool default_pool = (opt.idle_timeout_s < 0 &&
+                               opt.max_idle_connections < 0 &&
+                               opt.http_max_pipelined_requests <= 1);
     if (opt.auth == NULL &&
         !opt.has_ssl_options() &&
-        opt.connection_group.empty()) {
+        opt.connection_group.empty() &&
+        default_pool) {
         // Returning zeroized result by default is more intuitive for users.
         return ChannelSignature();
     }
@@ -84,6 +93,16 @@ static ChannelSignature ComputeChannelSignature(const ChannelOptions& opt) {
             buf.append("|auth=");
             buf.append((char*)&opt.auth, sizeof(opt.auth));
         }
+        if (!default_pool) {
+            // Pooled connections of the main socket are managed by options
+            // of the first RPC.
+            buf.append("|pool=");
+            buf.append((char*)&opt.idle_timeout_s, sizeof(opt.idle_timeout_s));
+            buf.append((char*)&opt.max_idle_connections,
+                       sizeof(opt.max_idle_connections));
+            buf.append((char*)&opt.http_max_pipelined_requests,
+                       sizeof(opt.http_max_pipelined_requests));
+        }
         if (opt.has_ssl_options()) {
             const ChannelSSLOptions& ssl = opt.ssl_options();
             buf.push_back('|');
@@ -179,6 +198,15 @@ int Channel::InitChannelOptions(const ChannelOptions* options) {
         }
     }
 
+    if (_options.http_max_pipelined_requests > 1 &&
+        (_options.protocol != PROTOCOL_HTTP ||
+         _options.connection_type != CONNECTION_TYPE_POOLED)) {
+        LOG(ERROR) << "http_max_pipelined_requests="
+                   << _options.http_max_pipelined_requests
+                   << " only works with http and pooled connections";
+        return -1;
+    }
+
     _preferred_index = get_client_side_messenger()->FindProtocolIndex(_options.protocol);
     if (_preferred_index < 0) {
         LOG(ERROR) << "Fail to get index for protocol="
@@ -197,6 +225,17 @@ int Channel::InitChannelOptions(const ChannelOptions* options) {
     if (!cg.empty() && (::isspace(cg.front()) || ::isspace(cg.back()))) {
         butil::TrimWhitespace(cg, butil::TRIM_ALL, &cg);
     }
+
+    ClientConcurrencyLimiter* cl = NULL;
+    if (ClientConcurrencyLimiter::Create(
+            _options.max_concurrency,
+            _options.max_concurrency_per_server, &cl) != 0) {
+        LOG(ERROR) << "Fail to create ConcurrencyLimiter, max_concurrency="
+                   << _options.max_concurrency << " max_concurrency_per_server="
+                   << _options.max_concurrency_per_server;
+        return -1;
+    }
+    _cl.reset(cl);
     return 0;
 }
 
@@ -440,6 +479,19 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     if (cntl->timeout_ms() == UNSET_MAGIC_NUM) {
         cntl->set_timeout_ms(_options.timeout_ms);
     }
+    // Inherit deadline of the server-side RPC being processed in this bthread,
+    // nobody is waiting for the result after that.
+    const int64_t inherited_deadline_us = ScopedServerDeadline::tls_deadline_us();
+    bool inherited_deadline_reached = false;
+    if (inherited_deadline_us > 0) {
+        const int64_t left_ms =
+            (inherited_deadline_us - start_send_real_us) / 1000;
+        if (left_ms <= 0) {
+            inherited_deadline_reached = true;
+        } else if (cntl->timeout_ms() < 0 || cntl->timeout_ms() > left_ms) {
+            cntl->set_timeout_ms(left_ms);
+        }
+    }
     // Since connection is shared extensively amongst channels and RPC,
     // overriding connect_timeout_ms does not make sense, just use the
     // one in ChannelOptions
@@ -450,6 +502,9 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
     if (cntl->connection_type() == CONNECTION_TYPE_UNKNOWN) {
         cntl->set_connection_type(_options.connection_type);
     }
+    cntl->_pool_idle_timeout_s = _options.idle_timeout_s;
+    cntl->_pool_max_idle_connections = _options.max_idle_connections;
+    cntl->_max_pipelined_requests = _options.http_max_pipelined_requests;
     cntl->_response = response;
     cntl->_done = done;
     cntl->_pack_request = _pack_request;
@@ -480,6 +535,26 @@ void Channel::CallMethod(const google::protobuf::MethodDescriptor* method,
                         "-usercode_in_pthread is on");
         return cntl->HandleSendFailed();
     }
+    if (inherited_deadline_reached) {
+        // Retrying does not help either.
+        cntl->_max_retry = 0;
+        cntl->SetFailed(ERPCTIMEDOUT, "Deadline of the upstream RPC was "
+                        "reached");
+        return cntl->HandleSendFailed();
+    }
+    if (_cl) {
+        // Share the limiter with controller which calls OnResponded() when
+        // the RPC ends, even if it's rejected here.
+        cntl->_client_cl = _cl;
+        int rejected_cc = 0;
+        if (!_cl->OnRequested(&rejected_cc)) {
+            // Retrying a rejected RPC just increases the load.
+            cntl->_max_retry = 0;
+            cntl->SetFailed(ELIMIT, "Rejected by ConcurrencyLimiter of the "
+                            "channel, concurrency=%d", rejected_cc);
+            return cntl->HandleSendFailed();
+        }
+    }
 
     if (cntl->_request_stream != INVALID_STREAM_ID) {
         // Currently we cannot handle retry and backup request correctly
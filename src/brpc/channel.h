@@ -30,6 +30,7 @@
 #include "brpc/channel_base.h"              // ChannelBase
 #include "brpc/adaptive_protocol_type.h"    // AdaptiveProtocolType
 #include "brpc/adaptive_connection_type.h"  // AdaptiveConnectionType
+#include "brpc/adaptive_max_concurrency.h"  // AdaptiveMaxConcurrency
 #include "brpc/socket_id.h"                 // SocketId
 #include "brpc/controller.h"                // brpc::Controller
 #include "brpc/details/profiler_linker.h"
@@ -76,6 +77,21 @@ struct ChannelOptions {
     // Default: false
     bool enable_circuit_breaker;
 
+    // Limit concurrency of RPCs over this Channel. When the limit is reached,
+    // RPCs fail with ELIMIT immediately without being sent (or retried), to
+    // stop queueing requests on an overloaded downstream. Possible values
+    // are same with ServerOptions.method_max_concurrency, e.g. "auto" for
+    // the adaptive limiter, or a positive number for a constant limit.
+    // Default: "unlimited"
+    AdaptiveMaxConcurrency max_concurrency;
+
+    // Limit concurrency of RPCs to each server. A rejected request is retried
+    // on other servers (if any) like other ELIMIT errors. Note that the
+    // limiter is stored in the server's connection and thus GLOBAL: channels
+    // to the same server share it and the first RPC decides its type.
+    // Default: "unlimited"
+    AdaptiveMaxConcurrency max_concurrency_per_server;
+
     // Serialization protocol, defined in src/brpc/options.proto
     // NOTE: You can assign name of the protocol to this field as well, for
     // Example: options.protocol = "baidu_std";
@@ -129,6 +145,33 @@ struct ChannelOptions {
     // Default: ""
     std::string connection_group;
 
+    // [Only for pooled connections]
+    // Close pooled connections without data transmission for so many seconds,
+    // overriding -idle_timeout_second. 0 means never.
+    // Channels with different values don't share connections.
+    // Default: -1 (use -idle_timeout_second)
+    int idle_timeout_s;
+
+    // [Only for pooled connections]
+    // Keep at most so many unused connections to each server, connections
+    // released by RPCs beyond the limit are closed. Overriding
+    // -max_connection_pool_size. Channels with different values don't share
+    // connections.
+    // Default: -1 (use -max_connection_pool_size)
+    int max_idle_connections;
+
+    // [Only for HTTP/1.1 with pooled connections]
+    // Send at most so many requests over one connection without waiting
+    // for their responses (HTTP pipelining), new connections are created
+    // only when all connections are full. Responses are correlated with
+    // requests by their order, so a slow response delays the ones behind
+    // it. If a connection breaks, all RPCs on it fail and are retried,
+    // set max_retry to 0 for non-idempotent requests. HEAD requests and
+    // progressively-read responses always use dedicated connections.
+    // Channels with different values don't share connections.
+    // Default: 1 (pipelining disabled)
+    int http_max_pipelined_requests;
+
 private:
     // SSLOptions is large and not often used, allocate it on heap to
     // prevent ChannelOptions from being bloated in most cases.
@@ -225,6 +268,8 @@ protected:
     // It will be destroyed after channel's destruction and all
     // the RPC above has finished
     butil::intrusive_ptr<SharedLoadBalancer> _lb;
+    // Shared with controllers as well, NULL when concurrency is unlimited.
+    butil::intrusive_ptr<ClientConcurrencyLimiter> _cl;
     ChannelOptions _options;
     int _preferred_index;
 };
@@ -55,6 +55,12 @@ inline Extension<const ConcurrencyLimiter>* ConcurrencyLimiterExtension() {
     return Extension<const ConcurrencyLimiter>::instance();
 }
 
+// Create a ConcurrencyLimiter from the registered one matching type of `amc'.
+// *out is set to NULL when `amc' is "unlimited".
+// Returns 0 on success, -1 otherwise.
+int NewConcurrencyLimiter(const AdaptiveMaxConcurrency& amc,
+                          ConcurrencyLimiter** out);
+
 }  // namespace brpc
 
 
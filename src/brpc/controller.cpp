@@ -34,6 +34,8 @@
 #include "brpc/load_balancer.h"
 #include "brpc/closure_guard.h"
 #include "brpc/details/controller_private_accessor.h"
+#include "brpc/details/client_concurrency_limiter.h"
+#include "brpc/details/server_call_map.h"
 #include "brpc/controller.h"
 #include "brpc/span.h"
 #include "brpc/server.h"   // Server::_session_local_data_pool
@@ -185,6 +187,9 @@ void Controller::ResetNonPods() {
     if (!is_used_by_rpc() && _correlation_id != INVALID_BTHREAD_ID) {
         CHECK_NE(EPERM, bthread_id_cancel(_correlation_id));
     }
+    if (_server_call_key != 0) {
+        ServerCallMap::Remove(_current_call.peer_id, _server_call_key);
+    }
     if (_oncancel_id != INVALID_BTHREAD_ID) {
         bthread_id_error(_oncancel_id, 0);
     }
@@ -193,6 +198,7 @@ void Controller::ResetNonPods() {
     }
     delete _sender;
     _lb.reset(NULL);
+    _client_cl.reset(NULL);
     _current_call.Reset();
     ExcludedServers::Destroy(_accessed);
     _request_buf.clear();
@@ -215,6 +221,7 @@ void Controller::ResetNonPods() {
         }
         _rpa.reset(NULL);
     }
+    _grpc_stream.reset(NULL);
     delete _remote_stream_settings;
     _thrift_method_name.clear();
 
@@ -233,6 +240,8 @@ void Controller::ResetPods() {
     _session_local_data = NULL;
     _server = NULL;
     _oncancel_id = INVALID_BTHREAD_ID;
+    _canceled_by_client.store(false, butil::memory_order_relaxed);
+    _server_call_key = 0;
     _auth_context = NULL;
     _sampled_request = NULL;
     _request_protocol = PROTOCOL_UNKNOWN;
@@ -240,6 +249,9 @@ void Controller::ResetPods() {
     _retry_policy = NULL;
     _correlation_id = INVALID_BTHREAD_ID;
     _connection_type = CONNECTION_TYPE_UNKNOWN;
+    _pool_idle_timeout_s = -1;
+    _pool_max_idle_connections = -1;
+    _max_pipelined_requests = 1;
     _timeout_ms = UNSET_MAGIC_NUM;
     _backup_request_ms = UNSET_MAGIC_NUM;
     _connect_timeout_ms = UNSET_MAGIC_NUM;
@@ -279,6 +291,7 @@ Controller::Call::Call(Controller::Call* rhs)
     : nretry(rhs->nretry)
     , need_feedback(rhs->need_feedback)
     , enable_circuit_breaker(rhs->enable_circuit_breaker)
+    , limited_by_server(rhs->limited_by_server)
     , peer_id(rhs->peer_id)
     , begin_time_us(rhs->begin_time_us)
     , sending_sock(rhs->sending_sock.release())
@@ -287,6 +300,7 @@ Controller::Call::Call(Controller::Call* rhs)
     // setting all the fields to next call and _current_call.OnComplete
     // will behave incorrectly.
     rhs->need_feedback = false;
+    rhs->limited_by_server = false;
     rhs->peer_id = INVALID_SOCKET_ID;
     rhs->stream_user_data = NULL;
 }
@@ -299,6 +313,7 @@ void Controller::Call::Reset() {
     nretry = 0;
     need_feedback = false;
     enable_circuit_breaker = false;
+    limited_by_server = false;
     peer_id = INVALID_SOCKET_ID;
     begin_time_us = 0;
     sending_sock.reset(NULL);
@@ -478,6 +493,9 @@ void Controller::CloseConnection(const char* reason_fmt, ...) {
 }
 
 bool Controller::IsCanceled() const {
+    if (_canceled_by_client.load(butil::memory_order_acquire)) {
+        return true;
+    }
     SocketUniquePtr sock;
     return (Socket::Address(_current_call.peer_id, &sock) != 0);
 }
@@ -536,6 +554,15 @@ void Controller::NotifyOnCancel(google::protobuf::Closure* callback) {
         PLOG(FATAL) << "Fail to create bthread_id";
         return;
     }
+    if (_server_call_key != 0 &&
+        ServerCallMap::SetCancelId(_current_call.peer_id, _server_call_key,
+                                   _oncancel_id) != 0) {
+        // Already canceled by the client, run the callback in another bthread
+        // just like Socket::SetFailed does.
+        guard.release();
+        bthread_id_error(_oncancel_id, ECANCELED);
+        return;
+    }
     SocketUniquePtr sock;
     if (Socket::Address(_current_call.peer_id, &sock) != 0) {
         // Connection already broken
@@ -732,6 +759,19 @@ void Controller::Call::OnComplete(
             sending_sock->FeedbackCircuitBreaker(error_code,
                 butil::gettimeofday_us() - begin_time_us);
         }
+
+        // Tell the server to stop processing the RPC which is given up.
+        // Pooled and short connections are closed in such case, which is
+        // observable by the server already.
+        if (!responded &&
+            (error_code == ECANCELED || error_code == ERPCTIMEDOUT) &&
+            c->connection_type() == CONNECTION_TYPE_SINGLE) {
+            const Protocol* protocol = FindProtocol(c->request_protocol());
+            if (protocol != NULL && protocol->cancel_request != NULL) {
+                protocol->cancel_request(sending_sock.get(),
+                                         c->_correlation_id.value + nretry + 1);
+            }
+        }
     }
 
     switch (c->connection_type()) {
@@ -748,6 +788,18 @@ void Controller::Call::OnComplete(
         }
         break;
     case CONNECTION_TYPE_POOLED:
+        if (c->_max_pipelined_requests > 1) {
+            // The connection is shared by pipelined RPCs. Responses are
+            // correlated by order, an unresponded (e.g. timedout) call does
+            // not break following responses and the connection is kept.
+            if (sending_sock != NULL) {
+                sending_sock->ReturnPipelinedSocket();
+            }
+            if (does_error_affect_main_socket(error_code)) {
+                Socket::SetFailed(peer_id);
+            }
+            break;
+        }
         // NOTE: Not reuse pooled connection if this call fails and no response
         // has been received through this connection
         // Otherwise in-flight responses may come back in future and break the
@@ -800,6 +852,15 @@ void Controller::Call::OnComplete(
         }
     }
 
+    if (limited_by_server) {
+        SocketUniquePtr sock;
+        if (Socket::AddressFailedAsWell(peer_id, &sock) >= 0) {
+            sock->OnClientResponded(
+                error_code, butil::gettimeofday_us() - begin_time_us);
+        }
+        limited_by_server = false;
+    }
+
     if (need_feedback) {
         const LoadBalancer::CallInfo info =
             { begin_time_us, peer_id, error_code, c };
@@ -871,6 +932,9 @@ void Controller::EndRPC(const CompletionInfo& info) {
             _unfinished_call = NULL;
         }
     }
+    if (_grpc_stream) {
+        _grpc_stream->OnRPCEnd(_error_code, _error_text);
+    }
     if (_stream_creator) {
         _stream_creator->DestroyStreamCreator(this);
         _stream_creator = NULL;
@@ -882,6 +946,11 @@ void Controller::EndRPC(const CompletionInfo& info) {
     }
     // RPC finished, now it's safe to release `LoadBalancerWithNaming'
     _lb.reset();
+    if (_client_cl) {
+        _client_cl->OnResponded(_error_code,
+                                butil::gettimeofday_us() - _begin_time_us);
+        _client_cl.reset();
+    }
     if (_span) {
         _span->set_ending_cid(info.id);
         _span->set_async(_done);
@@ -1037,6 +1106,19 @@ void Controller::IssueRPC(int64_t start_realtime_us) {
         // here.
         _remote_side = tmp_sock->remote_side();
     }
+    if (_client_cl && _client_cl->limit_per_server()) {
+        int rejected_cc = 0;
+        const bool accepted = tmp_sock->OnClientRequested(
+            _client_cl->max_concurrency_per_server(), &rejected_cc);
+        _current_call.limited_by_server = true;
+        if (!accepted) {
+            tmp_sock.reset();
+            SetFailed(ELIMIT, "Rejected by ConcurrencyLimiter of %s, "
+                      "concurrency=%d", endpoint2str(_remote_side).c_str(),
+                      rejected_cc);
+            return HandleSendFailed();
+        }
+    }
     if (_stream_creator) {
         _current_call.stream_user_data =
             _stream_creator->OnCreatingStream(&tmp_sock, this);
@@ -1071,7 +1153,19 @@ void Controller::IssueRPC(int64_t start_realtime_us) {
     } else {
         int rc = 0;
         if (_connection_type == CONNECTION_TYPE_POOLED) {
-            rc = tmp_sock->GetPooledSocket(&_current_call.sending_sock);
+            SocketPoolOptions pool_opt;
+            pool_opt.idle_timeout_s = _pool_idle_timeout_s;
+            pool_opt.max_idle_sockets = _pool_max_idle_connections;
+            pool_opt.max_pipelined_requests = _max_pipelined_requests;
+            if (_max_pipelined_requests > 1) {
+                rc = tmp_sock->GetPipelinedSocket(
+                    &_current_call.sending_sock, pool_opt);
+                // Responses are correlated with requests by order.
+                _pipelined_count = 1;
+            } else {
+                rc = tmp_sock->GetPooledSocket(
+                    &_current_call.sending_sock, &pool_opt);
+            }
         } else if (_connection_type == CONNECTION_TYPE_SHORT) {
             rc = tmp_sock->GetShortSocket(&_current_call.sending_sock);
         } else {
@@ -1396,7 +1490,8 @@ void Controller::ReadProgressiveAttachmentBy(ProgressiveReader* r) {
         LOG(FATAL) << "Param[r] is NULL";
         return;
     }
-    if (!is_response_read_progressively()) {
+    if (!is_response_read_progressively() &&
+        !is_request_read_progressively()) {
         return r->OnEndOfMessage(
             butil::Status(EINVAL, "Can't read progressive attachment from a "
                          "controller without calling "
@@ -1506,6 +1601,19 @@ google::protobuf::Closure* DoNothing() {
     return butil::get_leaky_singleton<DoNothingClosure>();
 }
 
+ScopedServerDeadline::ScopedServerDeadline(int64_t deadline_us)
+    : _saved_deadline_us(bthread::tls_bls.rpc_deadline_us) {
+    bthread::tls_bls.rpc_deadline_us = (deadline_us > 0 ? deadline_us : 0);
+}
+
+ScopedServerDeadline::~ScopedServerDeadline() {
+    bthread::tls_bls.rpc_deadline_us = _saved_deadline_us;
+}
+
+int64_t ScopedServerDeadline::tls_deadline_us() {
+    return bthread::tls_bls.rpc_deadline_us;
+}
+
 KVMap& Controller::SessionKV() {
     if (_session_kv == nullptr) {
         _session_kv.reset(new KVMap);
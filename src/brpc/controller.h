@@ -28,6 +28,7 @@
 #include "bthread/errno.h"                     // Redefine errno
 #include "butil/endpoint.h"                    // butil::EndPoint
 #include "butil/iobuf.h"                       // butil::IOBuf
+#include "butil/atomicops.h"                   // butil::atomic
 #include "bthread/types.h"                     // bthread_id_t
 #include "brpc/options.pb.h"                   // CompressType
 #include "brpc/errno.pb.h"                     // error code
@@ -64,6 +65,7 @@ namespace brpc {
 class Span;
 class Server;
 class SharedLoadBalancer;
+class ClientConcurrencyLimiter;
 class ExcludedServers;
 class RPCSender;
 class StreamSettings;
@@ -113,6 +115,7 @@ friend class ParallelChannel;
 friend class ParallelChannelDone;
 friend class ControllerPrivateAccessor;
 friend class ServerPrivateAccessor;
+friend class ServerCallMap;
 friend class SelectiveChannel;
 friend class ThriftStub;
 friend class schan::Sender;
@@ -143,6 +146,7 @@ friend void policy::ProcessThriftRequest(InputMessageBase*);
     static const uint32_t FLAGS_ENABLED_CIRCUIT_BREAKER = (1 << 17);
     static const uint32_t FLAGS_ALWAYS_PRINT_PRIMITIVE_FIELDS = (1 << 18);
     static const uint32_t FLAGS_HEALTH_CHECK_CALL = (1 << 19);
+    static const uint32_t FLAGS_REQUEST_READ_PROGRESSIVELY = (1 << 20);
 
 public:
     struct Inheritable {
@@ -293,7 +297,14 @@ public:
     // True if response_will_be_read_progressively() was called.
     bool is_response_read_progressively() const { return has_flag(FLAGS_READ_PROGRESSIVELY); }
 
-    // Read the remaining body after RPC:
+    // [Server-side] True if the method is listed in
+    // ServiceOptions.progressive_read_methods and runs before the request
+    // body is fully received, read the body by ReadProgressiveAttachmentBy().
+    bool is_request_read_progressively() const
+    { return has_flag(FLAGS_REQUEST_READ_PROGRESSIVELY); }
+
+    // Read the remaining body after RPC(or the request body inside a method
+    // with is_request_read_progressively() on server-side):
     // - This function can only be called once.
     // - If user called response_will_be_read_progressively() but
     //   ReadProgressiveAttachmentBy(), controller will set a reader ignoring
@@ -353,6 +364,9 @@ public:
     // Returns true if the client canceled the RPC or the connection has broken,
     // so the server may as well give up on replying to it. The server should still
     // call the final "done" callback.
+    // Cancellations are sent by clients of baidu_std(with
+    // -baidu_std_propagate_cancel on) and h2(RST_STREAM) when the RPC is
+    // canceled by StartCancel() or timed out.
     // Note: Reaching deadline of the RPC would not affect this function, which means
     // even if deadline has been reached, this function may still return false.
     bool IsCanceled() const override;
@@ -546,6 +560,9 @@ public:
 
     // Get deadline of this RPC (since the Epoch in microseconds).
     // -1 means no deadline.
+    // On server-side, it's the deadline propagated from the client, which is
+    // inherited by RPCs issued from the bthread running the service method:
+    // their timeouts are clamped to the time left.
     int64_t deadline_us() const { return _deadline_us; }
 
 private:
@@ -651,6 +668,7 @@ private:
         bool need_feedback;             // The LB needs feedback.
         bool enable_circuit_breaker;    // The channel enabled circuit_breaker
         bool touched_by_stream_creator; 
+        bool limited_by_server;         // counted in server's concurrency
         SocketId peer_id;               // main server id
         int64_t begin_time_us;          // sent real time.
         // The actual `Socket' for sending RPC. It's socket id will be
@@ -712,6 +730,10 @@ private:
     void* _session_local_data;
     const Server* _server;
     bthread_id_t _oncancel_id;
+    // Set when the client canceled this RPC explicitly.
+    butil::atomic<bool> _canceled_by_client;
+    // Key of this RPC in ServerCallMap, 0 for not cancelable.
+    uint64_t _server_call_key;
     const AuthContext* _auth_context;        // Authentication result
     butil::intrusive_ptr<MongoContext> _mongo_session_data;
     SampledRequest* _sampled_request;
@@ -726,6 +748,10 @@ private:
     CallId _correlation_id;
 
     ConnectionType _connection_type;
+    // Options of pooled connections, see ChannelOptions.
+    int _pool_idle_timeout_s;
+    int _pool_max_idle_connections;
+    int _max_pipelined_requests;
 
     // Used by ParallelChannel
     int _fail_limit;
@@ -757,6 +783,8 @@ private:
     uint64_t _request_code;
     SocketId _single_server_id;
     butil::intrusive_ptr<SharedLoadBalancer> _lb;
+    // Set when the channel limits concurrency.
+    butil::intrusive_ptr<ClientConcurrencyLimiter> _client_cl;
 
     // for passing parameters to created bthread, don't modify it otherwhere.
     CompletionInfo _tmp_completion_info;
@@ -789,6 +817,9 @@ private:
     // Readable progressive attachment
     butil::intrusive_ptr<ReadableProgressiveAttachment> _rpa;
 
+    // Messages of streaming gRPC calls
+    butil::intrusive_ptr<GrpcStream> _grpc_stream;
+
     // TODO: Replace following fields with StreamCreator
     // Defined at client side
     StreamId _request_stream;
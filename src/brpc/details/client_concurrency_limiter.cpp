@@ -0,0 +1,65 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "butil/logging.h"
+#include "brpc/details/client_concurrency_limiter.h"
+
+namespace brpc {
+
+ClientConcurrencyLimiter::ClientConcurrencyLimiter()
+    : _nconcurrency(0) {
+}
+
+ClientConcurrencyLimiter::~ClientConcurrencyLimiter() {
+}
+
+int ClientConcurrencyLimiter::Create(
+    const AdaptiveMaxConcurrency& max_concurrency,
+    const AdaptiveMaxConcurrency& max_concurrency_per_server,
+    ClientConcurrencyLimiter** out) {
+    *out = NULL;
+    if (max_concurrency == AdaptiveMaxConcurrency::UNLIMITED() &&
+        max_concurrency_per_server == AdaptiveMaxConcurrency::UNLIMITED()) {
+        return 0;
+    }
+    ConcurrencyLimiter* cl = NULL;
+    if (NewConcurrencyLimiter(max_concurrency, &cl) != 0) {
+        return -1;
+    }
+    if (max_concurrency_per_server != AdaptiveMaxConcurrency::UNLIMITED()) {
+        // Check validity of the option before any RPC is sent.
+        ConcurrencyLimiter* tmp = NULL;
+        if (NewConcurrencyLimiter(max_concurrency_per_server, &tmp) != 0) {
+            delete cl;
+            return -1;
+        }
+        delete tmp;
+    }
+    ClientConcurrencyLimiter* ccl = new (std::nothrow) ClientConcurrencyLimiter;
+    if (ccl == NULL) {
+        LOG(ERROR) << "Fail to new ClientConcurrencyLimiter";
+        delete cl;
+        return -1;
+    }
+    ccl->_cl.reset(cl);
+    ccl->_max_concurrency_per_server = max_concurrency_per_server;
+    *out = ccl;
+    return 0;
+}
+
+}  // namespace brpc
@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef  BRPC_CLIENT_CONCURRENCY_LIMITER_H
+#define  BRPC_CLIENT_CONCURRENCY_LIMITER_H
+
+#include <memory>                          // std::unique_ptr
+#include "butil/macros.h"                  // DISALLOW_COPY_AND_ASSIGN
+#include "butil/atomicops.h"
+#include "brpc/shared_object.h"            // SharedObject
+#include "brpc/concurrency_limiter.h"
+
+
+namespace brpc {
+
+// Limits concurrency of RPCs sent by a Channel. Shared between the channel
+// and RPCs over it, so that asynchronous RPCs still in flight can end
+// after destruction of the channel.
+class ClientConcurrencyLimiter : public SharedObject {
+public:
+    // Create an instance for a channel with `max_concurrency' limiting all
+    // RPCs of the channel and `max_concurrency_per_server' limiting RPCs to
+    // each server. *out is set to NULL when both are unlimited.
+    // Returns 0 on success, -1 otherwise.
+    static int Create(const AdaptiveMaxConcurrency& max_concurrency,
+                      const AdaptiveMaxConcurrency& max_concurrency_per_server,
+                      ClientConcurrencyLimiter** out);
+
+    // Call this function before sending a RPC over the channel.
+    // Returns false when the channel is overloaded. If rejected_cc is not
+    // NULL, it's set with the rejected concurrency.
+    // NOTE: OnResponded() must be called no matter what is returned.
+    bool OnRequested(int* rejected_cc = NULL);
+
+    // Call this function when the RPC ends.
+    void OnResponded(int error_code, int64_t latency_us);
+
+    // Current max_concurrency of the channel, 0 for unlimited.
+    int MaxConcurrency() const { return _cl ? _cl->MaxConcurrency() : 0; }
+
+    // Number of RPCs in flight.
+    int concurrency() const
+    { return _nconcurrency.load(butil::memory_order_relaxed); }
+
+    bool limit_per_server() const
+    { return _max_concurrency_per_server != AdaptiveMaxConcurrency::UNLIMITED(); }
+
+    const AdaptiveMaxConcurrency& max_concurrency_per_server() const
+    { return _max_concurrency_per_server; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ClientConcurrencyLimiter);
+    ClientConcurrencyLimiter();
+    ~ClientConcurrencyLimiter();
+
+    std::unique_ptr<ConcurrencyLimiter> _cl;
+    butil::atomic<int> _nconcurrency;
+    AdaptiveMaxConcurrency _max_concurrency_per_server;
+};
+
+inline bool ClientConcurrencyLimiter::OnRequested(int* rejected_cc) {
+    const int cc = _nconcurrency.fetch_add(1, butil::memory_order_relaxed) + 1;
+    if (NULL == _cl || _cl->OnRequested(cc)) {
+        return true;
+    }
+    if (rejected_cc) {
+        *rejected_cc = cc;
+    }
+    return false;
+}
+
+inline void ClientConcurrencyLimiter::OnResponded(int error_code,
+                                                  int64_t latency_us) {
+    _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
+    if (NULL != _cl) {
+        _cl->OnResponded(error_code, latency_us);
+    }
+}
+
+} // namespace brpc
+
+#endif  //BRPC_CLIENT_CONCURRENCY_LIMITER_H
@@ -0,0 +1,409 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <sys/time.h>                          // setitimer
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <gflags/gflags.h>
+#include "butil/atomicops.h"
+#include "butil/logging.h"
+#include "butil/time.h"
+#include "butil/thread_local.h"
+#include "butil/synchronization/lock.h"
+#include "butil/memory/singleton_on_pthread_once.h"
+#include "bvar/bvar.h"
+#include "bthread/task_meta.h"                 // bthread::LocalStorage
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/symbolizer.h"
+#include "brpc/builtin/flame_graph.h"
+#include "brpc/details/continuous_profiler.h"
+
+namespace bthread {
+extern thread_local LocalStorage tls_bls;
+}
+
+namespace brpc {
+
+static bool ValidateContinuousProfilingHz(const char*, int32_t);
+
+DEFINE_int32(cpu_continuous_profiling_hz, 0,
+             "Take so many samples for each second of cpu time consumed by "
+             "this process continuously, 0 to turn off. The samples are "
+             "available at /hotspots/cpu_continuous");
+BRPC_VALIDATE_GFLAG(cpu_continuous_profiling_hz, ValidateContinuousProfilingHz);
+
+DEFINE_int32(cpu_continuous_profiling_window_s, 600,
+             "Keep samples of the continuous cpu profiler for so many seconds");
+BRPC_VALIDATE_GFLAG(cpu_continuous_profiling_window_s, PositiveInteger);
+
+namespace {
+
+// Max frames of a sample.
+const int MAX_DEPTH = 62;
+// Must be power of 2.
+const size_t RING_SIZE = 2048;
+// Samples are aggregated in buckets of so many seconds.
+const int64_t BUCKET_SECONDS = 10;
+
+// Written by the signal handler and read by the aggregating thread.
+struct Sample {
+    butil::atomic<uint64_t> seq;
+    const char* tag;
+    int depth;
+    void* pcs[MAX_DEPTH];
+};
+
+// A bounded queue that can be pushed in signal handlers: pushing neither
+// blocks nor allocates memory, samples are dropped when it's full.
+Sample* g_ring = NULL;
+butil::atomic<uint64_t> g_push_pos(0);
+butil::atomic<int64_t> g_ndropped(0);
+
+// Address of bthread::tls_bls.cpu_profiling_tag of this pthread, set outside
+// the signal handler. Accessing thread_local variables in signal handlers
+// may allocate memory lazily, while initial-exec __thread variables don't.
+BAIDU_THREAD_LOCAL const char* const* tls_cpu_profiling_tag_slot
+    __attribute__((tls_model("initial-exec"))) = NULL;
+
+// Frames farther than this from the previous one are considered broken.
+const uintptr_t MAX_FRAME_SIZE = 100000;
+
+// Get pcs of the interrupted stack by walking frame pointers from registers
+// in `uc'. glibc backtrace() is not async-signal-safe: it loads libgcc on
+// first call and takes locks of the dynamic loader while unwinding.
+// Frames are walked only when they grow towards the stack bottom by less
+// than MAX_FRAME_SIZE each, functions without frame pointers may end the
+// stack early.
+int GetStackFromContext(const ucontext_t* uc, void** pcs, int max_depth) {
+    uintptr_t pc = 0;
+    uintptr_t fp = 0;
+    uintptr_t sp = 0;
+#if defined(__x86_64__)
+    pc = uc->uc_mcontext.gregs[REG_RIP];
+    fp = uc->uc_mcontext.gregs[REG_RBP];
+    sp = uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    pc = uc->uc_mcontext.pc;
+    fp = uc->uc_mcontext.regs[29];
+    sp = uc->uc_mcontext.sp;
+#else
+    return 0;
+#endif
+    int n = 0;
+    pcs[n++] = (void*)pc;
+    // A frame starts with the saved frame pointer of the caller followed by
+    // the return address on both x86_64 and aarch64.
+    uintptr_t prev = sp;
+    while (n < max_depth) {
+        if (fp < prev || fp - prev > MAX_FRAME_SIZE ||
+            (fp & (sizeof(void*) - 1)) != 0) {
+            break;
+        }
+        const uintptr_t* frame = (const uintptr_t*)fp;
+        const uintptr_t ret = frame[1];
+        if (ret == 0) {
+            break;
+        }
+        pcs[n++] = (void*)ret;
+        prev = fp + 2 * sizeof(void*);
+        fp = frame[0];
+    }
+    return n;
+}
+
+void HandleSigprof(int, siginfo_t*, void* ucontext) {
+    const int saved_errno = errno;
+    uint64_t pos = g_push_pos.load(butil::memory_order_relaxed);
+    Sample* s = NULL;
+    while (true) {
+        Sample* cell = &g_ring[pos & (RING_SIZE - 1)];
+        const uint64_t seq = cell->seq.load(butil::memory_order_acquire);
+        const int64_t diff = (int64_t)seq - (int64_t)pos;
+        if (diff == 0) {
+            if (g_push_pos.compare_exchange_weak(
+                    pos, pos + 1, butil::memory_order_relaxed)) {
+                s = cell;
+                break;
+            }
+        } else if (diff < 0) {
+            g_ndropped.fetch_add(1, butil::memory_order_relaxed);
+            errno = saved_errno;
+            return;
+        } else {
+            pos = g_push_pos.load(butil::memory_order_relaxed);
+        }
+    }
+    s->depth = GetStackFromContext(
+        (const ucontext_t*)ucontext, s->pcs, MAX_DEPTH);
+    const char* const* tag_slot = tls_cpu_profiling_tag_slot;
+    s->tag = (tag_slot ? *tag_slot : NULL);
+    s->seq.store(pos + 1, butil::memory_order_release);
+    errno = saved_errno;
+}
+
+// Samples aggregated by (tag, pcs).
+typedef std::map<std::string, int64_t> RawStacks;
+
+struct Bucket {
+    int64_t start_s;
+    RawStacks stacks;
+};
+
+int64_t GetDroppedCount(void*) {
+    return g_ndropped.load(butil::memory_order_relaxed);
+}
+
+class ContinuousProfiler {
+public:
+    ContinuousProfiler()
+        : _hz(0)
+        , _running(false)
+        , _nsuspend(0)
+        , _started_thread(false)
+        , _pop_pos(0)
+        , _nsample("cpu_continuous_profiling_sample_count")
+        , _ndropped("cpu_continuous_profiling_dropped_count",
+                    GetDroppedCount, NULL) {}
+
+    void SetHz(int hz) {
+        BAIDU_SCOPED_LOCK(_control_mutex);
+        _hz = hz;
+        if (hz > 0 && !_started_thread) {
+            g_ring = new Sample[RING_SIZE];
+            for (size_t i = 0; i < RING_SIZE; ++i) {
+                g_ring[i].seq.store(i, butil::memory_order_relaxed);
+            }
+            pthread_t th;
+            if (pthread_create(&th, NULL, RunThis, this) != 0) {
+                PLOG(ERROR) << "Fail to create thread of continuous profiler";
+                return;
+            }
+            pthread_detach(th);
+            _started_thread = true;
+        }
+        ApplyTimer();
+    }
+
+    void Suspend() {
+        BAIDU_SCOPED_LOCK(_control_mutex);
+        ++_nsuspend;
+        ApplyTimer();
+    }
+
+    void Resume() {
+        BAIDU_SCOPED_LOCK(_control_mutex);
+        if (_nsuspend > 0) {
+            --_nsuspend;
+        }
+        ApplyTimer();
+    }
+
+    int GetProfile(int seconds, FoldedStacks* stacks) {
+        RawStacks raw;
+        {
+            BAIDU_SCOPED_LOCK(_control_mutex);
+            if (!_started_thread) {
+                return -1;
+            }
+        }
+        {
+            BAIDU_SCOPED_LOCK(_data_mutex);
+            const int64_t min_start_s = (seconds > 0 ?
+                butil::gettimeofday_s() - seconds - BUCKET_SECONDS + 1 : 0);
+            for (size_t i = 0; i < _buckets.size(); ++i) {
+                if (_buckets[i].start_s < min_start_s) {
+                    continue;
+                }
+                for (RawStacks::const_iterator it = _buckets[i].stacks.begin();
+                     it != _buckets[i].stacks.end(); ++it) {
+                    raw[it->first] += it->second;
+                }
+            }
+        }
+        // Symbolize without the lock.
+        Symbolizer symbolizer;
+        std::string stack;
+        for (RawStacks::const_iterator it = raw.begin(); it != raw.end(); ++it) {
+            const char* tag = NULL;
+            memcpy(&tag, it->first.data(), sizeof(tag));
+            const char* pcs = it->first.data() + sizeof(tag);
+            const size_t depth = (it->first.size() - sizeof(tag)) / sizeof(void*);
+            stack.clear();
+            if (tag != NULL) {
+                stack.append(tag);
+            }
+            for (size_t j = depth; j > 0; --j) {
+                if (!stack.empty()) {
+                    stack.push_back(';');
+                }
+                uintptr_t pc = 0;
+                memcpy(&pc, pcs + (j - 1) * sizeof(void*), sizeof(pc));
+                stack.append(symbolizer.Symbolize(pc, j != 1));
+            }
+            stacks->Add(stack, it->second);
+        }
+        stacks->set_unit("samples");
+        return 0;
+    }
+
+private:
+    // Called with _control_mutex held.
+    void ApplyTimer() {
+        const bool should_run = (_hz > 0 && _nsuspend == 0 && _started_thread);
+        if (should_run) {
+            // The handler may be replaced by other profilers, always
+            // install it again.
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_sigaction = HandleSigprof;
+            sa.sa_flags = SA_SIGINFO | SA_RESTART;
+            sigemptyset(&sa.sa_mask);
+            if (sigaction(SIGPROF, &sa, NULL) != 0) {
+                PLOG(ERROR) << "Fail to install handler of SIGPROF";
+                return;
+            }
+        } else if (!_running) {
+            return;
+        }
+        // Signals are sent for every 1/hz seconds of cpu time consumed
+        // by the process.
+        struct itimerval timer;
+        memset(&timer, 0, sizeof(timer));
+        if (should_run) {
+            timer.it_interval.tv_usec = std::max(1000000 / _hz, 1);
+            timer.it_value = timer.it_interval;
+        }
+        if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+            PLOG(ERROR) << "Fail to set ITIMER_PROF";
+            return;
+        }
+        // The handler is kept to ignore pending signals after stopping.
+        _running = should_run;
+    }
+
+    static void* RunThis(void* arg) {
+        static_cast<ContinuousProfiler*>(arg)->Run();
+        return NULL;
+    }
+
+    void Run() {
+        RawStacks local;
+        std::string key;
+        while (true) {
+            usleep(100000);
+            int64_t n = 0;
+            while (true) {
+                Sample* cell = &g_ring[_pop_pos & (RING_SIZE - 1)];
+                if (cell->seq.load(butil::memory_order_acquire) != _pop_pos + 1) {
+                    break;
+                }
+                key.assign((const char*)&cell->tag, sizeof(cell->tag));
+                key.append((const char*)cell->pcs, cell->depth * sizeof(void*));
+                cell->seq.store(_pop_pos + RING_SIZE, butil::memory_order_release);
+                ++_pop_pos;
+                ++local[key];
+                ++n;
+            }
+            _nsample << n;
+            const int64_t now_s = butil::gettimeofday_s();
+            BAIDU_SCOPED_LOCK(_data_mutex);
+            const int64_t start_s = now_s - now_s % BUCKET_SECONDS;
+            if (!local.empty()) {
+                if (_buckets.empty() || _buckets.back().start_s != start_s) {
+                    _buckets.push_back(Bucket());
+                    _buckets.back().start_s = start_s;
+                }
+                RawStacks& stacks = _buckets.back().stacks;
+                if (stacks.empty()) {
+                    stacks.swap(local);
+                } else {
+                    for (RawStacks::const_iterator it = local.begin();
+                         it != local.end(); ++it) {
+                        stacks[it->first] += it->second;
+                    }
+                    local.clear();
+                }
+            }
+            const int64_t window_s = FLAGS_cpu_continuous_profiling_window_s;
+            while (!_buckets.empty() &&
+                   _buckets.front().start_s + BUCKET_SECONDS <= now_s - window_s) {
+                _buckets.pop_front();
+            }
+        }
+    }
+
+    butil::Mutex _control_mutex;
+    int _hz;
+    bool _running;
+    int _nsuspend;
+    bool _started_thread;
+
+    uint64_t _pop_pos;
+    butil::Mutex _data_mutex;
+    std::deque<Bucket> _buckets;
+
+    bvar::Adder<int64_t> _nsample;
+    bvar::PassiveStatus<int64_t> _ndropped;
+};
+
+ContinuousProfiler* GetProfiler() {
+    return butil::get_leaky_singleton<ContinuousProfiler>();
+}
+
+} // namespace
+
+static bool ValidateContinuousProfilingHz(const char*, int32_t val) {
+    if (val < 0 || val > 1000) {
+        return false;
+    }
+    GetProfiler()->SetHz(val);
+    return true;
+}
+
+ScopedCpuProfilingTag::ScopedCpuProfilingTag(const char* tag)
+    : _saved_tag(bthread::tls_bls.cpu_profiling_tag) {
+    // tls_bls of a pthread stays at the same address while bthreads switch
+    // contents of it, cache the address for the signal handler. The bthread
+    // may be stolen by another pthread in the scope, which is set in dtor.
+    tls_cpu_profiling_tag_slot = &bthread::tls_bls.cpu_profiling_tag;
+    bthread::tls_bls.cpu_profiling_tag = tag;
+}
+
+ScopedCpuProfilingTag::~ScopedCpuProfilingTag() {
+    tls_cpu_profiling_tag_slot = &bthread::tls_bls.cpu_profiling_tag;
+    bthread::tls_bls.cpu_profiling_tag = _saved_tag;
+}
+
+int GetContinuousCpuProfile(int seconds, FoldedStacks* stacks) {
+    return GetProfiler()->GetProfile(seconds, stacks);
+}
+
+void SuspendContinuousCpuProfiling() {
+    GetProfiler()->Suspend();
+}
+
+void ResumeContinuousCpuProfiling() {
+    GetProfiler()->Resume();
+}
+
+} // namespace brpc
@@ -0,0 +1,60 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_CONTINUOUS_PROFILER_H
+#define BRPC_DETAILS_CONTINUOUS_PROFILER_H
+
+#include "butil/macros.h"
+
+// A low-overhead cpu profiler which is always on when
+// -cpu_continuous_profiling_hz is positive. Samples are taken by SIGPROF
+// and aggregated by call stacks in memory for the last
+// -cpu_continuous_profiling_window_s seconds, so that hot spots of an
+// incident can be checked after it happens.
+
+namespace brpc {
+
+class FoldedStacks;
+
+// Attribute cpu samples of current bthread (or pthread) to `tag' in this
+// scope. Servers use full names of the methods being called, `tag' must
+// be valid until the end of the program.
+class ScopedCpuProfilingTag {
+public:
+    explicit ScopedCpuProfilingTag(const char* tag);
+    ~ScopedCpuProfilingTag();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ScopedCpuProfilingTag);
+    const char* _saved_tag;
+};
+
+// Aggregate samples of the last `seconds' seconds (all samples in the
+// window if `seconds' is non-positive) into `stacks'. Stacks of tagged
+// samples start with the tags.
+// Returns 0 on success, -1 if the profiler was never turned on.
+int GetContinuousCpuProfile(int seconds, FoldedStacks* stacks);
+
+// Profilers running on demand (gperftools) also rely on SIGPROF, suspend
+// the continuous profiler before starting them and resume it after.
+void SuspendContinuousCpuProfiling();
+void ResumeContinuousCpuProfiling();
+
+} // namespace brpc
+
+#endif // BRPC_DETAILS_CONTINUOUS_PROFILER_H
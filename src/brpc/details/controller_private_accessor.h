@@ -20,9 +20,11 @@
 
 // This is an rpc-internal file.
 
+#include "butil/time.h"
 #include "brpc/socket.h"
 #include "brpc/controller.h"
 #include "brpc/stream.h"
+#include "brpc/details/server_call_map.h"
 
 namespace google {
 namespace protobuf {
@@ -101,6 +103,9 @@ public:
     uint32_t pipelined_count() const { return _cntl->_pipelined_count; }
     void set_pipelined_count(uint32_t count) {  _cntl->_pipelined_count = count; }
 
+    int max_pipelined_requests() const { return _cntl->_max_pipelined_requests; }
+    void set_max_pipelined_requests(int n) { _cntl->_max_pipelined_requests = n; }
+
     ControllerPrivateAccessor& set_server(const Server* server) {
         _cntl->_server = server;
         return *this;
@@ -124,6 +129,12 @@ public:
     void set_readable_progressive_attachment(ReadableProgressiveAttachment* s)
     { _cntl->_rpa.reset(s); }
 
+    void set_request_read_progressively()
+    { _cntl->add_flag(Controller::FLAGS_REQUEST_READ_PROGRESSIVELY); }
+
+    GrpcStream* grpc_stream() const { return _cntl->_grpc_stream.get(); }
+    void set_grpc_stream(GrpcStream* s) { _cntl->_grpc_stream.reset(s); }
+
     void add_with_auth() {
         _cntl->add_flag(Controller::FLAGS_REQUEST_WITH_AUTH);
     }
@@ -139,12 +150,31 @@ public:
     // side is properly set in the RPC sending path.
     void set_deadline_us(int64_t deadline_us) { _cntl->_deadline_us = deadline_us; }
 
+    // Time left before the deadline in milliseconds which is sent to server
+    // (instead of the deadline itself which is meaningless to a server whose
+    // clock differs). -1 means no deadline.
+    int64_t remaining_timeout_ms() const {
+        if (_cntl->_deadline_us < 0) {
+            return -1;
+        }
+        const int64_t left_us = _cntl->_deadline_us - butil::gettimeofday_us();
+        return left_us > 0 ? (left_us + 999) / 1000 : 0;
+    }
+
     ControllerPrivateAccessor& set_begin_time_us(int64_t begin_time_us) {
         _cntl->_begin_time_us = begin_time_us;
         _cntl->_end_time_us = UNSET_MAGIC_NUM;
         return *this;
     }
 
+    // Make the server-side RPC cancelable by the client with `key' which
+    // identifies the RPC on the connection set by set_peer_id().
+    void set_cancelable(uint64_t key) {
+        if (ServerCallMap::Insert(_cntl->_current_call.peer_id, key, _cntl) == 0) {
+            _cntl->_server_call_key = key;
+        }
+    }
+
     ControllerPrivateAccessor& set_health_check_call() {
         _cntl->add_flag(Controller::FLAGS_HEALTH_CHECK_CALL);
         return *this;
@@ -154,6 +184,24 @@ private:
     Controller* _cntl;
 };
 
+// Make RPCs issued by current bthread (or pthread) inherit the deadline of the
+// server-side RPC being processed, during lifetime of this object.
+// NOTE: Methods are not inlined on purpose: the bthread may be switched to
+// another pthread before destruction, address of the thread-local storage
+// must not be cached.
+class ScopedServerDeadline {
+public:
+    explicit ScopedServerDeadline(int64_t deadline_us);
+    ~ScopedServerDeadline();
+
+    // Deadline inherited by RPCs issued by current bthread, 0 means none.
+    static int64_t tls_deadline_us();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ScopedServerDeadline);
+    int64_t _saved_deadline_us;
+};
+
 // Inherit this class to intercept Controller::IssueRPC. This is an internal
 // utility only useable by brpc developers.
 class RPCSender {
@@ -329,6 +329,8 @@ public:
         return &_node_memory[id - 1];
     }
 
+    size_t node_count() const { return _node_memory.size(); }
+
 private:
 
     HuffmanNode& node(NodeId id) {
@@ -351,43 +353,34 @@ public:
     HuffmanEncoder(butil::IOBufAppender* out, const HuffmanCode* table)
         : _out(out)
         , _table(table)
-        , _partial_byte(0)
-        , _remain_bit(8)
+        , _bits(0)
+        , _nbits(0)
         , _out_bytes(0)
     {}
 
     void Encode(unsigned char byte) {
-        const HuffmanCode code = _table[byte];
-        uint16_t bits_left = code.bit_len;
-        while (bits_left) {
-            const uint16_t adding_bits_len = std::min(_remain_bit, bits_left);
-            const uint8_t adding_bits = static_cast<uint8_t>(
-                    (code.code & ((1u << bits_left) - 1))   // clear leading bits
-                            >> (bits_left - adding_bits_len));  // align to LSB
-            _partial_byte |= adding_bits << (_remain_bit - adding_bits_len);
-            _remain_bit -= adding_bits_len;
-            bits_left -= adding_bits_len;
-            if (!_remain_bit) {
-                ++_out_bytes;
-                _out->push_back(_partial_byte);
-                _remain_bit = 8;
-                _partial_byte = 0;
-            }
+        const HuffmanCode& code = _table[byte];
+        // Less than 8 bits are pending and codes have at most 30 bits, which
+        // always fit in _bits. Higher bits shifted out are already written.
+        _bits = (_bits << code.bit_len) | code.code;
+        _nbits += code.bit_len;
+        while (_nbits >= 8) {
+            _nbits -= 8;
+            _out->push_back(static_cast<uint8_t>(_bits >> _nbits));
+            ++_out_bytes;
         }
     }
 
     void EndStream() {
-        if (_remain_bit == 8u) {
+        if (_nbits == 0) {
             return;
         }
-        DCHECK_LT(_remain_bit, 8u);
-        // Add padding `1's to lsb to make _out aligned
-        _partial_byte |= (1 << _remain_bit) - 1;
-        // TODO: push_back is probably costly since it acquires tls everytime it
-        // is invoked.
-        _out->push_back(_partial_byte);
-        _partial_byte = 0;
-        _remain_bit = 0;
+        DCHECK_LT(_nbits, 8u);
+        // Add padding `1's (MSB of EOS) to lsb to make _out aligned
+        const uint32_t padding = 8 - _nbits;
+        _out->push_back(static_cast<uint8_t>(
+                            (_bits << padding) | ((1u << padding) - 1)));
+        _nbits = 0;
         _out = NULL;
         ++_out_bytes;
     }
@@ -397,70 +390,141 @@ public:
 private:
     butil::IOBufAppender* _out;
     const HuffmanCode* _table;
-    uint8_t  _partial_byte;
-    uint16_t _remain_bit;
+    uint64_t _bits;
+    uint32_t _nbits;
     uint32_t _out_bytes;
 };
 
-class HuffmanDecoder {
-DISALLOW_COPY_AND_ASSIGN(HuffmanDecoder);
+enum HuffmanDecodeFlag {
+    HUFFMAN_DECODE_SYMBOL = 1,    // `symbol' is decoded by this transition
+    HUFFMAN_DECODE_ACCEPTED = 2,  // The string may end at the next state
+    HUFFMAN_DECODE_FAIL = 4,      // Reached EOS or an invalid code
+};
+
+struct HuffmanDecodeEntry {
+    uint8_t state;
+    uint8_t flags;
+    uint8_t symbol;
+};
+
+// Decode huffman strings 4 bits at a time instead of walking the tree bit by
+// bit. States are internal nodes of the huffman tree(the root is state 0),
+// an entry tells where 4 bits lead from a state. Since the shortest code has
+// 5 bits, at most one symbol is decoded by each transition.
+class BAIDU_CACHELINE_ALIGNMENT HuffmanDecodeTable {
+DISALLOW_COPY_AND_ASSIGN(HuffmanDecodeTable);
 public:
-    HuffmanDecoder(std::string* out, const HuffmanTree* tree)
-        // FIXME: resizing of out is costly
-        : _out(out)
-        , _tree(tree)
-        , _cur_node(tree->node(HuffmanTree::ROOT_NODE))
-        , _cur_depth(0)  // Depth of root node is 0
-        , _padding(true)
-    {}
-    int Decode(uint8_t byte) {
-        for (int i = 7; i >= 0; --i) {
-            if (byte & (1u << i)) {
-                _cur_node = _tree->node(_cur_node->right_child);
-                if (BAIDU_UNLIKELY(!_cur_node)) {
-                    LOG(ERROR) << "Decoder stream reaches NULL_NODE";
+    // A complete huffman tree of 257 symbols has 256 internal nodes.
+    static const size_t MAX_STATES = 256;
+
+    HuffmanDecodeTable() {}
+    int Init(const HuffmanTree& tree);
+
+    const HuffmanDecodeEntry& entry(uint8_t state, uint8_t nibble) const {
+        return _entries[state][nibble];
+    }
+
+private:
+    HuffmanDecodeEntry _entries[MAX_STATES][16];
+};
+
+int HuffmanDecodeTable::Init(const HuffmanTree& tree) {
+    typedef HuffmanTree::NodeId NodeId;
+    // Number internal nodes in BFS order so that the root is state 0.
+    std::vector<NodeId> nodes;
+    std::vector<int> states(tree.node_count() + 1, -1);
+    nodes.push_back(HuffmanTree::ROOT_NODE);
+    states[HuffmanTree::ROOT_NODE] = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const HuffmanNode* n = tree.node(nodes[i]);
+        const NodeId children[2] = { n->left_child, n->right_child };
+        for (int j = 0; j < 2; ++j) {
+            const HuffmanNode* child = tree.node(children[j]);
+            if (child != NULL && child->value == HuffmanTree::INVALID_VALUE) {
+                if (nodes.size() >= MAX_STATES) {
+                    LOG(ERROR) << "Too many internal nodes in huffman tree";
                     return -1;
                 }
-                if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                    if (BAIDU_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                        LOG(ERROR) << "Decoder stream reaches EOS";
-                        return -1;
-                    }
-                    _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                    _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                    _cur_depth = 0;
-                    _padding = true;
-                    continue;
+                states[children[j]] = nodes.size();
+                nodes.push_back(children[j]);
+            }
+        }
+    }
+    // A string may end at the root or inside a padding, which is a prefix of
+    // EOS(all `1's) shorter than 8 bits.
+    // https://tools.ietf.org/html/rfc7541#section-5.2
+    std::vector<bool> accepted(tree.node_count() + 1, false);
+    NodeId padding = HuffmanTree::ROOT_NODE;
+    for (int depth = 0; depth <= 7 && padding != HuffmanTree::NULL_NODE; ++depth) {
+        accepted[padding] = true;
+        padding = tree.node(padding)->right_child;
+    }
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        for (int nibble = 0; nibble < 16; ++nibble) {
+            HuffmanDecodeEntry e = { 0, 0, 0 };
+            NodeId cur = nodes[i];
+            for (int bit = 3; bit >= 0; --bit) {
+                const HuffmanNode* n = tree.node(cur);
+                const NodeId next = (nibble & (1 << bit))
+                    ? n->right_child : n->left_child;
+                const HuffmanNode* next_node = tree.node(next);
+                if (next_node == NULL || next_node->value == HPACK_HUFFMAN_EOS) {
+                    e.flags = HUFFMAN_DECODE_FAIL;
+                    break;
                 }
-                _padding &= 1;
-            } else {
-                _cur_node = _tree->node(_cur_node->left_child);
-                if (BAIDU_UNLIKELY(!_cur_node)) {
-                    LOG(ERROR) << "Decoder stream reaches NULL_NODE";
-                    return -1;
+                if (next_node->value != HuffmanTree::INVALID_VALUE) {
+                    DCHECK(!(e.flags & HUFFMAN_DECODE_SYMBOL));
+                    e.flags |= HUFFMAN_DECODE_SYMBOL;
+                    e.symbol = static_cast<uint8_t>(next_node->value);
+                    cur = HuffmanTree::ROOT_NODE;
+                } else {
+                    cur = next;
                 }
-                if (_cur_node->value != HuffmanTree::INVALID_VALUE) {
-                    if (BAIDU_UNLIKELY(_cur_node->value == HPACK_HUFFMAN_EOS)) {
-                        LOG(ERROR) << "Decoder stream reaches EOS";
-                        return -1;
-                    }
-                    _out->push_back(static_cast<uint8_t>(_cur_node->value));
-                    _cur_node = _tree->node(HuffmanTree::ROOT_NODE);
-                    _cur_depth = 0;
-                    _padding = true;
-                    continue;
+            }
+            if (!(e.flags & HUFFMAN_DECODE_FAIL)) {
+                e.state = states[cur];
+                if (accepted[cur]) {
+                    e.flags |= HUFFMAN_DECODE_ACCEPTED;
                 }
-                _padding &= 0;
             }
-            ++_cur_depth;
+            _entries[i][nibble] = e;
+        }
+    }
+    return 0;
+}
+
+class HuffmanDecoder {
+DISALLOW_COPY_AND_ASSIGN(HuffmanDecoder);
+public:
+    HuffmanDecoder(std::string* out, const HuffmanDecodeTable* table)
+        : _out(out)
+        , _table(table)
+        , _state(0)
+        , _accepted(true)  // Empty string is valid
+    {}
+    int Decode(uint8_t byte) {
+        const HuffmanDecodeEntry& e1 = _table->entry(_state, byte >> 4);
+        if (BAIDU_UNLIKELY(e1.flags & HUFFMAN_DECODE_FAIL)) {
+            LOG(ERROR) << "Decoder stream reaches EOS";
+            return -1;
+        }
+        if (e1.flags & HUFFMAN_DECODE_SYMBOL) {
+            _out->push_back(e1.symbol);
         }
+        const HuffmanDecodeEntry& e2 = _table->entry(e1.state, byte & 0xF);
+        if (BAIDU_UNLIKELY(e2.flags & HUFFMAN_DECODE_FAIL)) {
+            LOG(ERROR) << "Decoder stream reaches EOS";
+            return -1;
+        }
+        if (e2.flags & HUFFMAN_DECODE_SYMBOL) {
+            _out->push_back(e2.symbol);
+        }
+        _state = e2.state;
+        _accepted = (e2.flags & HUFFMAN_DECODE_ACCEPTED);
         return 0;
     }
     int EndStream() {
-        if (_cur_depth == 0) {
-            return 0;
-        }
-        if (_cur_depth <= 7 && _padding) {
+        if (_accepted) {
             return 0;
         }
         // Invalid stream, the padding is not corresponding to MSB of EOS
@@ -469,10 +533,9 @@ public:
     }
 private:
     std::string* _out;
-    const HuffmanTree* _tree;
-    const HuffmanNode* _cur_node;
-    uint16_t _cur_depth;
-    bool _padding;
+    const HuffmanDecodeTable* _table;
+    uint8_t _state;
+    bool _accepted;
 };
 
 // Primitive Type Representations
@@ -499,14 +562,40 @@ inline void EncodeInteger(butil::IOBufAppender* out, uint8_t msb,
 }
 
 // Static variables
-static HuffmanTree* s_huffman_tree = NULL;
+static HuffmanDecodeTable* s_huffman_decode_table = NULL;
 static IndexTable* s_static_table = NULL;
+// Names of headers are in whatever case users set, e.g. "Authorization".
+static butil::CaseIgnoredFlatMap<HeaderIndexPolicy>* s_index_policies = NULL;
 static pthread_once_t s_create_once = PTHREAD_ONCE_INIT;
 
+// Credentials, which should not be guessed by probing the dynamic table.
+// https://tools.ietf.org/html/rfc7541#section-7.1.3
+static const char* const s_never_indexed_names[] = {
+    "authorization", "proxy-authorization", "cookie", "set-cookie",
+};
+
+// Values of these headers differ in nearly every message, indexing them just
+// evicts reusable entries from the dynamic table.
+static const char* const s_not_indexed_names[] = {
+    "content-length", "date", "expires", "last-modified", "age", "etag",
+    "if-modified-since", "if-none-match", "grpc-timeout", "grpc-message",
+    "x-bd-timeout-ms", "x-bd-trace-id", "x-bd-span-id", "x-bd-parent-span-id",
+    "log-id", "x-request-id",
+};
+
+// Values longer than this are not indexed, a few of them take up the whole
+// dynamic table(4096 bytes by default).
+static const size_t MAX_INDEXED_VALUE_SIZE = 256;
+
 static void CreateStaticTableOrDie() {
-    s_huffman_tree = new HuffmanTree;
+    HuffmanTree huffman_tree;
     for (size_t i = 0; i < ARRAY_SIZE(s_huffman_table); ++i) {
-        s_huffman_tree->AddLeafNode(i, s_huffman_table[i]);
+        huffman_tree.AddLeafNode(i, s_huffman_table[i]);
+    }
+    s_huffman_decode_table = new HuffmanDecodeTable;
+    if (s_huffman_decode_table->Init(huffman_tree) != 0) {
+        LOG(ERROR) << "Fail to init huffman decode table";
+        exit(1);
     }
     IndexTableOptions options;
     options.max_size = UINT_MAX;
@@ -519,6 +608,17 @@ static void CreateStaticTableOrDie() {
         LOG(ERROR) << "Fail to init static table";
         exit(1);
     }
+    s_index_policies = new butil::CaseIgnoredFlatMap<HeaderIndexPolicy>;
+    if (s_index_policies->init(64) != 0) {
+        LOG(ERROR) << "Fail to init index policies";
+        exit(1);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(s_never_indexed_names); ++i) {
+        (*s_index_policies)[s_never_indexed_names[i]] = HPACK_NEVER_INDEX_HEADER;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(s_not_indexed_names); ++i) {
+        (*s_index_policies)[s_not_indexed_names[i]] = HPACK_NOT_INDEX_HEADER;
+    }
 }
 
 static void CreateStaticTableOnceOrDie() {
@@ -570,40 +670,45 @@ inline ssize_t DecodeInteger(butil::IOBufBytesIterator& iter,
 template <bool LOWERCASE> // use template to remove dead branches.
 inline void EncodeString(butil::IOBufAppender* out, const std::string& s,
                          bool huffman_encoding) {
-    if (!huffman_encoding) {
-        EncodeInteger(out, 0x00, 7, s.size());
+    if (huffman_encoding) {
+        // Calculate length of encoded string
+        uint32_t bit_len = 0;
         if (LOWERCASE) {
             for (size_t i = 0; i < s.size(); ++i) {
-                out->push_back(butil::ascii_tolower(s[i]));
+                bit_len += s_huffman_table[(uint8_t)butil::ascii_tolower(s[i])].bit_len;
             }
         } else {
-            out->append(s);
-        }
-        return;
-    }
-    // Calculate length of encoded string
-    uint32_t bit_len = 0;
-    if (LOWERCASE) {
-        for (size_t i = 0; i < s.size(); ++i) {
-            bit_len += s_huffman_table[(uint8_t)butil::ascii_tolower(s[i])].bit_len;
+            for (size_t i = 0; i < s.size(); ++i) {
+                bit_len += s_huffman_table[(uint8_t)s[i]].bit_len;
+            }
         }
-    } else {
-        for (size_t i = 0; i < s.size(); ++i) {
-            bit_len += s_huffman_table[(uint8_t)s[i]].bit_len;
+        const uint32_t encoded_len = (bit_len >> 3) + !!(bit_len & 7);
+        // Strings with many symbols or non-ascii characters may be longer
+        // after encoding, send them as they are.
+        if (encoded_len <= s.size()) {
+            EncodeInteger(out, 0x80, 7, encoded_len);
+            HuffmanEncoder e(out, s_huffman_table);
+            if (LOWERCASE) {
+                for (size_t i = 0; i < s.size(); ++i) {
+                    e.Encode(butil::ascii_tolower(s[i]));
+                }
+            } else {
+                for (size_t i = 0; i < s.size(); ++i) {
+                    e.Encode(s[i]);
+                }
+            }
+            e.EndStream();
+            return;
         }
     }
-    EncodeInteger(out, 0x80, 7, (bit_len >> 3) + !!(bit_len & 7));
-    HuffmanEncoder e(out, s_huffman_table);
+    EncodeInteger(out, 0x00, 7, s.size());
     if (LOWERCASE) {
         for (size_t i = 0; i < s.size(); ++i) {
-            e.Encode(butil::ascii_tolower(s[i]));
+            out->push_back(butil::ascii_tolower(s[i]));
         }
     } else {
-        for (size_t i = 0; i < s.size(); ++i) {
-            e.Encode(s[i]);
-        }
+        out->append(s);
     }
-    e.EndStream();
 }
 
 inline ssize_t DecodeString(butil::IOBufBytesIterator& iter, std::string* out) {
@@ -625,7 +730,9 @@ inline ssize_t DecodeString(butil::IOBufBytesIterator& iter, std::string* out) {
         iter.copy_and_forward(out, length);
         return in_bytes;
     }
-    HuffmanDecoder d(out, s_huffman_tree);
+    // Every byte decodes to at most 8/5 characters.
+    out->reserve(length * 8 / 5);
+    HuffmanDecoder d(out, s_huffman_decode_table);
     for (; iter != NULL && length; ++iter, --length) {
         if (d.Decode(*iter) != 0) {
             return -1;
@@ -867,6 +974,28 @@ void HPacker::Describe(std::ostream& os, const DescribeOptions& opt) const {
     }
 }
 
+HeaderIndexPolicy HPacker::SuggestIndexPolicy(const Header& h) const {
+    const HeaderIndexPolicy* policy = s_index_policies->seek(h.name);
+    if (policy != NULL) {
+        if (*policy == HPACK_NOT_INDEX_HEADER &&
+            FindNameFromIndexTable(h.name) == 0) {
+            // Index the first one so that following ones refer to the name
+            // in the dynamic table.
+            return HPACK_INDEX_HEADER;
+        }
+        return *policy;
+    }
+    if (h.value.size() > MAX_INDEXED_VALUE_SIZE) {
+        return HPACK_NOT_INDEX_HEADER;
+    }
+    if (strcasecmp(h.name.c_str(), ":path") == 0 &&
+        h.value.find('?') != std::string::npos) {
+        // Queries are usually different.
+        return HPACK_NOT_INDEX_HEADER;
+    }
+    return HPACK_INDEX_HEADER;
+}
+
 void tolower(std::string* s) {
     const char* d = s->c_str();
     for (size_t i = 0; i < s->size(); ++i) {
@@ -51,11 +51,13 @@ struct HPackOptions {
     // Default: HPACK_INDEX_HEADER
     HeaderIndexPolicy index_policy;
 
-    // If true, the name string would be encoded with huffman encoding
+    // If true, the name string would be encoded with huffman encoding when
+    // the encoded string is shorter.
     // Default: false
     bool encode_name;
 
-    // If true, the value string would be encoded with huffman encoding
+    // If true, the value string would be encoded with huffman encoding when
+    // the encoded string is shorter.
     // Default: false
     bool encode_value;
 
@@ -120,6 +122,14 @@ public:
     // IOBufBytesIterator.
     ssize_t Decode(butil::IOBufBytesIterator& source, Header* h);
 
+    // Suggest index policy of `h' for a connection sending many requests or
+    // responses: headers repeated across messages(:path, content-type,
+    // grpc-* ...) are indexed, headers whose values vary per message
+    // (content-length, grpc-timeout ...) or are too long are not indexed to
+    // keep reusable entries in the dynamic table, and credentials are never
+    // indexed.
+    HeaderIndexPolicy SuggestIndexPolicy(const Header& h) const;
+
     void Describe(std::ostream& os, const DescribeOptions&) const;
     
 private:
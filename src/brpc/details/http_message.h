@@ -81,6 +81,10 @@ public:
     const http_parser& parser() const { return _parser; }
 
     bool read_body_progressively() const { return _read_body_progressively; }
+    // Switch to reading body progressively, must be called before
+    // SetBodyReader(). Parts of the body already read are kept in body()
+    // and fed to the reader first.
+    void set_read_body_progressively(bool v) { _read_body_progressively = v; }
 
     // Send new parts of the body to the reader. If the body already has some
     // data, feed them to the reader immediately.
@@ -60,6 +60,12 @@ int MethodStatus::Expose(const butil::StringPiece& prefix) {
     if (_latency_rec.expose(prefix) != 0) {
         return -1;
     }
+    if (_queueing_delay_rec.expose(prefix, "queueing") != 0) {
+        return -1;
+    }
+    if (_nqueueing_rejected_bvar.expose_as(prefix, "queueing_rejected") != 0) {
+        return -1;
+    }
     if (_cl) {
         if (_max_concurrency_bvar.expose_as(prefix, "max_concurrency") != 0) {
             return -1;
@@ -136,6 +142,19 @@ void MethodStatus::Describe(
     OutputValue(os, "max_latency: ", _latency_rec.max_latency_name(),
                 _latency_rec.max_latency(), options, false);
 
+    // Queueing delays
+    OutputValue(os, "queueing_delay: ", _queueing_delay_rec.latency_name(),
+                _queueing_delay_rec.latency(), options, false);
+    if (!options.use_html) {
+        OutputTextValue(os, "queueing_delay_99: ",
+                        _queueing_delay_rec.latency_percentile(0.99));
+    }
+    OutputValue(os, "max_queueing_delay: ",
+                _queueing_delay_rec.max_latency_name(),
+                _queueing_delay_rec.max_latency(), options, false);
+    OutputValue(os, "queueing_rejected: ", _nqueueing_rejected_bvar.name(),
+                _nqueueing_rejected_bvar.get_value(), options, false);
+
     // Concurrency
     OutputValue(os, "concurrency: ", _nconcurrency_bvar.name(),
                 _nconcurrency, options, false);
@@ -23,6 +23,7 @@
 #include "bvar/bvar.h"                    // vars
 #include "brpc/describable.h"
 #include "brpc/concurrency_limiter.h"
+#include "brpc/details/queueing_delay_limiter.h"
 
 
 namespace brpc {
@@ -40,6 +41,12 @@ public:
     // NULL, it's set with the rejected concurrency.
     bool OnRequested(int* rejected_cc = NULL);
 
+    // Call this function after OnRequested() with the time that the request
+    // waited in queues before the method is about to be called.
+    // Returns false when the request should be rejected for being queued for
+    // too long, see QueueingDelayLimiter for details.
+    bool OnQueued(int64_t queueing_delay_us);
+
     // Call this when the method just finished.
     // `error_code' : The error code obtained from the controller. Equal to 
     // 0 when the call is successful.
@@ -73,6 +80,9 @@ friend class Server;
     bvar::PassiveStatus<int>  _nconcurrency_bvar;
     bvar::PerSecond<bvar::Adder<int64_t>> _eps_bvar;
     bvar::PassiveStatus<int32_t> _max_concurrency_bvar;
+    QueueingDelayLimiter _queueing_delay_limiter;
+    bvar::LatencyRecorder _queueing_delay_rec;
+    bvar::Adder<int64_t> _nqueueing_rejected_bvar;
 };
 
 class ConcurrencyRemover {
@@ -100,6 +110,15 @@ inline bool MethodStatus::OnRequested(int* rejected_cc) {
     return false;
 }
 
+inline bool MethodStatus::OnQueued(int64_t queueing_delay_us) {
+    _queueing_delay_rec << queueing_delay_us;
+    if (_queueing_delay_limiter.OnRequested(queueing_delay_us)) {
+        return true;
+    }
+    _nqueueing_rejected_bvar << 1;
+    return false;
+}
+
 inline void MethodStatus::OnResponded(int error_code, int64_t latency) {
     _nconcurrency.fetch_sub(1, butil::memory_order_relaxed);
     if (0 == error_code) {
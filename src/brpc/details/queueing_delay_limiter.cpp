@@ -0,0 +1,81 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gflags/gflags.h>
+#include "butil/time.h"
+#include "brpc/reloadable_flags.h"
+#include "brpc/details/queueing_delay_limiter.h"
+
+namespace brpc {
+
+DEFINE_int32(codel_target_delay_ms, 0,
+             "Reject requests with ELIMIT when the minimum queueing delay "
+             "(from being received to the service method being called) of a "
+             "method over -codel_interval_ms exceeds this value. Requests "
+             "queued for more than twice of the value are rejected in the "
+             "overloaded state. <= 0 disables the rejection");
+BRPC_VALIDATE_GFLAG(codel_target_delay_ms, PassValidate);
+
+DEFINE_int32(codel_interval_ms, 100,
+             "Interval for checking the minimum queueing delay of a method");
+BRPC_VALIDATE_GFLAG(codel_interval_ms, PositiveInteger);
+
+QueueingDelayLimiter::QueueingDelayLimiter()
+    : _interval_end_us(0)
+    , _min_delay_us(0)
+    , _reset_min_delay(false)
+    , _overloaded(false) {
+}
+
+bool QueueingDelayLimiter::OnRequested(int64_t queueing_delay_us) {
+    const int64_t target_us = FLAGS_codel_target_delay_ms * 1000L;
+    if (target_us <= 0) {
+        _overloaded.store(false, butil::memory_order_relaxed);
+        return true;
+    }
+    const int64_t now_us = butil::cpuwide_time_us();
+    // Only one thread ends the interval, testing before exchanging is more
+    // cacheline-friendly.
+    if (now_us > _interval_end_us.load(butil::memory_order_relaxed) &&
+        !_reset_min_delay.load(butil::memory_order_acquire) &&
+        !_reset_min_delay.exchange(true, butil::memory_order_acquire)) {
+        _interval_end_us.store(now_us + FLAGS_codel_interval_ms * 1000L,
+                               butil::memory_order_relaxed);
+        _overloaded.store(
+            _min_delay_us.load(butil::memory_order_relaxed) > target_us,
+            butil::memory_order_relaxed);
+    }
+    if (_reset_min_delay.load(butil::memory_order_acquire) &&
+        _reset_min_delay.exchange(false, butil::memory_order_release)) {
+        // First request of the interval, never rejected so that more than
+        // one request are needed to reject requests.
+        _min_delay_us.store(queueing_delay_us, butil::memory_order_relaxed);
+        return true;
+    }
+    // Races between the load and the store are benign, the minimum is just
+    // a bit inaccurate.
+    if (queueing_delay_us < _min_delay_us.load(butil::memory_order_relaxed)) {
+        _min_delay_us.store(queueing_delay_us, butil::memory_order_relaxed);
+    }
+    // Different from CoDel which drops more and more frequently, requests
+    // waited for too long are rejected all in the overloaded state.
+    return !(_overloaded.load(butil::memory_order_relaxed) &&
+             queueing_delay_us > 2 * target_us);
+}
+
+} // namespace brpc
@@ -0,0 +1,61 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef  BRPC_QUEUEING_DELAY_LIMITER_H
+#define  BRPC_QUEUEING_DELAY_LIMITER_H
+
+#include <stdint.h>
+#include "butil/macros.h"                  // DISALLOW_COPY_AND_ASSIGN
+#include "butil/atomicops.h"
+
+
+namespace brpc {
+
+// CoDel-like admission control based on queueing delays of requests, namely
+// the time between a request being cut from the connection and the service
+// method being about to be called. When the minimum queueing delay over an
+// interval(-codel_interval_ms) exceeds the target(-codel_target_delay_ms),
+// the method is regarded as overloaded and requests queued for more than
+// twice of the target are rejected until the minimum queueing delay of an
+// interval drops below the target again. Rejecting requests with long delays
+// instead of the ones just arrived keeps the standing queue short.
+class QueueingDelayLimiter {
+public:
+    QueueingDelayLimiter();
+
+    // Call this function when the method is about to be called.
+    // Returns false when the request should be rejected.
+    bool OnRequested(int64_t queueing_delay_us);
+
+    // True if the minimum queueing delay over last interval exceeded the
+    // target.
+    bool overloaded() const
+    { return _overloaded.load(butil::memory_order_relaxed); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(QueueingDelayLimiter);
+
+    butil::atomic<int64_t> _interval_end_us;
+    butil::atomic<int64_t> _min_delay_us;
+    butil::atomic<bool> _reset_min_delay;
+    butil::atomic<bool> _overloaded;
+};
+
+} // namespace brpc
+
+#endif  //BRPC_QUEUEING_DELAY_LIMITER_H
@@ -0,0 +1,129 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <pthread.h>
+#include "butil/logging.h"
+#include "butil/synchronization/lock.h"
+#include "butil/containers/flat_map.h"
+#include "bthread/bthread.h"
+#include "brpc/errno.pb.h"
+#include "brpc/controller.h"
+#include "brpc/details/server_call_map.h"
+
+
+namespace brpc {
+
+namespace {
+
+struct CallKey {
+    SocketId socket_id;
+    uint64_t key;
+    bool operator==(const CallKey& rhs) const
+    { return socket_id == rhs.socket_id && key == rhs.key; }
+};
+
+struct CallKeyHasher {
+    size_t operator()(const CallKey& k) const {
+        return (k.socket_id * 0x9E3779B97F4A7C15ULL) ^ k.key;
+    }
+};
+
+struct CallEntry {
+    Controller* cntl;
+    bthread_id_t cancel_id;
+};
+
+// Shard the map to reduce contention between RPCs.
+const size_t NSHARD = 64;
+
+struct CallShard {
+    butil::Mutex mutex;
+    butil::FlatMap<CallKey, CallEntry, CallKeyHasher> map;
+} BAIDU_CACHELINE_ALIGNMENT;
+
+static CallShard* g_shards = NULL;
+static pthread_once_t g_shards_once = PTHREAD_ONCE_INIT;
+
+static void InitShards() {
+    g_shards = new CallShard[NSHARD];
+    for (size_t i = 0; i < NSHARD; ++i) {
+        CHECK_EQ(0, g_shards[i].map.init(256));
+    }
+}
+
+inline CallShard& GetShard(const CallKey& k) {
+    pthread_once(&g_shards_once, InitShards);
+    return g_shards[CallKeyHasher()(k) % NSHARD];
+}
+
+}  // namespace
+
+int ServerCallMap::Insert(SocketId socket_id, uint64_t key, Controller* cntl) {
+    const CallKey k = { socket_id, key };
+    const CallEntry e = { cntl, INVALID_BTHREAD_ID };
+    CallShard& shard = GetShard(k);
+    BAIDU_SCOPED_LOCK(shard.mutex);
+    return shard.map.insert(k, e) ? 0 : -1;
+}
+
+void ServerCallMap::Remove(SocketId socket_id, uint64_t key) {
+    const CallKey k = { socket_id, key };
+    CallShard& shard = GetShard(k);
+    BAIDU_SCOPED_LOCK(shard.mutex);
+    shard.map.erase(k);
+}
+
+bool ServerCallMap::Cancel(SocketId socket_id, uint64_t key) {
+    const CallKey k = { socket_id, key };
+    CallShard& shard = GetShard(k);
+    bthread_id_t cancel_id = INVALID_BTHREAD_ID;
+    {
+        BAIDU_SCOPED_LOCK(shard.mutex);
+        CallEntry* e = shard.map.seek(k);
+        if (e == NULL) {
+            return false;
+        }
+        e->cntl->_canceled_by_client.store(true, butil::memory_order_release);
+        cancel_id = e->cancel_id;
+    }
+    // Signal outside the lock which runs the callback in a new bthread.
+    // The id may be destroyed by the controller right now, which is fine
+    // since bthread_id_t is versioned.
+    if (cancel_id != INVALID_BTHREAD_ID) {
+        bthread_id_error(cancel_id, ECANCELED);
+    }
+    return true;
+}
+
+int ServerCallMap::SetCancelId(SocketId socket_id, uint64_t key,
+                               bthread_id_t id) {
+    const CallKey k = { socket_id, key };
+    CallShard& shard = GetShard(k);
+    BAIDU_SCOPED_LOCK(shard.mutex);
+    CallEntry* e = shard.map.seek(k);
+    if (e == NULL) {
+        return 0;
+    }
+    if (e->cntl->_canceled_by_client.load(butil::memory_order_relaxed)) {
+        return -1;
+    }
+    e->cancel_id = id;
+    return 0;
+}
+
+} // namespace brpc
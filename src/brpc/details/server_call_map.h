@@ -0,0 +1,55 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_SERVER_CALL_MAP_H
+#define BRPC_SERVER_CALL_MAP_H
+
+#include <stdint.h>
+#include "bthread/types.h"                     // bthread_id_t
+#include "brpc/socket_id.h"                    // SocketId
+
+
+namespace brpc {
+
+class Controller;
+
+// Maps server-side RPCs being processed to their controllers by the
+// connection and the id of the request(correlation_id in baidu_std, stream_id
+// in h2), so that cancellations sent by clients can be delivered.
+// Cancellations arriving before Insert() or after Remove() are ignored.
+class ServerCallMap {
+public:
+    // Make `cntl' cancelable by Cancel(socket_id, key) until Remove() is
+    // called, which must be done before destruction of `cntl'.
+    // Returns 0 on success, -1 otherwise.
+    static int Insert(SocketId socket_id, uint64_t key, Controller* cntl);
+    static void Remove(SocketId socket_id, uint64_t key);
+
+    // Mark the RPC as canceled and signal the id set by SetCancelId().
+    // Returns true if the RPC is found.
+    static bool Cancel(SocketId socket_id, uint64_t key);
+
+    // Signal `id' with ECANCELED when the RPC is canceled.
+    // Returns -1 if the RPC was canceled already, 0 otherwise.
+    static int SetCancelId(SocketId socket_id, uint64_t key, bthread_id_t id);
+};
+
+} // namespace brpc
+
+
+#endif // BRPC_SERVER_CALL_MAP_H
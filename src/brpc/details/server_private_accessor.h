@@ -100,6 +100,10 @@ public:
     RestfulMap* global_restful_map() const
     { return _server->_global_restful_map; }
 
+    // True if any method reads http requests progressively.
+    bool has_progressive_read_method() const
+    { return _server->_progressive_read_method_count > 0; }
+
 private:
     const Server* _server;
 };
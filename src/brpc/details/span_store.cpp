@@ -0,0 +1,632 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <inttypes.h>
+#include <algorithm>
+#include <map>
+#include "butil/logging.h"
+#include "butil/file_util.h"
+#include "butil/string_printf.h"
+#include "butil/time.h"
+#include "butil/third_party/snappy/snappy.h"
+#include "brpc/span.h"                         // SpanFilter
+#include "brpc/details/span_store.h"
+
+namespace brpc {
+
+namespace {
+
+// A segment is sealed when any of following limits is reached.
+const uint32_t SEGMENT_MAX_SPANS = 8192;
+const size_t SEGMENT_MAX_PAYLOAD = 4 * 1024 * 1024;
+const int64_t SEGMENT_MAX_AGE_US = 10000000L/*10s*/;
+// Max number of decoded segments cached for queries.
+const size_t MAX_CACHED_SEGMENTS = 4;
+
+const char SEGMENT_MAGIC[8] = { 'R', 'P', 'C', 'Z', 'S', 'E', 'G', '1' };
+
+void AppendVarint(std::string* out, uint64_t v) {
+    while (v >= 0x80) {
+        out->push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out->push_back((char)v);
+}
+
+bool ReadVarint(const char** p, const char* end, uint64_t* v) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        const uint8_t b = (uint8_t)*(*p)++;
+        result |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline uint64_t ZigZag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+void AppendFixed64(std::string* out, uint64_t v) {
+    out->append((const char*)&v, sizeof(v));
+}
+
+void AppendFixed32(std::string* out, uint32_t v) {
+    out->append((const char*)&v, sizeof(v));
+}
+
+// Fingerprints of trace ids to skip segments in FindSpan(s).
+inline uint32_t TraceFingerprint(uint64_t trace_id) {
+    return (uint32_t)(trace_id ^ (trace_id >> 32));
+}
+
+// A row of BriefSpan decoded from columns.
+struct BriefRow {
+    int64_t start_us;
+    int64_t latency_us;
+    uint64_t trace_id;
+    uint64_t span_id;
+    uint64_t log_id;
+    int32_t type;
+    int32_t error_code;
+    int32_t request_size;
+    int32_t response_size;
+    uint32_t method;
+};
+
+struct LaterRow {
+    explicit LaterRow(const std::vector<BriefRow>& rows) : _rows(rows) {}
+    bool operator()(uint32_t i1, uint32_t i2) const {
+        return _rows[i1].start_us > _rows[i2].start_us;
+    }
+    const std::vector<BriefRow>& _rows;
+};
+
+} // namespace
+
+// Spans of the segment being appended. Values except ids are
+// varint-encoded, start times are delta-encoded. Columns make values of
+// the same field adjacent, which compress much better than protobufs.
+struct SpanStore::Columns {
+    uint32_t count;
+    int64_t created_us;
+    int64_t last_start_us;
+    int64_t min_start_us;
+    int64_t max_start_us;
+    std::string start_us;
+    std::string latency_us;
+    std::string ids;            // fixed64 trace_id and span_id
+    std::string log_id;
+    std::string type;
+    std::string error_code;
+    std::string request_size;
+    std::string response_size;
+    std::string method;         // index into `methods'
+    std::vector<std::string> methods;
+    std::map<std::string, uint32_t> method_index;
+    // varint length + serialized RpczSpan for each span.
+    std::string payload;
+    std::vector<uint32_t> trace_fps;
+
+    Columns()
+        : count(0)
+        , created_us(butil::gettimeofday_us())
+        , last_start_us(0)
+        , min_start_us(INT64_MAX)
+        , max_start_us(INT64_MIN) {}
+
+    std::string* columns(size_t i) {
+        std::string* cols[] = { &start_us, &latency_us, &ids, &log_id, &type,
+                                &error_code, &request_size, &response_size,
+                                &method };
+        return i < arraysize(cols) ? cols[i] : NULL;
+    }
+
+    // Serialize columns of BriefSpan.
+    void SerializeBriefs(std::string* out) {
+        out->clear();
+        AppendVarint(out, count);
+        for (size_t i = 0; columns(i) != NULL; ++i) {
+            AppendVarint(out, columns(i)->size());
+            out->append(*columns(i));
+        }
+        AppendVarint(out, methods.size());
+        for (size_t i = 0; i < methods.size(); ++i) {
+            AppendVarint(out, methods[i].size());
+            out->append(methods[i]);
+        }
+    }
+};
+
+// A sealed segment, only its indexes are kept in memory.
+struct SpanStore::Segment {
+    uint64_t id;
+    std::string path;
+    uint32_t count;
+    int64_t min_start_us;
+    int64_t max_start_us;
+    uint32_t brief_size;        // compressed
+    uint32_t payload_size;      // compressed
+    size_t raw_size;
+    std::vector<uint32_t> trace_fps;   // sorted
+};
+
+struct SpanStore::DecodedSegment {
+    uint64_t id;
+    std::vector<BriefRow> rows;
+    std::vector<std::string> methods;
+    bool has_payload;
+    std::string payload;
+    // Offset and length of each row in `payload'.
+    std::vector<std::pair<uint32_t, uint32_t> > records;
+
+    DecodedSegment() : id(0), has_payload(false) {}
+
+    bool ParseBriefs(const butil::StringPiece& data) {
+        const char* p = data.data();
+        const char* const end = data.data() + data.size();
+        uint64_t count = 0;
+        if (!ReadVarint(&p, end, &count)) {
+            return false;
+        }
+        butil::StringPiece cols[9];
+        for (size_t i = 0; i < arraysize(cols); ++i) {
+            uint64_t len = 0;
+            if (!ReadVarint(&p, end, &len) || len > (uint64_t)(end - p)) {
+                return false;
+            }
+            cols[i].set(p, len);
+            p += len;
+        }
+        uint64_t nmethod = 0;
+        if (!ReadVarint(&p, end, &nmethod)) {
+            return false;
+        }
+        methods.resize(nmethod);
+        for (size_t i = 0; i < nmethod; ++i) {
+            uint64_t len = 0;
+            if (!ReadVarint(&p, end, &len) || len > (uint64_t)(end - p)) {
+                return false;
+            }
+            methods[i].assign(p, len);
+            p += len;
+        }
+        if (cols[2].size() != count * 16) {
+            return false;
+        }
+        rows.resize(count);
+        const char* ptrs[9];
+        for (size_t i = 0; i < arraysize(cols); ++i) {
+            ptrs[i] = cols[i].data();
+        }
+        int64_t last_start_us = 0;
+        for (size_t r = 0; r < count; ++r) {
+            BriefRow& row = rows[r];
+            uint64_t v[9];
+            for (size_t i = 0; i < arraysize(cols); ++i) {
+                if (i == 2) {
+                    continue;
+                }
+                if (!ReadVarint(&ptrs[i], cols[i].data() + cols[i].size(), &v[i])) {
+                    return false;
+                }
+            }
+            last_start_us += UnZigZag(v[0]);
+            row.start_us = last_start_us;
+            row.latency_us = UnZigZag(v[1]);
+            memcpy(&row.trace_id, ptrs[2], 8);
+            memcpy(&row.span_id, ptrs[2] + 8, 8);
+            ptrs[2] += 16;
+            row.log_id = v[3];
+            row.type = (int32_t)v[4];
+            row.error_code = (int32_t)UnZigZag(v[5]);
+            row.request_size = (int32_t)UnZigZag(v[6]);
+            row.response_size = (int32_t)UnZigZag(v[7]);
+            row.method = (uint32_t)v[8];
+            if (row.method >= methods.size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool ParsePayload() {
+        records.clear();
+        records.reserve(rows.size());
+        const char* p = payload.data();
+        const char* const end = payload.data() + payload.size();
+        while (p < end) {
+            uint64_t len = 0;
+            if (!ReadVarint(&p, end, &len) || len > (uint64_t)(end - p)) {
+                return false;
+            }
+            records.push_back(std::make_pair((uint32_t)(p - payload.data()),
+                                             (uint32_t)len));
+            p += len;
+        }
+        has_payload = true;
+        return records.size() == rows.size();
+    }
+
+    void ToBrief(size_t i, BriefSpan* brief) const {
+        const BriefRow& row = rows[i];
+        brief->set_trace_id(row.trace_id);
+        brief->set_span_id(row.span_id);
+        brief->set_log_id(row.log_id);
+        brief->set_type((SpanType)row.type);
+        brief->set_error_code(row.error_code);
+        brief->set_request_size(row.request_size);
+        brief->set_response_size(row.response_size);
+        brief->set_start_real_us(row.start_us);
+        brief->set_latency_us(row.latency_us);
+        brief->set_full_method_name(methods[row.method]);
+    }
+
+    bool ToSpan(size_t i, RpczSpan* span) const {
+        return has_payload && i < records.size() &&
+            span->ParseFromArray(payload.data() + records[i].first,
+                                 records[i].second);
+    }
+};
+
+SpanStore::SpanStore(const std::string& dir, bool keep_files)
+    : _dir(dir)
+    , _keep_files(keep_files)
+    , _active(new Columns)
+    , _next_segment_id(0) {}
+
+SpanStore::~SpanStore() {
+    if (_keep_files) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        SealLocked();
+    } else {
+        butil::DeleteFile(butil::FilePath(_dir), true);
+    }
+}
+
+SpanStore* SpanStore::Open(const std::string& dir, bool keep_files) {
+    butil::File::Error error;
+    if (!butil::CreateDirectoryAndGetError(butil::FilePath(dir), &error)) {
+        LOG(ERROR) << "Fail to create directory=`" << dir << "', " << error;
+        return NULL;
+    }
+    SpanStore* store = new (std::nothrow) SpanStore(dir, keep_files);
+    if (store != NULL) {
+        LOG(INFO) << "Opened span store in " << dir;
+    }
+    return store;
+}
+
+int SpanStore::Append(const BriefSpan& brief, const RpczSpan& span) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    Columns& c = *_active;
+    const int64_t start_us = brief.start_real_us();
+    AppendVarint(&c.start_us, ZigZag(start_us - c.last_start_us));
+    c.last_start_us = start_us;
+    c.min_start_us = std::min(c.min_start_us, start_us);
+    c.max_start_us = std::max(c.max_start_us, start_us);
+    AppendVarint(&c.latency_us, ZigZag(brief.latency_us()));
+    AppendFixed64(&c.ids, brief.trace_id());
+    AppendFixed64(&c.ids, brief.span_id());
+    AppendVarint(&c.log_id, brief.log_id());
+    AppendVarint(&c.type, brief.type());
+    AppendVarint(&c.error_code, ZigZag(brief.error_code()));
+    AppendVarint(&c.request_size, ZigZag(brief.request_size()));
+    AppendVarint(&c.response_size, ZigZag(brief.response_size()));
+    std::map<std::string, uint32_t>::iterator it =
+        c.method_index.find(brief.full_method_name());
+    if (it == c.method_index.end()) {
+        it = c.method_index.insert(std::make_pair(
+                brief.full_method_name(), (uint32_t)c.methods.size())).first;
+        c.methods.push_back(brief.full_method_name());
+    }
+    AppendVarint(&c.method, it->second);
+    const size_t size = span.ByteSizeLong();
+    AppendVarint(&c.payload, size);
+    const size_t offset = c.payload.size();
+    c.payload.resize(offset + size);
+    span.SerializeWithCachedSizesToArray((uint8_t*)&c.payload[offset]);
+    c.trace_fps.push_back(TraceFingerprint(brief.trace_id()));
+    ++c.count;
+    if (c.count >= SEGMENT_MAX_SPANS ||
+        c.payload.size() >= SEGMENT_MAX_PAYLOAD ||
+        butil::gettimeofday_us() - c.created_us >= SEGMENT_MAX_AGE_US) {
+        return SealLocked();
+    }
+    return 0;
+}
+
+int SpanStore::Flush() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return SealLocked();
+}
+
+int SpanStore::SealLocked() {
+    std::unique_ptr<Columns> c(new Columns);
+    c.swap(_active);
+    if (c->count == 0) {
+        return 0;
+    }
+    std::string briefs;
+    c->SerializeBriefs(&briefs);
+    std::string data(SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    std::string compressed_briefs;
+    butil::snappy::Compress(briefs.data(), briefs.size(), &compressed_briefs);
+    std::string compressed_payload;
+    butil::snappy::Compress(c->payload.data(), c->payload.size(),
+                            &compressed_payload);
+    AppendFixed32(&data, compressed_briefs.size());
+    AppendFixed32(&data, compressed_payload.size());
+    data.append(compressed_briefs);
+    data.append(compressed_payload);
+
+    std::shared_ptr<Segment> seg(new Segment);
+    seg->id = _next_segment_id++;
+    seg->path = butil::string_printf("%s/%06" PRIu64 ".seg",
+                                     _dir.c_str(), seg->id);
+    seg->count = c->count;
+    seg->min_start_us = c->min_start_us;
+    seg->max_start_us = c->max_start_us;
+    seg->brief_size = compressed_briefs.size();
+    seg->payload_size = compressed_payload.size();
+    seg->raw_size = briefs.size() + c->payload.size();
+    seg->trace_fps.swap(c->trace_fps);
+    std::sort(seg->trace_fps.begin(), seg->trace_fps.end());
+    seg->trace_fps.erase(std::unique(seg->trace_fps.begin(), seg->trace_fps.end()),
+                         seg->trace_fps.end());
+    // Writing a file of several megabytes takes a few milliseconds, which
+    // is fine for the thread collecting spans.
+    if (butil::WriteFile(butil::FilePath(seg->path), data.data(), data.size())
+        != (int)data.size()) {
+        PLOG(ERROR) << "Fail to write " << seg->path << ", "
+                    << seg->count << " spans are dropped";
+        return -1;
+    }
+    _segments.push_back(seg);
+    return 0;
+}
+
+void SpanStore::RemoveSpansBefore(int64_t realtime_us) {
+    std::vector<std::string> paths;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        while (!_segments.empty() &&
+               _segments.front()->max_start_us < realtime_us) {
+            paths.push_back(_segments.front()->path);
+            _segments.pop_front();
+        }
+    }
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!butil::DeleteFile(butil::FilePath(paths[i]), false)) {
+            LOG(WARNING) << "Fail to remove " << paths[i];
+        }
+    }
+}
+
+std::shared_ptr<SpanStore::DecodedSegment> SpanStore::Load(
+    const std::shared_ptr<Segment>& seg, bool with_payload) {
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        for (size_t i = 0; i < _cache.size(); ++i) {
+            if (_cache[i]->id == seg->id &&
+                (_cache[i]->has_payload || !with_payload)) {
+                return _cache[i];
+            }
+        }
+    }
+    std::shared_ptr<DecodedSegment> d(new DecodedSegment);
+    d->id = seg->id;
+    std::string data;
+    if (!butil::ReadFileToString(butil::FilePath(seg->path), &data)) {
+        // Probably removed.
+        return NULL;
+    }
+    const size_t header_size = sizeof(SEGMENT_MAGIC) + 8;
+    if (data.size() != header_size + seg->brief_size + seg->payload_size ||
+        memcmp(data.data(), SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0) {
+        LOG(ERROR) << "Corrupted segment " << seg->path;
+        return NULL;
+    }
+    std::string briefs;
+    if (!butil::snappy::Uncompress(data.data() + header_size, seg->brief_size,
+                                   &briefs) ||
+        !d->ParseBriefs(briefs) || d->rows.size() != seg->count) {
+        LOG(ERROR) << "Fail to parse briefs of segment " << seg->path;
+        return NULL;
+    }
+    if (with_payload) {
+        if (!butil::snappy::Uncompress(
+                data.data() + header_size + seg->brief_size,
+                seg->payload_size, &d->payload) || !d->ParsePayload()) {
+            LOG(ERROR) << "Fail to parse payload of segment " << seg->path;
+            return NULL;
+        }
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    for (size_t i = 0; i < _cache.size(); ++i) {
+        if (_cache[i]->id == d->id) {
+            _cache.erase(_cache.begin() + i);
+            break;
+        }
+    }
+    _cache.push_back(d);
+    if (_cache.size() > MAX_CACHED_SEGMENTS) {
+        _cache.pop_front();
+    }
+    return d;
+}
+
+int SpanStore::FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* span) {
+    std::deque<RpczSpan> spans;
+    FindSpans(trace_id, &spans);
+    for (size_t i = 0; i < spans.size(); ++i) {
+        if (spans[i].span_id() == span_id) {
+            span->Swap(&spans[i]);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+struct SmallerSpanId {
+    bool operator()(const RpczSpan& s1, const RpczSpan& s2) const {
+        return s1.span_id() < s2.span_id();
+    }
+};
+
+void SpanStore::FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out) {
+    out->clear();
+    const uint32_t fp = TraceFingerprint(trace_id);
+    std::vector<std::shared_ptr<Segment> > segments;
+    DecodedSegment active;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        for (size_t i = 0; i < _segments.size(); ++i) {
+            if (std::binary_search(_segments[i]->trace_fps.begin(),
+                                   _segments[i]->trace_fps.end(), fp)) {
+                segments.push_back(_segments[i]);
+            }
+        }
+        if (std::find(_active->trace_fps.begin(), _active->trace_fps.end(), fp)
+            != _active->trace_fps.end()) {
+            std::string briefs;
+            _active->SerializeBriefs(&briefs);
+            active.ParseBriefs(briefs);
+            active.payload = _active->payload;
+            active.ParsePayload();
+        }
+    }
+    for (size_t i = 0; i < active.rows.size(); ++i) {
+        if (active.rows[i].trace_id == trace_id) {
+            out->push_back(RpczSpan());
+            if (!active.ToSpan(i, &out->back())) {
+                out->pop_back();
+            }
+        }
+    }
+    for (size_t i = 0; i < segments.size(); ++i) {
+        std::shared_ptr<DecodedSegment> d = Load(segments[i], true);
+        if (d == NULL) {
+            continue;
+        }
+        for (size_t j = 0; j < d->rows.size(); ++j) {
+            if (d->rows[j].trace_id == trace_id) {
+                out->push_back(RpczSpan());
+                if (!d->ToSpan(j, &out->back())) {
+                    out->pop_back();
+                }
+            }
+        }
+    }
+    std::sort(out->begin(), out->end(), SmallerSpanId());
+}
+
+void SpanStore::ListSpans(int64_t before_this_time, size_t max_scan,
+                          std::deque<BriefSpan>* out, SpanFilter* filter) {
+    out->clear();
+    std::vector<std::shared_ptr<Segment> > segments;
+    std::shared_ptr<DecodedSegment> active(new DecodedSegment);
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        // From the latest to the earliest.
+        for (size_t i = _segments.size(); i > 0; --i) {
+            if (_segments[i - 1]->min_start_us <= before_this_time) {
+                segments.push_back(_segments[i - 1]);
+            }
+        }
+        if (_active->count != 0 && _active->min_start_us <= before_this_time) {
+            std::string briefs;
+            _active->SerializeBriefs(&briefs);
+            active->ParseBriefs(briefs);
+        }
+    }
+    size_t nscan = 0;
+    std::vector<uint32_t> order;
+    BriefSpan brief;
+    for (size_t i = 0; i <= segments.size() && nscan < max_scan; ++i) {
+        std::shared_ptr<DecodedSegment> d =
+            (i == 0 ? active : Load(segments[i - 1], false));
+        if (d == NULL) {
+            continue;
+        }
+        order.clear();
+        for (size_t j = 0; j < d->rows.size(); ++j) {
+            if (d->rows[j].start_us <= before_this_time) {
+                order.push_back(j);
+            }
+        }
+        std::sort(order.begin(), order.end(), LaterRow(d->rows));
+        for (size_t j = 0; j < order.size() && nscan < max_scan; ++j) {
+            brief.Clear();
+            d->ToBrief(order[j], &brief);
+            if (NULL == filter || filter->Keep(brief)) {
+                out->push_back(brief);
+            }
+            // Count spans no matter the filter passed or not to avoid
+            // scanning too many spans.
+            ++nscan;
+        }
+    }
+}
+
+void SpanStore::Describe(std::ostream& os) {
+    size_t nsegment = 0;
+    int64_t nspan = 0;
+    int64_t raw_size = 0;
+    int64_t compressed_size = 0;
+    int64_t min_start_us = 0;
+    uint32_t nactive = 0;
+    size_t active_size = 0;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        nsegment = _segments.size();
+        for (size_t i = 0; i < _segments.size(); ++i) {
+            const Segment& seg = *_segments[i];
+            nspan += seg.count;
+            raw_size += seg.raw_size;
+            compressed_size += seg.brief_size + seg.payload_size;
+        }
+        if (!_segments.empty()) {
+            min_start_us = _segments.front()->min_start_us;
+        }
+        nactive = _active->count;
+        active_size = _active->payload.size();
+    }
+    os << "[ " << _dir << " ]\n"
+       << "segments: " << nsegment << '\n'
+       << "sealed_spans: " << nspan << '\n'
+       << "sealed_bytes: " << raw_size << '\n'
+       << "compressed_bytes: " << compressed_size;
+    if (compressed_size > 0) {
+        os << butil::string_printf(" (%.1fx)", (double)raw_size / compressed_size);
+    }
+    os << "\nactive_spans: " << nactive << '\n'
+       << "active_payload_bytes: " << active_size << '\n';
+    if (min_start_us > 0) {
+        os << "earliest_span_us: " << min_start_us << '\n';
+    }
+}
+
+} // namespace brpc
@@ -0,0 +1,107 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_SPAN_STORE_H
+#define BRPC_DETAILS_SPAN_STORE_H
+
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "butil/synchronization/lock.h"
+#include "brpc/shared_object.h"
+#include "brpc/span.pb.h"
+
+namespace brpc {
+
+class SpanFilter;
+
+// Storage of spans collected by rpcz.
+// Spans are appended into an in-memory segment in columns. When the
+// segment is full or old enough, columns of BriefSpan and serialized
+// RpczSpan are compressed separately and written into a new file with
+// one sequential write, so that storing a span costs neither random disk
+// writes nor compactions. Time ranges and trace ids of segments are kept
+// in memory to skip irrelevant segments in queries, and old spans are
+// removed by deleting whole files.
+// Spans should be appended by one thread, queries can be run concurrently.
+class SpanStore : public SharedObject {
+public:
+    // Create a store putting files in `dir', which is removed when the
+    // store is destroyed unless `keep_files' is true.
+    // Returns NULL on error.
+    static SpanStore* Open(const std::string& dir, bool keep_files);
+
+    // Append a span. `brief' and `span' should describe the same span.
+    // Returns 0 on success, -1 if the segment being sealed was dropped
+    // because of failed writes.
+    int Append(const BriefSpan& brief, const RpczSpan& span);
+
+    // Seal the in-memory segment if it's not empty.
+    int Flush();
+
+    // Remove segments whose spans all started before `realtime_us'.
+    void RemoveSpansBefore(int64_t realtime_us);
+
+    // Find a span by its trace_id and span_id.
+    // Returns 0 on found, -1 otherwise.
+    int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* span);
+
+    // Find spans by their trace_id, ordered by span_id.
+    void FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out);
+
+    // Put at most `max_scan' spans started before `before_this_time' into
+    // `out' from the latest to the earliest. If filter is not NULL, only
+    // push spans that make SpanFilter::Keep() true.
+    void ListSpans(int64_t before_this_time, size_t max_scan,
+                   std::deque<BriefSpan>* out, SpanFilter* filter);
+
+    void Describe(std::ostream& os);
+
+    const std::string& dir() const { return _dir; }
+
+private:
+    struct Columns;
+    struct Segment;
+    struct DecodedSegment;
+
+    SpanStore(const std::string& dir, bool keep_files);
+    ~SpanStore();
+    DISALLOW_COPY_AND_ASSIGN(SpanStore);
+
+    // Called with _mutex held.
+    int SealLocked();
+    std::shared_ptr<DecodedSegment> Load(
+        const std::shared_ptr<Segment>& seg, bool with_payload);
+
+    const std::string _dir;
+    const bool _keep_files;
+
+    butil::Mutex _mutex;
+    std::unique_ptr<Columns> _active;
+    std::deque<std::shared_ptr<Segment> > _segments;
+    uint64_t _next_segment_id;
+    // Recently decoded segments, the latest at back.
+    std::deque<std::shared_ptr<DecodedSegment> > _cache;
+};
+
+} // namespace brpc
+
+#endif // BRPC_DETAILS_SPAN_STORE_H
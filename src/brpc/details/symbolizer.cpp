@@ -0,0 +1,330 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <inttypes.h>
+#include <fcntl.h>                                  // open
+#include <sys/mman.h>                               // mmap
+#include <sys/stat.h>                               // fstat
+#include <algorithm>
+#include "butil/build_config.h"
+#if defined(OS_LINUX)
+#include <elf.h>
+#include <link.h>                                   // ElfW
+#else
+#include <dlfcn.h>                                  // dladdr
+#endif
+#include "butil/logging.h"
+#include "butil/file_util.h"                        // ReadFileToString
+#include "butil/fd_guard.h"                         // fd_guard
+#include "butil/third_party/symbolize/demangle.h"   // google::Demangle
+#include "brpc/log.h"
+#include "brpc/details/symbolizer.h"
+
+namespace brpc {
+
+struct Symbolizer::ObjectFile {
+    // A loadable segment, to convert file offsets to virtual addresses.
+    struct Segment {
+        uint64_t offset;
+        uint64_t filesz;
+        uint64_t vaddr;
+    };
+    struct Symbol {
+        uint64_t addr;
+        uint64_t size;
+        size_t name;    // offset in `names'
+        bool operator<(const Symbol& rhs) const { return addr < rhs.addr; }
+    };
+    std::vector<Segment> segments;
+    std::vector<Symbol> symbols;
+    std::string names;
+};
+
+Symbolizer::Symbolizer() : _mappings_set(false) {
+    CHECK_EQ(0, _cache.init(1024));
+}
+
+Symbolizer::~Symbolizer() {
+    for (std::map<std::string, ObjectFile*>::iterator
+             it = _objects.begin(); it != _objects.end(); ++it) {
+        delete it->second;
+    }
+    _objects.clear();
+}
+
+void Symbolizer::ParseMappings(const butil::StringPiece& maps,
+                               std::vector<Mapping>* out) {
+    out->clear();
+    size_t pos = 0;
+    while (pos < maps.size()) {
+        size_t eol = maps.find('\n', pos);
+        if (eol == butil::StringPiece::npos) {
+            eol = maps.size();
+        }
+        const std::string line = maps.substr(pos, eol - pos).as_string();
+        pos = eol + 1;
+        // start-end perms offset dev inode [path]
+        unsigned long long start = 0;
+        unsigned long long end = 0;
+        unsigned long long offset = 0;
+        char perms[8];
+        int path_pos = 0;
+        if (sscanf(line.c_str(), "%llx-%llx %7s %llx %*s %*s %n",
+                   &start, &end, perms, &offset, &path_pos) < 4 ||
+            path_pos <= 0) {
+            continue;
+        }
+        // Only code is interesting to profiles.
+        if (strchr(perms, 'x') == NULL) {
+            continue;
+        }
+        Mapping m;
+        m.start = start;
+        m.end = end;
+        m.offset = offset;
+        m.path.assign(line, path_pos, std::string::npos);
+        out->push_back(m);
+    }
+    std::sort(out->begin(), out->end(),
+              [](const Mapping& a, const Mapping& b) {
+                  return a.start < b.start;
+              });
+}
+
+void Symbolizer::SetMappings(const butil::StringPiece& maps) {
+    ParseMappings(maps, &_mappings);
+    _mappings_set = !_mappings.empty();
+    _cache.clear();
+}
+
+const Symbolizer::Mapping* Symbolizer::FindMapping(uint64_t addr) const {
+    size_t lo = 0;
+    size_t hi = _mappings.size();
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (_mappings[mid].end <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < _mappings.size() && _mappings[lo].start <= addr) {
+        return &_mappings[lo];
+    }
+    return NULL;
+}
+
+#if defined(OS_LINUX)
+
+#ifndef STT_GNU_IFUNC
+#define STT_GNU_IFUNC 10
+#endif
+
+template <typename T>
+static const T* ElfAt(const char* base, size_t size, uint64_t off) {
+    if (off > size || size - off < sizeof(T)) {
+        return NULL;
+    }
+    return reinterpret_cast<const T*>(base + off);
+}
+
+bool Symbolizer::ParseElf(const char* base, size_t size, ObjectFile* obj) {
+    const ElfW(Ehdr)* ehdr = ElfAt<ElfW(Ehdr)>(base, size, 0);
+    if (ehdr == NULL || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32)) {
+        return false;
+    }
+    for (size_t i = 0; i < ehdr->e_phnum; ++i) {
+        const ElfW(Phdr)* phdr = ElfAt<ElfW(Phdr)>(
+            base, size, ehdr->e_phoff + i * sizeof(ElfW(Phdr)));
+        if (phdr == NULL) {
+            return false;
+        }
+        if (phdr->p_type == PT_LOAD) {
+            ObjectFile::Segment seg =
+                { phdr->p_offset, phdr->p_filesz, phdr->p_vaddr };
+            obj->segments.push_back(seg);
+        }
+    }
+    const ElfW(Shdr)* symtab = NULL;
+    for (int type : { SHT_SYMTAB, SHT_DYNSYM }) {
+        for (size_t i = 0; i < ehdr->e_shnum && symtab == NULL; ++i) {
+            const ElfW(Shdr)* shdr = ElfAt<ElfW(Shdr)>(
+                base, size, ehdr->e_shoff + i * sizeof(ElfW(Shdr)));
+            if (shdr != NULL && shdr->sh_type == (ElfW(Word))type) {
+                symtab = shdr;
+            }
+        }
+        if (symtab != NULL) {
+            break;
+        }
+    }
+    if (symtab == NULL || symtab->sh_link >= ehdr->e_shnum) {
+        // No symbols, addresses are still mapped to the file.
+        return true;
+    }
+    const ElfW(Shdr)* strtab = ElfAt<ElfW(Shdr)>(
+        base, size, ehdr->e_shoff + symtab->sh_link * sizeof(ElfW(Shdr)));
+    if (strtab == NULL || strtab->sh_offset > size ||
+        size - strtab->sh_offset < strtab->sh_size) {
+        return false;
+    }
+    const char* strs = base + strtab->sh_offset;
+    const size_t nsym = symtab->sh_size / sizeof(ElfW(Sym));
+    obj->symbols.reserve(nsym / 2);
+    for (size_t i = 0; i < nsym; ++i) {
+        const ElfW(Sym)* sym = ElfAt<ElfW(Sym)>(
+            base, size, symtab->sh_offset + i * sizeof(ElfW(Sym)));
+        if (sym == NULL) {
+            break;
+        }
+        const int type = (sym->st_info & 0xf);
+        if ((type != STT_FUNC && type != STT_GNU_IFUNC) ||
+            sym->st_shndx == SHN_UNDEF || sym->st_value == 0 ||
+            sym->st_name >= strtab->sh_size) {
+            continue;
+        }
+        const char* name = strs + sym->st_name;
+        const size_t len = strnlen(name, strtab->sh_size - sym->st_name);
+        ObjectFile::Symbol s =
+            { sym->st_value, sym->st_size, obj->names.size() };
+        obj->names.append(name, len);
+        obj->names.push_back('\0');
+        obj->symbols.push_back(s);
+    }
+    std::stable_sort(obj->symbols.begin(), obj->symbols.end());
+    return true;
+}
+
+bool Symbolizer::LoadElfFile(const std::string& path, ObjectFile* obj) {
+    butil::fd_guard fd(open(path.c_str(), O_RDONLY));
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        return false;
+    }
+    void* mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    const bool rc = ParseElf(static_cast<const char*>(mem), st.st_size, obj);
+    munmap(mem, st.st_size);
+    return rc;
+}
+
+#endif // OS_LINUX
+
+Symbolizer::ObjectFile* Symbolizer::GetObjectFile(const std::string& path) {
+    std::map<std::string, ObjectFile*>::iterator it = _objects.find(path);
+    if (it != _objects.end()) {
+        return it->second;
+    }
+    ObjectFile* obj = new ObjectFile;
+#if defined(OS_LINUX)
+    if (!LoadElfFile(path, obj)) {
+        RPC_VLOG << "Fail to load symbols from " << path;
+        delete obj;
+        obj = NULL;
+    }
+#endif
+    _objects[path] = obj;
+    return obj;
+}
+
+static void AppendDemangled(const char* mangled, std::string* out) {
+    char buf[1024];
+    if (google::Demangle(mangled, buf, sizeof(buf))) {
+        out->append(buf);
+    } else {
+        out->append(mangled);
+    }
+}
+
+bool Symbolizer::Lookup(uint64_t pc, std::string* name) {
+#if defined(OS_LINUX)
+    const Mapping* m = FindMapping(pc);
+    if (m == NULL || m->path.empty() || m->path[0] != '/') {
+        return false;
+    }
+    ObjectFile* obj = GetObjectFile(m->path);
+    if (obj == NULL) {
+        return false;
+    }
+    const uint64_t file_offset = pc - m->start + m->offset;
+    const ObjectFile::Segment* seg = NULL;
+    for (size_t i = 0; i < obj->segments.size(); ++i) {
+        const ObjectFile::Segment& s = obj->segments[i];
+        if (s.offset <= file_offset && file_offset < s.offset + s.filesz) {
+            seg = &s;
+            break;
+        }
+    }
+    if (seg == NULL) {
+        return false;
+    }
+    ObjectFile::Symbol key = { file_offset - seg->offset + seg->vaddr, 0, 0 };
+    std::vector<ObjectFile::Symbol>::const_iterator it =
+        std::upper_bound(obj->symbols.begin(), obj->symbols.end(), key);
+    if (it == obj->symbols.begin()) {
+        return false;
+    }
+    --it;
+    if (it->size != 0 && key.addr >= it->addr + it->size) {
+        return false;
+    }
+    AppendDemangled(obj->names.c_str() + it->name, name);
+    return true;
+#else
+    // Only addresses of current process can be resolved.
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(pc), &info) == 0 ||
+        info.dli_sname == NULL) {
+        return false;
+    }
+    AppendDemangled(info.dli_sname, name);
+    return true;
+#endif
+}
+
+const std::string& Symbolizer::Symbolize(uint64_t pc, bool is_return_address) {
+    if (is_return_address && pc != 0) {
+        --pc;
+    }
+    std::string* name = _cache.seek(pc);
+    if (name != NULL) {
+        return *name;
+    }
+    if (!_mappings_set) {
+        std::string maps;
+        if (butil::ReadFileToString(butil::FilePath("/proc/self/maps"), &maps)) {
+            ParseMappings(maps, &_mappings);
+        }
+        _mappings_set = true;
+    }
+    name = &_cache[pc];
+    if (!Lookup(pc, name)) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "0x%" PRIx64, pc);
+        name->assign(buf);
+    }
+    return *name;
+}
+
+} // namespace brpc
@@ -0,0 +1,84 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_DETAILS_SYMBOLIZER_H
+#define BRPC_DETAILS_SYMBOLIZER_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "butil/macros.h"
+#include "butil/strings/string_piece.h"
+#include "butil/containers/flat_map.h"
+
+namespace brpc {
+
+// Translate addresses recorded in profiles into function names.
+// Symbol tables of object files are loaded once and searched with binary
+// search, which is much faster than symbolizing each address separately.
+// Addresses are mapped to object files with the memory mappings saved
+// along with the profile, so that profiles written by an earlier run of
+// the same program can still be symbolized.
+// Not thread-safe.
+class Symbolizer {
+public:
+    Symbolizer();
+    ~Symbolizer();
+
+    // Use `maps' (in the format of /proc/<pid>/maps) to locate object
+    // files of addresses. Mappings of current process are used when this
+    // method is not called or `maps' is empty.
+    void SetMappings(const butil::StringPiece& maps);
+
+    // Get name of the function containing `pc'. If `pc' is a return
+    // address, it's adjusted to the call instruction before lookup.
+    // Hex of `pc' is returned when no symbol is found. The returned
+    // reference is valid until next call to this method.
+    const std::string& Symbolize(uint64_t pc, bool is_return_address);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(Symbolizer);
+
+    struct Mapping {
+        uint64_t start;
+        uint64_t end;
+        uint64_t offset;
+        std::string path;
+    };
+    struct ObjectFile;
+
+    static void ParseMappings(const butil::StringPiece& maps,
+                              std::vector<Mapping>* out);
+    // Load loadable segments and function symbols of ELF file `path'.
+    // .symtab is preferred, .dynsym is used when the file is stripped.
+    static bool LoadElfFile(const std::string& path, ObjectFile* obj);
+    static bool ParseElf(const char* base, size_t size, ObjectFile* obj);
+    const Mapping* FindMapping(uint64_t addr) const;
+    ObjectFile* GetObjectFile(const std::string& path);
+    bool Lookup(uint64_t pc, std::string* name);
+
+    std::vector<Mapping> _mappings;
+    bool _mappings_set;
+    std::map<std::string, ObjectFile*> _objects;
+    butil::FlatMap<uint64_t, std::string> _cache;
+};
+
+} // namespace brpc
+
+#endif // BRPC_DETAILS_SYMBOLIZER_H
@@ -65,6 +65,7 @@
 #include "brpc/policy/ubrpc2pb_protocol.h"
 #include "brpc/policy/sofa_pbrpc_protocol.h"
 #include "brpc/policy/memcache_binary_protocol.h"
+#include "brpc/policy/memcache_text_protocol.h"
 #include "brpc/policy/streaming_rpc_protocol.h"
 #include "brpc/policy/mongo_protocol.h"
 #include "brpc/policy/redis_protocol.h"
@@ -390,7 +391,8 @@ static void GlobalInitializeOrDieImpl() {
                                 SerializeRequestDefault, PackRpcRequest,
                                 ProcessRpcRequest, ProcessRpcResponse,
                                 VerifyRpcRequest, NULL, NULL,
-                                CONNECTION_TYPE_ALL, "baidu_std" };
+                                CONNECTION_TYPE_ALL, "baidu_std",
+                                CancelRpcRequest };
     if (RegisterProtocol(PROTOCOL_BAIDU_STD, baidu_protocol) != 0) {
         exit(1);
     }
@@ -399,7 +401,7 @@ static void GlobalInitializeOrDieImpl() {
                                     NULL, NULL, ProcessStreamingMessage,
                                     ProcessStreamingMessage,
                                     NULL, NULL, NULL,
-                                    CONNECTION_TYPE_SINGLE, "streaming_rpc" };
+                                    CONNECTION_TYPE_SINGLE, "streaming_rpc", NULL };
 
     if (RegisterProtocol(PROTOCOL_STREAMING_RPC, streaming_protocol) != 0) {
         exit(1);
@@ -411,7 +413,7 @@ static void GlobalInitializeOrDieImpl() {
                                VerifyHttpRequest, ParseHttpServerAddress,
                                GetHttpMethodName,
                                CONNECTION_TYPE_POOLED_AND_SHORT,
-                               "http" };
+                               "http", NULL };
     if (RegisterProtocol(PROTOCOL_HTTP, http_protocol) != 0) {
         exit(1);
     }
@@ -422,7 +424,7 @@ static void GlobalInitializeOrDieImpl() {
                                 VerifyHttpRequest, ParseHttpServerAddress,
                                 GetHttpMethodName,
                                 CONNECTION_TYPE_SINGLE,
-                                "h2" };
+                                "h2", NULL };
     if (RegisterProtocol(PROTOCOL_H2, http2_protocol) != 0) {
         exit(1);
     }
@@ -431,7 +433,7 @@ static void GlobalInitializeOrDieImpl() {
                                SerializeRequestDefault, PackHuluRequest,
                                ProcessHuluRequest, ProcessHuluResponse,
                                VerifyHuluRequest, NULL, NULL,
-                               CONNECTION_TYPE_ALL, "hulu_pbrpc" };
+                               CONNECTION_TYPE_ALL, "hulu_pbrpc", NULL };
     if (RegisterProtocol(PROTOCOL_HULU_PBRPC, hulu_protocol) != 0) {
         exit(1);
     }
@@ -441,7 +443,7 @@ static void GlobalInitializeOrDieImpl() {
                                SerializeNovaRequest, PackNovaRequest,
                                NULL, ProcessNovaResponse,
                                NULL, NULL, NULL,
-                               CONNECTION_TYPE_POOLED_AND_SHORT,  "nova_pbrpc" };
+                               CONNECTION_TYPE_POOLED_AND_SHORT,  "nova_pbrpc", NULL };
     if (RegisterProtocol(PROTOCOL_NOVA_PBRPC, nova_protocol) != 0) {
         exit(1);
     }
@@ -455,7 +457,7 @@ static void GlobalInitializeOrDieImpl() {
                                        // public_pbrpc server implementation
                                        // doesn't support full duplex
                                        CONNECTION_TYPE_POOLED_AND_SHORT,
-                                       "public_pbrpc" };
+                                       "public_pbrpc", NULL };
     if (RegisterProtocol(PROTOCOL_PUBLIC_PBRPC, public_pbrpc_protocol) != 0) {
         exit(1);
     }
@@ -464,7 +466,7 @@ static void GlobalInitializeOrDieImpl() {
                                SerializeRequestDefault, PackSofaRequest,
                                ProcessSofaRequest, ProcessSofaResponse,
                                VerifySofaRequest, NULL, NULL,
-                               CONNECTION_TYPE_ALL, "sofa_pbrpc" };
+                               CONNECTION_TYPE_ALL, "sofa_pbrpc", NULL };
     if (RegisterProtocol(PROTOCOL_SOFA_PBRPC, sofa_protocol) != 0) {
         exit(1);
     }
@@ -476,7 +478,7 @@ static void GlobalInitializeOrDieImpl() {
                                  SerializeNsheadRequest, PackNsheadRequest,
                                  ProcessNsheadRequest, ProcessNsheadResponse,
                                  VerifyNsheadRequest, NULL, NULL,
-                                 CONNECTION_TYPE_POOLED_AND_SHORT, "nshead" };
+                                 CONNECTION_TYPE_POOLED_AND_SHORT, "nshead", NULL };
     if (RegisterProtocol(PROTOCOL_NSHEAD, nshead_protocol) != 0) {
         exit(1);
     }
@@ -484,19 +486,31 @@ static void GlobalInitializeOrDieImpl() {
     Protocol mc_binary_protocol = { ParseMemcacheMessage,
                                     SerializeMemcacheRequest,
                                     PackMemcacheRequest,
-                                    NULL, ProcessMemcacheResponse,
+                                    ProcessMemcacheRequest,
+                                    ProcessMemcacheResponse,
                                     NULL, NULL, GetMemcacheMethodName,
-                                    CONNECTION_TYPE_ALL, "memcache" };
+                                    CONNECTION_TYPE_ALL, "memcache", NULL };
     if (RegisterProtocol(PROTOCOL_MEMCACHE, mc_binary_protocol) != 0) {
         exit(1);
     }
 
+    Protocol mc_text_protocol = { ParseMemcacheTextMessage,
+                                  SerializeMemcacheTextRequest,
+                                  PackMemcacheTextRequest,
+                                  ProcessMemcacheTextRequest,
+                                  ProcessMemcacheTextResponse,
+                                  NULL, NULL, GetMemcacheMethodName,
+                                  CONNECTION_TYPE_ALL, "memcache_text", NULL };
+    if (RegisterProtocol(PROTOCOL_MEMCACHE_TEXT, mc_text_protocol) != 0) {
+        exit(1);
+    }
+
     Protocol redis_protocol = { ParseRedisMessage,
                                 SerializeRedisRequest,
                                 PackRedisRequest,
                                 ProcessRedisRequest, ProcessRedisResponse,
                                 NULL, NULL, GetRedisMethodName,
-                                CONNECTION_TYPE_ALL, "redis" };
+                                CONNECTION_TYPE_ALL, "redis", NULL };
     if (RegisterProtocol(PROTOCOL_REDIS, redis_protocol) != 0) {
         exit(1);
     }
@@ -505,7 +519,7 @@ static void GlobalInitializeOrDieImpl() {
                                 NULL, NULL,
                                 ProcessMongoRequest, NULL,
                                 NULL, NULL, NULL,
-                                CONNECTION_TYPE_POOLED, "mongo" };
+                                CONNECTION_TYPE_POOLED, "mongo", NULL };
     if (RegisterProtocol(PROTOCOL_MONGO, mongo_protocol) != 0) {
         exit(1);
     }
@@ -517,7 +531,7 @@ static void GlobalInitializeOrDieImpl() {
         policy::SerializeThriftRequest, policy::PackThriftRequest,
         policy::ProcessThriftRequest, policy::ProcessThriftResponse,
         policy::VerifyThriftRequest, NULL, NULL,
-        CONNECTION_TYPE_POOLED_AND_SHORT, "thrift" };
+        CONNECTION_TYPE_POOLED_AND_SHORT, "thrift", NULL };
     if (RegisterProtocol(PROTOCOL_THRIFT, thrift_binary_protocol) != 0) {
         exit(1);
     }
@@ -529,7 +543,7 @@ static void GlobalInitializeOrDieImpl() {
         SerializeUbrpcCompackRequest, PackUbrpcRequest,
         NULL, ProcessUbrpcResponse,
         NULL, NULL, NULL,
-        CONNECTION_TYPE_POOLED_AND_SHORT,  "ubrpc_compack" };
+        CONNECTION_TYPE_POOLED_AND_SHORT,  "ubrpc_compack", NULL };
     if (RegisterProtocol(PROTOCOL_UBRPC_COMPACK, ubrpc_compack_protocol) != 0) {
         exit(1);
     }
@@ -538,7 +552,7 @@ static void GlobalInitializeOrDieImpl() {
         SerializeUbrpcMcpack2Request, PackUbrpcRequest,
         NULL, ProcessUbrpcResponse,
         NULL, NULL, NULL,
-        CONNECTION_TYPE_POOLED_AND_SHORT,  "ubrpc_mcpack2" };
+        CONNECTION_TYPE_POOLED_AND_SHORT,  "ubrpc_mcpack2", NULL };
     if (RegisterProtocol(PROTOCOL_UBRPC_MCPACK2, ubrpc_mcpack2_protocol) != 0) {
         exit(1);
     }
@@ -549,7 +563,7 @@ static void GlobalInitializeOrDieImpl() {
         SerializeNsheadMcpackRequest, PackNsheadMcpackRequest,
         NULL, ProcessNsheadMcpackResponse,
         NULL, NULL, NULL,
-        CONNECTION_TYPE_POOLED_AND_SHORT,  "nshead_mcpack" };
+        CONNECTION_TYPE_POOLED_AND_SHORT,  "nshead_mcpack", NULL };
     if (RegisterProtocol(PROTOCOL_NSHEAD_MCPACK, nshead_mcpack_protocol) != 0) {
         exit(1);
     }
@@ -560,7 +574,7 @@ static void GlobalInitializeOrDieImpl() {
         ProcessRtmpMessage, ProcessRtmpMessage,
         NULL, NULL, NULL,
         (ConnectionType)(CONNECTION_TYPE_SINGLE|CONNECTION_TYPE_SHORT),
-        "rtmp" };
+        "rtmp", NULL };
     if (RegisterProtocol(PROTOCOL_RTMP, rtmp_protocol) != 0) {
         exit(1);
     }
@@ -570,7 +584,7 @@ static void GlobalInitializeOrDieImpl() {
         SerializeEspRequest, PackEspRequest,
         NULL, ProcessEspResponse,
         NULL, NULL, NULL,
-        CONNECTION_TYPE_POOLED_AND_SHORT, "esp"};
+        CONNECTION_TYPE_POOLED_AND_SHORT, "esp", NULL };
     if (RegisterProtocol(PROTOCOL_ESP, esp_protocol) != 0) {
         exit(1);
     }
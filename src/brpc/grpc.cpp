@@ -22,7 +22,11 @@
 #include "brpc/grpc.h"
 #include "brpc/errno.pb.h"
 #include "brpc/http_status_code.h"
+#include "brpc/controller.h"
+#include "brpc/details/controller_private_accessor.h"
+#include "brpc/policy/http2_rpc_protocol.h"
 #include "butil/logging.h"
+#include "butil/iobuf.h"
 
 namespace brpc {
 
@@ -205,4 +209,56 @@ int64_t ConvertGrpcTimeoutToUS(const std::string* grpc_timeout) {
     CHECK(false) << "Impossible";
 }
 
+GrpcStreamOptions::GrpcStreamOptions()
+    : handler(NULL)
+    , max_buf_size(2 * 1024 * 1024)
+    , weight(policy::H2_DEFAULT_STREAM_WEIGHT) {}
+
+int GrpcStream::Write(const google::protobuf::Message& message) {
+    butil::IOBuf buf;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&buf);
+    if (!message.SerializeToZeroCopyStream(&wrapper)) {
+        LOG(ERROR) << "Fail to serialize " << message.GetTypeName();
+        return EINVAL;
+    }
+    return Write(buf);
+}
+
+int GrpcStreamCreate(butil::intrusive_ptr<GrpcStream>* stream,
+                     Controller* cntl, const GrpcStreamOptions* options) {
+    ControllerPrivateAccessor accessor(cntl);
+    if (accessor.grpc_stream() != NULL) {
+        LOG(ERROR) << "A gRPC stream was already created with the controller";
+        return -1;
+    }
+    butil::intrusive_ptr<policy::H2GrpcStream> s(
+        new policy::H2GrpcStream(false));
+    if (s->Init(options) != 0) {
+        return -1;
+    }
+    // Messages written into the stream can't be sent again.
+    cntl->set_max_retry(0);
+    cntl->set_backup_request_ms(-1);
+    accessor.set_grpc_stream(s.get());
+    stream->reset(s.get());
+    return 0;
+}
+
+int GrpcStreamAccept(butil::intrusive_ptr<GrpcStream>* stream,
+                     google::protobuf::RpcController* cntl_base,
+                     const GrpcStreamOptions* options) {
+    Controller* cntl = static_cast<Controller*>(cntl_base);
+    policy::H2GrpcStream* s = static_cast<policy::H2GrpcStream*>(
+        ControllerPrivateAccessor(cntl).grpc_stream());
+    if (s == NULL) {
+        LOG(ERROR) << "The request is not a streaming gRPC call";
+        return -1;
+    }
+    if (s->Accept(options) != 0) {
+        return -1;
+    }
+    stream->reset(s);
+    return 0;
+}
+
 } // namespace brpc
@@ -20,7 +20,13 @@
 #define BRPC_GRPC_H
 
 #include <map>
-#include <brpc/http2.h>
+#include <string>
+#include <google/protobuf/message.h>
+#include <google/protobuf/service.h>
+#include "butil/iobuf.h"
+#include "butil/endpoint.h"
+#include "brpc/http2.h"
+#include "brpc/shared_object.h"
 
 namespace brpc {
 
@@ -155,6 +161,135 @@ void PercentEncode(const std::string& str, std::string* str_out);
 
 void PercentDecode(const std::string& str, std::string* str_out);
 
+class Controller;
+class GrpcStream;
+
+// Receive messages of a gRPC stream.
+class GrpcStreamHandler {
+public:
+    virtual ~GrpcStreamHandler() {}
+
+    // Called with messages from the peer in the order they were sent, batch
+    // by batch in a bthread dedicated to the stream. Messages are serialized
+    // protobufs without the 5-byte gRPC prefix and already decompressed.
+    // The peer is not allowed to send more when too many bytes are not
+    // consumed yet, namely a slow handler slows down the peer rather than
+    // making messages pile up in memory.
+    virtual void OnReceivedMessages(GrpcStream* stream,
+                                    butil::IOBuf* const messages[],
+                                    size_t size) = 0;
+
+    // Called once after all messages, when no more messages will be received:
+    // At server-side, `error_code' is 0 if the client half-closed the stream
+    // normally. At client-side, `error_code' and `error_text' are converted
+    // from grpc-status and grpc-message in trailers of the server, which are
+    // 0 and "" when the call succeeded. Otherwise the stream was reset or
+    // the connection was broken.
+    virtual void OnClosed(GrpcStream* stream, int error_code,
+                          const std::string& error_text) = 0;
+};
+
+struct GrpcStreamOptions {
+    GrpcStreamOptions();
+
+    // Receive messages from the peer. Must be valid until OnClosed() is
+    // called. If it's NULL, messages from the peer are dropped.
+    // Default: NULL
+    GrpcStreamHandler* handler;
+
+    // Write() fails with EAGAIN when so many bytes are written but not sent
+    // yet because of HTTP/2 flow control. Non-positive value means no limit.
+    // Default: 2097152 (2M)
+    int64_t max_buf_size;
+
+    // Streams and calls of a connection send DATA frames in turns, the
+    // stream sends at most so many frames in each turn. A larger weight
+    // gives the stream a larger share of the bandwidth when the connection
+    // is busy. Unary calls always use the default. Must be in [1, 256].
+    // Default: 16
+    int weight;
+};
+
+// A stream of messages in a streaming gRPC call (client-streaming,
+// server-streaming or bidirectional streaming), carried by a HTTP/2 stream
+// and subject to flow control of the stream and the connection.
+//
+// Client-side:
+//   brpc::Controller cntl;
+//   butil::intrusive_ptr<brpc::GrpcStream> stream;
+//   brpc::GrpcStreamCreate(&stream, &cntl, &options);
+//   stub.Chat(&cntl, &first_request, &response, done);  // h2:grpc channel
+//   stream->Write(another_request);
+//   stream->Close();  // half-close, the server sees OnClosed(0)
+// `first_request' is the first message of the stream. The RPC completes
+// when response headers of the server arrive (some servers send them with
+// the first message) and `response' is not used, messages of the server are
+// passed to the handler, the final status of the call is given to OnClosed().
+// Retrying and backup requests are disabled for such RPCs, the timeout
+// covers the wait for the response headers only.
+//
+// Server-side, for methods declared with `stream' in proto files:
+//   void Chat(RpcController* cntl, const Request* req, Response*, Closure* done) {
+//       brpc::ClosureGuard done_guard(done);
+//       butil::intrusive_ptr<brpc::GrpcStream> stream;
+//       if (brpc::GrpcStreamAccept(&stream, cntl, &options) != 0) { ... }
+//       // Response headers are sent after done->Run(), and messages written
+//       // by stream->Write() are sent after them until stream->Close().
+//   }
+// `req' is only filled for server-streaming methods. Messages of the client
+// in client-streaming and bidirectional methods are passed to the handler.
+// If the stream is not accepted, the call ends as a unary one with the
+// response of `done'.
+class GrpcStream : public SharedObject {
+friend class Controller;
+public:
+    // [Thread-safe] Send `message' after previously written messages.
+    // Returns 0 on success, error code otherwise:
+    //   EAGAIN: too many bytes pending, see GrpcStreamOptions.max_buf_size.
+    //           Call Wait() and write again.
+    //   EINVAL: the stream was closed.
+    //   ECONNRESET: the stream was reset or the connection was broken.
+    virtual int Write(const butil::IOBuf& message) = 0;
+    int Write(const google::protobuf::Message& message);
+
+    // Wait until Write() is possible again, namely pending bytes are less
+    // than max_buf_size. `due_time' is absolute and NULL means forever.
+    // Returns 0 on success, ETIMEDOUT on timeout, or EINVAL when the stream
+    // was closed during waiting.
+    virtual int Wait(const timespec* due_time) = 0;
+
+    // Close the stream after all written messages are sent. Client-side
+    // half-closes the stream and keeps receiving messages until the server
+    // ends the call. Server-side ends the call with the status converted from
+    // `error_code' and `error_text' (grpc-status and grpc-message). A client
+    // cancels the call with non-zero `error_code'.
+    // Returns 0 on success, EINVAL if the stream was already closed.
+    virtual int Close(int error_code, const std::string& error_text) = 0;
+    int Close() { return Close(0, std::string()); }
+
+    // Address of the peer, empty if the stream is not connected yet.
+    virtual butil::EndPoint remote_side() const = 0;
+
+protected:
+    // Called when the RPC carrying the stream ends at client-side.
+    virtual void OnRPCEnd(int error_code, const std::string& error_text) = 0;
+};
+
+// [Called at client-side before calling the method with `cntl']
+// Create a gRPC stream which is carried by the next RPC of `cntl'.
+// `options' is default when it's NULL.
+// Returns 0 on success, -1 otherwise.
+int GrpcStreamCreate(butil::intrusive_ptr<GrpcStream>* stream,
+                     Controller* cntl, const GrpcStreamOptions* options);
+
+// [Called at server-side inside the streaming method]
+// Accept the stream of the gRPC call. Fails if the method is not declared
+// as streaming.
+// Returns 0 on success, -1 otherwise.
+int GrpcStreamAccept(butil::intrusive_ptr<GrpcStream>* stream,
+                     google::protobuf::RpcController* cntl,
+                     const GrpcStreamOptions* options);
+
 
 } // namespace brpc
 
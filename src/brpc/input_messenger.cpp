@@ -314,7 +314,7 @@ void InputMessenger::OnNewMessages(Socket* m) {
                       "destroyed when authentication failed";
                 }
             }
-            if (!m->is_read_progressive()) {
+            if (!m->is_read_progressive() && !pr.is_partial()) {
                 // Transfer ownership to last_msg
                 last_msg.reset(msg.release());
             } else {
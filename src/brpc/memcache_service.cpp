@@ -0,0 +1,74 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include "brpc/memcache_service.h"
+
+namespace brpc {
+
+const char* MemcacheStoreModeToString(MemcacheStoreMode mode) {
+    switch (mode) {
+    case MEMCACHE_STORE_SET:
+        return "set";
+    case MEMCACHE_STORE_ADD:
+        return "add";
+    case MEMCACHE_STORE_REPLACE:
+        return "replace";
+    case MEMCACHE_STORE_APPEND:
+        return "append";
+    case MEMCACHE_STORE_PREPEND:
+        return "prepend";
+    }
+    return "unknown";
+}
+
+MemcacheService::Status MemcacheService::Get(
+    const butil::StringPiece&, butil::IOBuf*, uint32_t*, uint64_t*) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Store(
+    MemcacheStoreMode, const butil::StringPiece&, const butil::IOBuf&,
+    uint32_t, uint32_t, uint64_t, uint64_t*) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Delete(
+    const butil::StringPiece&, uint64_t) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Counter(
+    bool, const butil::StringPiece&, uint64_t, uint64_t, uint32_t,
+    uint64_t*, uint64_t*) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Touch(
+    const butil::StringPiece&, uint32_t) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+MemcacheService::Status MemcacheService::Flush(uint32_t) {
+    return MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+}
+
+void MemcacheService::Version(std::string* version) {
+    *version = "brpc";
+}
+
+} // namespace brpc
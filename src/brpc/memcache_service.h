@@ -0,0 +1,102 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_MEMCACHE_SERVICE_H
+#define BRPC_MEMCACHE_SERVICE_H
+
+#include <string>
+#include "butil/iobuf.h"
+#include "butil/strings/string_piece.h"
+#include "brpc/memcache.h"
+
+namespace brpc {
+
+enum MemcacheStoreMode {
+    MEMCACHE_STORE_SET = 0,
+    MEMCACHE_STORE_ADD = 1,      // Store only if the key does not exist.
+    MEMCACHE_STORE_REPLACE = 2,  // Store only if the key exists.
+    MEMCACHE_STORE_APPEND = 3,   // Append to the existing value.
+    MEMCACHE_STORE_PREPEND = 4,  // Prepend to the existing value.
+};
+
+const char* MemcacheStoreModeToString(MemcacheStoreMode mode);
+
+// Serve memcache clients speaking the binary protocol or the text protocol
+// (including meta commands mg/ms/md/mn). Both protocols are translated into
+// calls to following methods, implement the ones you need, the others
+// reply STATUS_UNKNOWN_COMMAND(an "ERROR" in the text protocol).
+// Assign an instance to ServerOptions.memcache_service to enable memcache
+// support.
+//
+// Methods are called one by one in the order that requests of a connection
+// arrive, in the bthread parsing the connection, just like what memcached
+// does. Requests from different connections run concurrently, so methods
+// must be thread-safe. Don't block for long inside methods, which delays all
+// following requests of the connection.
+//
+// Values are IOBuf referencing memory of the connection, storing a value
+// by `stored = value' and replying it by `*value = stored' copy nothing.
+class MemcacheService {
+public:
+    typedef MemcacheResponse::Status Status;
+
+    virtual ~MemcacheService() {}
+
+    // Set `value', `flags' and `cas_value' of `key' and return STATUS_SUCCESS,
+    // or return STATUS_KEY_ENOENT if `key' does not exist.
+    virtual Status Get(const butil::StringPiece& key, butil::IOBuf* value,
+                       uint32_t* flags, uint64_t* cas_value);
+
+    // Store `value' of `key' according to `mode'.
+    // If `cas_value' is non-zero, the value must be stored only if `key'
+    // exists and has the same cas value, STATUS_KEY_EEXISTS should be
+    // returned for mismatched cas and STATUS_KEY_ENOENT for missing key.
+    // Otherwise returns STATUS_SUCCESS and sets `new_cas_value', or
+    // STATUS_NOT_STORED if `mode' is not satisfied.
+    virtual Status Store(MemcacheStoreMode mode, const butil::StringPiece& key,
+                         const butil::IOBuf& value, uint32_t flags,
+                         uint32_t exptime, uint64_t cas_value,
+                         uint64_t* new_cas_value);
+
+    // `cas_value' is same with Store().
+    virtual Status Delete(const butil::StringPiece& key, uint64_t cas_value);
+
+    // Add(or subtract if `increment' is false) `delta' to the value of `key'
+    // as a decimal number, set `new_value' and `new_cas_value'. If `key' does
+    // not exist, store `initial_value' unless `exptime' is 0xffffffff, in
+    // which case STATUS_KEY_ENOENT is returned. Return STATUS_DELTA_BADVAL if
+    // the value is not a number.
+    virtual Status Counter(bool increment, const butil::StringPiece& key,
+                           uint64_t delta, uint64_t initial_value,
+                           uint32_t exptime, uint64_t* new_value,
+                           uint64_t* new_cas_value);
+
+    // Update expiration time of `key'.
+    virtual Status Touch(const butil::StringPiece& key, uint32_t exptime);
+
+    // Invalidate all items after `delay' seconds.
+    virtual Status Flush(uint32_t delay);
+
+    // Version replied to clients, "brpc" by default.
+    virtual void Version(std::string* version);
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_MEMCACHE_SERVICE_H
@@ -0,0 +1,878 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <algorithm>
+#include <map>
+#include <google/protobuf/reflection_ops.h>
+#include <google/protobuf/wire_format.h>
+#include "butil/string_printf.h"
+#include "butil/string_splitter.h"
+#include "butil/strings/string_number_conversions.h"
+#include "butil/logging.h"
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "bthread/countdown_event.h"
+#include "bthread/unstable.h"
+#include "brpc/channel_base.h"
+#include "brpc/controller.h"
+#include "brpc/errno.pb.h"
+#include "brpc/memcache_text.h"
+#include "brpc/policy/memcache_text_protocol.h"
+
+namespace brpc {
+
+MemcacheTextRequest::MemcacheTextRequest()
+    : ::google::protobuf::Message() {
+    SharedCtor();
+}
+
+MemcacheTextRequest::MemcacheTextRequest(const MemcacheTextRequest& from)
+    : ::google::protobuf::Message() {
+    SharedCtor();
+    MergeFrom(from);
+}
+
+void MemcacheTextRequest::SharedCtor() {
+    _pipelined_count = 0;
+    _cached_size_ = 0;
+}
+
+MemcacheTextRequest::~MemcacheTextRequest() {
+    SharedDtor();
+}
+
+void MemcacheTextRequest::SharedDtor() {
+}
+
+void MemcacheTextRequest::SetCachedSize(int size) const {
+    _cached_size_ = size;
+}
+
+const ::google::protobuf::Descriptor* MemcacheTextRequest::descriptor() {
+    return MemcacheTextRequestBase::descriptor();
+}
+
+MemcacheTextRequest* MemcacheTextRequest::New() const {
+    return new MemcacheTextRequest;
+}
+
+void MemcacheTextRequest::Clear() {
+    _buf.clear();
+    _pipelined_count = 0;
+}
+
+bool MemcacheTextRequest::MergePartialFromCodedStream(
+    ::google::protobuf::io::CodedInputStream*) {
+    LOG(WARNING) << "You're not supposed to parse a MemcacheTextRequest";
+    return false;
+}
+
+void MemcacheTextRequest::SerializeWithCachedSizes(
+    ::google::protobuf::io::CodedOutputStream* output) const {
+    LOG(WARNING) << "You're not supposed to serialize a MemcacheTextRequest";
+
+    // simple approach just making it work.
+    butil::IOBufAsZeroCopyInputStream wrapper(_buf);
+    const void* data = NULL;
+    int size = 0;
+    while (wrapper.Next(&data, &size)) {
+        output->WriteRaw(data, size);
+    }
+}
+
+::google::protobuf::uint8* MemcacheTextRequest::SerializeWithCachedSizesToArray(
+    ::google::protobuf::uint8* target) const {
+    return target;
+}
+
+int MemcacheTextRequest::ByteSize() const {
+    int total_size =  _buf.size();
+    _cached_size_ = total_size;
+    return total_size;
+}
+
+void MemcacheTextRequest::MergeFrom(const ::google::protobuf::Message& from) {
+    GOOGLE_CHECK_NE(&from, this);
+    const MemcacheTextRequest* source = dynamic_cast<const MemcacheTextRequest*>(&from);
+    if (source == NULL) {
+        ::google::protobuf::internal::ReflectionOps::Merge(from, this);
+    } else {
+        MergeFrom(*source);
+    }
+}
+
+void MemcacheTextRequest::MergeFrom(const MemcacheTextRequest& from) {
+    GOOGLE_CHECK_NE(&from, this);
+    _buf.append(from._buf);
+    _pipelined_count += from._pipelined_count;
+}
+
+void MemcacheTextRequest::CopyFrom(const ::google::protobuf::Message& from) {
+    if (&from == this) return;
+    Clear();
+    MergeFrom(from);
+}
+
+void MemcacheTextRequest::CopyFrom(const MemcacheTextRequest& from) {
+    if (&from == this) return;
+    Clear();
+    MergeFrom(from);
+}
+
+bool MemcacheTextRequest::IsInitialized() const {
+    return _pipelined_count != 0;
+}
+
+void MemcacheTextRequest::Swap(MemcacheTextRequest* other) {
+    if (other != this) {
+        _buf.swap(other->_buf);
+        std::swap(_pipelined_count, other->_pipelined_count);
+        std::swap(_cached_size_, other->_cached_size_);
+    }
+}
+
+::google::protobuf::Metadata MemcacheTextRequest::GetMetadata() const {
+    ::google::protobuf::Metadata metadata;
+    metadata.descriptor = MemcacheTextRequest::descriptor();
+    metadata.reflection = NULL;
+    return metadata;
+}
+
+MemcacheTextResponse::MemcacheTextResponse()
+    : ::google::protobuf::Message() {
+    SharedCtor();
+}
+
+MemcacheTextResponse::MemcacheTextResponse(const MemcacheTextResponse& from)
+    : ::google::protobuf::Message() {
+    SharedCtor();
+    MergeFrom(from);
+}
+
+void MemcacheTextResponse::SharedCtor() {
+    _cached_size_ = 0;
+}
+
+MemcacheTextResponse::~MemcacheTextResponse() {
+    SharedDtor();
+}
+
+void MemcacheTextResponse::SharedDtor() {
+}
+
+void MemcacheTextResponse::SetCachedSize(int size) const {
+    _cached_size_ = size;
+}
+const ::google::protobuf::Descriptor* MemcacheTextResponse::descriptor() {
+    return MemcacheTextResponseBase::descriptor();
+}
+
+MemcacheTextResponse* MemcacheTextResponse::New() const {
+    return new MemcacheTextResponse;
+}
+
+void MemcacheTextResponse::Clear() {
+    _err.clear();
+    _buf.clear();
+}
+
+bool MemcacheTextResponse::MergePartialFromCodedStream(
+    ::google::protobuf::io::CodedInputStream* input) {
+    LOG(WARNING) << "You're not supposed to parse a MemcacheTextResponse";
+
+    // simple approach just making it work.
+    const void* data = NULL;
+    int size = 0;
+    while (input->GetDirectBufferPointer(&data, &size)) {
+        _buf.append(data, size);
+        input->Skip(size);
+    }
+    return true;
+}
+
+void MemcacheTextResponse::SerializeWithCachedSizes(
+    ::google::protobuf::io::CodedOutputStream* output) const {
+    LOG(WARNING) << "You're not supposed to serialize a MemcacheTextResponse";
+    
+    // simple approach just making it work.
+    butil::IOBufAsZeroCopyInputStream wrapper(_buf);
+    const void* data = NULL;
+    int size = 0;
+    while (wrapper.Next(&data, &size)) {
+        output->WriteRaw(data, size);
+    }
+}
+
+::google::protobuf::uint8* MemcacheTextResponse::SerializeWithCachedSizesToArray(
+    ::google::protobuf::uint8* target) const {
+    return target;
+}
+
+int MemcacheTextResponse::ByteSize() const {
+    int total_size = _buf.size();
+    _cached_size_ = total_size;
+    return total_size;
+}
+
+void MemcacheTextResponse::MergeFrom(const ::google::protobuf::Message& from) {
+    GOOGLE_CHECK_NE(&from, this);
+    const MemcacheTextResponse* source = dynamic_cast<const MemcacheTextResponse*>(&from);
+    if (source == NULL) {
+        ::google::protobuf::internal::ReflectionOps::Merge(from, this);
+    } else {
+        MergeFrom(*source);
+    }
+}
+
+void MemcacheTextResponse::MergeFrom(const MemcacheTextResponse& from) {
+    GOOGLE_CHECK_NE(&from, this);
+    _err = from._err;
+    // responses of memcached according to their binary layout, should be
+    // directly concatenatible.
+    _buf.append(from._buf);
+}
+
+void MemcacheTextResponse::CopyFrom(const ::google::protobuf::Message& from) {
+    if (&from == this) return;
+    Clear();
+    MergeFrom(from);
+}
+
+void MemcacheTextResponse::CopyFrom(const MemcacheTextResponse& from) {
+    if (&from == this) return;
+    Clear();
+    MergeFrom(from);
+}
+
+bool MemcacheTextResponse::IsInitialized() const {
+    return !_buf.empty();
+}
+
+void MemcacheTextResponse::Swap(MemcacheTextResponse* other) {
+    if (other != this) {
+        _err.swap(other->_err);
+        _buf.swap(other->_buf);
+        std::swap(_cached_size_, other->_cached_size_);
+    }
+}
+
+::google::protobuf::Metadata MemcacheTextResponse::GetMetadata() const {
+    ::google::protobuf::Metadata metadata;
+    metadata.descriptor = MemcacheTextResponse::descriptor();
+    metadata.reflection = NULL;
+    return metadata;
+}
+
+
+// ===================================================================
+
+// Keys can't be empty, longer than 250 bytes or contain spaces and control
+// characters.
+static bool IsValidKey(const butil::StringPiece& key) {
+    if (key.empty() || key.size() > 250) {
+        LOG(ERROR) << "Invalid length=" << key.size() << " of memcache key";
+        return false;
+    }
+    for (size_t i = 0; i < key.size(); ++i) {
+        const unsigned char c = key[i];
+        if (c <= ' ' || c == 127) {
+            LOG(ERROR) << "Invalid character in memcache key=" << key;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool IsValidMetaFlags(const butil::StringPiece& flags) {
+    for (butil::StringSplitter sp(flags.data(), flags.data() + flags.size(), ' ');
+         sp; ++sp) {
+        if (*sp.field() == 'q') {
+            LOG(ERROR) << "Quiet mode is not supported";
+            return false;
+        }
+        for (size_t i = 0; i < sp.length(); ++i) {
+            if ((unsigned char)sp.field()[i] < ' ') {
+                LOG(ERROR) << "Invalid character in meta flags=" << flags;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool MemcacheTextRequest::Get(const butil::StringPiece& key) {
+    return MultiGet(&key, 1);
+}
+
+bool MemcacheTextRequest::MultiGet(const butil::StringPiece* keys, size_t count) {
+    if (count == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (!IsValidKey(keys[i])) {
+            return false;
+        }
+    }
+    std::string line = "gets";
+    for (size_t i = 0; i < count; ++i) {
+        line.push_back(' ');
+        line.append(keys[i].data(), keys[i].size());
+    }
+    line.append("\r\n", 2);
+    _buf.append(line);
+    ++_pipelined_count;
+    return true;
+}
+
+bool MemcacheTextRequest::Set(
+    const butil::StringPiece& key, const butil::StringPiece& value,
+    uint32_t flags, uint32_t exptime, uint64_t cas_value) {
+    if (!IsValidKey(key)) {
+        return false;
+    }
+    std::string header;
+    if (cas_value == 0) {
+        butil::string_printf(&header, "set %.*s %u %u %lu\r\n",
+                             (int)key.size(), key.data(), flags, exptime,
+                             (unsigned long)value.size());
+    } else {
+        butil::string_printf(&header, "cas %.*s %u %u %lu %llu\r\n",
+                             (int)key.size(), key.data(), flags, exptime,
+                             (unsigned long)value.size(),
+                             (unsigned long long)cas_value);
+    }
+    _buf.append(header);
+    _buf.append(value.data(), value.size());
+    _buf.append("\r\n", 2);
+    ++_pipelined_count;
+    return true;
+}
+
+bool MemcacheTextRequest::Delete(const butil::StringPiece& key) {
+    if (!IsValidKey(key)) {
+        return false;
+    }
+    _buf.append("delete ", 7);
+    _buf.append(key.data(), key.size());
+    _buf.append("\r\n", 2);
+    ++_pipelined_count;
+    return true;
+}
+
+bool MemcacheTextRequest::AppendMetaCommand(
+    const char* cmd, const butil::StringPiece& key,
+    const butil::StringPiece* value, const butil::StringPiece& flags) {
+    if (!IsValidKey(key) || !IsValidMetaFlags(flags)) {
+        return false;
+    }
+    std::string line = cmd;
+    line.push_back(' ');
+    line.append(key.data(), key.size());
+    if (value) {
+        butil::string_appendf(&line, " %lu", (unsigned long)value->size());
+    }
+    if (!flags.empty()) {
+        line.push_back(' ');
+        line.append(flags.data(), flags.size());
+    }
+    line.append("\r\n", 2);
+    _buf.append(line);
+    if (value) {
+        _buf.append(value->data(), value->size());
+        _buf.append("\r\n", 2);
+    }
+    ++_pipelined_count;
+    return true;
+}
+
+bool MemcacheTextRequest::MetaGet(const butil::StringPiece& key,
+                                  const butil::StringPiece& flags) {
+    return AppendMetaCommand("mg", key, NULL, flags);
+}
+
+bool MemcacheTextRequest::MetaSet(const butil::StringPiece& key,
+                                  const butil::StringPiece& value,
+                                  const butil::StringPiece& flags) {
+    return AppendMetaCommand("ms", key, &value, flags);
+}
+
+bool MemcacheTextRequest::MetaDelete(const butil::StringPiece& key,
+                                     const butil::StringPiece& flags) {
+    return AppendMetaCommand("md", key, NULL, flags);
+}
+
+bool MemcacheTextRequest::MetaNoop() {
+    _buf.append("mn\r\n", 4);
+    ++_pipelined_count;
+    return true;
+}
+
+// Pop a line, error lines are put into _err and false is returned.
+bool MemcacheTextResponse::PopLine(std::string* line) {
+    char buf[policy::MEMCACHE_TEXT_MAX_LINE];
+    const int len = policy::FetchMemcacheTextLine(_buf, buf);
+    if (len < 0) {
+        butil::string_printf(&_err, "%s", (_buf.empty() ? "No more responses"
+                                           : "Incomplete response"));
+        return false;
+    }
+    _buf.pop_front(len + 2);
+    line->assign(buf, len);
+    if (*line == "ERROR" ||
+        line->compare(0, 13, "CLIENT_ERROR ") == 0 ||
+        line->compare(0, 13, "SERVER_ERROR ") == 0) {
+        _err.swap(*line);
+        return false;
+    }
+    return true;
+}
+
+bool MemcacheTextResponse::PopData(const butil::StringPiece& size,
+                                   butil::IOBuf* data) {
+    uint64_t n = 0;
+    if (!butil::StringToUint64(size, &n)) {
+        butil::string_printf(&_err, "Invalid data size=%.*s",
+                             (int)size.size(), size.data());
+        return false;
+    }
+    if (_buf.size() < n + 2) {
+        butil::string_printf(&_err, "response=%lu is shorter than data=%lu",
+                             (unsigned long)_buf.size(), (unsigned long)n);
+        return false;
+    }
+    if (data) {
+        data->clear();
+        _buf.cutn(data, n);
+    } else {
+        _buf.pop_front(n);
+    }
+    char crlf[2];
+    _buf.cutn(crlf, sizeof(crlf));
+    if (crlf[0] != '\r' || crlf[1] != '\n') {
+        butil::string_printf(&_err, "Data is not ended with \\r\\n");
+        return false;
+    }
+    return true;
+}
+
+bool MemcacheTextResponse::PopMultiGet(std::vector<Item>* items) {
+    std::string line;
+    while (PopLine(&line)) {
+        if (line == "END") {
+            _err.clear();
+            return true;
+        }
+        // VALUE <key> <flags> <bytes> [<cas unique>]
+        butil::StringPiece tokens[5];
+        int ntoken = 0;
+        for (butil::StringSplitter sp(line.data(), line.data() + line.size(), ' ');
+             sp && ntoken < 5; ++sp) {
+            tokens[ntoken++].set(sp.field(), sp.length());
+        }
+        if (ntoken < 4 || tokens[0] != "VALUE") {
+            butil::string_printf(&_err, "Unexpected line=`%s' in GET response",
+                                 line.c_str());
+            return false;
+        }
+        Item item;
+        item.cas_value = 0;
+        if (!butil::StringToUint(tokens[2], &item.flags) ||
+            (ntoken == 5 && !butil::StringToUint64(tokens[4], &item.cas_value))) {
+            butil::string_printf(&_err, "Invalid line=`%s' in GET response",
+                                 line.c_str());
+            return false;
+        }
+        if (!PopData(tokens[3], &item.value)) {
+            return false;
+        }
+        tokens[1].CopyToString(&item.key);
+        if (items) {
+            items->push_back(item);
+        }
+    }
+    return false;
+}
+
+bool MemcacheTextResponse::PopGet(
+    butil::IOBuf* value, uint32_t* flags, uint64_t* cas_value) {
+    std::vector<Item> items;
+    if (!PopMultiGet(&items)) {
+        return false;
+    }
+    if (items.empty()) {
+        butil::string_printf(&_err, "Not found");
+        return false;
+    }
+    if (value) {
+        value->swap(items[0].value);
+    }
+    if (flags) {
+        *flags = items[0].flags;
+    }
+    if (cas_value) {
+        *cas_value = items[0].cas_value;
+    }
+    return true;
+}
+
+bool MemcacheTextResponse::PopGet(
+    std::string* value, uint32_t* flags, uint64_t* cas_value) {
+    butil::IOBuf tmp;
+    if (PopGet(&tmp, flags, cas_value)) {
+        tmp.copy_to(value);
+        return true;
+    }
+    return false;
+}
+
+bool MemcacheTextResponse::PopStatus(const char* expected, const char* op) {
+    std::string line;
+    if (!PopLine(&line)) {
+        return false;
+    }
+    if (line == expected) {
+        _err.clear();
+        return true;
+    }
+    if (line == "NOT_FOUND") {
+        butil::string_printf(&_err, "Not found");
+    } else if (line == "NOT_STORED" || line == "EXISTS") {
+        _err.swap(line);
+    } else {
+        butil::string_printf(&_err, "Unexpected line=`%s' in %s response",
+                             line.c_str(), op);
+    }
+    return false;
+}
+
+bool MemcacheTextResponse::PopSet() {
+    return PopStatus("STORED", "SET");
+}
+
+bool MemcacheTextResponse::PopDelete() {
+    return PopStatus("DELETED", "DELETE");
+}
+
+// Split "<code> <flags>*" of meta responses.
+static void SplitMetaLine(const std::string& line, butil::StringPiece* code,
+                          butil::StringPiece* flags) {
+    const size_t pos = line.find(' ');
+    if (pos == std::string::npos) {
+        code->set(line.data(), line.size());
+        flags->clear();
+    } else {
+        code->set(line.data(), pos);
+        flags->set(line.data() + pos + 1, line.size() - pos - 1);
+    }
+}
+
+bool MemcacheTextResponse::PopMetaStatus(std::string* return_flags,
+                                         const char* op) {
+    std::string line;
+    if (!PopLine(&line)) {
+        return false;
+    }
+    butil::StringPiece code;
+    butil::StringPiece flags;
+    SplitMetaLine(line, &code, &flags);
+    if (return_flags) {
+        flags.CopyToString(return_flags);
+    }
+    if (code == "HD") {
+        _err.clear();
+        return true;
+    }
+    if (code == "NF" || code == "EN") {
+        butil::string_printf(&_err, "Not found");
+    } else if (code == "NS" || code == "EX") {
+        code.CopyToString(&_err);
+    } else {
+        butil::string_printf(&_err, "Unexpected line=`%s' in %s response",
+                             line.c_str(), op);
+    }
+    return false;
+}
+
+bool MemcacheTextResponse::PopMetaGet(butil::IOBuf* value,
+                                      std::string* return_flags) {
+    std::string line;
+    if (!PopLine(&line)) {
+        return false;
+    }
+    butil::StringPiece code;
+    butil::StringPiece flags;
+    SplitMetaLine(line, &code, &flags);
+    if (code == "VA") {
+        // VA <size> <flags>*
+        butil::StringPiece size = flags;
+        const size_t pos = flags.find(' ');
+        if (pos == butil::StringPiece::npos) {
+            flags.clear();
+        } else {
+            size = flags.substr(0, pos);
+            flags = flags.substr(pos + 1);
+        }
+        if (!PopData(size, value)) {
+            return false;
+        }
+    } else if (code == "HD") {
+        if (value) {
+            value->clear();
+        }
+    } else if (code == "EN") {
+        butil::string_printf(&_err, "Not found");
+        return false;
+    } else {
+        butil::string_printf(&_err, "Unexpected line=`%s' in MG response",
+                             line.c_str());
+        return false;
+    }
+    if (return_flags) {
+        flags.CopyToString(return_flags);
+    }
+    _err.clear();
+    return true;
+}
+
+bool MemcacheTextResponse::PopMetaSet(std::string* return_flags) {
+    return PopMetaStatus(return_flags, "MS");
+}
+
+bool MemcacheTextResponse::PopMetaDelete(std::string* return_flags) {
+    return PopMetaStatus(return_flags, "MD");
+}
+
+bool MemcacheTextResponse::PopMetaNoop() {
+    std::string line;
+    if (!PopLine(&line)) {
+        return false;
+    }
+    if (line != "MN") {
+        butil::string_printf(&_err, "Unexpected line=`%s' in MN response",
+                             line.c_str());
+        return false;
+    }
+    _err.clear();
+    return true;
+}
+
+// ===================================================================
+
+MemcacheGetBatcherOptions::MemcacheGetBatcherOptions()
+    : window_us(100)
+    , max_keys(64) {}
+
+struct MemcacheGetWaiter {
+    explicit MemcacheGetWaiter(const butil::StringPiece& key2)
+        : key(key2), value(NULL), flags(NULL), rc(0) {}
+
+    butil::StringPiece key;
+    butil::IOBuf* value;
+    uint32_t* flags;
+    int rc;
+    bthread::CountdownEvent event;
+};
+
+// GETs sent together, deleted after waking up all waiters.
+struct MemcacheGetBatch : public google::protobuf::Closure {
+    void Send();
+    void Run();
+    void Finish(int rc);
+
+    ChannelBase* channel;
+    std::vector<MemcacheGetWaiter*> waiters;
+    Controller cntl;
+    MemcacheTextRequest request;
+    MemcacheTextResponse response;
+};
+
+void MemcacheGetBatch::Send() {
+    std::vector<butil::StringPiece> keys(waiters.size());
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        keys[i] = waiters[i]->key;
+    }
+    // Same key may be got by different waiters.
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    if (!request.MultiGet(&keys[0], keys.size())) {
+        return Finish(EREQUEST);
+    }
+    channel->CallMethod(NULL, &cntl, &request, &response, this);
+}
+
+void MemcacheGetBatch::Finish(int rc) {
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        waiters[i]->rc = rc;
+        waiters[i]->event.signal();
+    }
+    delete this;
+}
+
+void MemcacheGetBatch::Run() {
+    if (cntl.Failed()) {
+        return Finish(cntl.ErrorCode());
+    }
+    std::vector<MemcacheTextResponse::Item> items;
+    if (!response.PopMultiGet(&items)) {
+        LOG(WARNING) << "Fail to get " << waiters.size() << " keys: "
+                     << response.LastError();
+        return Finish(ERESPONSE);
+    }
+    std::map<butil::StringPiece, const MemcacheTextResponse::Item*> found;
+    for (size_t i = 0; i < items.size(); ++i) {
+        found[items[i].key] = &items[i];
+    }
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        MemcacheGetWaiter* w = waiters[i];
+        std::map<butil::StringPiece,
+                 const MemcacheTextResponse::Item*>::const_iterator
+            it = found.find(w->key);
+        if (it == found.end()) {
+            w->rc = ENOENT;
+        } else {
+            if (w->value) {
+                *w->value = it->second->value;
+            }
+            if (w->flags) {
+                *w->flags = it->second->flags;
+            }
+            w->rc = 0;
+        }
+        w->event.signal();
+    }
+    delete this;
+}
+
+MemcacheGetBatcher::MemcacheGetBatcher()
+    : _channel(NULL)
+    , _batch(NULL)
+    , _timer_scheduled(false)
+    , _timer(0) {
+}
+
+MemcacheGetBatcher::~MemcacheGetBatcher() {
+    while (true) {
+        {
+            BAIDU_SCOPED_LOCK(_mutex);
+            if (!_timer_scheduled) {
+                break;
+            }
+            if (bthread_timer_del(_timer) == 0) {
+                _timer_scheduled = false;
+                break;
+            }
+        }
+        // The timer is running.
+        bthread_usleep(1000);
+    }
+    LOG_IF(ERROR, _batch != NULL) << "MemcacheGetBatcher is destroyed with "
+                                  "pending Get()";
+}
+
+int MemcacheGetBatcher::Init(ChannelBase* channel,
+                             const MemcacheGetBatcherOptions* options) {
+    if (channel == NULL) {
+        LOG(ERROR) << "Param[channel] is NULL";
+        return -1;
+    }
+    if (options) {
+        _options = *options;
+    }
+    if (_options.max_keys <= 0) {
+        LOG(ERROR) << "Invalid max_keys=" << _options.max_keys;
+        return -1;
+    }
+    _channel = channel;
+    return 0;
+}
+
+MemcacheGetBatch* MemcacheGetBatcher::TakeBatch() {
+    MemcacheGetBatch* batch = _batch;
+    _batch = NULL;
+    return batch;
+}
+
+static void* SendMemcacheGetBatch(void* arg) {
+    static_cast<MemcacheGetBatch*>(arg)->Send();
+    return NULL;
+}
+
+void MemcacheGetBatcher::OnWindowExpired(void* arg) {
+    MemcacheGetBatcher* batcher = static_cast<MemcacheGetBatcher*>(arg);
+    MemcacheGetBatch* batch = NULL;
+    {
+        BAIDU_SCOPED_LOCK(batcher->_mutex);
+        batcher->_timer_scheduled = false;
+        batch = batcher->TakeBatch();
+    }
+    if (batch == NULL) {
+        return;
+    }
+    // Don't send in the timer thread.
+    bthread_t th;
+    if (bthread_start_background(&th, NULL, SendMemcacheGetBatch, batch) != 0) {
+        LOG(ERROR) << "Fail to start bthread";
+        batch->Send();
+    }
+}
+
+int MemcacheGetBatcher::Get(const butil::StringPiece& key,
+                            butil::IOBuf* value, uint32_t* flags) {
+    if (_channel == NULL) {
+        LOG(ERROR) << "MemcacheGetBatcher is not initialized";
+        return EINVAL;
+    }
+    if (!IsValidKey(key)) {
+        return EREQUEST;
+    }
+    MemcacheGetWaiter waiter(key);
+    waiter.value = value;
+    waiter.flags = flags;
+    MemcacheGetBatch* full_batch = NULL;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_batch == NULL) {
+            _batch = new MemcacheGetBatch;
+            _batch->channel = _channel;
+        }
+        _batch->waiters.push_back(&waiter);
+        if ((int)_batch->waiters.size() >= _options.max_keys) {
+            full_batch = TakeBatch();
+            // If the timer is running, it finds no batch or the next one.
+            if (_timer_scheduled && bthread_timer_del(_timer) == 0) {
+                _timer_scheduled = false;
+            }
+        } else if (!_timer_scheduled) {
+            if (bthread_timer_add(&_timer,
+                                  butil::microseconds_from_now(_options.window_us),
+                                  OnWindowExpired, this) == 0) {
+                _timer_scheduled = true;
+            } else {
+                LOG(ERROR) << "Fail to add timer";
+                full_batch = TakeBatch();
+            }
+        }
+    }
+    if (full_batch) {
+        full_batch->Send();
+    }
+    waiter.event.wait();
+    return waiter.rc;
+}
+
+} // namespace brpc
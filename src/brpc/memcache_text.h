@@ -0,0 +1,266 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_MEMCACHE_TEXT_H
+#define BRPC_MEMCACHE_TEXT_H
+
+#include <string>
+#include <vector>
+#include <google/protobuf/message.h>
+
+#include "butil/iobuf.h"
+#include "butil/synchronization/lock.h"
+#include "butil/strings/string_piece.h"
+#include "bthread/types.h"
+#include "brpc/proto_base.pb.h"
+
+namespace brpc {
+
+class ChannelBase;
+
+// Request to memcache in the text protocol, including meta commands
+// (mg/ms/md/mn) of memcached 1.6+. Use a channel with protocol
+// "memcache_text"(PROTOCOL_MEMCACHE_TEXT).
+// Operations in one request are pipelined and each of them gets exactly
+// one response, which are popped from MemcacheTextResponse in the same order.
+// Example:
+//   MemcacheTextRequest request;
+//   request.MetaSet("my_key1", "some_value", "T60");
+//   request.MetaGet("my_key1", "v f c");
+//   const butil::StringPiece keys[] = { "my_key2", "my_key3" };
+//   request.MultiGet(keys, 2);
+//   MemcacheTextResponse response;
+//   channel.CallMethod(NULL, &controller, &request, &response, NULL);
+class MemcacheTextRequest : public ::google::protobuf::Message {
+public:
+    MemcacheTextRequest();
+    virtual ~MemcacheTextRequest();
+    MemcacheTextRequest(const MemcacheTextRequest& from);
+    inline MemcacheTextRequest& operator=(const MemcacheTextRequest& from) {
+        CopyFrom(from);
+        return *this;
+    }
+    void Swap(MemcacheTextRequest* other);
+
+    // Classic text commands. Keys are at most 250 bytes without spaces or
+    // control characters.
+
+    // "gets <key>"
+    bool Get(const butil::StringPiece& key);
+
+    // "gets <key1> <key2> ...", values of all found keys are returned in
+    // one response.
+    bool MultiGet(const butil::StringPiece* keys, size_t count);
+
+    // "set" if cas_value is 0, "cas" otherwise.
+    bool Set(const butil::StringPiece& key, const butil::StringPiece& value,
+             uint32_t flags, uint32_t exptime, uint64_t cas_value);
+    bool Delete(const butil::StringPiece& key);
+
+    // Meta commands. `flags' are space-separated meta flags, e.g. "v f c T30".
+    // The quiet mode flag(q) is not allowed since it breaks the one-to-one
+    // correspondence between commands and responses.
+    bool MetaGet(const butil::StringPiece& key, const butil::StringPiece& flags);
+    bool MetaSet(const butil::StringPiece& key, const butil::StringPiece& value,
+                 const butil::StringPiece& flags);
+    bool MetaDelete(const butil::StringPiece& key, const butil::StringPiece& flags);
+    bool MetaNoop();
+
+    int pipelined_count() const { return _pipelined_count; }
+
+    butil::IOBuf& raw_buffer() { return _buf; }
+    const butil::IOBuf& raw_buffer() const { return _buf; }
+
+    // Protobuf methods.
+    MemcacheTextRequest* New() const;
+    void CopyFrom(const ::google::protobuf::Message& from);
+    void MergeFrom(const ::google::protobuf::Message& from);
+    void CopyFrom(const MemcacheTextRequest& from);
+    void MergeFrom(const MemcacheTextRequest& from);
+    void Clear();
+    bool IsInitialized() const;
+
+    int ByteSize() const;
+    bool MergePartialFromCodedStream(
+        ::google::protobuf::io::CodedInputStream* input);
+    void SerializeWithCachedSizes(
+        ::google::protobuf::io::CodedOutputStream* output) const;
+    ::google::protobuf::uint8* SerializeWithCachedSizesToArray(::google::protobuf::uint8* output) const;
+    int GetCachedSize() const { return _cached_size_; }
+
+    static const ::google::protobuf::Descriptor* descriptor();
+
+protected:
+    ::google::protobuf::Metadata GetMetadata() const override;
+
+private:
+    bool AppendMetaCommand(const char* cmd, const butil::StringPiece& key,
+                           const butil::StringPiece* value,
+                           const butil::StringPiece& flags);
+
+    void SharedCtor();
+    void SharedDtor();
+    void SetCachedSize(int size) const;
+
+    int _pipelined_count;
+    butil::IOBuf _buf;
+    mutable int _cached_size_;
+};
+
+// Responses from memcache in the text protocol. Call Pop* in the same order
+// of operations in the MemcacheTextRequest. If a Pop* returns false, the
+// reason is in LastError(), which is "Not found" for misses.
+class MemcacheTextResponse : public ::google::protobuf::Message {
+public:
+    struct Item {
+        std::string key;
+        butil::IOBuf value;
+        uint32_t flags;
+        uint64_t cas_value;
+    };
+
+    MemcacheTextResponse();
+    virtual ~MemcacheTextResponse();
+    MemcacheTextResponse(const MemcacheTextResponse& from);
+    inline MemcacheTextResponse& operator=(const MemcacheTextResponse& from) {
+        CopyFrom(from);
+        return *this;
+    }
+    void Swap(MemcacheTextResponse* other);
+
+    const std::string& LastError() const { return _err; }
+
+    bool PopGet(butil::IOBuf* value, uint32_t* flags, uint64_t* cas_value);
+    bool PopGet(std::string* value, uint32_t* flags, uint64_t* cas_value);
+    // Found keys are appended to `items' in the order returned by the
+    // server, missing keys are absent. Returns true even if no key is found.
+    bool PopMultiGet(std::vector<Item>* items);
+    bool PopSet();
+    bool PopDelete();
+
+    // `return_flags' (if not NULL) is set to flags returned by the server,
+    // e.g. "f30 c5" for MetaGet(key, "v f c").
+    // PopMetaGet() sets `value' only if the "v" flag was requested.
+    bool PopMetaGet(butil::IOBuf* value, std::string* return_flags);
+    bool PopMetaSet(std::string* return_flags);
+    bool PopMetaDelete(std::string* return_flags);
+    bool PopMetaNoop();
+
+    butil::IOBuf& raw_buffer() { return _buf; }
+    const butil::IOBuf& raw_buffer() const { return _buf; }
+
+    // implements Message ----------------------------------------------
+
+    MemcacheTextResponse* New() const;
+    void CopyFrom(const ::google::protobuf::Message& from);
+    void MergeFrom(const ::google::protobuf::Message& from);
+    void CopyFrom(const MemcacheTextResponse& from);
+    void MergeFrom(const MemcacheTextResponse& from);
+    void Clear();
+    bool IsInitialized() const;
+
+    int ByteSize() const;
+    bool MergePartialFromCodedStream(
+        ::google::protobuf::io::CodedInputStream* input);
+    void SerializeWithCachedSizes(
+        ::google::protobuf::io::CodedOutputStream* output) const;
+    ::google::protobuf::uint8* SerializeWithCachedSizesToArray(::google::protobuf::uint8* output) const;
+    int GetCachedSize() const { return _cached_size_; }
+
+    static const ::google::protobuf::Descriptor* descriptor();
+
+protected:
+    ::google::protobuf::Metadata GetMetadata() const override;
+
+private:
+    bool PopLine(std::string* line);
+    bool PopData(const butil::StringPiece& size, butil::IOBuf* data);
+    bool PopStatus(const char* expected, const char* op);
+    bool PopMetaStatus(std::string* return_flags, const char* op);
+
+    void SharedCtor();
+    void SharedDtor();
+    void SetCachedSize(int size) const;
+
+    std::string _err;
+    butil::IOBuf _buf;
+    mutable int _cached_size_;
+};
+
+struct MemcacheGetBatcherOptions {
+    MemcacheGetBatcherOptions();
+
+    // A Get() waits at most so many microseconds for other Get() to be
+    // sent together.
+    // Default: 100
+    int64_t window_us;
+
+    // Send the batch immediately when it has so many keys.
+    // Default: 64
+    int max_keys;
+};
+
+struct MemcacheGetBatch;
+
+// Merge GETs issued concurrently (by different bthreads) into multi-key
+// gets, to reduce packets and syscalls on both sides and raise QPS of
+// each connection to memcache.
+// Example:
+//   brpc::ChannelOptions options;
+//   options.protocol = brpc::PROTOCOL_MEMCACHE_TEXT;
+//   options.connection_type = "pooled";
+//   brpc::Channel channel;
+//   channel.Init("127.0.0.1:11211", &options);
+//   brpc::MemcacheGetBatcher batcher;
+//   batcher.Init(&channel, NULL);
+//   ...
+//   // in many bthreads:
+//   butil::IOBuf value;
+//   if (batcher.Get("my_key", &value, NULL) == 0) { ... }
+class MemcacheGetBatcher {
+public:
+    MemcacheGetBatcher();
+    // All Get() must have returned.
+    ~MemcacheGetBatcher();
+
+    // `channel' must use PROTOCOL_MEMCACHE_TEXT and outlive this batcher.
+    // Returns 0 on success, -1 otherwise.
+    int Init(ChannelBase* channel, const MemcacheGetBatcherOptions* options);
+
+    // Get the value of `key', blocking until the batch containing it is
+    // responded. Returns 0 if the key is found, ENOENT if the key does not
+    // exist, or error code of the RPC(same as Controller::ErrorCode()).
+    int Get(const butil::StringPiece& key, butil::IOBuf* value, uint32_t* flags);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MemcacheGetBatcher);
+    static void OnWindowExpired(void* arg);
+    MemcacheGetBatch* TakeBatch();
+
+    ChannelBase* _channel;
+    MemcacheGetBatcherOptions _options;
+    butil::Mutex _mutex;
+    MemcacheGetBatch* _batch;
+    bool _timer_scheduled;
+    bthread_timer_t _timer;
+};
+
+} // namespace brpc
+
+
+#endif  // BRPC_MEMCACHE_TEXT_H
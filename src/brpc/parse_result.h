@@ -50,13 +50,13 @@ class ParseResult {
 public:
     // Create a failed parsing result.
     explicit ParseResult(ParseError err)
-        : _msg(NULL), _err(err), _user_desc(NULL) {}
+        : _msg(NULL), _err(err), _user_desc(NULL), _partial(false) {}
     // The `user_desc' must be string constant or always valid.
     explicit ParseResult(ParseError err, const char* user_desc)
-        : _msg(NULL), _err(err), _user_desc(user_desc) {}
+        : _msg(NULL), _err(err), _user_desc(user_desc), _partial(false) {}
     // Create a successful parsing result.
-    explicit ParseResult(InputMessageBase* msg)
-        : _msg(msg), _err(PARSE_OK), _user_desc(NULL) {}
+    explicit ParseResult(InputMessageBase* msg, bool partial = false)
+        : _msg(msg), _err(PARSE_OK), _user_desc(NULL), _partial(partial) {}
     
     // Return PARSE_OK when the result is successful.
     ParseError error() const { return _err; }
@@ -66,11 +66,17 @@ public:
 
     // definitely NULL when result is failed.
     InputMessageBase* message() const { return _msg; }
+
+    // True if the message was returned before the remaining data of it is
+    // parsed, e.g. headers of a http message whose body is read
+    // progressively. Such messages are processed in new bthreads at once.
+    bool is_partial() const { return _partial; }
  
 private:
     InputMessageBase* _msg;
     ParseError _err;
     const char* _user_desc;
+    bool _partial;
 };
 
 // Wrap ParseError/message into ParseResult.
@@ -85,6 +91,9 @@ inline ParseResult MakeParseError(ParseError err, const char* user_desc) {
 inline ParseResult MakeMessage(InputMessageBase* msg) {
     return ParseResult(msg);
 }
+inline ParseResult MakePartialMessage(InputMessageBase* msg) {
+    return ParseResult(msg, true);
+}
 
 } // namespace brpc
 
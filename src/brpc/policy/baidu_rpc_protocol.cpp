@@ -20,6 +20,9 @@
 #include <google/protobuf/message.h>            // Message
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <google/protobuf/io/coded_stream.h>
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+#include <google/protobuf/arena.h>
+#endif
 #include "butil/logging.h"                       // LOG()
 #include "butil/time.h"
 #include "butil/iobuf.h"                         // butil::IOBuf
@@ -36,6 +39,7 @@
 #include "brpc/policy/most_common_message.h"
 #include "brpc/policy/streaming_rpc_protocol.h"
 #include "brpc/details/usercode_backup_pool.h"
+#include "brpc/details/continuous_profiler.h"
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/details/server_private_accessor.h"
 
@@ -51,6 +55,13 @@ DEFINE_bool(baidu_protocol_use_fullname, true,
             "If this flag is true, baidu_std puts service.full_name in requests"
             ", otherwise puts service.name (required by jprotobuf).");
 
+DEFINE_bool(baidu_std_propagate_cancel, false,
+            "If this flag is true, baidu_std clients tell servers to cancel "
+            "RPCs which are canceled or timed out, so that the servers can "
+            "stop processing them. Turn on this flag only when all servers "
+            "recognize the cancellation, otherwise they reply errors to it.");
+BRPC_VALIDATE_GFLAG(baidu_std_propagate_cancel, PassValidate);
+
 // Notes:
 // 1. 12-byte header [PRPC][body_size][meta_size]
 // 2. body_size and meta_size are in network byte order
@@ -58,6 +69,49 @@ DEFINE_bool(baidu_protocol_use_fullname, true,
 // 4. `attachment_size' is set iff request/response has attachment
 // 5. Not supported: chunk_info
 
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+typedef google::protobuf::Arena PbArena;
+
+// Create an Arena for messages of a RPC whose request is `req_size' bytes,
+// blocks are sized to hold the request in a few allocations.
+static PbArena* NewPbArena(size_t req_size) {
+    google::protobuf::ArenaOptions options;
+    options.start_block_size = std::min(std::max(req_size * 2, (size_t)256),
+                                        (size_t)(1 << 20));
+    options.max_block_size = std::max(options.start_block_size, (size_t)8192);
+    return new PbArena(options);
+}
+
+static google::protobuf::Message* NewMessage(
+    const google::protobuf::Message& prototype, PbArena* arena) {
+    return prototype.New(arena);
+}
+#else
+struct PbArena {};
+
+static PbArena* NewPbArena(size_t) { return NULL; }
+
+static google::protobuf::Message* NewMessage(
+    const google::protobuf::Message& prototype, PbArena*) {
+    return prototype.New();
+}
+#endif
+
+// Messages allocated with an Arena are owned by the Arena. Whether they are
+// can't be told by GetArena(): with protobuf < 3.14, types without
+// cc_enable_arenas are allocated on heap, registered by Arena::Own() and
+// GetArena() returns NULL.
+struct DeleteUnlessOwnedByArena {
+    explicit DeleteUnlessOwnedByArena(bool owned_by_arena = false)
+        : owned_by_arena(owned_by_arena) {}
+    void operator()(const google::protobuf::Message* msg) const {
+        if (!owned_by_arena) {
+            delete msg;
+        }
+    }
+    bool owned_by_arena;
+};
+
 // Pack header into `buf'
 inline void PackRpcHeader(char* rpc_header, int meta_size, int payload_size) {
     uint32_t* dummy = (uint32_t*)rpc_header;  // suppress strict-alias warning
@@ -132,14 +186,15 @@ ParseResult ParseRpcMessage(butil::IOBuf* source, Socket* socket,
     return MakeMessage(msg);
 }
 
-// Used by UT, can't be static.
-void SendRpcResponse(int64_t correlation_id,
-                     Controller* cntl, 
-                     const google::protobuf::Message* req,
-                     const google::protobuf::Message* res,
-                     const Server* server,
-                     MethodStatus* method_status,
-                     int64_t received_us) {
+// `req' and `res' are deleted unless `owned_by_arena' is true.
+static void SendRpcResponseImpl(int64_t correlation_id,
+                                Controller* cntl,
+                                const google::protobuf::Message* req,
+                                const google::protobuf::Message* res,
+                                const Server* server,
+                                MethodStatus* method_status,
+                                int64_t received_us,
+                                bool owned_by_arena) {
     ControllerPrivateAccessor accessor(cntl);
     Span* span = accessor.span();
     if (span) {
@@ -148,8 +203,10 @@ void SendRpcResponse(int64_t correlation_id,
     Socket* sock = accessor.get_sending_socket();
     std::unique_ptr<Controller, LogErrorTextAndDelete> recycle_cntl(cntl);
     ConcurrencyRemover concurrency_remover(method_status, cntl, received_us);
-    std::unique_ptr<const google::protobuf::Message> recycle_req(req);
-    std::unique_ptr<const google::protobuf::Message> recycle_res(res);
+    std::unique_ptr<const google::protobuf::Message, DeleteUnlessOwnedByArena>
+        recycle_req(req, DeleteUnlessOwnedByArena(owned_by_arena));
+    std::unique_ptr<const google::protobuf::Message, DeleteUnlessOwnedByArena>
+        recycle_res(res, DeleteUnlessOwnedByArena(owned_by_arena));
     
     StreamId response_stream_id = accessor.response_stream();
 
@@ -265,6 +322,33 @@ void SendRpcResponse(int64_t correlation_id,
     }
 }
 
+// Used by UT, can't be static.
+void SendRpcResponse(int64_t correlation_id,
+                     Controller* cntl, 
+                     const google::protobuf::Message* req,
+                     const google::protobuf::Message* res,
+                     const Server* server,
+                     MethodStatus* method_status,
+                     int64_t received_us) {
+    SendRpcResponseImpl(correlation_id, cntl, req, res, server,
+                        method_status, received_us, false);
+}
+
+// Destroy `arena' after the response is sent, which owns `req' and `res'
+// if it's not NULL.
+static void SendRpcResponseAndDeleteArena(int64_t correlation_id,
+                                          Controller* cntl,
+                                          const google::protobuf::Message* req,
+                                          const google::protobuf::Message* res,
+                                          const Server* server,
+                                          MethodStatus* method_status,
+                                          int64_t received_us,
+                                          PbArena* arena) {
+    SendRpcResponseImpl(correlation_id, cntl, req, res, server,
+                        method_status, received_us, arena != NULL);
+    delete arena;
+}
+
 struct CallMethodInBackupThreadArgs {
     ::google::protobuf::Service* service;
     const ::google::protobuf::MethodDescriptor* method;
@@ -276,6 +360,9 @@ struct CallMethodInBackupThreadArgs {
 
 static void CallMethodInBackupThread(void* void_args) {
     CallMethodInBackupThreadArgs* args = (CallMethodInBackupThreadArgs*)void_args;
+    ScopedServerDeadline sd(
+        static_cast<Controller*>(args->controller)->deadline_us());
+    ScopedCpuProfilingTag pt(args->method->full_name().c_str());
     args->service->CallMethod(args->method, args->controller, args->request,
                               args->response, args->done);
     delete args;
@@ -314,6 +401,12 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
                           socket->description().c_str());
         return;
     }
+    if (meta.cancel()) {
+        // Not a request, no response.
+        non_service_error.release();
+        ServerCallMap::Cancel(socket->id(), meta.correlation_id());
+        return;
+    }
     const RpcRequestMeta &request_meta = meta.request();
 
     SampledRequest* sample = AskToBeSampled();
@@ -333,8 +426,10 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         LOG(WARNING) << "Fail to new Controller";
         return;
     }
-    std::unique_ptr<google::protobuf::Message> req;
-    std::unique_ptr<google::protobuf::Message> res;
+    // Declared before `req' and `res' which may be allocated on it.
+    std::unique_ptr<PbArena> arena;
+    std::unique_ptr<google::protobuf::Message, DeleteUnlessOwnedByArena> req;
+    std::unique_ptr<google::protobuf::Message, DeleteUnlessOwnedByArena> res;
 
     ServerPrivateAccessor server_accessor(server);
     ControllerPrivateAccessor accessor(cntl.get());
@@ -346,6 +441,10 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     if (request_meta.has_request_id()) {
         cntl->set_request_id(request_meta.request_id());
     }
+    if (request_meta.has_timeout_ms()) {
+        accessor.set_deadline_us(msg->base_real_us() + msg->received_us() +
+                                 request_meta.timeout_ms() * 1000L);
+    }
     cntl->set_request_compress_type((CompressType)meta.compress_type());
     accessor.set_server(server)
         .set_security_mode(security_mode)
@@ -356,6 +455,9 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         .set_request_protocol(PROTOCOL_BAIDU_STD)
         .set_begin_time_us(msg->received_us())
         .move_in_server_receiving_sock(socket_guard);
+    if (request_meta.cancelable()) {
+        accessor.set_cancelable(meta.correlation_id());
+    }
 
     if (meta.has_stream_settings()) {
         accessor.set_remote_stream_settings(meta.release_stream_settings());
@@ -445,6 +547,20 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
                                 mp->method->full_name().c_str(), rejected_cc);
                 break;
             }
+            if (!method_status->OnQueued(
+                    butil::cpuwide_time_us() - msg->received_us())) {
+                cntl->SetFailed(ELIMIT, "Rejected by %s's QueueingDelayLimiter",
+                                mp->method->full_name().c_str());
+                break;
+            }
+        }
+        if (cntl->deadline_us() >= 0 &&
+            butil::gettimeofday_us() >= cntl->deadline_us()) {
+            // The client has given up, don't waste time on it.
+            cntl->SetFailed(ERPCTIMEDOUT, "Deadline of the request was "
+                            "reached before calling %s",
+                            mp->method->full_name().c_str());
+            break;
         }
         google::protobuf::Service* svc = mp->service;
         const google::protobuf::MethodDescriptor* method = mp->method;
@@ -469,7 +585,14 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
         }
 
         CompressType req_cmp_type = (CompressType)meta.compress_type();
-        req.reset(svc->GetRequestPrototype(method).New());
+        if (server->options().use_pb_arena) {
+            arena.reset(NewPbArena(req_size));
+        }
+        // Recorded here since GetArena() of the messages may be NULL even
+        // if they're allocated with the arena.
+        req.get_deleter().owned_by_arena = (arena != NULL);
+        res.get_deleter().owned_by_arena = (arena != NULL);
+        req.reset(NewMessage(svc->GetRequestPrototype(method), arena.get()));
         if (!ParseFromCompressedData(*req_buf_ptr, req.get(), req_cmp_type)) {
             cntl->SetFailed(EREQUEST, "Fail to parse request message, "
                             "CompressType=%s, request_size=%d", 
@@ -477,15 +600,15 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             break;
         }
         
-        res.reset(svc->GetResponsePrototype(method).New());
+        res.reset(NewMessage(svc->GetResponsePrototype(method), arena.get()));
         // `socket' will be held until response has been sent
         google::protobuf::Closure* done = ::brpc::NewCallback<
             int64_t, Controller*, const google::protobuf::Message*,
             const google::protobuf::Message*, const Server*,
-            MethodStatus*, int64_t>(
-                &SendRpcResponse, meta.correlation_id(), cntl.get(), 
-                req.get(), res.get(), server,
-                method_status, msg->received_us());
+            MethodStatus*, int64_t, PbArena*>(
+                &SendRpcResponseAndDeleteArena, meta.correlation_id(),
+                cntl.get(), req.get(), res.get(), server,
+                method_status, msg->received_us(), arena.release());
 
         // optional, just release resourse ASAP
         msg.reset();
@@ -496,12 +619,18 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
             span->AsParent();
         }
         if (!FLAGS_usercode_in_pthread) {
+            ScopedServerDeadline sd(cntl->deadline_us());
+            ScopedCpuProfilingTag pt(method->full_name().c_str());
             return svc->CallMethod(method, cntl.release(), 
                                    req.release(), res.release(), done);
         }
         if (BeginRunningUserCode()) {
-            svc->CallMethod(method, cntl.release(), 
-                            req.release(), res.release(), done);
+            {
+                ScopedServerDeadline sd(cntl->deadline_us());
+                ScopedCpuProfilingTag pt(method->full_name().c_str());
+                svc->CallMethod(method, cntl.release(), 
+                                req.release(), res.release(), done);
+            }
             return EndRunningUserCodeInPlace();
         } else {
             return EndRunningCallMethodInPool(
@@ -512,9 +641,9 @@ void ProcessRpcRequest(InputMessageBase* msg_base) {
     
     // `cntl', `req' and `res' will be deleted inside `SendRpcResponse'
     // `socket' will be held until response has been sent
-    SendRpcResponse(meta.correlation_id(), cntl.release(), 
-                    req.release(), res.release(), server,
-                    method_status, msg->received_us());
+    SendRpcResponseImpl(meta.correlation_id(), cntl.release(),
+                        req.release(), res.release(), server,
+                        method_status, msg->received_us(), arena != NULL);
 }
 
 bool VerifyRpcRequest(const InputMessageBase* msg_base) {
@@ -654,6 +783,13 @@ void PackRpcRequest(butil::IOBuf* req_buf,
     if (!cntl->request_id().empty()) {
         request_meta->set_request_id(cntl->request_id());
     }
+    const int64_t timeout_ms = accessor.remaining_timeout_ms();
+    if (timeout_ms >= 0) {
+        request_meta->set_timeout_ms(timeout_ms);
+    }
+    if (FLAGS_baidu_std_propagate_cancel) {
+        request_meta->set_cancelable(true);
+    }
     meta.set_correlation_id(correlation_id);
     StreamId request_stream_id = accessor.request_stream();
     if (request_stream_id != INVALID_STREAM_ID) {
@@ -686,5 +822,20 @@ void PackRpcRequest(butil::IOBuf* req_buf,
     }
 }
 
+void CancelRpcRequest(Socket* sending_sock, uint64_t correlation_id) {
+    if (!FLAGS_baidu_std_propagate_cancel) {
+        return;
+    }
+    RpcMeta meta;
+    meta.set_correlation_id(correlation_id);
+    meta.set_cancel(true);
+    butil::IOBuf buf;
+    SerializeRpcHeaderAndMeta(&buf, meta, 0);
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    // Best effort, the RPC is ended anyway.
+    sending_sock->Write(&buf, &wopt);
+}
+
 }  // namespace policy
 } // namespace brpc
@@ -46,6 +46,9 @@ void PackRpcRequest(butil::IOBuf* buf,
                     const butil::IOBuf& request,
                     const Authenticator* auth);
 
+// Tell the server to cancel the RPC with `correlation_id'.
+void CancelRpcRequest(Socket* sending_sock, uint64_t correlation_id);
+
 }  // namespace policy
 } // namespace brpc
 
@@ -18,8 +18,11 @@
 
 #include "brpc/policy/http2_rpc_protocol.h"
 #include "brpc/details/controller_private_accessor.h"
+#include "brpc/details/server_private_accessor.h"
 #include "brpc/server.h"
+#include "brpc/policy/gzip_compress.h"
 #include "butil/base64.h"
+#include "butil/sys_byteorder.h"
 #include "brpc/log.h"
 
 namespace brpc {
@@ -28,6 +31,7 @@ DECLARE_bool(http_verbose);
 DECLARE_int32(http_verbose_max_body_length);
 DECLARE_int32(health_check_interval);
 DECLARE_bool(usercode_in_pthread);
+DECLARE_uint64(max_body_size);
 
 namespace policy {
 
@@ -42,10 +46,10 @@ DEFINE_int32(h2_client_max_frame_size,
              H2Settings::DEFAULT_MAX_FRAME_SIZE,
              "Size of the largest frame payload that client is willing to receive");
 
-DEFINE_bool(h2_hpack_encode_name, false,
-            "Encode name in HTTP2 headers with huffman encoding");
-DEFINE_bool(h2_hpack_encode_value, false,
-            "Encode value in HTTP2 headers with huffman encoding");
+DEFINE_bool(h2_hpack_encode_name, true,
+            "Encode name in HTTP2 headers with huffman encoding if it's shorter");
+DEFINE_bool(h2_hpack_encode_value, true,
+            "Encode value in HTTP2 headers with huffman encoding if it's shorter");
 
 static bool CheckStreamWindowSize(const char*, int32_t val) {
     return val >= 0;
@@ -324,6 +328,7 @@ inline H2Context::FrameHandler FindFrameHandler(H2FrameType type) {
 
 H2Context::H2Context(Socket* socket, const Server* server)
     : _socket(socket)
+    , _server(server)
     // Maximize the window size to make sending big request possible before
     // receving the remote settings.
     , _remote_window_left(H2Settings::MAX_WINDOW_SIZE)
@@ -359,6 +364,11 @@ H2Context::~H2Context() {
         delete it->second;
     }
     _pending_streams.clear();
+    for (size_t i = 0; i < _blocked_messages.size(); ++i) {
+        // Destroyed by the deleter.
+        SocketMessagePtr<> msg(_blocked_messages[i]);
+    }
+    _blocked_messages.clear();
 }
 
 int H2Context::Init() {
@@ -519,7 +529,12 @@ ParseResult H2Context::Consume(
             }
             H2StreamContext* sctx = RemoveStream(h2_res.stream_id());
             if (sctx) {
-                if (is_server_side()) {
+                if (sctx->grpc_stream() != NULL) {
+                    std::string error_text = "Reset the stream: ";
+                    error_text.append(H2ErrorToString(h2_res.error()));
+                    sctx->grpc_stream()->OnRemoteClosed(ECONNRESET, error_text);
+                }
+                if (is_server_side() || sctx->_grpc_dispatched) {
                     delete sctx;
                     return MakeMessage(NULL);
                 } else {
@@ -643,9 +658,10 @@ H2ParseResult H2StreamContext::OnHeaders(
             return MakeH2Error(H2_PROTOCOL_ERROR);
         }
         if (frame_head.flags & H2_FLAGS_END_STREAM) {
+            OnEndHeaders(true);
             return OnEndStream();
         }
-        return MakeH2Message(NULL);
+        return OnEndHeaders(false);
     } else {
         if (frame_head.flags & H2_FLAGS_END_STREAM) {
             // Delay calling OnEndStream() in OnContinuation()
@@ -693,12 +709,149 @@ H2ParseResult H2StreamContext::OnContinuation(
             return MakeH2Error(H2_PROTOCOL_ERROR);
         }
         if (_stream_ended) {
+            OnEndHeaders(true);
             return OnEndStream();
         }
+        return OnEndHeaders(false);
     }
     return MakeH2Message(NULL);
 }
 
+const CommonStrings* get_common_strings();
+
+// Find the streaming method that a gRPC request calls.
+static const google::protobuf::MethodDescriptor*
+FindGrpcStreamingMethod(const Server* server, const HttpHeader& h) {
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+    if (server == NULL) {
+        return NULL;
+    }
+    bool is_grpc_ct = false;
+    if (ParseContentType(h.content_type(), &is_grpc_ct) != HTTP_CONTENT_PROTO
+        || !is_grpc_ct) {
+        return NULL;
+    }
+    // The path is "/<full service name>/<method name>".
+    const std::string& path = h.uri().path();
+    const size_t slash_pos = path.find('/', 1);
+    if (path.size() < 2 || path[0] != '/' || slash_pos == std::string::npos) {
+        return NULL;
+    }
+    ServerPrivateAccessor accessor(server);
+    const Server::MethodProperty* mp = accessor.FindMethodPropertyByFullName(
+        butil::StringPiece(path.data() + 1, slash_pos - 1),
+        butil::StringPiece(path.data() + slash_pos + 1,
+                           path.size() - slash_pos - 1));
+    if (mp == NULL || mp->method == NULL) {
+        return NULL;
+    }
+    if (mp->method->client_streaming() || mp->method->server_streaming()) {
+        return mp->method;
+    }
+#else
+    (void)server;
+    (void)h;
+#endif
+    return NULL;
+}
+
+static bool IsGrpcClientStreaming(const google::protobuf::MethodDescriptor* md) {
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+    return md == NULL || md->client_streaming();
+#else
+    return md == NULL;
+#endif
+}
+
+static bool IsGrpcGzip(const HttpHeader& h) {
+    const CommonStrings* const common = get_common_strings();
+    const std::string* encoding = h.GetHeader(common->GRPC_ENCODING);
+    return encoding != NULL && *encoding == common->GZIP;
+}
+
+// grpc-status and grpc-message of the trailers, or the HTTP error if the
+// response is not gRPC.
+static void GetGrpcStatus(const HttpHeader& h, int* error_code,
+                          std::string* error_text) {
+    const CommonStrings* const common = get_common_strings();
+    const std::string* grpc_status = h.GetHeader(common->GRPC_STATUS);
+    if (grpc_status == NULL) {
+        if (h.status_code() != HTTP_STATUS_OK) {
+            *error_code = EHTTP;
+            butil::string_printf(error_text, "HTTP status=%d",
+                                 h.status_code());
+        } else {
+            *error_code = ERESPONSE;
+            *error_text = "Missing grpc-status in trailers";
+        }
+        return;
+    }
+    const GrpcStatus status = (GrpcStatus)strtol(grpc_status->c_str(), NULL, 10);
+    *error_code = GrpcStatusToErrorCode(status);
+    error_text->clear();
+    if (*error_code != 0) {
+        const std::string* grpc_message = h.GetHeader(common->GRPC_MESSAGE);
+        if (grpc_message) {
+            PercentDecode(*grpc_message, error_text);
+        } else {
+            butil::string_printf(error_text, "%s", GrpcStatusToString(status));
+        }
+    }
+}
+
+// Create the gRPC stream if the headers start a streaming call. Returns the
+// message to dispatch, which is always NULL if `end_stream' is true.
+H2ParseResult H2StreamContext::OnEndHeaders(bool end_stream) {
+    if (_grpc_dispatched) {
+        // Trailers without END_STREAM are not allowed, just ignore them.
+        return MakeH2Message(NULL);
+    }
+    if (_conn_ctx->is_server_side()) {
+        if (_grpc_stream != NULL) {
+            return MakeH2Message(NULL);
+        }
+        const google::protobuf::MethodDescriptor* md =
+            FindGrpcStreamingMethod(_conn_ctx->_server, header());
+        if (md == NULL) {
+            return MakeH2Message(NULL);
+        }
+        H2GrpcStream* s = new H2GrpcStream(true);
+        _grpc_stream.reset(s);
+        s->set_client_streaming(IsGrpcClientStreaming(md));
+        s->set_recv_gzip(IsGrpcGzip(header()));
+        s->OnCreated(_conn_ctx, _conn_ctx->_socket, stream_id(), NULL, NULL);
+        if (!s->client_streaming() || end_stream) {
+            // The request is the only message, dispatch it at END_STREAM.
+            return MakeH2Message(NULL);
+        }
+        return DispatchGrpcStream();
+    }
+    if (_grpc_stream == NULL || end_stream ||
+        header().status_code() / 100 == 1) {
+        // Trailers-only responses are handled in OnEndStream().
+        return MakeH2Message(NULL);
+    }
+    // Response headers of the streaming call, which completes the RPC.
+    _grpc_stream->set_recv_gzip(IsGrpcGzip(header()));
+    return DispatchGrpcStream();
+}
+
+H2ParseResult H2StreamContext::DispatchGrpcStream() {
+    // This context stays in the connection to receive following frames of
+    // the stream, pass a copy to user.
+    H2StreamContext* head = new H2StreamContext(false);
+    head->Init(_conn_ctx, stream_id());
+    head->set_correlation_id(_correlation_id);
+    head->header().Swap(header());
+    head->body().swap(body());
+    head->_parsed_length = _parsed_length;
+    head->_grpc_stream = _grpc_stream;
+    head->_is_grpc_head = true;
+    head->OnMessageComplete();
+    _grpc_dispatched = true;
+    return MakeH2Message(head);
+}
+
 H2ParseResult H2Context::OnData(
     butil::IOBufBytesIterator& it, const H2FrameHead& frame_head) {
     uint32_t frag_size = frame_head.payload_size;
@@ -735,6 +888,22 @@ H2ParseResult H2StreamContext::OnData(
     butil::IOBuf data;
     it.append_and_forward(&data, frag_size);
     it.forward(pad_length);
+    if (_grpc_dispatched) {
+        // Stream-level window is given back by the gRPC stream after
+        // messages are consumed, which slows down the peer.
+        _conn_ctx->DeferWindowUpdate(frag_size);
+        const int64_t window_size = std::max(
+            _conn_ctx->local_settings().stream_window_size,
+            _conn_ctx->_unack_local_settings.stream_window_size);
+        const H2Error h2_error = _grpc_stream->OnData(&data, window_size);
+        if (h2_error != H2_NO_ERROR) {
+            return MakeH2Error(h2_error, frame_head.stream_id);
+        }
+        if (frame_head.flags & H2_FLAGS_END_STREAM) {
+            return OnEndStream();
+        }
+        return MakeH2Message(NULL);
+    }
     for (size_t i = 0; i < data.backing_block_num(); ++i) {
         const butil::StringPiece blk = data.backing_block(i);
         if (OnBody(blk.data(), blk.size()) != 0) {
@@ -785,6 +954,10 @@ H2ParseResult H2Context::OnResetStream(
     const H2Error h2_error = static_cast<H2Error>(LoadUint32(it));
     H2StreamContext* sctx = FindStream(frame_head.stream_id);
     if (sctx == NULL) {
+        if (is_server_side()) {
+            // The request may be being processed, notify the handler.
+            ServerCallMap::Cancel(_socket->id(), frame_head.stream_id);
+        }
         RPC_VLOG << "Fail to find stream_id=" << frame_head.stream_id;
         return MakeH2Message(NULL);
     }
@@ -810,6 +983,22 @@ H2ParseResult H2StreamContext::OnResetStream(
         LOG(ERROR) << "Fail to find stream_id=" << stream_id();
         return MakeH2Error(H2_PROTOCOL_ERROR);
     }
+    if (sctx->_grpc_stream != NULL) {
+        if (h2_error == H2_CANCEL) {
+            sctx->_grpc_stream->OnRemoteClosed(ECANCELED, "The stream was canceled");
+        } else {
+            std::string error_text = "The stream was reset: ";
+            error_text.append(H2ErrorToString(h2_error));
+            sctx->_grpc_stream->OnRemoteClosed(ECONNRESET, error_text);
+        }
+        if (sctx->_grpc_dispatched) {
+            if (_conn_ctx->is_server_side()) {
+                ServerCallMap::Cancel(_conn_ctx->_socket->id(), stream_id());
+            }
+            delete sctx;
+            return MakeH2Message(NULL);
+        }
+    }
     if (_conn_ctx->is_client_side()) {
         sctx->header().set_status_code(H2ErrorToStatusCode(h2_error));
         return MakeH2Message(sctx);
@@ -832,6 +1021,31 @@ H2ParseResult H2StreamContext::OnEndStream() {
         return MakeH2Error(H2_PROTOCOL_ERROR);
     }
 #endif
+    if (_grpc_stream != NULL) {
+        if (_conn_ctx->is_server_side()) {
+            // Keep this context in the connection to receive WINDOW_UPDATE
+            // until the server ends the call.
+            if (_grpc_dispatched) {
+                _grpc_stream->OnRemoteClosed(0, std::string());
+                return MakeH2Message(NULL);
+            }
+            H2ParseResult res = DispatchGrpcStream();
+            _grpc_stream->OnRemoteClosed(0, std::string());
+            return res;
+        }
+        int error_code = 0;
+        std::string error_text;
+        GetGrpcStatus(header(), &error_code, &error_text);
+        _grpc_stream->OnRemoteClosed(error_code, error_text);
+        if (_grpc_dispatched) {
+            // Trailers of a call whose RPC already completed.
+            H2StreamContext* sctx = _conn_ctx->RemoveStream(stream_id());
+            CHECK_EQ(sctx, this);
+            delete sctx;
+            return MakeH2Message(NULL);
+        }
+        // Otherwise it's a trailers-only response which fails the RPC.
+    }
     H2StreamContext* sctx = _conn_ctx->RemoveStream(stream_id());
     if (sctx == NULL) {
         RPC_VLOG << "Fail to find stream_id=" << stream_id();
@@ -901,8 +1115,15 @@ H2ParseResult H2Context::OnSettings(
             if (!AddWindowSize(&it->second->_remote_window_left, window_diff)) {
                 return MakeH2Error(H2_FLOW_CONTROL_ERROR);
             }
+            H2GrpcStream* gs = it->second->grpc_stream();
+            if (gs != NULL && !gs->AddRemoteWindowSize(window_diff)) {
+                return MakeH2Error(H2_FLOW_CONTROL_ERROR);
+            }
         }
     }
+    if (window_diff > 0) {
+        FlushBlockedStreams();
+    }
     // Respond with ack
     char headbuf[FRAME_HEAD_SIZE];
     SerializeFrameHead(headbuf, 0, H2_FRAME_SETTINGS, H2_FLAGS_ACK, 0);
@@ -983,9 +1204,22 @@ H2ParseResult H2Context::OnGoAway(
         if (goaway_streams.empty()) {
             return MakeH2Message(NULL);
         }
+        size_t n = 0;
         for (size_t i = 0; i < goaway_streams.size(); ++i) {
             H2StreamContext* sctx = goaway_streams[i];
+            if (sctx->_grpc_dispatched) {
+                // The RPC completed already, end the gRPC stream only.
+                sctx->_grpc_stream->OnRemoteClosed(
+                    ELOGOFF, "The stream was refused by GOAWAY");
+                delete sctx;
+                continue;
+            }
             sctx->header().set_status_code(HTTP_STATUS_SERVICE_UNAVAILABLE);
+            goaway_streams[n++] = sctx;
+        }
+        goaway_streams.resize(n);
+        if (goaway_streams.empty()) {
+            return MakeH2Message(NULL);
         }
         for (size_t i = 1; i < goaway_streams.size(); ++i) {
             bthread_t th;
@@ -1019,6 +1253,7 @@ H2ParseResult H2Context::OnWindowUpdate(
             LOG(ERROR) << "Invalid connection-level window_size_increment=" << inc;
             return MakeH2Error(H2_FLOW_CONTROL_ERROR);
         }
+        FlushBlockedStreams();
         return MakeH2Message(NULL);
     } else {
         H2StreamContext* sctx = FindStream(frame_head.stream_id);
@@ -1026,6 +1261,14 @@ H2ParseResult H2Context::OnWindowUpdate(
             RPC_VLOG << "Fail to find stream_id=" << frame_head.stream_id;
             return MakeH2Message(NULL);
         }
+        if (sctx->grpc_stream() != NULL) {
+            if (!sctx->grpc_stream()->AddRemoteWindowSize(inc)) {
+                LOG(ERROR) << "Invalid stream-level window_size_increment=" << inc;
+                return MakeH2Error(H2_FLOW_CONTROL_ERROR);
+            }
+            sctx->grpc_stream()->Flush();
+            return MakeH2Message(NULL);
+        }
         if (!AddWindowSize(&sctx->_remote_window_left, inc)) {
             LOG(ERROR) << "Invalid stream-level window_size_increment=" << inc
                 << " to remote_window_left=" << sctx->_remote_window_left.load(butil::memory_order_relaxed);
@@ -1168,7 +1411,9 @@ H2StreamContext::H2StreamContext(bool read_body_progressively)
     , _stream_ended(false)
     , _remote_window_left(0)
     , _deferred_window_update(0)
-    , _correlation_id(INVALID_BTHREAD_ID.value) {
+    , _correlation_id(INVALID_BTHREAD_ID.value)
+    , _is_grpc_head(false)
+    , _grpc_dispatched(false) {
     header().set_version(2, 0);
 #ifndef NDEBUG
     get_h2_bvars()->h2_stream_context_count << 1;
@@ -1183,6 +1428,10 @@ void H2StreamContext::Init(H2Context* conn_ctx, int stream_id) {
 }
 
 H2StreamContext::~H2StreamContext() {
+    if (_grpc_stream != NULL && !_is_grpc_head) {
+        // No-op if the stream was closed normally.
+        _grpc_stream->OnRemoteClosed(EFAILEDSOCKET, "The stream was abandoned");
+    }
 #ifndef NDEBUG
     get_h2_bvars()->h2_stream_context_count << -1;
 #endif
@@ -1308,19 +1557,27 @@ int H2StreamContext::ConsumeHeaders(butil::IOBufBytesIterator& it) {
     return 0;
 }
 
-const CommonStrings* get_common_strings();
+// Encode `h' with the index policy suggested for it.
+inline void EncodeH2Header(HPacker& hpacker, butil::IOBufAppender* out,
+                           const HPacker::Header& h, HPackOptions& options) {
+    options.index_policy = hpacker.SuggestIndexPolicy(h);
+    hpacker.Encode(out, h, options);
+}
 
+// The stream is left open if `end_stream' is false, which is used by gRPC
+// streams sending messages after headers.
 static void PackH2Message(butil::IOBuf* out,
                           butil::IOBuf& headers,
                           butil::IOBuf& trailer_headers,
                           const butil::IOBuf& data,
                           int stream_id,
-                          H2Context* conn_ctx) {
+                          H2Context* conn_ctx,
+                          bool end_stream) {
     const H2Settings& remote_settings = conn_ctx->remote_settings();
     char headbuf[FRAME_HEAD_SIZE];
     H2FrameHead headers_head = {
         (uint32_t)headers.size(), H2_FRAME_HEADERS, 0, stream_id};
-    if (data.empty() && trailer_headers.empty()) {
+    if (data.empty() && trailer_headers.empty() && end_stream) {
         headers_head.flags |= H2_FLAGS_END_STREAM;
     }
     if (headers_head.payload_size <= remote_settings.max_frame_size) {
@@ -1353,7 +1610,7 @@ static void PackH2Message(butil::IOBuf* out,
         while (it.bytes_left()) {
             if (it.bytes_left() <= remote_settings.max_frame_size) {
                 data_head.payload_size = it.bytes_left();
-                if (trailer_headers.empty()) {
+                if (trailer_headers.empty() && end_stream) {
                     data_head.flags |= H2_FLAGS_END_STREAM;
                 }
             } else {
@@ -1486,6 +1743,13 @@ void H2UnsentRequest::DestroyStreamUserData(SocketUniquePtr& sending_sock,
         if (_stream_id != 0) {
             H2Context* ctx = static_cast<H2Context*>(sending_sock->parsing_context());
             ctx->AddAbandonedStream(_stream_id);
+            if (error_code == ECANCELED || error_code == ERPCTIMEDOUT) {
+                // Tell the server to stop processing the stream.
+                char rstbuf[FRAME_HEAD_SIZE + 4];
+                SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, _stream_id);
+                SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_CANCEL);
+                WriteAck(sending_sock.get(), rstbuf, sizeof(rstbuf));
+            }
         }
     }
 }
@@ -1551,8 +1815,11 @@ H2UnsentRequest::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
     }
 
     _sctx->Init(ctx, id);
-    // check flow control restriction
-    if (!_cntl->request_attachment().empty()) {
+    H2GrpcStream* grpc_stream = static_cast<H2GrpcStream*>(
+        ControllerPrivateAccessor(_cntl).grpc_stream());
+    // check flow control restriction, messages of gRPC streams are sent
+    // as windows allow.
+    if (grpc_stream == NULL && !_cntl->request_attachment().empty()) {
         const int64_t data_size = _cntl->request_attachment().size();
         if (!_sctx->ConsumeWindowSize(data_size)) {
             return butil::Status(ELIMIT, "remote_window_left is not enough, data_size=%" PRId64, data_size);
@@ -1567,7 +1834,12 @@ H2UnsentRequest::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
     }
     _stream_id = _sctx->stream_id();
     // After calling TryToInsertStream, the ownership of _sctx is transferred to ctx
-    _sctx.release();
+    H2StreamContext* sctx = _sctx.release();
+    if (grpc_stream != NULL) {
+        // Responses can't arrive before the request is written, no race
+        // with the parsing thread.
+        sctx->set_grpc_stream(grpc_stream);
+    }
 
     HPacker& hpacker = ctx->hpacker();
     butil::IOBufAppender appender;
@@ -1575,20 +1847,28 @@ H2UnsentRequest::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
     options.encode_name = FLAGS_h2_hpack_encode_name;
     options.encode_value = FLAGS_h2_hpack_encode_value;
     for (size_t i = 0; i < _size; ++i) {
-        hpacker.Encode(&appender, _list[i], options);
+        EncodeH2Header(hpacker, &appender, _list[i], options);
     }
     if (_cntl->has_http_request()) {
         const HttpHeader& h = _cntl->http_request();
         for (HttpHeader::HeaderIterator it = h.HeaderBegin();
              it != h.HeaderEnd(); ++it) {
             HPacker::Header header(it->first, it->second);
-            hpacker.Encode(&appender, header, options);
+            EncodeH2Header(hpacker, &appender, header, options);
         }
     }
     butil::IOBuf frag;
     appender.move_to(frag);
     butil::IOBuf dummy_buf;
-    PackH2Message(out, frag, dummy_buf, _cntl->request_attachment(), _stream_id, ctx);
+    if (grpc_stream == NULL) {
+        PackH2Message(out, frag, dummy_buf, _cntl->request_attachment(),
+                      _stream_id, ctx, true);
+    } else {
+        PackH2Message(out, frag, dummy_buf, butil::IOBuf(), _stream_id, ctx, false);
+        grpc_stream->set_client_streaming(IsGrpcClientStreaming(_cntl->method()));
+        grpc_stream->OnCreated(ctx, socket, _stream_id,
+                               &_cntl->request_attachment(), out);
+    }
     return butil::Status::OK();
 }
 
@@ -1636,19 +1916,23 @@ void H2UnsentRequest::Print(std::ostream& os) const {
 
 }
 
-H2UnsentResponse::H2UnsentResponse(Controller* c, int stream_id, bool is_grpc)
+H2UnsentResponse::H2UnsentResponse(Controller* c, int stream_id, bool is_grpc,
+                                   bool grpc_stream_accepted)
     : _size(0)
     , _stream_id(stream_id)
     , _http_response(c->release_http_response())
-    , _is_grpc(is_grpc) {
+    , _is_grpc(is_grpc)
+    , _headers_only(grpc_stream_accepted)
+    , _headers_sent(false) {
     _data.swap(c->response_attachment());
-    if (is_grpc) {
+    if (is_grpc && !_headers_only) {
         _grpc_status = ErrorCodeToGrpcStatus(c->ErrorCode());
         PercentEncode(c->ErrorText(), &_grpc_message);
     }
 }
 
-H2UnsentResponse* H2UnsentResponse::New(Controller* c, int stream_id, bool is_grpc) {
+H2UnsentResponse* H2UnsentResponse::New(Controller* c, int stream_id, bool is_grpc,
+                                        bool grpc_stream_accepted) {
     const HttpHeader* const h = &c->http_response();
     const CommonStrings* const common = get_common_strings();
     const bool need_content_type = !h->content_type().empty();
@@ -1656,7 +1940,8 @@ H2UnsentResponse* H2UnsentResponse::New(Controller* c, int stream_id, bool is_gr
         + (size_t)need_content_type;
     const size_t memsize = offsetof(H2UnsentResponse, _list) +
         sizeof(HPacker::Header) * maxsize;
-    H2UnsentResponse* msg = new (malloc(memsize)) H2UnsentResponse(c, stream_id, is_grpc);
+    H2UnsentResponse* msg = new (malloc(memsize)) H2UnsentResponse(
+        c, stream_id, is_grpc, grpc_stream_accepted);
     // :status
     if (h->status_code() == 200) {
         msg->push(common->H2_STATUS, common->STATUS_200);
@@ -1694,54 +1979,81 @@ H2UnsentResponse::AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) {
         return butil::Status::OK();
     }
     H2Context* ctx = static_cast<H2Context*>(socket->parsing_context());
-
-    // flow control
-    // NOTE: Currently the stream context is definitely removed and updating
-    // window size is useless, however it's not true when progressive request
-    // is supported.
-    // TODO(zhujiashun): Instead of just returning error to client, a better
-    // solution to handle not enough window size is to wait until WINDOW_UPDATE
-    // is received, and then retry those failed response again.
-    if (!MinusWindowSize(&ctx->_remote_window_left, _data.size())) {
-        char rstbuf[FRAME_HEAD_SIZE + 4];
-        SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, _stream_id);
-        SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_FLOW_CONTROL_ERROR);
-        out->append(rstbuf, sizeof(rstbuf));
-        return butil::Status::OK();
-    }
-
     HPacker& hpacker = ctx->hpacker();
-    butil::IOBufAppender appender;
     HPackOptions options;
     options.encode_name = FLAGS_h2_hpack_encode_name;
     options.encode_value = FLAGS_h2_hpack_encode_value;
 
-    for (size_t i = 0; i < _size; ++i) {
-        hpacker.Encode(&appender, _list[i], options);
-    }
-    if (_http_response) {
-        for (HttpHeader::HeaderIterator it = _http_response->HeaderBegin();
-             it != _http_response->HeaderEnd(); ++it) {
-            HPacker::Header header(it->first, it->second);
-            hpacker.Encode(&appender, header, options);
+    butil::IOBuf dummy_buf;
+    if (!_headers_sent) {
+        butil::IOBufAppender appender;
+        for (size_t i = 0; i < _size; ++i) {
+            EncodeH2Header(hpacker, &appender, _list[i], options);
         }
+        if (_http_response) {
+            for (HttpHeader::HeaderIterator it = _http_response->HeaderBegin();
+                 it != _http_response->HeaderEnd(); ++it) {
+                HPacker::Header header(it->first, it->second);
+                EncodeH2Header(hpacker, &appender, header, options);
+            }
+        }
+        butil::IOBuf frag;
+        appender.move_to(frag);
+        if (_headers_only) {
+            // Messages and trailers are sent by the gRPC stream.
+            PackH2Message(out, frag, dummy_buf, _data, _stream_id, ctx, false);
+            return butil::Status::OK();
+        }
+        _headers_sent = true;
+        PackH2Message(out, frag, dummy_buf, dummy_buf, _stream_id, ctx,
+                      _data.empty() && !_is_grpc);
     }
-    butil::IOBuf frag;
-    appender.move_to(frag);
 
-    butil::IOBuf trailer_frag;
+    // flow control
+    // NOTE: Currently the stream context is definitely removed and the
+    // stream-level window is not tracked.
+    const int64_t max_frame_size = ctx->remote_settings().max_frame_size;
+    char headbuf[FRAME_HEAD_SIZE];
+    for (int i = 0; i < H2_DEFAULT_STREAM_WEIGHT && !_data.empty(); ++i) {
+        int64_t size = std::min((int64_t)_data.size(), max_frame_size);
+        size = std::min(size, ctx->_remote_window_left.load(butil::memory_order_relaxed));
+        if (size <= 0 || !MinusWindowSize(&ctx->_remote_window_left, size)) {
+            break;
+        }
+        uint8_t flags = 0;
+        if ((size_t)size == _data.size() && !_is_grpc) {
+            flags |= H2_FLAGS_END_STREAM;
+        }
+        SerializeFrameHead(headbuf, size, H2_FRAME_DATA, flags, _stream_id);
+        out->append(headbuf, sizeof(headbuf));
+        _data.cutn(out, size);
+    }
+    if (!_data.empty()) {
+        H2UnsentResponse* self = destroy_self.release();
+        if (ctx->_remote_window_left.load(butil::memory_order_relaxed) <= 0) {
+            ctx->WaitForWindowUpdate(self);
+        } else {
+            // Let messages written meanwhile go first.
+            SocketMessagePtr<H2UnsentResponse> next_turn(self);
+            Socket::WriteOptions wopt;
+            wopt.ignore_eovercrowded = true;
+            socket->Write(next_turn, &wopt);
+        }
+        return butil::Status::OK();
+    }
     if (_is_grpc) {
+        butil::IOBufAppender appender;
         HPacker::Header status_header("grpc-status",
                                       butil::string_printf("%d", _grpc_status));
-        hpacker.Encode(&appender, status_header, options);
+        EncodeH2Header(hpacker, &appender, status_header, options);
         if (!_grpc_message.empty()) {
             HPacker::Header msg_header("grpc-message", _grpc_message);
-            hpacker.Encode(&appender, msg_header, options);
+            EncodeH2Header(hpacker, &appender, msg_header, options);
         }
+        butil::IOBuf trailer_frag;
         appender.move_to(trailer_frag);
+        PackH2Message(out, trailer_frag, dummy_buf, dummy_buf, _stream_id, ctx, true);
     }
-
-    PackH2Message(out, frag, trailer_frag, _data, _stream_id, ctx);
     return butil::Status::OK();
 }
 
@@ -1818,6 +2130,9 @@ StreamUserData* H2GlobalStreamCreator::OnCreatingStream(
         return NULL;
     }
 
+    // Streams are created for each attempt, refresh the remaining time
+    // before the headers are copied.
+    SetRemainingTimeoutHeader(cntl);
     H2UnsentRequest* h2_req = H2UnsentRequest::New(cntl);
     if (!h2_req) {
         cntl->SetFailed(ENOMEM, "Fail to create H2UnsentRequest");
@@ -1831,6 +2146,600 @@ void H2GlobalStreamCreator::DestroyStreamCreator(Controller* cntl) {
     // Don't delete it in this function.
 }
 
+void H2Context::WaitForWindowUpdate(SocketMessage* msg) {
+    {
+        // Checking the window inside the lock pairs with FlushBlockedStreams()
+        // called after the window grows, so that `msg' won't be missed.
+        std::unique_lock<butil::Mutex> mu(_blocked_mutex);
+        if (_remote_window_left.load(butil::memory_order_relaxed) <= 0) {
+            _blocked_messages.push_back(msg);
+            return;
+        }
+    }
+    SocketMessagePtr<> msg_ptr(msg);
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    _socket->Write(msg_ptr, &wopt);
+}
+
+void H2Context::FlushBlockedStreams() {
+    std::vector<SocketMessage*> messages;
+    {
+        std::unique_lock<butil::Mutex> mu(_blocked_mutex);
+        messages.swap(_blocked_messages);
+    }
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    for (size_t i = 0; i < messages.size(); ++i) {
+        SocketMessagePtr<> msg(messages[i]);
+        _socket->Write(msg, &wopt);
+    }
+    std::vector<butil::intrusive_ptr<H2GrpcStream> > streams;
+    {
+        std::unique_lock<butil::Mutex> mu(_stream_mutex);
+        for (StreamMap::const_iterator it = _pending_streams.begin();
+             it != _pending_streams.end(); ++it) {
+            if (it->second->grpc_stream() != NULL) {
+                streams.push_back(it->second->grpc_stream());
+            }
+        }
+    }
+    for (size_t i = 0; i < streams.size(); ++i) {
+        streams[i]->Flush();
+    }
+}
+
+// Pack trailers ending a gRPC stream at server-side. Like other headers,
+// they must be encoded in AppendAndDestroySelf() so that the order of HPACK
+// encoding is same with the order of writing.
+static void PackGrpcTrailers(H2Context* ctx, butil::IOBuf* out, int stream_id,
+                             int error_code, const std::string& error_text) {
+    HPacker& hpacker = ctx->hpacker();
+    butil::IOBufAppender appender;
+    HPackOptions options;
+    options.encode_name = FLAGS_h2_hpack_encode_name;
+    options.encode_value = FLAGS_h2_hpack_encode_value;
+    HPacker::Header status_header(
+        "grpc-status",
+        butil::string_printf("%d", ErrorCodeToGrpcStatus(error_code)));
+    EncodeH2Header(hpacker, &appender, status_header, options);
+    if (error_code != 0) {
+        HPacker::Header msg_header("grpc-message");
+        PercentEncode(error_text, &msg_header.value);
+        if (!msg_header.value.empty()) {
+            EncodeH2Header(hpacker, &appender, msg_header, options);
+        }
+    }
+    butil::IOBuf frag;
+    appender.move_to(frag);
+    butil::IOBuf dummy_buf;
+    PackH2Message(out, frag, dummy_buf, dummy_buf, stream_id, ctx, true);
+}
+
+// A turn of sending frames of a gRPC stream.
+class H2GrpcStreamTurn : public SocketMessage {
+public:
+    explicit H2GrpcStreamTurn(H2GrpcStream* stream) : _stream(stream) {}
+
+    butil::Status AppendAndDestroySelf(butil::IOBuf* out, Socket* socket) override {
+        std::unique_ptr<H2GrpcStreamTurn> delete_self(this);
+        _stream->OnTurn(out, socket);
+        return butil::Status::OK();
+    }
+
+private:
+    butil::intrusive_ptr<H2GrpcStream> _stream;
+};
+
+H2GrpcStream::H2GrpcStream(bool server_side)
+    : _server_side(server_side)
+    , _client_streaming(true)
+    , _started(false)
+    , _recv_gzip(false)
+    , _socket_id(INVALID_SOCKET_ID)
+    , _stream_id(0)
+    , _headers_sent(false)
+    , _local_closed(false)
+    , _end_sent(false)
+    , _close_error_code(0)
+    , _turn_queued(false)
+    , _remote_window_left(0)
+    , _remote_closed(false)
+    , _remote_error_code(0)
+    , _unacked_bytes(0)
+    , _queued_bytes(0)
+    , _local_window_size(H2Settings::DEFAULT_INITIAL_WINDOW_SIZE) {
+}
+
+H2GrpcStream::~H2GrpcStream() {
+    for (size_t i = 0; i < _unaccepted_tasks.size(); ++i) {
+        delete _unaccepted_tasks[i].message;
+    }
+}
+
+int H2GrpcStream::StartQueue(const GrpcStreamOptions* options) {
+    if (options) {
+        if (options->weight < 1 || options->weight > 256) {
+            LOG(ERROR) << "Invalid weight=" << options->weight;
+            return -1;
+        }
+        _options = *options;
+    }
+    bthread::ExecutionQueueOptions q_opt;
+    q_opt.bthread_attr
+        = FLAGS_usercode_in_pthread ? BTHREAD_ATTR_PTHREAD : BTHREAD_ATTR_NORMAL;
+    // Released after the queue is stopped.
+    AddRefManually();
+    if (bthread::execution_queue_start(&_queue, &q_opt, Consume, this) != 0) {
+        LOG(FATAL) << "Fail to create ExecutionQueue";
+        RemoveRefManually();
+        return -1;
+    }
+    _started = true;
+    return 0;
+}
+
+int H2GrpcStream::Init(const GrpcStreamOptions* options) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    return StartQueue(options);
+}
+
+int H2GrpcStream::Accept(const GrpcStreamOptions* options) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    if (_started) {
+        LOG(ERROR) << "The gRPC stream was already accepted";
+        return -1;
+    }
+    if (_end_sent) {
+        LOG(ERROR) << "The gRPC call was already ended";
+        return -1;
+    }
+    if (StartQueue(options) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < _unaccepted_tasks.size(); ++i) {
+        if (bthread::execution_queue_execute(_queue, _unaccepted_tasks[i]) != 0) {
+            delete _unaccepted_tasks[i].message;
+        }
+    }
+    _unaccepted_tasks.clear();
+    if (_remote_closed) {
+        bthread::execution_queue_stop(_queue);
+    }
+    return 0;
+}
+
+int H2GrpcStream::Consume(void* meta, bthread::TaskIterator<H2GrpcStreamTask>& iter) {
+    H2GrpcStream* s = static_cast<H2GrpcStream*>(meta);
+    GrpcStreamHandler* handler = s->_options.handler;
+    if (iter.is_queue_stopped()) {
+        // _remote_error_code and _remote_error_text are set before stopping
+        // the queue and never change since.
+        if (handler != NULL) {
+            handler->OnClosed(s, s->_remote_error_code, s->_remote_error_text);
+        }
+        s->RemoveRefManually();
+        return 0;
+    }
+    std::vector<butil::IOBuf*> messages;
+    size_t wire_size = 0;
+    for (; iter; ++iter) {
+        messages.push_back(iter->message);
+        wire_size += iter->wire_size;
+    }
+    if (handler != NULL && !messages.empty()) {
+        handler->OnReceivedMessages(s, &messages[0], messages.size());
+    }
+    for (size_t i = 0; i < messages.size(); ++i) {
+        delete messages[i];
+    }
+    s->OnConsumed(wire_size);
+    return 0;
+}
+
+void H2GrpcStream::OnCreated(H2Context* ctx, Socket* s, int stream_id,
+                             const butil::IOBuf* first_message,
+                             butil::IOBuf* out) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    _socket_id = s->id();
+    _stream_id = stream_id;
+    _remote_window_left.store(ctx->remote_settings().stream_window_size,
+                              butil::memory_order_relaxed);
+    _local_window_size = std::max(ctx->local_settings().stream_window_size,
+                                  ctx->_unack_local_settings.stream_window_size);
+    if (_server_side) {
+        // Messages are sent after the response headers.
+        return;
+    }
+    _headers_sent = true;
+    if (_end_sent) {
+        // Canceled before sending.
+        char rstbuf[FRAME_HEAD_SIZE + 4];
+        SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, _stream_id);
+        SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_CANCEL);
+        out->append(rstbuf, sizeof(rstbuf));
+        return;
+    }
+    if (first_message != NULL && !first_message->empty()) {
+        // The first message is already prefixed in SerializeHttpRequest.
+        butil::IOBuf tmp(*first_message);
+        tmp.append(butil::IOBuf::Movable(_pending));
+        _pending.swap(tmp);
+    }
+    if (!_client_streaming) {
+        // The first message is the only one from the client.
+        _local_closed = true;
+    }
+    if (PackPendingData(ctx, out, _options.weight)) {
+        _turn_queued = true;
+        mu.unlock();
+        WriteTurn(s);
+    }
+}
+
+int H2GrpcStream::Write(const butil::IOBuf& message) {
+    char prefix[5];
+    prefix[0] = 0;  // not compressed
+    const uint32_t size = butil::HostToNet32(message.size());
+    memcpy(prefix + 1, &size, 4);
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    if (_local_closed) {
+        return (_remote_closed && _remote_error_code != 0) ? ECONNRESET : EINVAL;
+    }
+    if (_options.max_buf_size > 0 &&
+        (int64_t)_pending.size() >= _options.max_buf_size) {
+        return EAGAIN;
+    }
+    _pending.append(prefix, sizeof(prefix));
+    _pending.append(message);
+    FlushInLock(mu);
+    return 0;
+}
+
+int H2GrpcStream::Wait(const timespec* due_time) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    bool timed_out = false;
+    while (true) {
+        if (_local_closed) {
+            return EINVAL;
+        }
+        if (_options.max_buf_size <= 0 ||
+            (int64_t)_pending.size() < _options.max_buf_size) {
+            return 0;
+        }
+        if (timed_out) {
+            return ETIMEDOUT;
+        }
+        if (due_time == NULL) {
+            _writable_cond.wait(mu);
+        } else if (_writable_cond.wait_until(mu, *due_time) == ETIMEDOUT) {
+            timed_out = true;
+        }
+    }
+}
+
+int H2GrpcStream::Close(int error_code, const std::string& error_text) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    if (_local_closed) {
+        return EINVAL;
+    }
+    _local_closed = true;
+    _close_error_code = error_code;
+    _close_error_text = error_text;
+    _writable_cond.notify_all();
+    if (!_server_side && error_code != 0) {
+        // Cancel the call.
+        const bool bound = (_stream_id != 0 && !_end_sent);
+        _end_sent = true;
+        _pending.clear();
+        CloseRemoteInLock(error_code, error_text);
+        mu.unlock();
+        if (bound) {
+            AbandonStream(true);
+        }
+        return 0;
+    }
+    FlushInLock(mu);
+    return 0;
+}
+
+butil::EndPoint H2GrpcStream::remote_side() const {
+    SocketId id = INVALID_SOCKET_ID;
+    {
+        std::unique_lock<bthread::Mutex> mu(_mutex);
+        id = _socket_id;
+    }
+    SocketUniquePtr s;
+    if (id == INVALID_SOCKET_ID || Socket::Address(id, &s) != 0) {
+        return butil::EndPoint();
+    }
+    return s->remote_side();
+}
+
+H2Error H2GrpcStream::OnData(butil::IOBuf* data, int64_t local_window_size) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    if (_remote_closed) {
+        // The call was ended locally, drop the data.
+        return H2_NO_ERROR;
+    }
+    _local_window_size = local_window_size;
+    _unacked_bytes += data->size();
+    if (_unacked_bytes > _local_window_size) {
+        LOG(ERROR) << "Fail to satisfy the stream-level flow control policy";
+        return H2_FLOW_CONTROL_ERROR;
+    }
+    _recv_buf.append(butil::IOBuf::Movable(*data));
+    while (_recv_buf.size() >= 5) {
+        char prefix[5];
+        _recv_buf.copy_to(prefix, sizeof(prefix));
+        uint32_t size = 0;
+        memcpy(&size, prefix + 1, 4);
+        size = butil::NetToHost32(size);
+        if (size > FLAGS_max_body_size) {
+            LOG(ERROR) << "gRPC message size=" << size << " is bigger than "
+                       << FLAGS_max_body_size;
+            return H2_PROTOCOL_ERROR;
+        }
+        if (_recv_buf.size() < 5 + (size_t)size) {
+            break;
+        }
+        H2GrpcStreamTask task;
+        task.wire_size = 5 + size;
+        task.message = new butil::IOBuf;
+        _recv_buf.pop_front(5);
+        _recv_buf.cutn(task.message, size);
+        if (prefix[0]) {
+            butil::IOBuf uncompressed;
+            if (!_recv_gzip || !GzipDecompress(*task.message, &uncompressed)) {
+                LOG(ERROR) << "Fail to decompress gRPC message";
+                delete task.message;
+                return H2_PROTOCOL_ERROR;
+            }
+            task.message->swap(uncompressed);
+        }
+        _queued_bytes += task.wire_size;
+        if (!_started) {
+            _unaccepted_tasks.push_back(task);
+        } else if (bthread::execution_queue_execute(_queue, task) != 0) {
+            _queued_bytes -= task.wire_size;
+            delete task.message;
+        }
+    }
+    const int64_t window_update = TakeWindowUpdateInLock();
+    mu.unlock();
+    SendWindowUpdate(window_update);
+    return H2_NO_ERROR;
+}
+
+void H2GrpcStream::OnConsumed(size_t wire_size) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    _queued_bytes -= wire_size;
+    const int64_t window_update = TakeWindowUpdateInLock();
+    mu.unlock();
+    SendWindowUpdate(window_update);
+}
+
+int64_t H2GrpcStream::TakeWindowUpdateInLock() {
+    // Bytes of partial messages are acked as well, otherwise messages larger
+    // than the window can never be completed.
+    const int64_t size = _unacked_bytes - _queued_bytes;
+    if (_remote_closed || size <= 0 || size < _local_window_size / 2) {
+        return 0;
+    }
+    _unacked_bytes -= size;
+    return size;
+}
+
+void H2GrpcStream::SendWindowUpdate(int64_t size) {
+    // Writing into the socket may run turns of this stream in the calling
+    // thread, don't do it with _mutex locked.
+    SocketUniquePtr s;
+    if (size <= 0 || Socket::Address(_socket_id, &s) != 0) {
+        return;
+    }
+    char winbuf[FRAME_HEAD_SIZE + 4];
+    SerializeFrameHead(winbuf, 4, H2_FRAME_WINDOW_UPDATE, 0, _stream_id);
+    SaveUint32(winbuf + FRAME_HEAD_SIZE, size);
+    if (WriteAck(s.get(), winbuf, sizeof(winbuf)) != 0) {
+        LOG(WARNING) << "Fail to send WINDOW_UPDATE to " << *s;
+    }
+}
+
+void H2GrpcStream::OnRemoteClosed(int error_code, const std::string& error_text) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    if (_remote_closed) {
+        return;
+    }
+    if (error_code != 0 || !_server_side) {
+        // The call is over, anything unsent is dropped.
+        _local_closed = true;
+        _end_sent = true;
+        _pending.clear();
+        _writable_cond.notify_all();
+    }
+    CloseRemoteInLock(error_code, error_text);
+}
+
+void H2GrpcStream::CloseRemoteInLock(int error_code, const std::string& error_text) {
+    if (_remote_closed) {
+        return;
+    }
+    _remote_closed = true;
+    _remote_error_code = error_code;
+    _remote_error_text = error_text;
+    _recv_buf.clear();
+    if (_started) {
+        bthread::execution_queue_stop(_queue);
+    }
+}
+
+bool H2GrpcStream::AddRemoteWindowSize(int64_t diff) {
+    return AddWindowSize(&_remote_window_left, diff);
+}
+
+void H2GrpcStream::Flush() {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    FlushInLock(mu);
+}
+
+bool H2GrpcStream::PackPendingData(H2Context* ctx, butil::IOBuf* out,
+                                   int max_frames) {
+    const int64_t max_frame_size = ctx->remote_settings().max_frame_size;
+    char headbuf[FRAME_HEAD_SIZE];
+    for (int i = 0; i < max_frames && !_pending.empty(); ++i) {
+        int64_t size = std::min((int64_t)_pending.size(), max_frame_size);
+        size = std::min(size, _remote_window_left.load(butil::memory_order_relaxed));
+        size = std::min(size, ctx->_remote_window_left.load(butil::memory_order_relaxed));
+        if (size <= 0 || !MinusWindowSize(&ctx->_remote_window_left, size)) {
+            // Sent after WINDOW_UPDATE.
+            break;
+        }
+        _remote_window_left.fetch_sub(size, butil::memory_order_relaxed);
+        uint8_t flags = 0;
+        if (!_server_side && _local_closed && (size_t)size == _pending.size()) {
+            flags |= H2_FLAGS_END_STREAM;
+            _end_sent = true;
+        }
+        SerializeFrameHead(headbuf, size, H2_FRAME_DATA, flags, _stream_id);
+        out->append(headbuf, sizeof(headbuf));
+        _pending.cutn(out, size);
+    }
+    if (!_server_side && _local_closed && !_end_sent && _pending.empty()) {
+        SerializeFrameHead(headbuf, 0, H2_FRAME_DATA, H2_FLAGS_END_STREAM, _stream_id);
+        out->append(headbuf, sizeof(headbuf));
+        _end_sent = true;
+    }
+    return !_pending.empty()
+        && _remote_window_left.load(butil::memory_order_relaxed) > 0
+        && ctx->_remote_window_left.load(butil::memory_order_relaxed) > 0;
+}
+
+void H2GrpcStream::FlushInLock(std::unique_lock<bthread::Mutex>& mu) {
+    if (_stream_id == 0 || !_headers_sent || _end_sent || _turn_queued) {
+        return;
+    }
+    if (_pending.empty() && !_local_closed) {
+        return;
+    }
+    SocketUniquePtr s;
+    if (Socket::Address(_socket_id, &s) != 0) {
+        // Notified by the H2StreamContext destroyed with the connection.
+        return;
+    }
+    _turn_queued = true;
+    mu.unlock();
+    WriteTurn(s.get());
+}
+
+void H2GrpcStream::WriteTurn(Socket* s) {
+    SocketMessagePtr<H2GrpcStreamTurn> turn(new H2GrpcStreamTurn(this));
+    Socket::WriteOptions wopt;
+    wopt.ignore_eovercrowded = true;
+    // The turn is dropped with NULL socket if the connection is broken.
+    s->Write(turn, &wopt);
+}
+
+void H2GrpcStream::OnTurn(butil::IOBuf* out, Socket* s) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    if (s == NULL || _end_sent) {
+        _turn_queued = false;
+        return;
+    }
+    H2Context* ctx = static_cast<H2Context*>(s->parsing_context());
+    const bool more = PackPendingData(ctx, out, _options.weight);
+    bool ended = false;
+    if (_server_side && _local_closed && _pending.empty()) {
+        _end_sent = true;
+        ended = true;
+        const bool reset = !_remote_closed;
+        // Messages from the client are not needed anymore.
+        CloseRemoteInLock(_close_error_code, _close_error_text);
+        PackGrpcTrailers(ctx, out, _stream_id, _close_error_code,
+                         _close_error_text);
+        if (reset) {
+            // The client is still sending, tell it to stop.
+            char rstbuf[FRAME_HEAD_SIZE + 4];
+            SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, _stream_id);
+            SaveUint32(rstbuf + FRAME_HEAD_SIZE, H2_NO_ERROR);
+            out->append(rstbuf, sizeof(rstbuf));
+        }
+    }
+    if (_options.max_buf_size <= 0 ||
+        (int64_t)_pending.size() < _options.max_buf_size) {
+        _writable_cond.notify_all();
+    }
+    if (!more || _end_sent) {
+        // Flushed again after WINDOW_UPDATE or writing.
+        _turn_queued = false;
+        mu.unlock();
+        if (ended) {
+            ctx->AddAbandonedStream(_stream_id);
+        }
+        return;
+    }
+    mu.unlock();
+    // Queue the next turn after messages written meanwhile.
+    WriteTurn(s);
+}
+
+void H2GrpcStream::OnResponseWritten(bool headers_only, int error_code) {
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    if (headers_only && error_code == 0) {
+        _headers_sent = true;
+        FlushInLock(mu);
+        return;
+    }
+    // The call was ended by the response.
+    const bool reset = !_remote_closed;
+    _local_closed = true;
+    _end_sent = true;
+    _pending.clear();
+    for (size_t i = 0; i < _unaccepted_tasks.size(); ++i) {
+        delete _unaccepted_tasks[i].message;
+    }
+    _unaccepted_tasks.clear();
+    CloseRemoteInLock(error_code, "The call was ended by the server");
+    _writable_cond.notify_all();
+    mu.unlock();
+    AbandonStream(reset);
+}
+
+void H2GrpcStream::OnRPCEnd(int error_code, const std::string& error_text) {
+    if (error_code == 0) {
+        // Response headers arrived, the stream goes on.
+        return;
+    }
+    std::unique_lock<bthread::Mutex> mu(_mutex);
+    if (_remote_closed) {
+        // Failed by trailers of the server.
+        return;
+    }
+    _local_closed = true;
+    _end_sent = true;
+    _pending.clear();
+    CloseRemoteInLock(error_code, error_text);
+    _writable_cond.notify_all();
+    mu.unlock();
+    AbandonStream(true);
+}
+
+void H2GrpcStream::AbandonStream(bool reset) {
+    SocketUniquePtr s;
+    if (_stream_id == 0 || Socket::Address(_socket_id, &s) != 0) {
+        return;
+    }
+    if (reset) {
+        char rstbuf[FRAME_HEAD_SIZE + 4];
+        SerializeFrameHead(rstbuf, 4, H2_FRAME_RST_STREAM, 0, _stream_id);
+        SaveUint32(rstbuf + FRAME_HEAD_SIZE, _server_side ? H2_NO_ERROR : H2_CANCEL);
+        WriteAck(s.get(), rstbuf, sizeof(rstbuf));
+    }
+    H2Context* ctx = static_cast<H2Context*>(s->parsing_context());
+    if (ctx != NULL) {
+        ctx->AddAbandonedStream(_stream_id);
+    }
+}
+
 StreamCreator* get_h2_global_stream_creator() {
     return butil::get_leaky_singleton<H2GlobalStreamCreator>();
 }
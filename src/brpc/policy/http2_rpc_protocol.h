@@ -19,6 +19,8 @@
 #ifndef BAIDU_RPC_POLICY_HTTP2_RPC_PROTOCOL_H
 #define BAIDU_RPC_POLICY_HTTP2_RPC_PROTOCOL_H
 
+#include "bthread/execution_queue.h"
+#include "bthread/condition_variable.h"
 #include "brpc/policy/http_rpc_protocol.h"   // HttpContext
 #include "brpc/input_message_base.h"
 #include "brpc/protocol.h"
@@ -193,9 +195,15 @@ private:
     HPacker::Header _list[0];
 };
 
+// DATA frames of a large body are sent in turns of at most
+// H2_DEFAULT_STREAM_WEIGHT frames, see H2GrpcStream. The response waits for
+// WINDOW_UPDATE of the peer if the connection-level window is exhausted.
 class H2UnsentResponse : public SocketMessage {
 public:
-    static H2UnsentResponse* New(Controller* c, int stream_id, bool is_grpc);
+    // Only headers are sent when `grpc_stream_accepted' is true, the stream
+    // is ended by the accepted H2GrpcStream.
+    static H2UnsentResponse* New(Controller* c, int stream_id, bool is_grpc,
+                                 bool grpc_stream_accepted = false);
     void Destroy();
     void Print(std::ostream& os) const;
     // @SocketMessage
@@ -209,7 +217,8 @@ private:
     void push(const std::string& name, const std::string& value)
     { new (&_list[_size++]) HPacker::Header(name, value); }
 
-    H2UnsentResponse(Controller* c, int stream_id, bool is_grpc);
+    H2UnsentResponse(Controller* c, int stream_id, bool is_grpc,
+                     bool grpc_stream_accepted);
     ~H2UnsentResponse() {}
     H2UnsentResponse(const H2UnsentResponse&);
     void operator=(const H2UnsentResponse&);
@@ -220,11 +229,132 @@ private:
     std::unique_ptr<HttpHeader> _http_response;
     butil::IOBuf _data;
     bool _is_grpc;
+    bool _headers_only;
+    bool _headers_sent;
     GrpcStatus _grpc_status;
     std::string _grpc_message;
     HPacker::Header _list[0];
 };
 
+struct H2GrpcStreamTask {
+    butil::IOBuf* message;
+    // Bytes of the message in DATA frames, namely the size of flow-control
+    // window to give back after the message is consumed.
+    size_t wire_size;
+};
+
+// Implement GrpcStream on a HTTP/2 stream.
+// Messages written are framed into DATA frames as long as windows of the
+// stream and the connection allow, the rest are buffered and sent after
+// WINDOW_UPDATE. Received messages are passed to the handler through an
+// ExecutionQueue, stream-level window of the peer is given back after the
+// handler consumed the messages.
+//
+// DATA frames are sent in turns: a turn is a SocketMessage packing at most
+// GrpcStreamOptions.weight frames when the socket writes it, and queueing
+// the next turn at the tail of the write queue if more can be sent. Since
+// the write queue is FIFO, turns of all streams and other messages of the
+// connection (e.g. responses of unary calls) are scheduled round-robin and a
+// bulk stream can't delay others by more than one turn.
+class H2GrpcStream : public GrpcStream {
+public:
+    explicit H2GrpcStream(bool server_side);
+    ~H2GrpcStream();
+
+    // [Client-side] Start with `options'.
+    int Init(const GrpcStreamOptions* options);
+    // [Server-side] Start with `options', returns -1 if accepted already.
+    int Accept(const GrpcStreamOptions* options);
+
+    // @GrpcStream
+    int Write(const butil::IOBuf& message) override;
+    int Wait(const timespec* due_time) override;
+    int Close(int error_code, const std::string& error_text) override;
+    butil::EndPoint remote_side() const override;
+
+    bool server_side() const { return _server_side; }
+    bool accepted() const { return _started; }
+    // True if messages of the peer are framed in the stream rather than
+    // being the body of a unary request/response.
+    bool client_streaming() const { return _client_streaming; }
+    void set_client_streaming(bool b) { _client_streaming = b; }
+
+    // Called in H2 internals.
+
+    // Bind the stream with the HTTP/2 stream. Client-side appends the first
+    // message and buffered messages after HEADERS into `out'. `first_message'
+    // may be NULL.
+    void OnCreated(H2Context* ctx, Socket* s, int stream_id,
+                   const butil::IOBuf* first_message, butil::IOBuf* out);
+    // Set when headers of the peer arrive.
+    void set_recv_gzip(bool gzip) { _recv_gzip = gzip; }
+    // Cut messages from DATA frames. Returns the error to reset the stream
+    // with if the peer violated flow control or sent malformed messages.
+    H2Error OnData(butil::IOBuf* data, int64_t local_window_size);
+    // No more data from the peer.
+    void OnRemoteClosed(int error_code, const std::string& error_text);
+    // Change window of the peer, call Flush() after the window grows.
+    bool AddRemoteWindowSize(int64_t diff);
+    // Send buffered messages as windows allow.
+    void Flush();
+    // Pack frames of a turn into `out'. `s' is NULL if the turn was dropped.
+    void OnTurn(butil::IOBuf* out, Socket* s);
+    // [Server-side] The response was written into the socket. If the
+    // stream was accepted, response headers were sent and messages follow,
+    // otherwise the call was ended by the response.
+    void OnResponseWritten(bool headers_only, int error_code);
+
+protected:
+    // @GrpcStream
+    void OnRPCEnd(int error_code, const std::string& error_text) override;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(H2GrpcStream);
+    static int Consume(void* meta, bthread::TaskIterator<H2GrpcStreamTask>& iter);
+    int StartQueue(const GrpcStreamOptions* options);
+    void OnConsumed(size_t wire_size);
+    // Returns size of the window to give back to the peer.
+    int64_t TakeWindowUpdateInLock();
+    void SendWindowUpdate(int64_t size);
+    // Returns true if more frames can be sent after `max_frames' frames.
+    bool PackPendingData(H2Context* ctx, butil::IOBuf* out, int max_frames);
+    // Queue a turn if anything needs to be sent. Socket::Write() may run
+    // the turn in the calling thread, so `mu' is unlocked before writing.
+    void FlushInLock(std::unique_lock<bthread::Mutex>& mu);
+    void WriteTurn(Socket* s);
+    void CloseRemoteInLock(int error_code, const std::string& error_text);
+    void AbandonStream(bool reset);
+
+    const bool _server_side;
+    bool _client_streaming;
+    bool _started;
+    bool _recv_gzip;
+    GrpcStreamOptions _options;
+    mutable bthread::Mutex _mutex;
+    bthread::ConditionVariable _writable_cond;
+    SocketId _socket_id;
+    int _stream_id;
+    // Sending side.
+    bool _headers_sent;
+    bool _local_closed;
+    bool _end_sent;
+    int _close_error_code;
+    std::string _close_error_text;
+    bool _turn_queued;
+    butil::IOBuf _pending;
+    butil::atomic<int64_t> _remote_window_left;
+    // Receiving side.
+    bool _remote_closed;
+    int _remote_error_code;
+    std::string _remote_error_text;
+    butil::IOBuf _recv_buf;
+    int64_t _unacked_bytes;
+    int64_t _queued_bytes;
+    int64_t _local_window_size;
+    std::vector<H2GrpcStreamTask> _unaccepted_tasks;
+    bthread::ExecutionQueueId<H2GrpcStreamTask> _queue;
+};
+
 // Used in http_rpc_protocol.cpp
 class H2StreamContext : public HttpContext {
 public:
@@ -260,6 +390,10 @@ public:
 
     bool ConsumeWindowSize(int64_t size);
 
+    // Non-NULL if this stream carries a streaming gRPC call.
+    H2GrpcStream* grpc_stream() const { return _grpc_stream.get(); }
+    void set_grpc_stream(H2GrpcStream* s) { _grpc_stream.reset(s); }
+
 #if defined(BRPC_H2_STREAM_STATE)
     H2StreamState state() const { return _state; }
     void SetState(H2StreamState state);
@@ -276,6 +410,16 @@ friend class H2Context;
     butil::atomic<int64_t> _deferred_window_update;
     uint64_t _correlation_id;
     butil::IOBuf _remaining_header_fragment;
+    butil::intrusive_ptr<H2GrpcStream> _grpc_stream;
+    // True if this is the message carrying headers of a streaming gRPC call
+    // to user rather than the context receiving frames of the stream.
+    bool _is_grpc_head;
+    // Headers of the streaming gRPC call were passed to user.
+    bool _grpc_dispatched;
+
+private:
+    H2ParseResult OnEndHeaders(bool end_stream);
+    H2ParseResult DispatchGrpcStream();
 };
 
 StreamCreator* get_h2_global_stream_creator();
@@ -310,6 +454,10 @@ size_t SerializeH2Settings(const H2Settings& in, void* out);
 
 const size_t FRAME_HEAD_SIZE = 9;
 
+// DATA frames sent in each turn by default, which is also the default
+// priority weight in rfc7540.
+const int H2_DEFAULT_STREAM_WEIGHT = 16;
+
 // Contexts of a http2 connection
 class H2Context : public Destroyable, public Describable {
 public:
@@ -329,6 +477,9 @@ public:
     void ClearAbandonedStreams();
     void AddAbandonedStream(uint32_t stream_id);
 
+    // Write `msg' again after WINDOW_UPDATE of the connection.
+    void WaitForWindowUpdate(SocketMessage* msg);
+
     //@Destroyable
     void Destroy() override { delete this; }
 
@@ -355,6 +506,7 @@ private:
 friend class H2StreamContext;
 friend class H2UnsentRequest;
 friend class H2UnsentResponse;
+friend class H2GrpcStream;
 friend void InitFrameHandlers();
 
     ParseResult ConsumeFrameHead(butil::IOBufBytesIterator&, H2FrameHead*);
@@ -375,10 +527,13 @@ friend void InitFrameHandlers();
 
     H2StreamContext* FindStream(int stream_id);
     void ClearAbandonedStreamsImpl();
+    // Resume messages and gRPC streams blocked by the connection-level window.
+    void FlushBlockedStreams();
 
     // True if the connection is established by client, otherwise it's
     // accepted by server.
     Socket* _socket;
+    const Server* _server;
     butil::atomic<int64_t> _remote_window_left;
     H2ConnectionState _conn_state;
     int _last_received_stream_id;
@@ -395,6 +550,8 @@ friend void InitFrameHandlers();
     mutable butil::Mutex _stream_mutex;
     StreamMap _pending_streams;
     butil::atomic<int64_t> _deferred_window_update;
+    butil::Mutex _blocked_mutex;
+    std::vector<SocketMessage*> _blocked_messages;
 };
 
 inline int H2Context::AllocateClientStreamId() {
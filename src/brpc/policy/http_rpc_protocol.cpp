@@ -40,6 +40,7 @@
 #include "brpc/policy/gzip_compress.h"
 #include "brpc/policy/http2_rpc_protocol.h"
 #include "brpc/details/usercode_backup_pool.h"
+#include "brpc/details/continuous_profiler.h"
 #include "brpc/grpc.h"
 
 extern "C" {
@@ -124,6 +125,7 @@ CommonStrings::CommonStrings()
     , KEEP_ALIVE("keep-alive")
     , CLOSE("close")
     , LOG_ID("log-id")
+    , TIMEOUT_MS("x-bd-timeout-ms")
     , DEFAULT_METHOD("default_method")
     , NO_METHOD("no_method")
     , H2_SCHEME(":scheme")
@@ -265,6 +267,8 @@ void ProcessHttpResponse(InputMessageBase* msg) {
     if (is_http2) {
         H2StreamContext* h2_sctx = static_cast<H2StreamContext*>(msg);
         cid_value = h2_sctx->correlation_id();
+    } else if (imsg_guard->pipelined_cid() != 0) {
+        cid_value = imsg_guard->pipelined_cid();
     } else {
         cid_value = socket->correlation_id();
     }
@@ -399,6 +403,11 @@ void ProcessHttpResponse(InputMessageBase* msg) {
             }
             break;
         }
+        if (accessor.grpc_stream() != NULL) {
+            // A streaming gRPC call completes with the response headers,
+            // messages are passed to the GrpcStream.
+            break;
+        }
         if (cntl->response() == NULL ||
             cntl->response()->GetDescriptor()->field_count() == 0) {
             // a http call, content is the "real response".
@@ -591,7 +600,9 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
             */
             // TODO: do we need this?
             hreq.SetHeader(common->TE, common->TRAILERS);
-            if (cntl->timeout_ms() >= 0) {
+            // Timeout of a streaming call only covers the RPC, not the
+            // lifetime of the stream.
+            if (cntl->timeout_ms() >= 0 && accessor.grpc_stream() == NULL) {
                 hreq.SetHeader(common->GRPC_TIMEOUT,
                         butil::string_printf("%" PRId64 "m", cntl->timeout_ms()));
             }
@@ -615,6 +626,15 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
         hreq.uri().set_path(path);
     }
 
+    // Responses to HEAD have no body even if content-length is present and
+    // progressively-read responses occupy the connection until the body
+    // ends, neither can be pipelined.
+    if (accessor.max_pipelined_requests() > 1 &&
+        (hreq.method() == HTTP_METHOD_HEAD ||
+         cntl->is_response_read_progressively())) {
+        accessor.set_max_pipelined_requests(1);
+    }
+
     Span* span = accessor.span();
     if (span) {
         hreq.SetHeader("x-bd-trace-id", butil::string_printf(
@@ -626,6 +646,29 @@ void SerializeHttpRequest(butil::IOBuf* /*not used*/,
     }
 }
 
+void SetRemainingTimeoutHeader(Controller* cntl) {
+    // Only calls to pb services are understood by brpc servers, and gRPC
+    // carries the deadline in grpc-timeout already.
+    if (cntl->method() == NULL) {
+        return;
+    }
+    HttpHeader* header = &cntl->http_request();
+    bool is_grpc = false;
+    ParseContentType(header->content_type(), &is_grpc);
+    if (is_grpc) {
+        return;
+    }
+    const int64_t timeout_ms = ControllerPrivateAccessor(cntl).remaining_timeout_ms();
+    if (timeout_ms > 0) {
+        header->SetHeader(common->TIMEOUT_MS,
+                          butil::string_printf("%" PRId64, timeout_ms));
+    } else {
+        // No deadline, or the deadline was reached and the RPC is about to
+        // time out, a stale value from a previous attempt must not be sent.
+        header->RemoveHeader(common->TIMEOUT_MS);
+    }
+}
+
 void PackHttpRequest(butil::IOBuf* buf,
                      SocketMessage**,
                      uint64_t correlation_id,
@@ -645,10 +688,14 @@ void PackHttpRequest(butil::IOBuf* buf,
         }
         header->SetHeader(common->AUTHORIZATION, auth_data);
     }
+    SetRemainingTimeoutHeader(cntl);
 
     // Store `correlation_id' into Socket since http server
     // may not echo back this field. But we send it anyway.
-    accessor.get_sending_socket()->set_correlation_id(correlation_id);
+    // Pipelined requests are correlated with PipelinedInfo instead.
+    if (accessor.pipelined_count() == 0) {
+        accessor.get_sending_socket()->set_correlation_id(correlation_id);
+    }
 
     MakeRawHttpRequest(buf, header, cntl->remote_side(),
                        &cntl->request_attachment());
@@ -740,11 +787,16 @@ HttpResponseSender::~HttpResponseSender() {
     const HttpContentType content_type = ParseContentType(*content_type_str, &is_grpc_ct);
     const bool is_http2 = req_header->is_http2();
     const bool is_grpc = (is_http2 && is_grpc_ct);
+    // Only headers are sent for accepted gRPC streams, messages are written
+    // by the stream.
+    H2GrpcStream* grpc_stream = static_cast<H2GrpcStream*>(accessor.grpc_stream());
+    const bool grpc_stream_accepted =
+        (grpc_stream != NULL && grpc_stream->accepted() && !cntl->Failed());
 
     // Convert response to json/proto if needed.
     // Notice: Not check res->IsInitialized() which should be checked in the
     // conversion function.
-    if (res != NULL &&
+    if (res != NULL && !grpc_stream_accepted &&
         cntl->response_attachment().empty() &&
         // ^ user did not fill the body yet.
         res->GetDescriptor()->field_count() > 0 &&
@@ -870,12 +922,13 @@ HttpResponseSender::~HttpResponseSender() {
     Socket::WriteOptions wopt;
     wopt.ignore_eovercrowded = true;
     if (is_http2) {
-        if (is_grpc) {
+        if (is_grpc && !grpc_stream_accepted) {
             // Append compressed and length before body
             AddGrpcPrefix(&cntl->response_attachment(), grpc_compressed);
         }
         SocketMessagePtr<H2UnsentResponse> h2_response(
-                H2UnsentResponse::New(cntl, _h2_stream_id, is_grpc));
+            H2UnsentResponse::New(cntl, _h2_stream_id, is_grpc,
+                                  grpc_stream_accepted));
         if (h2_response == NULL) {
             LOG(ERROR) << "Fail to make http2 response";
             errno = EINVAL;
@@ -889,6 +942,13 @@ HttpResponseSender::~HttpResponseSender() {
             }
             rc = socket->Write(h2_response, &wopt);
         }
+        if (grpc_stream != NULL) {
+            const int saved_errno = errno;
+            grpc_stream->OnResponseWritten(
+                grpc_stream_accepted && rc == 0,
+                rc == 0 ? cntl->ErrorCode() : saved_errno);
+            errno = saved_errno;
+        }
     } else {
         butil::IOBuf* content = NULL;
         if (cntl->Failed() || !cntl->has_progressive_writer()) {
@@ -1039,8 +1099,38 @@ FindMethodPropertyByURI(const std::string& uri_path, const Server* server,
     return NULL;
 }
 
+// [Server-side] Let the method run before the body of `http_imsg' is fully
+// received if it's listed in ServiceOptions.progressive_read_methods.
+// Returns true if so.
+static bool ReadRequestProgressively(HttpContext* http_imsg, Socket* socket,
+                                     const Server* server) {
+    if (server == NULL ||
+        server->options().http_master_service != NULL ||
+        !ServerPrivateAccessor(server).has_progressive_read_method()) {
+        return false;
+    }
+    const Server::MethodProperty* mp = FindMethodPropertyByURI(
+        http_imsg->header().uri().path(), server, NULL);
+    if (mp == NULL || !mp->params.read_request_progressively) {
+        return false;
+    }
+    http_imsg->set_read_body_progressively(true);
+    const std::string* expect = http_imsg->header().GetHeader("Expect");
+    if (expect != NULL && !http_imsg->Completed() &&
+        strcasecmp(expect->c_str(), "100-continue") == 0) {
+        // Clients uploading large bodies (curl for example) wait for this
+        // interim response before sending the body.
+        butil::IOBuf interim;
+        interim.append("HTTP/1.1 100 Continue\r\n\r\n");
+        Socket::WriteOptions wopt;
+        wopt.ignore_eovercrowded = true;
+        socket->Write(&interim, &wopt);
+    }
+    return true;
+}
+
 ParseResult ParseHttpMessage(butil::IOBuf *source, Socket *socket,
-                             bool read_eof, const void* /*arg*/) {
+                             bool read_eof, const void* arg) {
     HttpContext* http_imsg = 
         static_cast<HttpContext*>(socket->parsing_context());
     if (http_imsg == NULL) {
@@ -1101,19 +1191,38 @@ ParseResult ParseHttpMessage(butil::IOBuf *source, Socket *socket,
     } else if (rc >= 0) {
         // Normal or stage1 of progressive-read http message.
         source->pop_front(rc);
+        if (!socket->CreatedByConnect() &&
+            http_imsg->stage() >= HTTP_ON_HEADERS_COMPLETE &&
+            !http_imsg->progressive_read_checked()) {
+            http_imsg->set_progressive_read_checked();
+            ReadRequestProgressively(http_imsg, socket,
+                                     static_cast<const Server*>(arg));
+        }
         if (http_imsg->Completed()) {
             CHECK_EQ(http_imsg, socket->release_parsing_context());
+            if (socket->CreatedByConnect()) {
+                // Responses of pipelined requests come back in the same
+                // order. Pop the request here rather than in
+                // ProcessHttpResponse() which may run in different bthreads
+                // out of order.
+                PipelinedInfo pi;
+                if (socket->PopPipelinedInfo(&pi)) {
+                    http_imsg->set_pipelined_cid(pi.id_wait.value);
+                }
+            }
             const ParseResult result = MakeMessage(http_imsg);
             if (socket->is_read_progressive()) {
                 socket->OnProgressiveReadCompleted();
             }
             return result;
-        } else if (socket->is_read_progressive() &&
+        } else if (http_imsg->read_body_progressively() &&
                    http_imsg->stage() >= HTTP_ON_HEADERS_COMPLETE) {
-            // header part of a progressively-read http message is complete,
-            // go on to ProcessHttpXXX w/o waiting for full body.
+            // header part of a progressively-read http message(a response
+            // read progressively or a request to a method reading requests
+            // progressively) is complete, go on to ProcessHttpXXX w/o
+            // waiting for full body.
             http_imsg->AddOneRefForStage2(); // released when body is fully read
-            return MakeMessage(http_imsg);
+            return MakePartialMessage(http_imsg);
         } else {
             return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
         }
@@ -1253,6 +1362,22 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         .set_request_protocol(PROTOCOL_HTTP)
         .set_begin_time_us(msg->received_us())
         .move_in_server_receiving_sock(socket_guard);
+    if (imsg_guard->read_body_progressively()) {
+        // The body is still being received and read by the method with
+        // Controller::ReadProgressiveAttachmentBy(). Set before any failure
+        // so that the body is drained by the controller when not read.
+        accessor.set_readable_progressive_attachment(imsg_guard.get());
+        accessor.set_request_read_progressively();
+    }
+    if (is_http2) {
+        H2StreamContext* h2_sctx = static_cast<H2StreamContext*>(msg);
+        // Canceled by RST_STREAM from the client.
+        accessor.set_cancelable(h2_sctx->stream_id());
+        if (h2_sctx->grpc_stream() != NULL) {
+            // Accepted by GrpcStreamAccept() in the method.
+            accessor.set_grpc_stream(h2_sctx->grpc_stream());
+        }
+    }
     
     // Read log-id. errno may be set when input to strtoull overflows.
     // atoi/atol/atoll don't support 64-bit integer and can't be used.
@@ -1274,6 +1399,27 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         cntl->set_request_id(*request_id);
     }
 
+    // Deadline is relative to the time when the request was received.
+    int64_t timeout_us = -1;
+    const std::string* timeout_str = req_header.GetHeader(common->TIMEOUT_MS);
+    if (timeout_str) {
+        char* endptr = NULL;
+        const int64_t timeout_ms = strtoll(timeout_str->c_str(), &endptr, 10);
+        if (*endptr || timeout_ms < 0) {
+            LOG(ERROR) << "Invalid " << common->TIMEOUT_MS << '='
+                       << *timeout_str << " in http request";
+        } else {
+            timeout_us = timeout_ms * 1000L;
+        }
+    } else if (is_http2) {
+        timeout_us = ConvertGrpcTimeoutToUS(
+            req_header.GetHeader(common->GRPC_TIMEOUT));
+    }
+    if (timeout_us >= 0) {
+        accessor.set_deadline_us(
+            msg->base_real_us() + msg->received_us() + timeout_us);
+    }
+
     // Tag the bthread with this server's key for
     // thread_local_data().
     if (server->thread_local_options().thread_local_data_factory) {
@@ -1366,6 +1512,13 @@ void ProcessHttpRequest(InputMessageBase *msg) {
                             sp->method->full_name().c_str(), rejected_cc);
             return;
         }
+        if (!sp->is_builtin_service &&
+            !method_status->OnQueued(
+                butil::cpuwide_time_us() - msg->received_us())) {
+            cntl->SetFailed(ELIMIT, "Rejected by %s's QueueingDelayLimiter",
+                            sp->method->full_name().c_str());
+            return;
+        }
     }
     
     if (span) {
@@ -1395,6 +1548,13 @@ void ProcessHttpRequest(InputMessageBase *msg) {
                         " internal network", server->options().internal_port);
         return;
     }
+    if (cntl->deadline_us() >= 0 &&
+        butil::gettimeofday_us() >= cntl->deadline_us()) {
+        // The client has given up, don't waste time on it.
+        cntl->SetFailed(ERPCTIMEDOUT, "Deadline of the request was reached "
+                        "before calling %s", sp->method->full_name().c_str());
+        return;
+    }
 
     google::protobuf::Service* svc = sp->service;
     const google::protobuf::MethodDescriptor* method = sp->method;
@@ -1409,8 +1569,15 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         cntl->SetFailed("Fail to new req or res");
         return;
     }
-    if (sp->params.allow_http_body_to_pb &&
-        method->input_type()->field_count() > 0) {
+    // Messages of client-streaming gRPC calls are passed to the GrpcStream,
+    // `req' is left empty.
+    const H2GrpcStream* grpc_stream =
+        static_cast<const H2GrpcStream*>(accessor.grpc_stream());
+    if (cntl->is_request_read_progressively()) {
+        // The body is read by the method progressively, `req' is left empty.
+    } else if (sp->params.allow_http_body_to_pb &&
+               method->input_type()->field_count() > 0 &&
+               (grpc_stream == NULL || !grpc_stream->client_streaming())) {
         // A protobuf service. No matter if Content-type is set to
         // applcation/json or body is empty, we have to treat body as a json
         // and try to convert it to pb, which guarantees that a protobuf
@@ -1444,12 +1611,6 @@ void ProcessHttpRequest(InputMessageBase *msg) {
                             return;
                         }
                     }
-                    int64_t timeout_value_us =
-                        ConvertGrpcTimeoutToUS(req_header.GetHeader(common->GRPC_TIMEOUT));
-                    if (timeout_value_us >= 0) {
-                        accessor.set_deadline_us(
-                                butil::gettimeofday_us() + timeout_value_us);
-                    }
                 }
             } else {
                 encoding = req_header.GetHeader(common->CONTENT_ENCODING);
@@ -1496,10 +1657,16 @@ void ProcessHttpRequest(InputMessageBase *msg) {
         span->AsParent();
     }
     if (!FLAGS_usercode_in_pthread) {
+        ScopedServerDeadline sd(cntl->deadline_us());
+        ScopedCpuProfilingTag pt(method->full_name().c_str());
         return svc->CallMethod(method, cntl, req, res, done);
     }
     if (BeginRunningUserCode()) {
-        svc->CallMethod(method, cntl, req, res, done);
+        {
+            ScopedServerDeadline sd(cntl->deadline_us());
+            ScopedCpuProfilingTag pt(method->full_name().c_str());
+            svc->CallMethod(method, cntl, req, res, done);
+        }
         return EndRunningUserCodeInPlace();
     } else {
         return EndRunningCallMethodInPool(svc, method, cntl, req, res, done);
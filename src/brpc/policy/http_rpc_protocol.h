@@ -51,6 +51,7 @@ struct CommonStrings {
     // rename this to `x-bd-log-id'.
     // NOTE: Keep in mind that this name also appears inside `http_message.cpp'
     std::string LOG_ID;
+    std::string TIMEOUT_MS;
     std::string DEFAULT_METHOD;
     std::string NO_METHOD;
     std::string H2_SCHEME;
@@ -86,7 +87,9 @@ public:
     HttpContext(bool read_body_progressively)
         : InputMessageBase()
         , HttpMessage(read_body_progressively)
-        , _is_stage2(false) {
+        , _is_stage2(false)
+        , _progressive_read_checked(false)
+        , _pipelined_cid(0) {
         // add one ref for Destroy
         butil::intrusive_ptr<HttpContext>(this).detach();
     }
@@ -103,6 +106,16 @@ public:
     // True if AddOneRefForStage2() was ever called.
     bool is_stage2() const { return _is_stage2; }
 
+    // [Server-side] True if the method of this request was checked for
+    // ServiceOptions.progressive_read_methods.
+    bool progressive_read_checked() const { return _progressive_read_checked; }
+    void set_progressive_read_checked() { _progressive_read_checked = true; }
+
+    // [Client-side] Correlation id of the pipelined request responded by
+    // this message, 0 if the request was not pipelined.
+    uint64_t pipelined_cid() const { return _pipelined_cid; }
+    void set_pipelined_cid(uint64_t cid) { _pipelined_cid = cid; }
+
     // @InputMessageBase
     void DestroyImpl() {
         RemoveOneRefForStage2();
@@ -115,6 +128,8 @@ public:
 
 private:
     bool _is_stage2;
+    bool _progressive_read_checked;
+    uint64_t _pipelined_cid;
 };
 
 // Implement functions required in protocol.h
@@ -133,6 +148,10 @@ void PackHttpRequest(butil::IOBuf* buf,
                      Controller* controller,
                      const butil::IOBuf& request,
                      const Authenticator* auth);
+// Set x-bd-timeout-ms of the request in `cntl' to the time left before its
+// deadline. Called whenever an attempt is packed so that retries and backup
+// requests carry an up-to-date value.
+void SetRemainingTimeoutHeader(Controller* cntl);
 bool ParseHttpServerAddress(butil::EndPoint* out, const char* server_addr_and_port);
 const std::string& GetHttpMethodName(const google::protobuf::MethodDescriptor*,
                                      const Controller*);
@@ -464,6 +464,12 @@ void ProcessHuluRequest(InputMessageBase* msg_base) {
                                 sp->method->full_name().c_str(), rejected_cc);
                 break;
             }
+            if (!method_status->OnQueued(
+                    butil::cpuwide_time_us() - msg->received_us())) {
+                cntl->SetFailed(ELIMIT, "Rejected by %s's QueueingDelayLimiter",
+                                sp->method->full_name().c_str());
+                break;
+            }
         }
         
         google::protobuf::Service* svc = sp->service;
@@ -33,6 +33,7 @@
 #include "brpc/policy/memcache_binary_protocol.h"
 #include "brpc/policy/memcache_binary_header.h"
 #include "brpc/memcache.h"
+#include "brpc/memcache_service.h"
 #include "brpc/policy/most_common_message.h"
 #include "butil/containers/flat_map.h"
 
@@ -40,6 +41,7 @@
 namespace brpc {
 
 DECLARE_bool(enable_rpcz);
+DECLARE_uint64(max_body_size);
 
 namespace policy {
 
@@ -73,8 +75,297 @@ inline bool IsSupportedCommand(uint8_t command) {
     return butil::bit_array_get(supported_cmd_map, command);
 }
 
+// Append a response to `req' into `out'.
+static void AppendMemcacheResponse(butil::IOBuf* out,
+                                   const MemcacheRequestHeader& req,
+                                   uint16_t status, uint64_t cas_value,
+                                   const void* extras, uint8_t extras_length,
+                                   const butil::StringPiece& key,
+                                   const butil::IOBuf& value) {
+    const MemcacheResponseHeader header = {
+        MC_MAGIC_RESPONSE,
+        req.command,
+        butil::HostToNet16(key.size()),
+        extras_length,
+        MC_BINARY_RAW_BYTES,
+        butil::HostToNet16(status),
+        butil::HostToNet32(extras_length + key.size() + value.size()),
+        req.opaque,  // not converted
+        butil::HostToNet64(cas_value)
+    };
+    out->append(&header, sizeof(header));
+    if (extras_length) {
+        out->append(extras, extras_length);
+    }
+    if (!key.empty()) {
+        out->append(key.data(), key.size());
+    }
+    out->append(value);
+}
+
+// Same error messages as memcached, which are visible to clients as
+// MemcacheResponse::LastError().
+static const char* MemcacheErrorMessage(MemcacheResponse::Status status) {
+    switch (status) {
+    case MemcacheResponse::STATUS_KEY_ENOENT:
+        return "Not found";
+    case MemcacheResponse::STATUS_KEY_EEXISTS:
+        return "Data exists for key.";
+    case MemcacheResponse::STATUS_E2BIG:
+        return "Too large.";
+    case MemcacheResponse::STATUS_EINVAL:
+        return "Invalid arguments";
+    case MemcacheResponse::STATUS_NOT_STORED:
+        return "Not stored.";
+    case MemcacheResponse::STATUS_DELTA_BADVAL:
+        return "Non-numeric server-side value for incr or decr";
+    case MemcacheResponse::STATUS_UNKNOWN_COMMAND:
+        return "Unknown command";
+    case MemcacheResponse::STATUS_ENOMEM:
+        return "Out of memory";
+    default:
+        return MemcacheResponse::status_str(status);
+    }
+}
+
+static void AppendMemcacheError(butil::IOBuf* out,
+                                const MemcacheRequestHeader& req,
+                                MemcacheResponse::Status status) {
+    butil::IOBuf msg;
+    msg.append(MemcacheErrorMessage(status));
+    AppendMemcacheResponse(out, req, status, 0, NULL, 0, butil::StringPiece(), msg);
+}
+
+// Quiet commands don't reply on success(or miss for GET).
+static uint8_t ToNonQuietCommand(uint8_t command, bool* quiet) {
+    *quiet = true;
+    switch (command) {
+    case MC_BINARY_GETQ:       return MC_BINARY_GET;
+    case MC_BINARY_GETKQ:      return MC_BINARY_GETK;
+    case MC_BINARY_SETQ:       return MC_BINARY_SET;
+    case MC_BINARY_ADDQ:       return MC_BINARY_ADD;
+    case MC_BINARY_REPLACEQ:   return MC_BINARY_REPLACE;
+    case MC_BINARY_DELETEQ:    return MC_BINARY_DELETE;
+    case MC_BINARY_INCREMENTQ: return MC_BINARY_INCREMENT;
+    case MC_BINARY_DECREMENTQ: return MC_BINARY_DECREMENT;
+    case MC_BINARY_QUITQ:      return MC_BINARY_QUIT;
+    case MC_BINARY_FLUSHQ:     return MC_BINARY_FLUSH;
+    case MC_BINARY_APPENDQ:    return MC_BINARY_APPEND;
+    case MC_BINARY_PREPENDQ:   return MC_BINARY_PREPEND;
+    }
+    *quiet = false;
+    return command;
+}
+
+// Run the request in `body'(extras + key + value) with `service' and append
+// the response into `out'.
+static void RunMemcacheRequest(MemcacheService* service,
+                               const MemcacheRequestHeader& req,
+                               butil::IOBuf& body, butil::IOBuf* out) {
+    bool quiet = false;
+    const uint8_t command = ToNonQuietCommand(req.command, &quiet);
+    if ((size_t)req.extras_length + req.key_length > body.size()) {
+        return AppendMemcacheError(out, req, MemcacheResponse::STATUS_EINVAL);
+    }
+    char extras[32];
+    if (req.extras_length > sizeof(extras)) {
+        return AppendMemcacheError(out, req, MemcacheResponse::STATUS_EINVAL);
+    }
+    body.cutn(extras, req.extras_length);
+    std::string key;
+    body.cutn(&key, req.key_length);
+    // The rest of `body' is the value.
+    const butil::IOBuf empty;
+    MemcacheResponse::Status st = MemcacheResponse::STATUS_SUCCESS;
+    switch (command) {
+    case MC_BINARY_GET:
+    case MC_BINARY_GETK: {
+        butil::IOBuf value;
+        uint32_t flags = 0;
+        uint64_t cas_value = 0;
+        st = service->Get(key, &value, &flags, &cas_value);
+        if (st == MemcacheResponse::STATUS_SUCCESS) {
+            const uint32_t raw_flags = butil::HostToNet32(flags);
+            AppendMemcacheResponse(
+                out, req, st, cas_value, &raw_flags, sizeof(raw_flags),
+                (command == MC_BINARY_GETK ? butil::StringPiece(key)
+                 : butil::StringPiece()), value);
+            return;
+        }
+        if (st == MemcacheResponse::STATUS_KEY_ENOENT && quiet) {
+            return;
+        }
+        break;
+    }
+    case MC_BINARY_SET:
+    case MC_BINARY_ADD:
+    case MC_BINARY_REPLACE:
+    case MC_BINARY_APPEND:
+    case MC_BINARY_PREPEND: {
+        uint32_t flags = 0;
+        uint32_t exptime = 0;
+        MemcacheStoreMode mode = MEMCACHE_STORE_SET;
+        if (command == MC_BINARY_APPEND || command == MC_BINARY_PREPEND) {
+            // Extras are ignored, MemcacheRequest::Append() sends them.
+            mode = (command == MC_BINARY_APPEND ? MEMCACHE_STORE_APPEND
+                    : MEMCACHE_STORE_PREPEND);
+        } else {
+            if (req.extras_length != 8) {
+                st = MemcacheResponse::STATUS_EINVAL;
+                break;
+            }
+            flags = butil::NetToHost32(*(const uint32_t*)extras);
+            exptime = butil::NetToHost32(*(const uint32_t*)(extras + 4));
+            mode = (command == MC_BINARY_SET ? MEMCACHE_STORE_SET :
+                    command == MC_BINARY_ADD ? MEMCACHE_STORE_ADD :
+                    MEMCACHE_STORE_REPLACE);
+        }
+        uint64_t new_cas_value = 0;
+        st = service->Store(mode, key, body, flags, exptime, req.cas_value,
+                            &new_cas_value);
+        if (st == MemcacheResponse::STATUS_SUCCESS) {
+            if (!quiet) {
+                AppendMemcacheResponse(out, req, st, new_cas_value, NULL, 0,
+                                       butil::StringPiece(), empty);
+            }
+            return;
+        }
+        break;
+    }
+    case MC_BINARY_DELETE:
+        st = service->Delete(key, req.cas_value);
+        break;
+    case MC_BINARY_INCREMENT:
+    case MC_BINARY_DECREMENT: {
+        if (req.extras_length != 20) {
+            st = MemcacheResponse::STATUS_EINVAL;
+            break;
+        }
+        const uint64_t delta = butil::NetToHost64(*(const uint64_t*)extras);
+        const uint64_t initial_value =
+            butil::NetToHost64(*(const uint64_t*)(extras + 8));
+        const uint32_t exptime = butil::NetToHost32(*(const uint32_t*)(extras + 16));
+        uint64_t new_value = 0;
+        uint64_t new_cas_value = 0;
+        st = service->Counter(command == MC_BINARY_INCREMENT, key, delta,
+                              initial_value, exptime, &new_value, &new_cas_value);
+        if (st == MemcacheResponse::STATUS_SUCCESS) {
+            if (!quiet) {
+                butil::IOBuf value;
+                const uint64_t raw_value = butil::HostToNet64(new_value);
+                value.append(&raw_value, sizeof(raw_value));
+                AppendMemcacheResponse(out, req, st, new_cas_value, NULL, 0,
+                                       butil::StringPiece(), value);
+            }
+            return;
+        }
+        break;
+    }
+    case MC_BINARY_TOUCH:
+        if (req.extras_length != 4) {
+            st = MemcacheResponse::STATUS_EINVAL;
+            break;
+        }
+        st = service->Touch(key, butil::NetToHost32(*(const uint32_t*)extras));
+        break;
+    case MC_BINARY_FLUSH:
+        st = service->Flush(req.extras_length == 4 ?
+                            butil::NetToHost32(*(const uint32_t*)extras) : 0);
+        break;
+    case MC_BINARY_NOOP:
+    case MC_BINARY_QUIT:
+        break;
+    case MC_BINARY_VERSION: {
+        std::string version;
+        service->Version(&version);
+        butil::IOBuf value;
+        value.append(version);
+        AppendMemcacheResponse(out, req, st, 0, NULL, 0,
+                               butil::StringPiece(), value);
+        return;
+    }
+    default:
+        st = MemcacheResponse::STATUS_UNKNOWN_COMMAND;
+        break;
+    }
+    if (st != MemcacheResponse::STATUS_SUCCESS) {
+        AppendMemcacheError(out, req, st);
+    } else if (!quiet) {
+        AppendMemcacheResponse(out, req, st, 0, NULL, 0,
+                               butil::StringPiece(), empty);
+    }
+}
+
+// Run requests from a client and write responses back.
+static ParseResult ParseMemcacheRequests(butil::IOBuf* source, Socket* socket,
+                                         MemcacheService* service) {
+    const uint8_t* p_mcmagic = (const uint8_t*)source->fetch1();
+    if (NULL == p_mcmagic) {
+        return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+    }
+    if (*p_mcmagic != (uint8_t)MC_MAGIC_REQUEST) {
+        return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+    }
+    ParseError err = PARSE_ERROR_NOT_ENOUGH_DATA;
+    butil::IOBuf sendbuf;
+    while (true) {
+        char buf[24];
+        const MemcacheRequestHeader* header =
+            (const MemcacheRequestHeader*)source->fetch(buf, sizeof(buf));
+        if (NULL == header) {
+            break;
+        }
+        if (header->magic != (uint8_t)MC_MAGIC_REQUEST) {
+            LOG(WARNING) << "Invalid magic=" << (int)header->magic
+                         << " from " << socket->remote_side();
+            err = PARSE_ERROR_ABSOLUTELY_WRONG;
+            break;
+        }
+        const uint32_t total_body_length =
+            butil::NetToHost32(header->total_body_length);
+        if (total_body_length > FLAGS_max_body_size) {
+            err = PARSE_ERROR_TOO_BIG_DATA;
+            break;
+        }
+        if (source->size() < sizeof(*header) + total_body_length) {
+            break;
+        }
+        // endianness conversions.
+        const MemcacheRequestHeader local_header = {
+            header->magic,
+            header->command,
+            butil::NetToHost16(header->key_length),
+            header->extras_length,
+            header->data_type,
+            butil::NetToHost16(header->vbucket_id),
+            total_body_length,
+            header->opaque,
+            butil::NetToHost64(header->cas_value),
+        };
+        source->pop_front(sizeof(*header));
+        butil::IOBuf body;
+        source->cutn(&body, total_body_length);
+        RunMemcacheRequest(service, local_header, body, &sendbuf);
+    }
+    if (!sendbuf.empty()) {
+        Socket::WriteOptions wopt;
+        wopt.ignore_eovercrowded = true;
+        LOG_IF(WARNING, socket->Write(&sendbuf, &wopt) != 0)
+            << "Fail to send memcache responses";
+    }
+    return MakeParseError(err);
+}
+
 ParseResult ParseMemcacheMessage(butil::IOBuf* source,
-                                 Socket* socket, bool /*read_eof*/, const void */*arg*/) {
+                                 Socket* socket, bool /*read_eof*/, const void* arg) {
+    const Server* server = static_cast<const Server*>(arg);
+    if (server) {
+        MemcacheService* service = server->options().memcache_service;
+        if (service == NULL) {
+            return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+        }
+        return ParseMemcacheRequests(source, socket, service);
+    }
     while (1) {
         const uint8_t* p_mcmagic = (const uint8_t*)source->fetch1();
         if (NULL == p_mcmagic) {
@@ -150,6 +441,8 @@ ParseResult ParseMemcacheMessage(butil::IOBuf* source,
     }
 }
 
+void ProcessMemcacheRequest(InputMessageBase*) {}
+
 void ProcessMemcacheResponse(InputMessageBase* msg_base) {
     const int64_t start_parse_us = butil::cpuwide_time_us();
     DestroyingPtr<MostCommonMessage> msg(static_cast<MostCommonMessage*>(msg_base));
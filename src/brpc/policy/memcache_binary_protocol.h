@@ -29,6 +29,10 @@ namespace policy {
 ParseResult ParseMemcacheMessage(butil::IOBuf* source, Socket *socket, bool read_eof,
         const void *arg);
 
+// Requests are run inside ParseMemcacheMessage() at server-side, this
+// function is never called.
+void ProcessMemcacheRequest(InputMessageBase* msg);
+
 // Actions to a memcache response.
 void ProcessMemcacheResponse(InputMessageBase* msg);
 
@@ -0,0 +1,856 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <inttypes.h>                           // PRIu64
+#include <string.h>                             // memmem
+#include <gflags/gflags.h>
+#include <google/protobuf/descriptor.h>         // MethodDescriptor
+#include <google/protobuf/message.h>            // Message
+#include "butil/logging.h"                      // LOG()
+#include "butil/time.h"
+#include "butil/iobuf.h"                        // butil::IOBuf
+#include "butil/string_splitter.h"
+#include "butil/strings/string_number_conversions.h"
+#include "bthread/id.h"                          // bthread_id_lock
+#include "brpc/controller.h"                    // Controller
+#include "brpc/details/controller_private_accessor.h"
+#include "brpc/socket.h"                        // Socket
+#include "brpc/input_messenger.h"
+#include "brpc/server.h"                        // Server
+#include "brpc/span.h"
+#include "brpc/memcache.h"
+#include "brpc/memcache_service.h"
+#include "brpc/memcache_text.h"
+#include "brpc/policy/memcache_text_protocol.h"
+
+
+namespace brpc {
+
+DECLARE_uint64(max_body_size);
+
+namespace policy {
+
+int FetchMemcacheTextLine(const butil::IOBuf& buf, char* line) {
+    // Most lines are short, try a small prefix first.
+    size_t len = 128;
+    while (true) {
+        const size_t n = buf.copy_to(line, len);
+        const char* crlf = (const char*)memmem(line, n, "\r\n", 2);
+        if (crlf != NULL) {
+            line[crlf - line] = '\0';
+            return crlf - line;
+        }
+        if (n < len) {
+            return -1;
+        }
+        if (len == MEMCACHE_TEXT_MAX_LINE - 1) {
+            return -2;
+        }
+        len = MEMCACHE_TEXT_MAX_LINE - 1;
+    }
+}
+
+// Cut one complete response from `source' into `out'. A response is a
+// single line, or a line followed by a data block(VA), or a sequence of
+// VALUE/STAT lines(with data blocks for VALUE) ended by a single line(END).
+// VALUE blocks are cut as soon as they're complete so that a large
+// multi-get is not scanned again and again.
+static ParseError CutMemcacheTextResponse(butil::IOBuf* source,
+                                          butil::IOBuf* out) {
+    char line[MEMCACHE_TEXT_MAX_LINE];
+    while (true) {
+        const int len = FetchMemcacheTextLine(*source, line);
+        if (len == -1) {
+            return PARSE_ERROR_NOT_ENOUGH_DATA;
+        }
+        if (len < 0) {
+            LOG(ERROR) << "Too long line in memcache response";
+            return PARSE_ERROR_ABSOLUTELY_WRONG;
+        }
+        // Index of the token of data size, "VALUE <key> <flags> <bytes>"
+        // or "VA <bytes> <flags>*"
+        int size_index = -1;
+        if (strncmp(line, "VALUE ", 6) == 0) {
+            size_index = 3;
+        } else if (strncmp(line, "VA ", 3) == 0) {
+            size_index = 1;
+        } else if (strncmp(line, "STAT ", 5) == 0) {
+            source->cutn(out, len + 2);
+            continue;
+        } else {
+            source->cutn(out, len + 2);
+            return PARSE_OK;
+        }
+        butil::StringSplitter sp(line, line + len, ' ');
+        for (int i = 0; sp && i < size_index; ++i, ++sp) {}
+        uint64_t bytes = 0;
+        if (!sp || !butil::StringToUint64(
+                butil::StringPiece(sp.field(), sp.length()), &bytes)) {
+            LOG(ERROR) << "Invalid line in memcache response: " << line;
+            return PARSE_ERROR_ABSOLUTELY_WRONG;
+        }
+        if (bytes > FLAGS_max_body_size) {
+            return PARSE_ERROR_TOO_BIG_DATA;
+        }
+        const size_t total = len + 2 + bytes + 2;
+        if (source->size() < total) {
+            return PARSE_ERROR_NOT_ENOUGH_DATA;
+        }
+        source->cutn(out, total);
+        if (size_index == 1) {
+            return PARSE_OK;
+        }
+    }
+}
+
+struct MemcacheTextInputResponse : public InputMessageBase {
+    MemcacheTextInputResponse() : count(0) {}
+
+    bthread_id_t id_wait;
+    // Number of complete responses in `buf'.
+    uint32_t count;
+    butil::IOBuf buf;
+
+    // @InputMessageBase
+    void DestroyImpl() {
+        delete this;
+    }
+};
+
+// Mark of connections being served, as parsing_context of the socket.
+class MemcacheTextConnContext : public Destroyable {
+public:
+    // @Destroyable
+    void Destroy() { delete this; }
+};
+
+enum MemcacheTextCommandResult {
+    MEMCACHE_TEXT_DONE,
+    MEMCACHE_TEXT_MORE_DATA,
+    MEMCACHE_TEXT_UNKNOWN_COMMAND,
+    MEMCACHE_TEXT_TOO_BIG,
+};
+
+static void AppendMemcacheTextError(MemcacheResponse::Status st,
+                                    butil::IOBuf* out) {
+    switch (st) {
+    case MemcacheResponse::STATUS_UNKNOWN_COMMAND:
+        out->append("ERROR\r\n");
+        break;
+    case MemcacheResponse::STATUS_DELTA_BADVAL:
+        out->append("CLIENT_ERROR cannot increment or decrement "
+                    "non-numeric value\r\n");
+        break;
+    case MemcacheResponse::STATUS_EINVAL:
+        out->append("CLIENT_ERROR bad data chunk\r\n");
+        break;
+    case MemcacheResponse::STATUS_E2BIG:
+        out->append("SERVER_ERROR object too large for cache\r\n");
+        break;
+    case MemcacheResponse::STATUS_ENOMEM:
+        out->append("SERVER_ERROR out of memory storing object\r\n");
+        break;
+    default:
+        out->append("SERVER_ERROR ");
+        out->append(MemcacheResponse::status_str(st));
+        out->append("\r\n");
+        break;
+    }
+}
+
+static const char* const MEMCACHE_TEXT_BAD_FORMAT =
+    "CLIENT_ERROR bad command line format\r\n";
+
+// Negative exptime means "expired immediately", namely an absolute time
+// in the past.
+static bool ParseMemcacheExptime(const butil::StringPiece& s,
+                                 uint32_t* exptime) {
+    int64_t v = 0;
+    if (!butil::StringToInt64(s, &v) || v > (int64_t)UINT32_MAX) {
+        return false;
+    }
+    *exptime = (v < 0 ? 1 : (uint32_t)v);
+    return true;
+}
+
+static bool ParseMemcacheUint32(const butil::StringPiece& s, uint32_t* v) {
+    uint64_t v64 = 0;
+    if (!butil::StringToUint64(s, &v64) || v64 > UINT32_MAX) {
+        return false;
+    }
+    *v = (uint32_t)v64;
+    return true;
+}
+
+static void AppendMemcacheTextValue(butil::IOBuf* out,
+                                    const butil::StringPiece& key,
+                                    const butil::IOBuf& value,
+                                    uint32_t flags, const uint64_t* cas_value) {
+    char buf[64];
+    out->append("VALUE ");
+    out->append(key.data(), key.size());
+    if (cas_value) {
+        snprintf(buf, sizeof(buf), " %u %lu %" PRIu64 "\r\n", flags,
+                 (unsigned long)value.size(), *cas_value);
+    } else {
+        snprintf(buf, sizeof(buf), " %u %lu\r\n", flags,
+                 (unsigned long)value.size());
+    }
+    out->append(buf);
+    out->append(value);
+    out->append("\r\n");
+}
+
+// get|gets <key>*
+static void RunMemcacheTextGet(MemcacheService* service,
+                               const std::vector<butil::StringPiece>& tokens,
+                               butil::IOBuf* out) {
+    const bool with_cas = (tokens[0] == "gets");
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        butil::IOBuf value;
+        uint32_t flags = 0;
+        uint64_t cas_value = 0;
+        const MemcacheResponse::Status st =
+            service->Get(tokens[i], &value, &flags, &cas_value);
+        if (st == MemcacheResponse::STATUS_SUCCESS) {
+            AppendMemcacheTextValue(out, tokens[i], value, flags,
+                                    with_cas ? &cas_value : NULL);
+        } else if (st != MemcacheResponse::STATUS_KEY_ENOENT) {
+            return AppendMemcacheTextError(st, out);
+        }
+    }
+    out->append("END\r\n");
+}
+
+// Cut the data block of `bytes' following the command line of `line_size'
+// from `source' into `data'.
+static MemcacheTextCommandResult CutMemcacheTextData(
+    butil::IOBuf* source, size_t line_size, uint64_t bytes,
+    butil::IOBuf* data, bool* bad_chunk) {
+    if (bytes > FLAGS_max_body_size) {
+        return MEMCACHE_TEXT_TOO_BIG;
+    }
+    if (source->size() < line_size + bytes + 2) {
+        return MEMCACHE_TEXT_MORE_DATA;
+    }
+    source->pop_front(line_size);
+    source->cutn(data, bytes);
+    char crlf[2];
+    source->cutn(crlf, sizeof(crlf));
+    *bad_chunk = (crlf[0] != '\r' || crlf[1] != '\n');
+    return MEMCACHE_TEXT_DONE;
+}
+
+// set|add|replace|append|prepend <key> <flags> <exptime> <bytes> [noreply]
+// cas <key> <flags> <exptime> <bytes> <cas unique> [noreply]
+static MemcacheTextCommandResult RunMemcacheTextStore(
+    MemcacheService* service, MemcacheStoreMode mode,
+    const std::vector<butil::StringPiece>& tokens,
+    butil::IOBuf* source, size_t line_size, butil::IOBuf* out) {
+    const bool is_cas = (tokens[0] == "cas");
+    const size_t nargs = (is_cas ? 6 : 5);
+    uint32_t flags = 0;
+    uint32_t exptime = 0;
+    uint64_t bytes = 0;
+    uint64_t cas_value = 0;
+    if (tokens.size() < nargs || tokens.size() > nargs + 1 ||
+        !ParseMemcacheUint32(tokens[2], &flags) ||
+        !ParseMemcacheExptime(tokens[3], &exptime) ||
+        !butil::StringToUint64(tokens[4], &bytes) ||
+        (is_cas && !butil::StringToUint64(tokens[5], &cas_value))) {
+        source->pop_front(line_size);
+        out->append(MEMCACHE_TEXT_BAD_FORMAT);
+        return MEMCACHE_TEXT_DONE;
+    }
+    const bool noreply = (tokens.size() > nargs && tokens[nargs] == "noreply");
+    const butil::StringPiece& key = tokens[1];
+    butil::IOBuf value;
+    bool bad_chunk = false;
+    const MemcacheTextCommandResult rc =
+        CutMemcacheTextData(source, line_size, bytes, &value, &bad_chunk);
+    if (rc != MEMCACHE_TEXT_DONE) {
+        return rc;
+    }
+    if (bad_chunk) {
+        out->append("CLIENT_ERROR bad data chunk\r\n");
+        return MEMCACHE_TEXT_DONE;
+    }
+    uint64_t new_cas_value = 0;
+    const MemcacheResponse::Status st = service->Store(
+        mode, key, value, flags, exptime, cas_value, &new_cas_value);
+    if (noreply) {
+        return MEMCACHE_TEXT_DONE;
+    }
+    switch (st) {
+    case MemcacheResponse::STATUS_SUCCESS:
+        out->append("STORED\r\n");
+        break;
+    case MemcacheResponse::STATUS_NOT_STORED:
+        out->append("NOT_STORED\r\n");
+        break;
+    case MemcacheResponse::STATUS_KEY_EEXISTS:
+        out->append("EXISTS\r\n");
+        break;
+    case MemcacheResponse::STATUS_KEY_ENOENT:
+        out->append(is_cas ? "NOT_FOUND\r\n" : "NOT_STORED\r\n");
+        break;
+    default:
+        AppendMemcacheTextError(st, out);
+        break;
+    }
+    return MEMCACHE_TEXT_DONE;
+}
+
+// Classic commands without data blocks.
+static MemcacheTextCommandResult RunMemcacheTextSimple(
+    MemcacheService* service, const std::vector<butil::StringPiece>& tokens,
+    butil::IOBuf* out) {
+    const butil::StringPiece& cmd = tokens[0];
+    const bool noreply = (tokens.back() == "noreply");
+    const size_t nargs = tokens.size() - noreply;
+    MemcacheResponse::Status st = MemcacheResponse::STATUS_SUCCESS;
+    const char* ok = "OK\r\n";
+    butil::IOBuf reply;
+    if (cmd == "delete") {
+        // "delete <key> 0" is accepted by old clients.
+        if (nargs != 2 && !(nargs == 3 && tokens[2] == "0")) {
+            out->append(MEMCACHE_TEXT_BAD_FORMAT);
+            return MEMCACHE_TEXT_DONE;
+        }
+        st = service->Delete(tokens[1], 0);
+        ok = "DELETED\r\n";
+    } else if (cmd == "incr" || cmd == "decr") {
+        uint64_t delta = 0;
+        if (nargs != 3 || !butil::StringToUint64(tokens[2], &delta)) {
+            out->append("CLIENT_ERROR invalid numeric delta argument\r\n");
+            return MEMCACHE_TEXT_DONE;
+        }
+        uint64_t new_value = 0;
+        uint64_t new_cas_value = 0;
+        st = service->Counter(cmd == "incr", tokens[1], delta, 0, 0xFFFFFFFF,
+                              &new_value, &new_cas_value);
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%" PRIu64 "\r\n", new_value);
+        reply.append(buf);
+    } else if (cmd == "touch") {
+        uint32_t exptime = 0;
+        if (nargs != 3 || !ParseMemcacheExptime(tokens[2], &exptime)) {
+            out->append(MEMCACHE_TEXT_BAD_FORMAT);
+            return MEMCACHE_TEXT_DONE;
+        }
+        st = service->Touch(tokens[1], exptime);
+        ok = "TOUCHED\r\n";
+    } else if (cmd == "flush_all") {
+        uint32_t delay = 0;
+        if (nargs > 2 ||
+            (nargs == 2 && !ParseMemcacheUint32(tokens[1], &delay))) {
+            out->append(MEMCACHE_TEXT_BAD_FORMAT);
+            return MEMCACHE_TEXT_DONE;
+        }
+        st = service->Flush(delay);
+    } else if (cmd == "version") {
+        std::string version;
+        service->Version(&version);
+        reply.append("VERSION ");
+        reply.append(version);
+        reply.append("\r\n");
+    } else if (cmd == "verbosity") {
+        // Nothing to do.
+    } else if (cmd == "quit") {
+        // Clients close the connection after quit.
+        return MEMCACHE_TEXT_DONE;
+    } else {
+        return MEMCACHE_TEXT_UNKNOWN_COMMAND;
+    }
+    if (noreply) {
+        return MEMCACHE_TEXT_DONE;
+    }
+    if (st == MemcacheResponse::STATUS_SUCCESS) {
+        if (reply.empty()) {
+            out->append(ok);
+        } else {
+            out->append(reply);
+        }
+    } else if (st == MemcacheResponse::STATUS_KEY_ENOENT) {
+        out->append("NOT_FOUND\r\n");
+    } else if (st == MemcacheResponse::STATUS_KEY_EEXISTS) {
+        out->append("EXISTS\r\n");
+    } else {
+        AppendMemcacheTextError(st, out);
+    }
+    return MEMCACHE_TEXT_DONE;
+}
+
+// Flags common to meta commands.
+struct MemcacheMetaFlags {
+    MemcacheMetaFlags() : quiet(false), return_key(false), return_cas(false) {}
+    bool quiet;
+    bool return_key;
+    bool return_cas;
+    butil::StringPiece opaque;
+};
+
+// Append return flags and the tailing "\r\n".
+static void AppendMemcacheMetaTail(butil::IOBuf* out,
+                                   const MemcacheMetaFlags& mf,
+                                   const butil::StringPiece& key,
+                                   uint64_t cas_value) {
+    if (mf.return_cas) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), " c%" PRIu64, cas_value);
+        out->append(buf);
+    }
+    if (mf.return_key) {
+        out->append(" k");
+        out->append(key.data(), key.size());
+    }
+    if (!mf.opaque.empty()) {
+        out->append(" O");
+        out->append(mf.opaque.data(), mf.opaque.size());
+    }
+    out->append("\r\n");
+}
+
+// Reply failures of meta commands.
+static void AppendMemcacheMetaStatus(butil::IOBuf* out,
+                                     MemcacheResponse::Status st,
+                                     const MemcacheMetaFlags& mf,
+                                     const butil::StringPiece& key) {
+    const char* code = NULL;
+    switch (st) {
+    case MemcacheResponse::STATUS_SUCCESS:    code = "HD"; break;
+    case MemcacheResponse::STATUS_NOT_STORED: code = "NS"; break;
+    case MemcacheResponse::STATUS_KEY_EEXISTS: code = "EX"; break;
+    case MemcacheResponse::STATUS_KEY_ENOENT: code = "NF"; break;
+    default:
+        return AppendMemcacheTextError(st, out);
+    }
+    out->append(code);
+    MemcacheMetaFlags tail = mf;
+    tail.return_cas = false;
+    AppendMemcacheMetaTail(out, tail, key, 0);
+}
+
+// mg <key> <flag>*
+static void RunMemcacheMetaGet(MemcacheService* service,
+                               const std::vector<butil::StringPiece>& tokens,
+                               butil::IOBuf* out) {
+    MemcacheMetaFlags mf;
+    bool return_value = false;
+    bool return_flags = false;
+    bool return_size = false;
+    bool return_ttl = false;
+    for (size_t i = 2; i < tokens.size(); ++i) {
+        switch (tokens[i][0]) {
+        case 'v': return_value = true; break;
+        case 'f': return_flags = true; break;
+        case 's': return_size = true; break;
+        case 't': return_ttl = true; break;
+        case 'c': mf.return_cas = true; break;
+        case 'k': mf.return_key = true; break;
+        case 'q': mf.quiet = true; break;
+        case 'O': mf.opaque = tokens[i].substr(1); break;
+        default: break;  // Unsupported flags are ignored.
+        }
+    }
+    const butil::StringPiece& key = tokens[1];
+    butil::IOBuf value;
+    uint32_t flags = 0;
+    uint64_t cas_value = 0;
+    const MemcacheResponse::Status st =
+        service->Get(key, &value, &flags, &cas_value);
+    if (st == MemcacheResponse::STATUS_KEY_ENOENT) {
+        if (!mf.quiet) {
+            out->append("EN\r\n");
+        }
+        return;
+    }
+    if (st != MemcacheResponse::STATUS_SUCCESS) {
+        return AppendMemcacheTextError(st, out);
+    }
+    char buf[64];
+    if (return_value) {
+        snprintf(buf, sizeof(buf), "VA %lu", (unsigned long)value.size());
+        out->append(buf);
+    } else {
+        out->append("HD");
+    }
+    if (return_flags) {
+        snprintf(buf, sizeof(buf), " f%u", flags);
+        out->append(buf);
+    }
+    if (return_size) {
+        snprintf(buf, sizeof(buf), " s%lu", (unsigned long)value.size());
+        out->append(buf);
+    }
+    if (return_ttl) {
+        // Remaining TTL is unknown to MemcacheService, reply "no expiry".
+        out->append(" t-1");
+    }
+    AppendMemcacheMetaTail(out, mf, key, cas_value);
+    if (return_value) {
+        out->append(value);
+        out->append("\r\n");
+    }
+}
+
+// ms <key> <datalen> <flag>*
+static MemcacheTextCommandResult RunMemcacheMetaSet(
+    MemcacheService* service, const std::vector<butil::StringPiece>& tokens,
+    butil::IOBuf* source, size_t line_size, butil::IOBuf* out) {
+    uint64_t bytes = 0;
+    if (tokens.size() < 3 || !butil::StringToUint64(tokens[2], &bytes)) {
+        source->pop_front(line_size);
+        out->append(MEMCACHE_TEXT_BAD_FORMAT);
+        return MEMCACHE_TEXT_DONE;
+    }
+    MemcacheMetaFlags mf;
+    MemcacheStoreMode mode = MEMCACHE_STORE_SET;
+    uint32_t flags = 0;
+    uint32_t exptime = 0;
+    uint64_t cas_value = 0;
+    bool bad_flag = false;
+    for (size_t i = 3; i < tokens.size(); ++i) {
+        const butil::StringPiece arg = tokens[i].substr(1);
+        switch (tokens[i][0]) {
+        case 'F': bad_flag |= !ParseMemcacheUint32(arg, &flags); break;
+        case 'T': bad_flag |= !ParseMemcacheExptime(arg, &exptime); break;
+        case 'C': bad_flag |= !butil::StringToUint64(arg, &cas_value); break;
+        case 'c': mf.return_cas = true; break;
+        case 'k': mf.return_key = true; break;
+        case 'q': mf.quiet = true; break;
+        case 'O': mf.opaque = arg; break;
+        case 'M':
+            switch (arg.empty() ? '\0' : arg[0]) {
+            case 'S': case 's': mode = MEMCACHE_STORE_SET; break;
+            case 'E': case 'e': mode = MEMCACHE_STORE_ADD; break;
+            case 'R': case 'r': mode = MEMCACHE_STORE_REPLACE; break;
+            case 'A': case 'a': mode = MEMCACHE_STORE_APPEND; break;
+            case 'P': case 'p': mode = MEMCACHE_STORE_PREPEND; break;
+            default: bad_flag = true; break;
+            }
+            break;
+        default: break;
+        }
+    }
+    const butil::StringPiece& key = tokens[1];
+    butil::IOBuf value;
+    bool bad_chunk = false;
+    const MemcacheTextCommandResult rc =
+        CutMemcacheTextData(source, line_size, bytes, &value, &bad_chunk);
+    if (rc != MEMCACHE_TEXT_DONE) {
+        return rc;
+    }
+    if (bad_chunk) {
+        out->append("CLIENT_ERROR bad data chunk\r\n");
+        return MEMCACHE_TEXT_DONE;
+    }
+    if (bad_flag) {
+        out->append("CLIENT_ERROR invalid flag\r\n");
+        return MEMCACHE_TEXT_DONE;
+    }
+    uint64_t new_cas_value = 0;
+    const MemcacheResponse::Status st = service->Store(
+        mode, key, value, flags, exptime, cas_value, &new_cas_value);
+    if (st == MemcacheResponse::STATUS_SUCCESS) {
+        if (!mf.quiet) {
+            out->append("HD");
+            AppendMemcacheMetaTail(out, mf, key, new_cas_value);
+        }
+    } else {
+        AppendMemcacheMetaStatus(out, st, mf, key);
+    }
+    return MEMCACHE_TEXT_DONE;
+}
+
+// md <key> <flag>*
+static void RunMemcacheMetaDelete(MemcacheService* service,
+                                  const std::vector<butil::StringPiece>& tokens,
+                                  butil::IOBuf* out) {
+    MemcacheMetaFlags mf;
+    uint64_t cas_value = 0;
+    for (size_t i = 2; i < tokens.size(); ++i) {
+        const butil::StringPiece arg = tokens[i].substr(1);
+        switch (tokens[i][0]) {
+        case 'C':
+            if (!butil::StringToUint64(arg, &cas_value)) {
+                out->append("CLIENT_ERROR invalid flag\r\n");
+                return;
+            }
+            break;
+        case 'k': mf.return_key = true; break;
+        case 'q': mf.quiet = true; break;
+        case 'O': mf.opaque = arg; break;
+        default: break;
+        }
+    }
+    const MemcacheResponse::Status st = service->Delete(tokens[1], cas_value);
+    if (st == MemcacheResponse::STATUS_SUCCESS && mf.quiet) {
+        return;
+    }
+    AppendMemcacheMetaStatus(out, st, mf, tokens[1]);
+}
+
+// Run the command in the first line of `source' which is copied into `line'
+// of `line_len' bytes. `tokens' reference `line'. The command is popped from
+// `source' if MEMCACHE_TEXT_DONE is returned.
+static MemcacheTextCommandResult RunMemcacheTextCommand(
+    MemcacheService* service, char* line, int line_len,
+    std::vector<butil::StringPiece>* tokens,
+    butil::IOBuf* source, butil::IOBuf* out) {
+    const size_t line_size = line_len + 2/*\r\n*/;
+    tokens->clear();
+    for (butil::StringSplitter sp(line, line + line_len, ' '); sp; ++sp) {
+        tokens->push_back(butil::StringPiece(sp.field(), sp.length()));
+    }
+    if (tokens->empty()) {
+        source->pop_front(line_size);
+        out->append("ERROR\r\n");
+        return MEMCACHE_TEXT_DONE;
+    }
+    const butil::StringPiece cmd = (*tokens)[0];
+    MemcacheStoreMode mode = MEMCACHE_STORE_SET;
+    if (cmd == "set" || cmd == "cas") {
+        mode = MEMCACHE_STORE_SET;
+    } else if (cmd == "add") {
+        mode = MEMCACHE_STORE_ADD;
+    } else if (cmd == "replace") {
+        mode = MEMCACHE_STORE_REPLACE;
+    } else if (cmd == "append") {
+        mode = MEMCACHE_STORE_APPEND;
+    } else if (cmd == "prepend") {
+        mode = MEMCACHE_STORE_PREPEND;
+    } else if (cmd == "ms") {
+        return RunMemcacheMetaSet(service, *tokens, source, line_size, out);
+    } else {
+        // Commands without data blocks. The line is kept in `source' for
+        // unknown commands which may belong to other protocols.
+        MemcacheTextCommandResult rc = MEMCACHE_TEXT_DONE;
+        if (cmd == "get" || cmd == "gets") {
+            RunMemcacheTextGet(service, *tokens, out);
+        } else if (cmd == "mg" || cmd == "md") {
+            if (tokens->size() < 2) {
+                out->append(MEMCACHE_TEXT_BAD_FORMAT);
+            } else if (cmd == "mg") {
+                RunMemcacheMetaGet(service, *tokens, out);
+            } else {
+                RunMemcacheMetaDelete(service, *tokens, out);
+            }
+        } else if (cmd == "mn") {
+            out->append("MN\r\n");
+        } else if (tokens->size() >= 2 ||
+                   cmd == "version" || cmd == "flush_all" ||
+                   cmd == "verbosity" || cmd == "quit") {
+            rc = RunMemcacheTextSimple(service, *tokens, out);
+        } else {
+            rc = MEMCACHE_TEXT_UNKNOWN_COMMAND;
+        }
+        if (rc == MEMCACHE_TEXT_DONE) {
+            source->pop_front(line_size);
+        }
+        return rc;
+    }
+    return RunMemcacheTextStore(service, mode, *tokens, source, line_size, out);
+}
+
+// Run commands from a client and write responses back.
+static ParseResult ParseMemcacheTextRequests(butil::IOBuf* source,
+                                             Socket* socket,
+                                             MemcacheService* service) {
+    MemcacheTextConnContext* ctx =
+        static_cast<MemcacheTextConnContext*>(socket->parsing_context());
+    if (ctx == NULL) {
+        // Commands in the text protocol always start with a lowercase
+        // letter.
+        const char fc = *(const char*)source->fetch1();
+        if (fc < 'a' || fc > 'z') {
+            return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+        }
+    }
+    ParseError err = PARSE_ERROR_NOT_ENOUGH_DATA;
+    butil::IOBuf sendbuf;
+    char line[MEMCACHE_TEXT_MAX_LINE];
+    std::vector<butil::StringPiece> tokens;
+    while (!source->empty()) {
+        const int len = FetchMemcacheTextLine(*source, line);
+        if (len == -1) {
+            break;
+        }
+        if (len < 0) {
+            if (ctx == NULL) {
+                return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+            }
+            LOG(WARNING) << "Too long line from " << socket->remote_side();
+            err = PARSE_ERROR_ABSOLUTELY_WRONG;
+            break;
+        }
+        const MemcacheTextCommandResult rc = RunMemcacheTextCommand(
+            service, line, len, &tokens, source, &sendbuf);
+        if (rc == MEMCACHE_TEXT_UNKNOWN_COMMAND) {
+            if (ctx == NULL) {
+                // Not memcache, let other protocols have a try.
+                return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+            }
+            source->pop_front(len + 2);
+            sendbuf.append("ERROR\r\n");
+            continue;
+        }
+        if (rc == MEMCACHE_TEXT_TOO_BIG) {
+            err = PARSE_ERROR_TOO_BIG_DATA;
+            break;
+        }
+        if (ctx == NULL) {
+            ctx = new MemcacheTextConnContext;
+            socket->reset_parsing_context(ctx);
+        }
+        if (rc == MEMCACHE_TEXT_MORE_DATA) {
+            break;
+        }
+    }
+    if (!sendbuf.empty()) {
+        Socket::WriteOptions wopt;
+        wopt.ignore_eovercrowded = true;
+        LOG_IF(WARNING, socket->Write(&sendbuf, &wopt) != 0)
+            << "Fail to send memcache responses";
+    }
+    return MakeParseError(err);
+}
+
+ParseResult ParseMemcacheTextMessage(butil::IOBuf* source, Socket* socket,
+                                     bool /*read_eof*/, const void* arg) {
+    if (source->empty()) {
+        return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
+    }
+    const Server* server = static_cast<const Server*>(arg);
+    if (server) {
+        MemcacheService* service = server->options().memcache_service;
+        if (service == NULL) {
+            return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+        }
+        return ParseMemcacheTextRequests(source, socket, service);
+    }
+    MemcacheTextInputResponse* msg =
+        static_cast<MemcacheTextInputResponse*>(socket->parsing_context());
+    if (msg == NULL) {
+        // Responses in the text protocol always start with an uppercase
+        // letter.
+        const char fc = *(const char*)source->fetch1();
+        if (fc < 'A' || fc > 'Z') {
+            return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+        }
+    }
+    PipelinedInfo pi;
+    if (!socket->PopPipelinedInfo(&pi)) {
+        LOG(WARNING) << "No corresponding PipelinedInfo in socket";
+        return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+    }
+    if (msg == NULL) {
+        msg = new MemcacheTextInputResponse;
+        socket->reset_parsing_context(msg);
+    }
+    while (msg->count < pi.count) {
+        ParseError err = CutMemcacheTextResponse(source, &msg->buf);
+        if (err != PARSE_OK) {
+            socket->GivebackPipelinedInfo(pi);
+            return MakeParseError(err);
+        }
+        ++msg->count;
+    }
+    msg->id_wait = pi.id_wait;
+    socket->release_parsing_context();
+    return MakeMessage(msg);
+}
+
+void ProcessMemcacheTextRequest(InputMessageBase*) {}
+
+void ProcessMemcacheTextResponse(InputMessageBase* msg_base) {
+    const int64_t start_parse_us = butil::cpuwide_time_us();
+    DestroyingPtr<MemcacheTextInputResponse> msg(
+        static_cast<MemcacheTextInputResponse*>(msg_base));
+
+    const bthread_id_t cid = msg->id_wait;
+    Controller* cntl = NULL;
+    const int rc = bthread_id_lock(cid, (void**)&cntl);
+    if (rc != 0) {
+        LOG_IF(ERROR, rc != EINVAL && rc != EPERM)
+            << "Fail to lock correlation_id=" << cid << ": " << berror(rc);
+        return;
+    }
+
+    ControllerPrivateAccessor accessor(cntl);
+    Span* span = accessor.span();
+    if (span) {
+        span->set_base_real_us(msg->base_real_us());
+        span->set_received_us(msg->received_us());
+        span->set_response_size(msg->buf.length());
+        span->set_start_parse_us(start_parse_us);
+    }
+    const int saved_error = cntl->ErrorCode();
+    if (cntl->response() == NULL) {
+        cntl->SetFailed(ERESPONSE, "response is NULL!");
+    } else if (cntl->response()->GetDescriptor() != MemcacheTextResponse::descriptor()) {
+        cntl->SetFailed(ERESPONSE, "Must be MemcacheTextResponse");
+    } else {
+        // We work around ParseFrom of pb which is just a placeholder.
+        ((MemcacheTextResponse*)cntl->response())->raw_buffer() = msg->buf.movable();
+        if (msg->count != accessor.pipelined_count()) {
+            cntl->SetFailed(ERESPONSE, "pipelined_count=%u of response does "
+                            "not equal request's=%u",
+                            msg->count, accessor.pipelined_count());
+        }
+    }
+    // Unlocks correlation_id inside. Revert controller's
+    // error code if it version check of `cid' fails
+    msg.reset();  // optional, just release resourse ASAP
+    accessor.OnResponse(cid, saved_error);
+}
+
+void SerializeMemcacheTextRequest(butil::IOBuf* buf,
+                                  Controller* cntl,
+                                  const google::protobuf::Message* request) {
+    if (request == NULL) {
+        return cntl->SetFailed(EREQUEST, "request is NULL");
+    }
+    if (request->GetDescriptor() != MemcacheTextRequest::descriptor()) {
+        return cntl->SetFailed(EREQUEST, "Must be MemcacheTextRequest");
+    }
+    const MemcacheTextRequest* mr = (const MemcacheTextRequest*)request;
+    if (mr->pipelined_count() == 0) {
+        return cntl->SetFailed(EREQUEST, "MemcacheTextRequest is empty");
+    }
+    // We work around SerializeTo of pb which is just a placeholder.
+    *buf = mr->raw_buffer();
+    ControllerPrivateAccessor(cntl).set_pipelined_count(mr->pipelined_count());
+}
+
+void PackMemcacheTextRequest(butil::IOBuf* buf,
+                             SocketMessage**,
+                             uint64_t /*correlation_id*/,
+                             const google::protobuf::MethodDescriptor*,
+                             Controller* cntl,
+                             const butil::IOBuf& request,
+                             const Authenticator* auth) {
+    if (auth) {
+        return cntl->SetFailed(EREQUEST, "The memcache text protocol does "
+                               "not support authentication");
+    }
+    buf->append(request);
+}
+
+}  // namespace policy
+} // namespace brpc
@@ -0,0 +1,68 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_POLICY_MEMCACHE_TEXT_PROTOCOL_H
+#define BRPC_POLICY_MEMCACHE_TEXT_PROTOCOL_H
+
+#include "brpc/protocol.h"
+
+
+namespace brpc {
+namespace policy {
+
+// Lines(including the trailing "\r\n") of the memcache text protocol must
+// be shorter than this.
+static const size_t MEMCACHE_TEXT_MAX_LINE = 2048;
+
+// Copy the first line of `buf' without "\r\n" into `line' which has at
+// least MEMCACHE_TEXT_MAX_LINE bytes, and end it with '\0'.
+// Returns length of the line, -1 if the line is not complete, -2 if the line
+// is too long.
+int FetchMemcacheTextLine(const butil::IOBuf& buf, char* line);
+
+// Parse responses in the memcache text protocol at client-side, or run
+// commands with ServerOptions.memcache_service at server-side.
+ParseResult ParseMemcacheTextMessage(butil::IOBuf* source, Socket *socket,
+                                     bool read_eof, const void *arg);
+
+// Commands are run inside ParseMemcacheTextMessage() at server-side, this
+// function is never called.
+void ProcessMemcacheTextRequest(InputMessageBase* msg);
+
+// Actions to a memcache text response.
+void ProcessMemcacheTextResponse(InputMessageBase* msg);
+
+// Serialize a MemcacheTextRequest.
+void SerializeMemcacheTextRequest(butil::IOBuf* buf,
+                                  Controller* cntl,
+                                  const google::protobuf::Message* request);
+
+// Pack `request' to `method' into `buf'.
+void PackMemcacheTextRequest(butil::IOBuf* buf,
+                             SocketMessage**,
+                             uint64_t correlation_id,
+                             const google::protobuf::MethodDescriptor* method,
+                             Controller* controller,
+                             const butil::IOBuf& request,
+                             const Authenticator* auth);
+
+}  // namespace policy
+} // namespace brpc
+
+
+#endif  // BRPC_POLICY_MEMCACHE_TEXT_PROTOCOL_H
@@ -252,6 +252,13 @@ void ProcessMongoRequest(InputMessageBase* msg_base) {
                     mp->method->full_name().c_str(), rejected_cc);
                 break;
             }
+            if (!method_status->OnQueued(
+                    butil::cpuwide_time_us() - msg->received_us())) {
+                mongo_done->cntl.SetFailed(
+                    ELIMIT, "Rejected by %s's QueueingDelayLimiter",
+                    mp->method->full_name().c_str());
+                break;
+            }
         }
         
         if (!MongoOp_IsValid(header->op_code)) {
@@ -23,12 +23,14 @@
 #include "butil/logging.h"                       // LOG()
 #include "butil/time.h"
 #include "butil/iobuf.h"                         // butil::IOBuf
+#include "butil/synchronization/lock.h"
 #include "brpc/controller.h"               // Controller
 #include "brpc/details/controller_private_accessor.h"
 #include "brpc/socket.h"                   // Socket
 #include "brpc/server.h"                   // Server
 #include "brpc/details/server_private_accessor.h"
 #include "brpc/span.h"
+#include "brpc/shared_object.h"
 #include "brpc/redis.h"
 #include "brpc/redis_command.h"
 #include "brpc/policy/redis_protocol.h"
@@ -53,11 +55,115 @@ struct InputResponse : public InputMessageBase {
     }
 };
 
+// Replies of a connection which ever ran asynchronous commands. Replies
+// are queued in the order of commands and written into the socket when all
+// replies before them are filled.
+class RedisReplyQueue : public SharedObject {
+public:
+    struct Reply {
+        butil::IOBuf buf;
+        bool ready;
+    };
+
+    explicit RedisReplyQueue(SocketId socket_id) : _socket_id(socket_id) {}
+
+    // Queue a reply which is filled later by Fill() if `buf' is NULL.
+    // Called by the parsing bthread only.
+    Reply* Push(butil::IOBuf* buf) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        _replies.push_back(Reply());
+        Reply* r = &_replies.back();
+        r->ready = (buf != NULL);
+        if (buf) {
+            r->buf.swap(*buf);
+        }
+        return r;
+    }
+
+    void Fill(Reply* r, butil::IOBuf* buf) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        r->buf.swap(*buf);
+        r->ready = true;
+        FlushLocked();
+    }
+
+    void Flush() {
+        BAIDU_SCOPED_LOCK(_mutex);
+        FlushLocked();
+    }
+
+private:
+    // Writing inside the lock keeps the order of replies. Socket::Write()
+    // just queues the data and does not block.
+    void FlushLocked() {
+        butil::IOBuf sendbuf;
+        while (!_replies.empty() && _replies.front().ready) {
+            sendbuf.append(_replies.front().buf);
+            _replies.pop_front();
+        }
+        if (sendbuf.empty()) {
+            return;
+        }
+        SocketUniquePtr s;
+        if (Socket::Address(_socket_id, &s) != 0) {
+            return;
+        }
+        Socket::WriteOptions wopt;
+        wopt.ignore_eovercrowded = true;
+        LOG_IF(WARNING, s->Write(&sendbuf, &wopt) != 0)
+            << "Fail to send redis reply";
+    }
+
+    const SocketId _socket_id;
+    butil::Mutex _mutex;
+    // push_back() and pop_front() of deque do not invalidate pointers to
+    // other elements.
+    std::deque<Reply> _replies;
+};
+
+// Owns the arguments and the reply of an asynchronous command.
+class AsyncRedisCommandDone : public google::protobuf::Closure {
+public:
+    AsyncRedisCommandDone(RedisReplyQueue* queue,
+                          const std::vector<butil::StringPiece>& args)
+        : output(&arena)
+        , _queue(queue)
+        , _reply(queue->Push(NULL)) {
+        // Arguments point to the arena of the connection which is cleared
+        // after each read, copy them.
+        this->args.reserve(args.size());
+        for (size_t i = 0; i < args.size(); ++i) {
+            char* p = (char*)arena.allocate(args[i].size() + 1);
+            memcpy(p, args[i].data(), args[i].size());
+            p[args[i].size()] = '\0';
+            this->args.push_back(butil::StringPiece(p, args[i].size()));
+        }
+    }
+
+    void Run() override {
+        butil::IOBufAppender appender;
+        output.SerializeTo(&appender);
+        butil::IOBuf buf;
+        appender.move_to(buf);
+        _queue->Fill(_reply, &buf);
+        delete this;
+    }
+
+    butil::Arena arena;
+    std::vector<butil::StringPiece> args;
+    RedisReply output;
+
+private:
+    butil::intrusive_ptr<RedisReplyQueue> _queue;
+    RedisReplyQueue::Reply* _reply;
+};
+
 // This class is as parsing_context in socket.
 class RedisConnContext : public Destroyable  {
 public:
-    explicit RedisConnContext(const RedisService* rs)
+    RedisConnContext(const RedisService* rs, SocketId socket_id)
         : redis_service(rs)
+        , socket_id(socket_id)
         , batched_size(0) {}
 
     ~RedisConnContext();
@@ -65,6 +171,10 @@ public:
     void Destroy() override;
 
     const RedisService* redis_service;
+    const SocketId socket_id;
+    // Created when the first asynchronous command arrives, all following
+    // replies are sent through it to keep the order.
+    butil::intrusive_ptr<RedisReplyQueue> reply_queue;
     // If user starts a transaction, transaction_handler indicates the
     // handler pointer that runs the transaction command.
     std::unique_ptr<RedisCommandHandler> transaction_handler;
@@ -95,6 +205,25 @@ int ConsumeCommand(RedisConnContext* ctx,
             char buf[64];
             snprintf(buf, sizeof(buf), "ERR unknown command `%s`", args[0].as_string().c_str());
             output.SetError(buf);
+        } else if (ch->is_async()) {
+            if (ctx->batched_size != 0) {
+                LOG(ERROR) << "Asynchronous command should not be run in a batched process.";
+                return -1;
+            }
+            if (ctx->reply_queue == NULL) {
+                ctx->reply_queue.reset(new RedisReplyQueue(ctx->socket_id));
+            }
+            // Replies of previous commands are ahead of this one.
+            butil::IOBuf prev;
+            appender->move_to(prev);
+            if (!prev.empty()) {
+                ctx->reply_queue->Push(&prev);
+            }
+            AsyncRedisCommandDone* done =
+                new AsyncRedisCommandDone(ctx->reply_queue.get(), args);
+            static_cast<AsyncRedisCommandHandler*>(ch)->RunAsync(
+                done->args, &done->output, done);
+            return 0;
         } else {
             result = ch->Run(args, &output, flush_batched);
             if (result == REDIS_CMD_CONTINUE) {
@@ -156,7 +285,7 @@ ParseResult ParseRedisMessage(butil::IOBuf* source, Socket* socket,
         }
         RedisConnContext* ctx = static_cast<RedisConnContext*>(socket->parsing_context());
         if (ctx == NULL) {
-            ctx = new RedisConnContext(rs);
+            ctx = new RedisConnContext(rs, socket->id());
             socket->reset_parsing_context(ctx);
         }
         std::vector<butil::StringPiece> current_args;
@@ -184,6 +313,14 @@ ParseResult ParseRedisMessage(butil::IOBuf* source, Socket* socket,
         }
         butil::IOBuf sendbuf;
         appender.move_to(sendbuf);
+        if (ctx->reply_queue != NULL) {
+            if (!sendbuf.empty()) {
+                ctx->reply_queue->Push(&sendbuf);
+            }
+            ctx->reply_queue->Flush();
+            ctx->arena.clear();
+            return MakeParseError(err);
+        }
         CHECK(!sendbuf.empty());
         Socket::WriteOptions wopt;
         wopt.ignore_eovercrowded = true;
@@ -203,8 +340,28 @@ ParseResult ParseRedisMessage(butil::IOBuf* source, Socket* socket,
         // in most cases, and the time decreases to ~0.14s.
         PipelinedInfo pi;
         if (!socket->PopPipelinedInfo(&pi)) {
-            LOG(WARNING) << "No corresponding PipelinedInfo in socket";
-            return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+            // RESP3 push messages may arrive when there's no pending request.
+            InputResponse* msg = static_cast<InputResponse*>(socket->parsing_context());
+            const char* pfc = (const char*)source->fetch1();
+            if (msg == NULL && (pfc == NULL || *pfc != '>')) {
+                LOG(WARNING) << "No corresponding PipelinedInfo in socket";
+                return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+            }
+            if (msg == NULL) {
+                msg = new InputResponse;
+                socket->reset_parsing_context(msg);
+            }
+            ParseError err = msg->response.ConsumePartialIOBuf(*source, 0);
+            if (err != PARSE_OK) {
+                return MakeParseError(err);
+            }
+            DestroyingPtr<InputResponse> push_msg(
+                static_cast<InputResponse*>(socket->release_parsing_context()));
+            if (!source->empty()) {
+                LOG(WARNING) << "No corresponding PipelinedInfo in socket";
+                return MakeParseError(PARSE_ERROR_TRY_OTHERS);
+            }
+            return MakeParseError(PARSE_ERROR_NOT_ENOUGH_DATA);
         }
 
         do {
@@ -151,6 +151,13 @@ struct Protocol {
     // Name of this protocol, must be string constant.
     const char* name;
 
+    // [Optional]
+    // Tell the server that the RPC with `correlation_id' sent over
+    // `sending_sock' is canceled or timed out, so that the server can stop
+    // processing it. Called when the RPC ends without a response.
+    typedef void (*CancelRequest)(Socket* sending_sock, uint64_t correlation_id);
+    CancelRequest cancel_request;
+
     // True if this protocol is supported at client-side.
     bool support_client() const {
         return serialize_request && pack_request && process_response;
@@ -22,6 +22,7 @@
 #include "butil/strings/string_util.h"          // StringToLowerASCII
 #include "brpc/redis.h"
 #include "brpc/redis_command.h"
+#include "brpc/log.h"
 
 namespace brpc {
 
@@ -252,6 +253,7 @@ RedisResponse::RedisResponse(const RedisResponse& from)
 
 void RedisResponse::SharedCtor() {
     _other_replies = NULL;
+    _pending_push = NULL;
     _cached_size_ = 0;
     _nreply = 0;
 }
@@ -274,6 +276,7 @@ RedisResponse* RedisResponse::New() const {
 void RedisResponse::Clear() {
     _first_reply.Reset();
     _other_replies = NULL;
+    _pending_push = NULL;
     _arena.clear();
     _nreply = 0;
     _cached_size_ = 0;
@@ -361,6 +364,7 @@ void RedisResponse::Swap(RedisResponse* other) {
     if (other != this) {
         _first_reply.Swap(other->_first_reply);
         std::swap(_other_replies, other->_other_replies);
+        std::swap(_pending_push, other->_pending_push);
         _arena.swap(other->_arena);
         std::swap(_nreply, other->_nreply);
         std::swap(_cached_size_, other->_cached_size_);
@@ -380,7 +384,52 @@ const ::google::protobuf::Descriptor* RedisResponse::descriptor() {
 
 // ===================================================================
 
+static RedisPushHandler* g_redis_push_handler = NULL;
+
+void SetRedisPushHandler(RedisPushHandler* handler) {
+    g_redis_push_handler = handler;
+}
+
+ParseError RedisResponse::ConsumePushes(butil::IOBuf& buf) {
+    while (true) {
+        if (_pending_push == NULL) {
+            const char* pfc = (const char*)buf.fetch1();
+            if (pfc == NULL || *pfc != '>') {
+                return PARSE_OK;
+            }
+            void* mem = _arena.allocate(sizeof(RedisReply));
+            if (mem == NULL) {
+                LOG(ERROR) << "Fail to allocate RedisReply";
+                return PARSE_ERROR_ABSOLUTELY_WRONG;
+            }
+            _pending_push = new (mem) RedisReply(&_arena);
+        }
+        ParseError err = _pending_push->ConsumePartialIOBuf(buf);
+        if (err != PARSE_OK) {
+            return err;
+        }
+        if (g_redis_push_handler) {
+            g_redis_push_handler->OnPush(*_pending_push);
+        } else {
+            RPC_VLOG << "Drop " << *_pending_push;
+        }
+        // Memory is still in _arena which is freed by Clear().
+        _pending_push = NULL;
+    }
+}
+
 ParseError RedisResponse::ConsumePartialIOBuf(butil::IOBuf& buf, int reply_count) {
+    // Push messages may arrive between replies, they're not replies to
+    // commands.
+    if (reply_size() == 0 && _first_reply.type() == REDIS_REPLY_NIL) {
+        ParseError err = ConsumePushes(buf);
+        if (err != PARSE_OK) {
+            return err;
+        }
+    }
+    if (reply_count <= 0) {
+        return PARSE_OK;
+    }
     size_t oldsize = buf.size();
     if (reply_size() == 0) {
         ParseError err = _first_reply.ConsumePartialIOBuf(buf);
@@ -405,6 +454,13 @@ ParseError RedisResponse::ConsumePartialIOBuf(butil::IOBuf& buf, int reply_count
             }
         }
         for (int i = reply_size(); i < reply_count; ++i) {
+            if (_other_replies[i - 1].type() == REDIS_REPLY_NIL) {
+                ParseError err = ConsumePushes(buf);
+                if (err != PARSE_OK) {
+                    return err;
+                }
+                oldsize = buf.size();
+            }
             ParseError err = _other_replies[i - 1].ConsumePartialIOBuf(buf);
             if (err != PARSE_OK) {
                 return err;
@@ -460,4 +516,12 @@ RedisCommandHandler* RedisCommandHandler::NewTransactionHandler() {
     return NULL;
 }
 
+RedisCommandHandlerResult AsyncRedisCommandHandler::Run(
+    const std::vector<butil::StringPiece>& args,
+    brpc::RedisReply* output, bool /*flush_batched*/) {
+    output->FormatError("ERR command `%s' can't be run synchronously",
+                        args.empty() ? "" : args[0].as_string().c_str());
+    return REDIS_CMD_HANDLED;
+}
+
 } // namespace brpc
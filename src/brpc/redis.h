@@ -169,7 +169,10 @@ public:
         return redis_nil;
     }
 
-    // Parse and consume intact replies from the buf.
+    // Parse and consume intact replies from the buf. RESP3 push messages
+    // between replies are consumed as well and passed to the handler set by
+    // SetRedisPushHandler(). If `reply_count' is 0, only push messages are
+    // consumed.
     // Returns PARSE_OK on success.
     // Returns PARSE_ERROR_NOT_ENOUGH_DATA if data in `buf' is not enough to parse.
     // Returns PARSE_ERROR_ABSOLUTELY_WRONG if the parsing failed.
@@ -202,9 +205,12 @@ private:
     void SharedCtor();
     void SharedDtor();
     void SetCachedSize(int size) const;
+    ParseError ConsumePushes(butil::IOBuf& buf);
 
     RedisReply _first_reply;
     RedisReply* _other_replies;
+    // The push message being parsed, NULL if there's none.
+    RedisReply* _pending_push;
     butil::Arena _arena;
     int _nreply;
     mutable int _cached_size_;
@@ -213,6 +219,23 @@ private:
 std::ostream& operator<<(std::ostream& os, const RedisRequest&);
 std::ostream& operator<<(std::ostream& os, const RedisResponse&);
 
+// Receive out-of-band RESP3 push messages(e.g. messages of subscribed
+// channels, invalidations of client-side caching) sent by redis servers
+// to clients speaking RESP3 (after HELLO 3).
+class RedisPushHandler {
+public:
+    virtual ~RedisPushHandler() {}
+
+    // Called in the bthread parsing the connection, `push' is only valid
+    // inside this function and the implementation should not block.
+    virtual void OnPush(const RedisReply& push) = 0;
+};
+
+// Set the handler of push messages for all redis connections of this
+// process. Push messages are dropped if the handler is NULL (the default).
+// `handler' is not owned and must be valid until it's replaced.
+void SetRedisPushHandler(RedisPushHandler* handler);
+
 class RedisCommandHandler;
 
 // Container of CommandHandlers.
@@ -280,6 +303,32 @@ public:
     // 5) An ending marker(exec) is found in transaction_handler.Run(), user exeuctes all
     // the commands and return OK. This Transation is done.
     virtual RedisCommandHandler* NewTransactionHandler();
+
+    // Returns true if this handler is an AsyncRedisCommandHandler.
+    virtual bool is_async() const { return false; }
+};
+
+// The Command handler which fills `output' asynchronously, so that commands
+// pipelined in one connection can be processed concurrently, e.g. a proxy
+// forwarding commands to other servers. User should implement RunAsync().
+// Replies are still sent in the order that commands arrive, a finished
+// command waits for all commands before it.
+// Asynchronous handlers can't be used in transactions or batches.
+class AsyncRedisCommandHandler : public RedisCommandHandler {
+public:
+    // `args' and `output' are valid until done->Run() is called. Call
+    // done->Run() in any thread after `output' is filled.
+    virtual void RunAsync(const std::vector<butil::StringPiece>& args,
+                          brpc::RedisReply* output,
+                          google::protobuf::Closure* done) = 0;
+
+    bool is_async() const override final { return true; }
+
+    // Only called when this handler is mistakenly used in a transaction,
+    // which replies an error.
+    RedisCommandHandlerResult Run(const std::vector<butil::StringPiece>& args,
+                                  brpc::RedisReply* output,
+                                  bool flush_batched) override final;
 };
 
 } // namespace brpc
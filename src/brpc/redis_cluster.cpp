@@ -0,0 +1,628 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <map>
+#include <memory>
+#include "butil/logging.h"
+#include "butil/string_printf.h"
+#include "butil/string_splitter.h"
+#include "butil/strings/string_util.h"          // TrimWhitespaceASCII
+#include "butil/synchronization/lock.h"
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "brpc/controller.h"
+#include "brpc/periodic_task.h"
+#include "brpc/shared_object.h"
+#include "brpc/redis.h"
+#include "brpc/redis_command.h"
+#include "brpc/redis_cluster.h"
+
+namespace brpc {
+
+static const int REDIS_CLUSTER_SLOTS = 16384;
+static const uint16_t NO_NODE = 0xFFFF;
+
+RedisClusterChannelOptions::RedisClusterChannelOptions()
+    : refresh_interval_s(30)
+    , max_redirect(5) {}
+
+// CRC16-CCITT (XMODEM) used by redis cluster.
+static uint16_t Crc16(const char* buf, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= (uint16_t)((uint8_t)buf[i]) << 8;
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+int RedisClusterSlot(const butil::StringPiece& key) {
+    const size_t start = key.find('{');
+    if (start != butil::StringPiece::npos) {
+        const size_t end = key.find('}', start + 1);
+        if (end != butil::StringPiece::npos && end != start + 1) {
+            return Crc16(key.data() + start + 1, end - start - 1)
+                & (REDIS_CLUSTER_SLOTS - 1);
+        }
+    }
+    return Crc16(key.data(), key.size()) & (REDIS_CLUSTER_SLOTS - 1);
+}
+
+static bool CommandIs(const butil::StringPiece& cmd, const char* name) {
+    return cmd.size() == strlen(name) &&
+        strncasecmp(cmd.data(), name, cmd.size()) == 0;
+}
+
+// Returns index of the key in args, -1 if the command has no key.
+static int FindKey(const std::vector<butil::StringPiece>& args) {
+    if (args.size() < 2) {
+        return -1;
+    }
+    const butil::StringPiece& cmd = args[0];
+    if (CommandIs(cmd, "eval") || CommandIs(cmd, "evalsha")) {
+        // EVAL script numkeys key [key ...] arg [arg ...]
+        return (args.size() >= 4 && args[2] != "0") ? 3 : -1;
+    }
+    static const char* const keyless_commands[] = {
+        "auth", "client", "cluster", "command", "config", "dbsize", "echo",
+        "flushall", "flushdb", "info", "ping", "randomkey", "readonly",
+        "readwrite", "script", "select", "time",
+    };
+    for (size_t i = 0; i < arraysize(keyless_commands); ++i) {
+        if (CommandIs(cmd, keyless_commands[i])) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// Serialize a reply parsed from a server back into RESP. Unlike
+// RedisReply::SerializeTo() which rejects nil (not set by servers),
+// nil replies and sub replies are serialized as null bulk strings.
+static void SerializeReply(const RedisReply& reply, butil::IOBufAppender* out) {
+    if (reply.is_nil()) {
+        out->append("$-1\r\n", 5);
+        return;
+    }
+    char prefix = 0;
+    size_t count = reply.size();
+    switch (reply.type()) {
+    case REDIS_REPLY_ARRAY: prefix = '*'; break;
+    case REDIS_REPLY_SET: prefix = '~'; break;
+    case REDIS_REPLY_PUSH: prefix = '>'; break;
+    case REDIS_REPLY_MAP: prefix = '%'; count /= 2; break;
+    default:
+        reply.SerializeTo(out);
+        return;
+    }
+    out->push_back(prefix);
+    out->append_decimal(count);
+    out->append("\r\n", 2);
+    for (size_t i = 0; i < reply.size(); ++i) {
+        SerializeReply(reply[i], out);
+    }
+}
+
+// Parse "MOVED <slot> <host:port>" or "ASK <slot> <host:port>".
+// Returns true if the error is a redirection.
+static bool ParseRedirection(const char* error, bool* asking,
+                             int* slot, std::string* addr) {
+    if (strncmp(error, "MOVED ", 6) == 0) {
+        *asking = false;
+        error += 6;
+    } else if (strncmp(error, "ASK ", 4) == 0) {
+        *asking = true;
+        error += 4;
+    } else {
+        return false;
+    }
+    char* endptr = NULL;
+    const long s = strtol(error, &endptr, 10);
+    if (endptr == error || *endptr != ' ' || s < 0 || s >= REDIS_CLUSTER_SLOTS) {
+        return false;
+    }
+    *slot = (int)s;
+    addr->assign(endptr + 1);
+    return !addr->empty();
+}
+
+struct RedisSlotMap {
+    std::vector<std::string> nodes;
+    // Index into `nodes' of each slot, NO_NODE if the slot is not served.
+    uint16_t slots[REDIS_CLUSTER_SLOTS];
+
+    RedisSlotMap() {
+        for (int i = 0; i < REDIS_CLUSTER_SLOTS; ++i) {
+            slots[i] = NO_NODE;
+        }
+    }
+
+    uint16_t AddNode(const std::string& addr) {
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i] == addr) {
+                return i;
+            }
+        }
+        nodes.push_back(addr);
+        return nodes.size() - 1;
+    }
+
+    // Parse reply of CLUSTER SLOTS sent to `from':
+    //   1) 1) start slot
+    //      2) end slot
+    //      3) 1) master ip
+    //         2) master port
+    //         ...
+    //      4) replicas ...
+    int Parse(const RedisReply& reply, const std::string& from) {
+        if (!reply.is_array()) {
+            return -1;
+        }
+        for (size_t i = 0; i < reply.size(); ++i) {
+            const RedisReply& range = reply[i];
+            if (!range.is_array() || range.size() < 3 ||
+                !range[0].is_integer() || !range[1].is_integer() ||
+                !range[2].is_array() || range[2].size() < 2 ||
+                !range[2][0].is_string() || !range[2][1].is_integer()) {
+                return -1;
+            }
+            const int64_t start = range[0].integer();
+            const int64_t end = range[1].integer();
+            if (start < 0 || end >= REDIS_CLUSTER_SLOTS || start > end) {
+                return -1;
+            }
+            std::string host = range[2][0].data().as_string();
+            if (host.empty()) {
+                // The node being asked.
+                host = from.substr(0, from.rfind(':'));
+            }
+            const uint16_t node = AddNode(butil::string_printf(
+                    "%s:%d", host.c_str(), (int)range[2][1].integer()));
+            for (int64_t s = start; s <= end; ++s) {
+                slots[s] = node;
+            }
+        }
+        return 0;
+    }
+};
+
+class RedisClusterState : public SharedObject {
+public:
+    RedisClusterState() : _stopped(false), _refreshing(false) {}
+
+    int Init(const char* seeds, const RedisClusterChannelOptions& options);
+    void Call(Controller* cntl, const RedisRequest* request,
+              RedisResponse* response);
+    int Refresh();
+    void RefreshInBackground();
+    void Stop() { _stopped.store(true, butil::memory_order_relaxed); }
+    bool stopped() const { return _stopped.load(butil::memory_order_relaxed); }
+    const RedisClusterChannelOptions& options() const { return _options; }
+    void Describe(std::ostream& os) const;
+
+private:
+    std::shared_ptr<const RedisSlotMap> slot_map() const {
+        BAIDU_SCOPED_LOCK(_mutex);
+        return _slot_map;
+    }
+    std::shared_ptr<Channel> GetChannel(const std::string& addr);
+    void UpdateSlot(int slot, const std::string& addr);
+    static void* RunRefresh(void* arg);
+
+    RedisClusterChannelOptions _options;
+    std::vector<std::string> _seeds;
+    butil::atomic<bool> _stopped;
+    butil::atomic<bool> _refreshing;
+
+    mutable butil::Mutex _mutex;
+    std::shared_ptr<const RedisSlotMap> _slot_map;
+    std::map<std::string, std::shared_ptr<Channel> > _channels;
+};
+
+int RedisClusterState::Init(const char* seeds,
+                            const RedisClusterChannelOptions& options) {
+    _options = options;
+    _options.channel_options.protocol = PROTOCOL_REDIS;
+    for (butil::StringSplitter sp(seeds, ','); sp; ++sp) {
+        std::string seed(sp.field(), sp.length());
+        butil::TrimWhitespaceASCII(seed, butil::TRIM_ALL, &seed);
+        if (!seed.empty()) {
+            _seeds.push_back(seed);
+        }
+    }
+    if (_seeds.empty()) {
+        LOG(ERROR) << "No seeds in `" << seeds << "'";
+        return -1;
+    }
+    return Refresh();
+}
+
+std::shared_ptr<Channel> RedisClusterState::GetChannel(const std::string& addr) {
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::map<std::string, std::shared_ptr<Channel> >::const_iterator it =
+            _channels.find(addr);
+        if (it != _channels.end()) {
+            return it->second;
+        }
+    }
+    std::shared_ptr<Channel> channel(new Channel);
+    if (channel->Init(addr.c_str(), &_options.channel_options) != 0) {
+        LOG(ERROR) << "Fail to init channel to redis node " << addr;
+        return NULL;
+    }
+    BAIDU_SCOPED_LOCK(_mutex);
+    // Keep the channel inserted first if any.
+    return _channels.insert(std::make_pair(addr, channel)).first->second;
+}
+
+void RedisClusterState::UpdateSlot(int slot, const std::string& addr) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    std::shared_ptr<RedisSlotMap> m(_slot_map ? new RedisSlotMap(*_slot_map)
+                                              : new RedisSlotMap);
+    m->slots[slot] = m->AddNode(addr);
+    _slot_map = m;
+}
+
+int RedisClusterState::Refresh() {
+    std::vector<std::string> candidates;
+    std::shared_ptr<const RedisSlotMap> old_map = slot_map();
+    if (old_map) {
+        candidates = old_map->nodes;
+    }
+    candidates.insert(candidates.end(), _seeds.begin(), _seeds.end());
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        std::shared_ptr<Channel> channel = GetChannel(candidates[i]);
+        if (channel == NULL) {
+            continue;
+        }
+        RedisRequest request;
+        RedisResponse response;
+        Controller cntl;
+        request.AddCommand("CLUSTER SLOTS");
+        channel->CallMethod(NULL, &cntl, &request, &response, NULL);
+        if (cntl.Failed()) {
+            LOG(WARNING) << "Fail to get slots from " << candidates[i]
+                         << ": " << cntl.ErrorText();
+            continue;
+        }
+        std::shared_ptr<RedisSlotMap> m(new RedisSlotMap);
+        if (m->Parse(response.reply(0), candidates[i]) != 0) {
+            LOG(WARNING) << "Invalid CLUSTER SLOTS from " << candidates[i]
+                         << ": " << response.reply(0);
+            continue;
+        }
+        BAIDU_SCOPED_LOCK(_mutex);
+        _slot_map = m;
+        return 0;
+    }
+    LOG(ERROR) << "Fail to get slots of the redis cluster";
+    return -1;
+}
+
+void* RedisClusterState::RunRefresh(void* arg) {
+    RedisClusterState* state = static_cast<RedisClusterState*>(arg);
+    if (!state->stopped()) {
+        state->Refresh();
+    }
+    state->_refreshing.store(false, butil::memory_order_release);
+    state->RemoveRefManually();
+    return NULL;
+}
+
+void RedisClusterState::RefreshInBackground() {
+    if (_refreshing.exchange(true, butil::memory_order_acquire)) {
+        return;
+    }
+    AddRefManually();
+    bthread_t th;
+    if (bthread_start_background(&th, NULL, RunRefresh, this) != 0) {
+        RunRefresh(this);
+    }
+}
+
+struct RedisClusterCommand {
+    std::vector<butil::StringPiece> args;
+    // Node set by redirections.
+    std::string target;
+    bool asking;
+    butil::IOBuf reply;
+
+    RedisClusterCommand() : asking(false) {}
+};
+
+struct RedisClusterSubCall {
+    std::vector<size_t> commands;
+    std::shared_ptr<Channel> channel;
+    Controller cntl;
+    RedisRequest request;
+    RedisResponse response;
+};
+
+void RedisClusterState::Call(Controller* cntl, const RedisRequest* request,
+                             RedisResponse* response) {
+    butil::IOBuf buf;
+    if (request->command_size() == 0 || !request->SerializeTo(&buf)) {
+        return cntl->SetFailed(EREQUEST, "Invalid RedisRequest");
+    }
+    butil::Arena arena;
+    RedisCommandParser parser;
+    std::vector<RedisClusterCommand> cmds(request->command_size());
+    for (size_t i = 0; i < cmds.size(); ++i) {
+        if (parser.Consume(buf, &cmds[i].args, &arena) != PARSE_OK ||
+            cmds[i].args.empty()) {
+            return cntl->SetFailed(EREQUEST, "Fail to parse command #%d", (int)i);
+        }
+    }
+
+    bool moved = false;
+    std::vector<size_t> pending(cmds.size());
+    for (size_t i = 0; i < pending.size(); ++i) {
+        pending[i] = i;
+    }
+    for (int round = 0; !pending.empty(); ++round) {
+        if (round > _options.max_redirect) {
+            return cntl->SetFailed(ERESPONSE, "Redirected more than %d times",
+                                   _options.max_redirect);
+        }
+        std::shared_ptr<const RedisSlotMap> m = slot_map();
+        std::map<std::string, std::vector<size_t> > groups;
+        for (size_t i = 0; i < pending.size(); ++i) {
+            RedisClusterCommand& c = cmds[pending[i]];
+            if (!c.target.empty()) {
+                groups[c.target].push_back(pending[i]);
+                continue;
+            }
+            if (m == NULL || m->nodes.empty()) {
+                return cntl->SetFailed(EHOSTDOWN, "Slots of the cluster are unknown");
+            }
+            const int key = FindKey(c.args);
+            uint16_t node = 0;
+            if (key >= 0) {
+                const int slot = RedisClusterSlot(c.args[key]);
+                node = m->slots[slot];
+                if (node == NO_NODE) {
+                    return cntl->SetFailed(EHOSTDOWN, "Slot %d is not served", slot);
+                }
+            }
+            groups[m->nodes[node]].push_back(pending[i]);
+        }
+
+        std::vector<std::unique_ptr<RedisClusterSubCall> > calls;
+        for (std::map<std::string, std::vector<size_t> >::iterator
+                 it = groups.begin(); it != groups.end(); ++it) {
+            std::unique_ptr<RedisClusterSubCall> sub(new RedisClusterSubCall);
+            sub->channel = GetChannel(it->first);
+            if (sub->channel == NULL) {
+                return cntl->SetFailed(EHOSTDOWN, "Fail to connect %s",
+                                       it->first.c_str());
+            }
+            sub->commands.swap(it->second);
+            for (size_t i = 0; i < sub->commands.size(); ++i) {
+                const RedisClusterCommand& c = cmds[sub->commands[i]];
+                if (c.asking) {
+                    sub->request.AddCommand("ASKING");
+                }
+                sub->request.AddCommandByComponents(&c.args[0], c.args.size());
+            }
+            if (cntl->timeout_ms() >= 0) {
+                sub->cntl.set_timeout_ms(cntl->timeout_ms());
+            }
+            if (cntl->has_log_id()) {
+                sub->cntl.set_log_id(cntl->log_id());
+            }
+            calls.push_back(std::move(sub));
+        }
+        for (size_t i = 0; i < calls.size(); ++i) {
+            RedisClusterSubCall* sub = calls[i].get();
+            sub->channel->CallMethod(NULL, &sub->cntl, &sub->request,
+                                     &sub->response, DoNothing());
+        }
+        for (size_t i = 0; i < calls.size(); ++i) {
+            Join(calls[i]->cntl.call_id());
+        }
+
+        std::vector<size_t> next;
+        for (size_t i = 0; i < calls.size(); ++i) {
+            RedisClusterSubCall* sub = calls[i].get();
+            if (sub->cntl.Failed()) {
+                return cntl->SetFailed(sub->cntl.ErrorCode(), "%s",
+                                       sub->cntl.ErrorText().c_str());
+            }
+            int r = 0;
+            for (size_t j = 0; j < sub->commands.size(); ++j) {
+                RedisClusterCommand& c = cmds[sub->commands[j]];
+                if (c.asking) {
+                    ++r;  // reply of ASKING
+                }
+                const RedisReply& reply = sub->response.reply(r++);
+                int slot = 0;
+                bool asking = false;
+                std::string addr;
+                if (reply.is_error() &&
+                    ParseRedirection(reply.error_message(), &asking, &slot, &addr)) {
+                    if (!asking) {
+                        UpdateSlot(slot, addr);
+                        moved = true;
+                    }
+                    c.target = addr;
+                    c.asking = asking;
+                    next.push_back(sub->commands[j]);
+                    continue;
+                }
+                butil::IOBufAppender appender;
+                SerializeReply(reply, &appender);
+                appender.move_to(c.reply);
+            }
+        }
+        pending.swap(next);
+    }
+    if (moved) {
+        RefreshInBackground();
+    }
+
+    butil::IOBuf replies;
+    for (size_t i = 0; i < cmds.size(); ++i) {
+        replies.append(cmds[i].reply);
+    }
+    response->Clear();
+    if (response->ConsumePartialIOBuf(replies, cmds.size()) != PARSE_OK) {
+        return cntl->SetFailed(ERESPONSE, "Fail to merge replies");
+    }
+}
+
+void RedisClusterState::Describe(std::ostream& os) const {
+    std::shared_ptr<const RedisSlotMap> m = slot_map();
+    os << "RedisCluster{nodes=";
+    if (m) {
+        for (size_t i = 0; i < m->nodes.size(); ++i) {
+            if (i) {
+                os << ',';
+            }
+            os << m->nodes[i];
+        }
+    }
+    os << '}';
+}
+
+class RedisSlotsRefresher : public PeriodicTask {
+public:
+    explicit RedisSlotsRefresher(RedisClusterState* state) : _state(state) {}
+
+    bool OnTriggeringTask(timespec* next_abstime) override {
+        if (_state->stopped()) {
+            return false;
+        }
+        _state->Refresh();
+        *next_abstime = butil::seconds_from_now(
+            _state->options().refresh_interval_s);
+        return true;
+    }
+
+    void OnDestroyingTask() override {
+        delete this;
+    }
+
+private:
+    butil::intrusive_ptr<RedisClusterState> _state;
+};
+
+RedisClusterChannel::RedisClusterChannel() : _state(NULL) {}
+
+RedisClusterChannel::~RedisClusterChannel() {
+    if (_state) {
+        _state->Stop();
+        _state->RemoveRefManually();
+    }
+}
+
+int RedisClusterChannel::Init(const char* seeds,
+                              const RedisClusterChannelOptions* options) {
+    if (_state != NULL) {
+        LOG(ERROR) << "Already initialized";
+        return -1;
+    }
+    RedisClusterChannelOptions default_options;
+    RedisClusterState* state = new RedisClusterState;
+    state->AddRefManually();
+    if (state->Init(seeds, options ? *options : default_options) != 0) {
+        state->RemoveRefManually();
+        return -1;
+    }
+    _state = state;
+    if (_state->options().refresh_interval_s > 0) {
+        PeriodicTaskManager::StartTaskAt(
+            new RedisSlotsRefresher(_state),
+            butil::seconds_from_now(_state->options().refresh_interval_s));
+    }
+    return 0;
+}
+
+struct RedisClusterAsyncCall {
+    butil::intrusive_ptr<RedisClusterState> state;
+    Controller* cntl;
+    const RedisRequest* request;
+    RedisResponse* response;
+    google::protobuf::Closure* done;
+};
+
+static void* RunRedisClusterCall(void* arg) {
+    std::unique_ptr<RedisClusterAsyncCall> call(
+        static_cast<RedisClusterAsyncCall*>(arg));
+    call->state->Call(call->cntl, call->request, call->response);
+    call->done->Run();
+    return NULL;
+}
+
+void RedisClusterChannel::CallMethod(
+    const google::protobuf::MethodDescriptor*,
+    google::protobuf::RpcController* controller,
+    const google::protobuf::Message* request,
+    google::protobuf::Message* response,
+    google::protobuf::Closure* done) {
+    Controller* cntl = static_cast<Controller*>(controller);
+    if (_state == NULL) {
+        cntl->SetFailed(EINVAL, "RedisClusterChannel is not initialized");
+    } else if (request == NULL ||
+               request->GetDescriptor() != RedisRequest::descriptor()) {
+        cntl->SetFailed(EREQUEST, "request must be RedisRequest");
+    } else if (response == NULL ||
+               response->GetDescriptor() != RedisResponse::descriptor()) {
+        cntl->SetFailed(ERESPONSE, "response must be RedisResponse");
+    } else if (done == NULL) {
+        return _state->Call(cntl, static_cast<const RedisRequest*>(request),
+                            static_cast<RedisResponse*>(response));
+    } else {
+        RedisClusterAsyncCall* call = new RedisClusterAsyncCall;
+        call->state.reset(_state);
+        call->cntl = cntl;
+        call->request = static_cast<const RedisRequest*>(request);
+        call->response = static_cast<RedisResponse*>(response);
+        call->done = done;
+        bthread_t th;
+        if (bthread_start_background(&th, NULL, RunRedisClusterCall, call) == 0) {
+            return;
+        }
+        delete call;
+        cntl->SetFailed(ENOMEM, "Fail to start bthread");
+    }
+    if (done) {
+        done->Run();
+    }
+}
+
+int RedisClusterChannel::RefreshSlots() {
+    return _state ? _state->Refresh() : -1;
+}
+
+void RedisClusterChannel::Describe(std::ostream& os,
+                                   const DescribeOptions&) const {
+    if (_state) {
+        _state->Describe(os);
+    } else {
+        os << "RedisCluster{uninitialized}";
+    }
+}
+
+int RedisClusterChannel::CheckHealth() {
+    return RefreshSlots();
+}
+
+} // namespace brpc
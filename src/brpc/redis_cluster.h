@@ -0,0 +1,104 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef BRPC_REDIS_CLUSTER_H
+#define BRPC_REDIS_CLUSTER_H
+
+// To brpc developers: This is a header included by user, don't depend
+// on internal structures, use opaque pointers instead.
+
+#include <stdint.h>
+#include "butil/strings/string_piece.h"
+#include "brpc/channel.h"
+
+namespace brpc {
+
+struct RedisClusterChannelOptions {
+    RedisClusterChannelOptions();
+
+    // Options of channels to nodes of the cluster. `protocol' is always
+    // PROTOCOL_REDIS.
+    ChannelOptions channel_options;
+
+    // Fetch CLUSTER SLOTS every so many seconds. Slots are also refreshed
+    // after any MOVED redirection. Non-positive value disables periodic
+    // refreshing.
+    // Default: 30
+    int refresh_interval_s;
+
+    // Follow MOVED/ASK redirections of a command at most so many times.
+    // Default: 5
+    int max_redirect;
+};
+
+class RedisClusterState;
+
+// Access a redis cluster with RedisRequest/RedisResponse.
+// Commands in a RedisRequest are routed to nodes owning slots of their keys
+// (the first key, or the hash tag if present), commands to the same node
+// are sent in one pipelined request, and replies are merged into the
+// RedisResponse in the order of commands. Commands without keys (PING,
+// INFO ...) are sent to an arbitrary node.
+// Example:
+//   brpc::RedisClusterChannel channel;
+//   if (channel.Init("10.0.0.1:6379,10.0.0.2:6379", NULL) != 0) { ... }
+//   brpc::RedisRequest request;
+//   request.AddCommand("SET foo bar");
+//   request.AddCommand("GET baz");
+//   brpc::RedisResponse response;
+//   brpc::Controller cntl;
+//   channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+// Asynchronous calls run `done' in another bthread. Join(cntl.call_id())
+// and cancelation are not supported.
+class RedisClusterChannel : public ChannelBase {
+public:
+    RedisClusterChannel();
+    ~RedisClusterChannel();
+
+    // `seeds' is a comma-separated list of "host:port" of nodes in the
+    // cluster, slots are fetched from the first reachable one.
+    // Returns 0 on success, -1 otherwise.
+    int Init(const char* seeds, const RedisClusterChannelOptions* options);
+
+    // `request' must be RedisRequest and `response' must be RedisResponse.
+    void CallMethod(const google::protobuf::MethodDescriptor* method,
+                    google::protobuf::RpcController* controller,
+                    const google::protobuf::Message* request,
+                    google::protobuf::Message* response,
+                    google::protobuf::Closure* done);
+
+    // Fetch CLUSTER SLOTS now.
+    // Returns 0 on success, -1 otherwise.
+    int RefreshSlots();
+
+    void Describe(std::ostream& os, const DescribeOptions& options) const;
+
+    int CheckHealth();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(RedisClusterChannel);
+    RedisClusterState* _state;
+};
+
+// Slot of `key' in redis cluster, namely CRC16 of the key (or the hash tag
+// inside `{' and `}') modulo 16384.
+int RedisClusterSlot(const butil::StringPiece& key);
+
+} // namespace brpc
+
+#endif  // BRPC_REDIS_CLUSTER_H
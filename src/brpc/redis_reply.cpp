@@ -34,16 +34,37 @@ const char* RedisReplyTypeToString(RedisReplyType type) {
     case REDIS_REPLY_NIL: return "nil";
     case REDIS_REPLY_STATUS: return "status";
     case REDIS_REPLY_ERROR: return "error";
+    case REDIS_REPLY_DOUBLE: return "double";
+    case REDIS_REPLY_BOOLEAN: return "boolean";
+    case REDIS_REPLY_BIG_NUMBER: return "big number";
+    case REDIS_REPLY_VERBATIM: return "verbatim";
+    case REDIS_REPLY_MAP: return "map";
+    case REDIS_REPLY_SET: return "set";
+    case REDIS_REPLY_PUSH: return "push";
+    case REDIS_REPLY_ATTRIBUTE: return "attribute";
     default: return "unknown redis type";
     }
 }
 
-bool RedisReply::SerializeTo(butil::IOBufAppender* appender) {
+static char AggregatePrefix(RedisReplyType type) {
+    switch (type) {
+    case REDIS_REPLY_MAP: return '%';
+    case REDIS_REPLY_SET: return '~';
+    case REDIS_REPLY_PUSH: return '>';
+    case REDIS_REPLY_ATTRIBUTE: return '|';
+    default: return '*';
+    }
+}
+
+bool RedisReply::SerializeTo(butil::IOBufAppender* appender) const {
     switch (_type) {
         case REDIS_REPLY_ERROR:
             // fall through
         case REDIS_REPLY_STATUS:
-            appender->push_back((_type == REDIS_REPLY_ERROR)? '-' : '+');
+            // fall through
+        case REDIS_REPLY_BIG_NUMBER:
+            appender->push_back((_type == REDIS_REPLY_ERROR) ? '-' :
+                                (_type == REDIS_REPLY_STATUS ? '+' : '('));
             if (_length < (int)sizeof(_data.short_str)) {
                 appender->append(_data.short_str, _length);
             } else {
@@ -57,7 +78,9 @@ bool RedisReply::SerializeTo(butil::IOBufAppender* appender) {
             appender->append("\r\n", 2);
             return true;
         case REDIS_REPLY_STRING:
-            appender->push_back('$');
+            // fall through
+        case REDIS_REPLY_VERBATIM:
+            appender->push_back(_type == REDIS_REPLY_STRING ? '$' : '=');
             appender->append_decimal(_length);
             appender->append("\r\n", 2);
             if (_length != npos) {
@@ -70,17 +93,39 @@ bool RedisReply::SerializeTo(butil::IOBufAppender* appender) {
             }
             return true;
         case REDIS_REPLY_ARRAY:
-            appender->push_back('*');
-            appender->append_decimal(_length);
+            // fall through
+        case REDIS_REPLY_MAP:
+            // fall through
+        case REDIS_REPLY_SET:
+            // fall through
+        case REDIS_REPLY_PUSH:
+            // fall through
+        case REDIS_REPLY_ATTRIBUTE:
+            appender->push_back(AggregatePrefix(_type));
+            if (_length == npos) {
+                appender->append("-1\r\n", 4);
+                return true;
+            }
+            appender->append_decimal(_type == REDIS_REPLY_MAP ||
+                                     _type == REDIS_REPLY_ATTRIBUTE ?
+                                     _length / 2 : _length);
             appender->append("\r\n", 2);
-            if (_length != npos) {
-                for (int i = 0; i < _length; ++i) {
-                    if (!_data.array.replies[i].SerializeTo(appender)) {
-                        return false;
-                    }
+            for (int i = 0; i < _length; ++i) {
+                if (!_data.array.replies[i].SerializeTo(appender)) {
+                    return false;
                 }
             }
             return true;
+        case REDIS_REPLY_DOUBLE: {
+            char buf[32];
+            // %.17g is enough to restore the double exactly.
+            const int n = snprintf(buf, sizeof(buf), ",%.17g\r\n", _data.real);
+            appender->append(buf, n);
+            return true;
+        }
+        case REDIS_REPLY_BOOLEAN:
+            appender->append(_data.integer ? "#t\r\n" : "#f\r\n", 4);
+            return true;
         case REDIS_REPLY_NIL:
             LOG(ERROR) << "Do you forget to call SetXXX()?";
             return false;
@@ -89,8 +134,24 @@ bool RedisReply::SerializeTo(butil::IOBufAppender* appender) {
     return false;
 }
 
+// Types of replies whose first line is a length or a count.
+static bool GetLengthPrefixedType(char fc, RedisReplyType* type) {
+    switch (fc) {
+    case '$': *type = REDIS_REPLY_STRING; return true;
+    case '!': *type = REDIS_REPLY_ERROR; return true;
+    case '=': *type = REDIS_REPLY_VERBATIM; return true;
+    case '*': *type = REDIS_REPLY_ARRAY; return true;
+    case '%': *type = REDIS_REPLY_MAP; return true;
+    case '~': *type = REDIS_REPLY_SET; return true;
+    case '>': *type = REDIS_REPLY_PUSH; return true;
+    case '|': *type = REDIS_REPLY_ATTRIBUTE; return true;
+    case ':': *type = REDIS_REPLY_INTEGER; return true;
+    default: return false;
+    }
+}
+
 ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
-    if (_type == REDIS_REPLY_ARRAY && _data.array.last_index >= 0) {
+    if (is_aggregate() && _data.array.last_index >= 0) {
         // The parsing was suspended while parsing sub replies,
         // continue the parsing.
         RedisReply* subs = (RedisReply*)_data.array.replies;
@@ -103,6 +164,11 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
         }
         // We've got an intact reply. reset the index.
         _data.array.last_index = -1;
+        if (_type == REDIS_REPLY_ATTRIBUTE) {
+            // Attributes are followed by the actual reply.
+            Reset();
+            return ConsumePartialIOBuf(buf);
+        }
         return PARSE_OK;
     }
 
@@ -112,9 +178,11 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
         return PARSE_ERROR_NOT_ENOUGH_DATA;
     }
     const char fc = *pfc;  // first character
+    RedisReplyType type = REDIS_REPLY_NIL;
     switch (fc) {
     case '-':   // Error          "-<message>\r\n"
-    case '+': { // Simple String  "+<string>\r\n"
+    case '+':   // Simple String  "+<string>\r\n"
+    case '(': { // Big Number     "(<big number>\r\n"
         butil::IOBuf str;
         if (buf.cut_until(&str, "\r\n") != 0) {
             const size_t len = buf.size();
@@ -125,10 +193,12 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
             }
             return PARSE_ERROR_NOT_ENOUGH_DATA;
         }
+        type = (fc == '-' ? REDIS_REPLY_ERROR :
+                (fc == '+' ? REDIS_REPLY_STATUS : REDIS_REPLY_BIG_NUMBER));
         const size_t len = str.size() - 1;
         if (len < sizeof(_data.short_str)) {
             // SSO short strings, including empty string.
-            _type = (fc == '-' ? REDIS_REPLY_ERROR : REDIS_REPLY_STATUS);
+            _type = type;
             _length = len;
             str.copy_to_cstr(_data.short_str, (size_t)-1L, 1/*skip fc*/);
             return PARSE_OK;
@@ -139,134 +209,184 @@ ParseError RedisReply::ConsumePartialIOBuf(butil::IOBuf& buf) {
             return PARSE_ERROR_ABSOLUTELY_WRONG;
         }
         CHECK_EQ(len, str.copy_to_cstr(d, (size_t)-1L, 1/*skip fc*/));
-        _type = (fc == '-' ? REDIS_REPLY_ERROR : REDIS_REPLY_STATUS);
+        _type = type;
         _length = len;
         _data.long_str = d;
         return PARSE_OK;
     }
-    case '$':   // Bulk String   "$<length>\r\n<string>\r\n"
-    case '*':   // Array         "*<size>\r\n<sub-reply1><sub-reply2>..."
-    case ':': { // Integer       ":<integer>\r\n"
-        char intbuf[32];  // enough for fc + 64-bit decimal + \r\n
-        const size_t ncopied = buf.copy_to(intbuf, sizeof(intbuf) - 1);
-        intbuf[ncopied] = '\0';
-        const size_t crlf_pos = butil::StringPiece(intbuf, ncopied).find("\r\n");
-        if (crlf_pos == butil::StringPiece::npos) {  // not enough data
+    case '_':   // Null           "_\r\n"
+    case '#':   // Boolean        "#t\r\n" or "#f\r\n"
+    case ',': { // Double         ",<floating-point number>\r\n"
+        char linebuf[64];
+        const size_t ncopied = buf.copy_to(linebuf, sizeof(linebuf) - 1);
+        linebuf[ncopied] = '\0';
+        const size_t crlf_pos = butil::StringPiece(linebuf, ncopied).find("\r\n");
+        if (crlf_pos == butil::StringPiece::npos) {
+            if (ncopied == sizeof(linebuf) - 1) {
+                LOG(ERROR) << "Too long line of type=" << fc;
+                return PARSE_ERROR_ABSOLUTELY_WRONG;
+            }
             return PARSE_ERROR_NOT_ENOUGH_DATA;
         }
-        char* endptr = NULL;
-        int64_t value = strtoll(intbuf + 1/*skip fc*/, &endptr, 10);
-        if (endptr != intbuf + crlf_pos) {
-            LOG(ERROR) << '`' << intbuf + 1 << "' is not a valid 64-bit decimal";
-            return PARSE_ERROR_ABSOLUTELY_WRONG;
-        }
-        if (fc == ':') {
-            buf.pop_front(crlf_pos + 2/*CRLF*/);
-            _type = REDIS_REPLY_INTEGER;
-            _length = 0;
-            _data.integer = value;
-            return PARSE_OK;
-        } else if (fc == '$') {
-            const int64_t len = value;  // `value' is length of the string
-            if (len < 0) {  // redis nil
-                buf.pop_front(crlf_pos + 2/*CRLF*/);
-                _type = REDIS_REPLY_NIL;
-                _length = 0;
-                _data.integer = 0;
-                return PARSE_OK;
-            }
-            if (len > (int64_t)std::numeric_limits<uint32_t>::max()) {
-                LOG(ERROR) << "bulk string is too long! max length=2^32-1,"
-                    " actually=" << len;
+        linebuf[crlf_pos] = '\0';
+        if (fc == '_') {
+            if (crlf_pos != 1) {
+                LOG(ERROR) << "Invalid null=`" << linebuf << '\'';
                 return PARSE_ERROR_ABSOLUTELY_WRONG;
             }
-            // We provide c_str(), thus even if bulk string is started with
-            // length, we have to end it with \0.
-            if (buf.size() < crlf_pos + 2 + (size_t)len + 2/*CRLF*/) {
-                return PARSE_ERROR_NOT_ENOUGH_DATA;
-            }
-            if ((size_t)len < sizeof(_data.short_str)) {
-                // SSO short strings, including empty string.
-                _type = REDIS_REPLY_STRING;
-                _length = len;
-                buf.pop_front(crlf_pos + 2);
-                buf.cutn(_data.short_str, len);
-                _data.short_str[len] = '\0';
-            } else {
-                char* d = (char*)_arena->allocate((len/8 + 1)*8);
-                if (d == NULL) {
-                    LOG(FATAL) << "Fail to allocate string[" << len << "]";
-                    return PARSE_ERROR_ABSOLUTELY_WRONG;
-                }
-                buf.pop_front(crlf_pos + 2/*CRLF*/);
-                buf.cutn(d, len);
-                d[len] = '\0';
-                _type = REDIS_REPLY_STRING;
-                _length = len;
-                _data.long_str = d;
-            }
-            char crlf[2];
-            buf.cutn(crlf, sizeof(crlf));
-            if (crlf[0] != '\r' || crlf[1] != '\n') {
-                LOG(ERROR) << "Bulk string is not ended with CRLF";
+            _type = REDIS_REPLY_NIL;
+            _length = 0;
+            _data.integer = 0;
+        } else if (fc == '#') {
+            if (crlf_pos != 2 || (linebuf[1] != 't' && linebuf[1] != 'f')) {
+                LOG(ERROR) << "Invalid boolean=`" << linebuf << '\'';
                 return PARSE_ERROR_ABSOLUTELY_WRONG;
             }
-            return PARSE_OK;
+            _type = REDIS_REPLY_BOOLEAN;
+            _length = 0;
+            _data.integer = (linebuf[1] == 't');
         } else {
-            const int64_t count = value;  // `value' is count of sub replies
-            if (count < 0) { // redis nil
-                buf.pop_front(crlf_pos + 2/*CRLF*/);
-                _type = REDIS_REPLY_NIL;
-                _length = 0;
-                _data.integer = 0;
-                return PARSE_OK;
-            }
-            if (count == 0) { // empty array
-                buf.pop_front(crlf_pos + 2/*CRLF*/);
-                _type = REDIS_REPLY_ARRAY;
-                _length = 0;
-                _data.array.last_index = -1;
-                _data.array.replies = NULL;
-                return PARSE_OK;
-            }
-            if (count > (int64_t)std::numeric_limits<uint32_t>::max()) {
-                LOG(ERROR) << "Too many sub replies! max count=2^32-1,"
-                    " actually=" << count;
+            char* endptr = NULL;
+            // strtod understands "inf", "-inf" and "nan" as well.
+            const double value = strtod(linebuf + 1, &endptr);
+            if (endptr != linebuf + crlf_pos || crlf_pos == 1) {
+                LOG(ERROR) << '`' << linebuf + 1 << "' is not a valid double";
                 return PARSE_ERROR_ABSOLUTELY_WRONG;
             }
-            // FIXME(gejun): Call allocate_aligned instead.
-            RedisReply* subs = (RedisReply*)_arena->allocate(sizeof(RedisReply) * count);
-            if (subs == NULL) {
-                LOG(FATAL) << "Fail to allocate RedisReply[" << count << "]";
+            _type = REDIS_REPLY_DOUBLE;
+            _length = 0;
+            _data.real = value;
+        }
+        buf.pop_front(crlf_pos + 2/*CRLF*/);
+        return PARSE_OK;
+    }
+    default:
+        if (!GetLengthPrefixedType(fc, &type)) {
+            LOG(ERROR) << "Invalid first character=" << (int)fc;
+            return PARSE_ERROR_ABSOLUTELY_WRONG;
+        }
+        break;
+    }
+
+    // Bulk String   "$<length>\r\n<string>\r\n"
+    // Blob Error    "!<length>\r\n<string>\r\n"
+    // Verbatim      "=<length>\r\n<format>:<string>\r\n"
+    // Integer       ":<integer>\r\n"
+    // Array         "*<size>\r\n<sub-reply1><sub-reply2>..."
+    // Set/Push      same with Array except the first character is `~' or `>'
+    // Map/Attribute "%<npairs>\r\n<key1><value1><key2><value2>..."
+    char intbuf[32];  // enough for fc + 64-bit decimal + \r\n
+    const size_t ncopied = buf.copy_to(intbuf, sizeof(intbuf) - 1);
+    intbuf[ncopied] = '\0';
+    const size_t crlf_pos = butil::StringPiece(intbuf, ncopied).find("\r\n");
+    if (crlf_pos == butil::StringPiece::npos) {  // not enough data
+        return PARSE_ERROR_NOT_ENOUGH_DATA;
+    }
+    char* endptr = NULL;
+    int64_t value = strtoll(intbuf + 1/*skip fc*/, &endptr, 10);
+    if (endptr != intbuf + crlf_pos) {
+        LOG(ERROR) << '`' << intbuf + 1 << "' is not a valid 64-bit decimal";
+        return PARSE_ERROR_ABSOLUTELY_WRONG;
+    }
+    if (type == REDIS_REPLY_INTEGER) {
+        buf.pop_front(crlf_pos + 2/*CRLF*/);
+        _type = REDIS_REPLY_INTEGER;
+        _length = 0;
+        _data.integer = value;
+        return PARSE_OK;
+    } else if (type == REDIS_REPLY_STRING || type == REDIS_REPLY_ERROR ||
+               type == REDIS_REPLY_VERBATIM) {
+        const int64_t len = value;  // `value' is length of the string
+        if (len < 0) {  // redis nil
+            buf.pop_front(crlf_pos + 2/*CRLF*/);
+            _type = REDIS_REPLY_NIL;
+            _length = 0;
+            _data.integer = 0;
+            return PARSE_OK;
+        }
+        if (len > (int64_t)std::numeric_limits<uint32_t>::max()) {
+            LOG(ERROR) << "bulk string is too long! max length=2^32-1,"
+                " actually=" << len;
+            return PARSE_ERROR_ABSOLUTELY_WRONG;
+        }
+        // We provide c_str(), thus even if bulk string is started with
+        // length, we have to end it with \0.
+        if (buf.size() < crlf_pos + 2 + (size_t)len + 2/*CRLF*/) {
+            return PARSE_ERROR_NOT_ENOUGH_DATA;
+        }
+        if ((size_t)len < sizeof(_data.short_str)) {
+            // SSO short strings, including empty string.
+            _type = type;
+            _length = len;
+            buf.pop_front(crlf_pos + 2);
+            buf.cutn(_data.short_str, len);
+            _data.short_str[len] = '\0';
+        } else {
+            char* d = (char*)_arena->allocate((len/8 + 1)*8);
+            if (d == NULL) {
+                LOG(FATAL) << "Fail to allocate string[" << len << "]";
                 return PARSE_ERROR_ABSOLUTELY_WRONG;
             }
-            for (int64_t i = 0; i < count; ++i) {
-                new (&subs[i]) RedisReply(_arena);
-            }
             buf.pop_front(crlf_pos + 2/*CRLF*/);
-            _type = REDIS_REPLY_ARRAY;
-            _length = count;
-            _data.array.replies = subs;
-
-            // Recursively parse sub replies. If any of them fails, it will
-            // be continued in next calls by tracking _data.array.last_index.
-            _data.array.last_index = 0;
-            for (int64_t i = 0; i < count; ++i) {
-                ParseError err = subs[i].ConsumePartialIOBuf(buf);
-                if (err != PARSE_OK) {
-                    return err;
-                }
-                ++_data.array.last_index;
-            }
-            _data.array.last_index = -1;
-            return PARSE_OK;
+            buf.cutn(d, len);
+            d[len] = '\0';
+            _type = type;
+            _length = len;
+            _data.long_str = d;
+        }
+        char crlf[2];
+        buf.cutn(crlf, sizeof(crlf));
+        if (crlf[0] != '\r' || crlf[1] != '\n') {
+            LOG(ERROR) << "Bulk string is not ended with CRLF";
+            return PARSE_ERROR_ABSOLUTELY_WRONG;
         }
+        return PARSE_OK;
     }
-    default:
-        LOG(ERROR) << "Invalid first character=" << (int)fc;
+    int64_t count = value;  // `value' is count of sub replies
+    if (count < 0) { // redis nil
+        buf.pop_front(crlf_pos + 2/*CRLF*/);
+        _type = REDIS_REPLY_NIL;
+        _length = 0;
+        _data.integer = 0;
+        return PARSE_OK;
+    }
+    if (type == REDIS_REPLY_MAP || type == REDIS_REPLY_ATTRIBUTE) {
+        count *= 2;
+    }
+    if (count == 0) { // empty aggregate
+        buf.pop_front(crlf_pos + 2/*CRLF*/);
+        if (type == REDIS_REPLY_ATTRIBUTE) {
+            return ConsumePartialIOBuf(buf);
+        }
+        _type = type;
+        _length = 0;
+        _data.array.last_index = -1;
+        _data.array.replies = NULL;
+        return PARSE_OK;
+    }
+    if (count > (int64_t)std::numeric_limits<int32_t>::max()) {
+        LOG(ERROR) << "Too many sub replies! max count=2^31-1,"
+            " actually=" << count;
         return PARSE_ERROR_ABSOLUTELY_WRONG;
     }
-    return PARSE_ERROR_ABSOLUTELY_WRONG;
+    // FIXME(gejun): Call allocate_aligned instead.
+    RedisReply* subs = (RedisReply*)_arena->allocate(sizeof(RedisReply) * count);
+    if (subs == NULL) {
+        LOG(FATAL) << "Fail to allocate RedisReply[" << count << "]";
+        return PARSE_ERROR_ABSOLUTELY_WRONG;
+    }
+    for (int64_t i = 0; i < count; ++i) {
+        new (&subs[i]) RedisReply(_arena);
+    }
+    buf.pop_front(crlf_pos + 2/*CRLF*/);
+    _type = type;
+    _length = count;
+    _data.array.replies = subs;
+
+    // Recursively parse sub replies. If any of them fails, it will
+    // be continued in next calls by tracking _data.array.last_index.
+    _data.array.last_index = 0;
+    return ConsumePartialIOBuf(buf);
 }
 
 class RedisStringPrinter {
@@ -316,6 +436,7 @@ void RedisStringPrinter::Print(std::ostream& os) const {
 void RedisReply::Print(std::ostream& os) const {
     switch (_type) {
     case REDIS_REPLY_STRING:
+    case REDIS_REPLY_VERBATIM:
         os << '"';
         if (_length < (int)sizeof(_data.short_str)) {
             os << RedisStringPrinter(_data.short_str, _length);
@@ -334,9 +455,42 @@ void RedisReply::Print(std::ostream& os) const {
         }
         os << ']';
         break;
+    case REDIS_REPLY_SET:
+    case REDIS_REPLY_PUSH:
+        os << (_type == REDIS_REPLY_SET ? "(set)[" : "(push)[");
+        for (int i = 0; i < _length; ++i) {
+            if (i != 0) {
+                os << ", ";
+            }
+            _data.array.replies[i].Print(os);
+        }
+        os << ']';
+        break;
+    case REDIS_REPLY_MAP:
+    case REDIS_REPLY_ATTRIBUTE:
+        os << '{';
+        for (int i = 0; i + 1 < _length; i += 2) {
+            if (i != 0) {
+                os << ", ";
+            }
+            _data.array.replies[i].Print(os);
+            os << ": ";
+            _data.array.replies[i + 1].Print(os);
+        }
+        os << '}';
+        break;
     case REDIS_REPLY_INTEGER:
         os << "(integer) " << _data.integer;
         break;
+    case REDIS_REPLY_DOUBLE:
+        os << "(double) " << _data.real;
+        break;
+    case REDIS_REPLY_BOOLEAN:
+        os << (_data.integer ? "(true)" : "(false)");
+        break;
+    case REDIS_REPLY_BIG_NUMBER:
+        os << "(big number) " << butil::StringPiece(c_str(), _length);
+        break;
     case REDIS_REPLY_NIL:
         os << "(nil)";
         break;
@@ -360,7 +514,14 @@ void RedisReply::CopyFromDifferentArena(const RedisReply& other) {
     _type = other._type;
     _length = other._length;
     switch (_type) {
-    case REDIS_REPLY_ARRAY: {
+    case REDIS_REPLY_ARRAY:
+    case REDIS_REPLY_MAP:
+    case REDIS_REPLY_SET:
+    case REDIS_REPLY_PUSH:
+    case REDIS_REPLY_ATTRIBUTE: {
+        if (_length == npos) {
+            break;
+        }
         RedisReply* subs = (RedisReply*)_arena->allocate(sizeof(RedisReply) * _length);
         if (subs == NULL) {
             LOG(FATAL) << "Fail to allocate RedisReply[" << _length << "]";
@@ -384,12 +545,20 @@ void RedisReply::CopyFromDifferentArena(const RedisReply& other) {
     }
         break;
     case REDIS_REPLY_INTEGER:
+    case REDIS_REPLY_BOOLEAN:
         _data.integer = other._data.integer;
         break;
+    case REDIS_REPLY_DOUBLE:
+        _data.real = other._data.real;
+        break;
     case REDIS_REPLY_NIL:
         break;
     case REDIS_REPLY_STRING:
         // fall through
+    case REDIS_REPLY_BIG_NUMBER:
+        // fall through
+    case REDIS_REPLY_VERBATIM:
+        // fall through
     case REDIS_REPLY_ERROR:
         // fall through
     case REDIS_REPLY_STATUS:
@@ -408,13 +577,14 @@ void RedisReply::CopyFromDifferentArena(const RedisReply& other) {
     }
 }
 
-void RedisReply::SetArray(int size) {
+void RedisReply::SetAggregateImpl(int size, RedisReplyType type) {
     if (_type != REDIS_REPLY_NIL) {
         Reset();
     }
-    _type = REDIS_REPLY_ARRAY;
+    _type = type;
     if (size < 0) {
-        LOG(ERROR) << "negative size=" << size << " when calling SetArray";
+        LOG(ERROR) << "negative size=" << size << " when calling Set"
+                   << RedisReplyTypeToString(type);
         return;
     } else if (size == 0) {
         _length = 0;
@@ -454,6 +624,21 @@ void RedisReply::SetStringImpl(const butil::StringPiece& str, RedisReplyType typ
     _length = size;
 }
 
+void RedisReply::SetVerbatim(const butil::StringPiece& format,
+                             const butil::StringPiece& str) {
+    if (format.size() != 3) {
+        LOG(ERROR) << "format=" << format << " of verbatim string is not"
+            " 3 characters";
+        return;
+    }
+    std::string buf;
+    buf.reserve(format.size() + 1 + str.size());
+    buf.append(format.data(), format.size());
+    buf.push_back(':');
+    buf.append(str.data(), str.size());
+    SetStringImpl(buf, REDIS_REPLY_VERBATIM);
+}
+
 void RedisReply::FormatStringImpl(const char* fmt, va_list args, RedisReplyType type) {
     va_list copied_args;
     va_copy(copied_args, args);
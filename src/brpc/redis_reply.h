@@ -35,7 +35,18 @@ enum RedisReplyType {
     REDIS_REPLY_INTEGER = 3,
     REDIS_REPLY_NIL = 4,
     REDIS_REPLY_STATUS = 5,  // Simple String
-    REDIS_REPLY_ERROR = 6
+    REDIS_REPLY_ERROR = 6,   // Simple Error or Blob Error of RESP3
+    // Types introduced by RESP3.
+    REDIS_REPLY_DOUBLE = 7,
+    REDIS_REPLY_BOOLEAN = 8,
+    REDIS_REPLY_BIG_NUMBER = 9,
+    REDIS_REPLY_VERBATIM = 10,  // Verbatim String, e.g. "txt:some text"
+    REDIS_REPLY_MAP = 11,
+    REDIS_REPLY_SET = 12,
+    REDIS_REPLY_PUSH = 13,      // Out-of-band data, see RedisPushHandler
+    // Attributes are auxiliary data before replies. They're skipped
+    // by the parser and never seen by users.
+    REDIS_REPLY_ATTRIBUTE = 14
 };
 
 const char* RedisReplyTypeToString(RedisReplyType);
@@ -55,6 +66,11 @@ public:
     bool is_error() const;   // True if the reply is an error.
     bool is_string() const;  // True if the reply is a string.
     bool is_array() const;   // True if the reply is an array.
+    bool is_double() const;  // True if the reply is a double (RESP3).
+    bool is_boolean() const; // True if the reply is a boolean (RESP3).
+    bool is_map() const;     // True if the reply is a map (RESP3).
+    bool is_set() const;     // True if the reply is a set (RESP3).
+    bool is_push() const;    // True if the reply is a push message (RESP3).
 
     // Set the reply to the null string.
     void SetNullString();
@@ -82,11 +98,44 @@ public:
     void SetString(const butil::StringPiece& str);
     void FormatString(const char* fmt, ...);
 
+    // Following types are only understood by clients using RESP3 (which
+    // sent "HELLO 3"), don't reply them to other clients.
+
+    // Set this reply to a map with `npairs' key-value pairs. After calling
+    // SetMap, set keys and values by operator[]: (*this)[2*i] is the i-th
+    // key and (*this)[2*i+1] is the i-th value.
+    void SetMap(int npairs);
+
+    // Set this reply to a set or a push message with `size' elements,
+    // which are set by operator[].
+    void SetSet(int size);
+    void SetPush(int size);
+
+    void SetDouble(double value);
+    void SetBoolean(bool value);
+
+    // Set this reply to a big number, `str' should be decimal digits with
+    // an optional leading '-'.
+    void SetBigNumber(const butil::StringPiece& str);
+
+    // Set this reply to a verbatim string, `format' is 3 characters,
+    // e.g. "txt" or "mkd".
+    void SetVerbatim(const butil::StringPiece& format,
+                     const butil::StringPiece& str);
+
     // Convert the reply into a signed 64-bit integer(according to
     // http://redis.io/topics/protocol). If the reply is not an integer,
     // call stacks are logged and 0 is returned.
     int64_t integer() const;
 
+    // Convert the reply to a double(RESP3). If the reply is not a double,
+    // call stacks are logged and 0 is returned.
+    double real() const;
+
+    // Convert the reply to a boolean(RESP3). If the reply is not a boolean,
+    // call stacks are logged and false is returned.
+    bool boolean() const;
+
     // Convert the reply to an error message. If the reply is not an error
     // message, call stacks are logged and "" is returned.
     const char* error_message() const;
@@ -94,6 +143,8 @@ public:
     // Convert the reply to a (c-style) string. If the reply is not a string,
     // call stacks are logged and "" is returned. Notice that a
     // string containing \0 is not printed fully, use data() instead.
+    // Digits of big numbers and verbatim strings (including the leading
+    // format and ':') of RESP3 can be got by c_str() and data() as well.
     const char* c_str() const;
     // Convert the reply to a StringPiece. If the reply is not a string,
     // call stacks are logged and "" is returned. 
@@ -103,9 +154,12 @@ public:
     // Return number of sub replies in the array if this reply is an array, or
     // return the length of string if this reply is a string, otherwise 0 is
     // returned (call stacks are not logged).
+    // A map of RESP3 has 2*N sub replies where N is number of pairs. Sets and
+    // push messages are same with arrays.
     size_t size() const;
-    // Get the index-th sub reply. If this reply is not an array or index is out of
-    // range, a nil reply is returned (call stacks are not logged)
+    // Get the index-th sub reply. If this reply is not an array (or a map, set,
+    // push message) or index is out of range, a nil reply is returned
+    // (call stacks are not logged)
     const RedisReply& operator[](size_t index) const;
     RedisReply& operator[](size_t index);
 
@@ -122,7 +176,7 @@ public:
     ParseError ConsumePartialIOBuf(butil::IOBuf& buf);
 
     // Serialize to iobuf appender using redis protocol
-    bool SerializeTo(butil::IOBufAppender* appender);
+    bool SerializeTo(butil::IOBufAppender* appender) const;
 
     // Swap internal fields with another reply.
     void Swap(RedisReply& other);
@@ -148,11 +202,17 @@ private:
 
     void FormatStringImpl(const char* fmt, va_list args, RedisReplyType type);
     void SetStringImpl(const butil::StringPiece& str, RedisReplyType type);
+    void SetAggregateImpl(int size, RedisReplyType type);
+    // True if the reply has sub replies.
+    bool is_aggregate() const;
+    // True if the string is stored in short_str/long_str.
+    bool has_string() const;
     
     RedisReplyType _type;
     int _length;  // length of short_str/long_str, count of replies
     union {
         int64_t integer;
+        double real;
         char short_str[16];
         const char* long_str;
         struct {
@@ -192,6 +252,20 @@ inline bool RedisReply::is_integer() const { return _type == REDIS_REPLY_INTEGER
 inline bool RedisReply::is_string() const
 { return _type == REDIS_REPLY_STRING || _type == REDIS_REPLY_STATUS; }
 inline bool RedisReply::is_array() const { return _type == REDIS_REPLY_ARRAY; }
+inline bool RedisReply::is_double() const { return _type == REDIS_REPLY_DOUBLE; }
+inline bool RedisReply::is_boolean() const { return _type == REDIS_REPLY_BOOLEAN; }
+inline bool RedisReply::is_map() const { return _type == REDIS_REPLY_MAP; }
+inline bool RedisReply::is_set() const { return _type == REDIS_REPLY_SET; }
+inline bool RedisReply::is_push() const { return _type == REDIS_REPLY_PUSH; }
+inline bool RedisReply::is_aggregate() const {
+    return _type == REDIS_REPLY_ARRAY || _type == REDIS_REPLY_MAP ||
+        _type == REDIS_REPLY_SET || _type == REDIS_REPLY_PUSH ||
+        _type == REDIS_REPLY_ATTRIBUTE;
+}
+inline bool RedisReply::has_string() const {
+    return is_string() || _type == REDIS_REPLY_BIG_NUMBER ||
+        _type == REDIS_REPLY_VERBATIM;
+}
 
 inline int64_t RedisReply::integer() const {
     if (is_integer()) {
@@ -202,6 +276,62 @@ inline int64_t RedisReply::integer() const {
     return 0;
 }
 
+inline double RedisReply::real() const {
+    if (is_double()) {
+        return _data.real;
+    }
+    CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
+                 << ", not a double";
+    return 0;
+}
+
+inline bool RedisReply::boolean() const {
+    if (is_boolean()) {
+        return _data.integer != 0;
+    }
+    CHECK(false) << "The reply is " << RedisReplyTypeToString(_type)
+                 << ", not a boolean";
+    return false;
+}
+
+inline void RedisReply::SetArray(int size) {
+    return SetAggregateImpl(size, REDIS_REPLY_ARRAY);
+}
+
+inline void RedisReply::SetMap(int npairs) {
+    return SetAggregateImpl(npairs * 2, REDIS_REPLY_MAP);
+}
+
+inline void RedisReply::SetSet(int size) {
+    return SetAggregateImpl(size, REDIS_REPLY_SET);
+}
+
+inline void RedisReply::SetPush(int size) {
+    return SetAggregateImpl(size, REDIS_REPLY_PUSH);
+}
+
+inline void RedisReply::SetDouble(double value) {
+    if (_type != REDIS_REPLY_NIL) {
+        Reset();
+    }
+    _type = REDIS_REPLY_DOUBLE;
+    _length = 0;
+    _data.real = value;
+}
+
+inline void RedisReply::SetBoolean(bool value) {
+    if (_type != REDIS_REPLY_NIL) {
+        Reset();
+    }
+    _type = REDIS_REPLY_BOOLEAN;
+    _length = 0;
+    _data.integer = value;
+}
+
+inline void RedisReply::SetBigNumber(const butil::StringPiece& str) {
+    return SetStringImpl(str, REDIS_REPLY_BIG_NUMBER);
+}
+
 inline void RedisReply::SetNullArray() {
     if (_type != REDIS_REPLY_NIL) {
         Reset();
@@ -258,7 +388,7 @@ inline void RedisReply::FormatString(const char* fmt, ...) {
 }
 
 inline const char* RedisReply::c_str() const {
-    if (is_string()) {
+    if (has_string()) {
         if (_length < (int)sizeof(_data.short_str)) { // SSO
             return _data.short_str;
         } else {
@@ -271,7 +401,7 @@ inline const char* RedisReply::c_str() const {
 }
 
 inline butil::StringPiece RedisReply::data() const {
-    if (is_string()) {
+    if (has_string()) {
         if (_length < (int)sizeof(_data.short_str)) { // SSO
             return butil::StringPiece(_data.short_str, _length);
         } else {
@@ -306,7 +436,7 @@ inline RedisReply& RedisReply::operator[](size_t index) {
 }
 
 inline const RedisReply& RedisReply::operator[](size_t index) const {
-    if (is_array() && index < (size_t)_length) {
+    if (is_aggregate() && index < (size_t)_length) {
         return _data.array.replies[index];
     }
     static RedisReply redis_nil(NULL);
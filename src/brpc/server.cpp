@@ -18,6 +18,7 @@
 
 #include <wordexp.h>                                // wordexp
 #include <iomanip>
+#include <set>
 #include <arpa/inet.h>                              // inet_aton
 #include <fcntl.h>                                  // O_CREAT
 #include <sys/stat.h>                               // mkdir
@@ -73,6 +74,7 @@
 #include "brpc/trackme.h"
 #include "brpc/restful.h"
 #include "brpc/rtmp.h"
+#include "brpc/memcache_service.h"
 #include "brpc/builtin/common.h"               // GetProgramName
 #include "brpc/details/tcmalloc_extension.h"
 
@@ -140,7 +142,9 @@ ServerOptions::ServerOptions()
     , http_master_service(NULL)
     , health_reporter(NULL)
     , rtmp_service(NULL)
-    , redis_service(NULL) {
+    , redis_service(NULL)
+    , memcache_service(NULL)
+    , use_pb_arena(false) {
     if (s_ncore > 0) {
         num_threads = s_ncore + 1;
     }
@@ -157,7 +161,8 @@ Server::MethodProperty::OpaqueParams::OpaqueParams()
     : is_tabbed(false)
     , allow_default_url(false)
     , allow_http_body_to_pb(true)
-    , pb_bytes_to_base64(false) {
+    , pb_bytes_to_base64(false)
+    , read_request_progressively(false) {
 }
 
 Server::MethodProperty::MethodProperty()
@@ -383,6 +388,7 @@ Server::Server(ProfilerLinker)
     , _builtin_service_count(0)
     , _virtual_service_count(0)
     , _failed_to_set_max_concurrency_of_method(false)
+    , _progressive_read_method_count(0)
     , _am(NULL)
     , _internal_am(NULL)
     , _first_service(NULL)
@@ -437,6 +443,9 @@ Server::~Server() {
 
     delete _options.redis_service;
     _options.redis_service = NULL;
+
+    delete _options.memcache_service;
+    _options.memcache_service = NULL;
 }
 
 int Server::AddBuiltinServices() {
@@ -676,27 +685,6 @@ static int get_port_from_fd(int fd) {
     return ntohs(addr.sin_port);
 }
 
-static bool CreateConcurrencyLimiter(const AdaptiveMaxConcurrency& amc,
-                                     ConcurrencyLimiter** out) {
-    if (amc.type() == AdaptiveMaxConcurrency::UNLIMITED()) {
-        *out = NULL;
-        return true;
-    }
-    const ConcurrencyLimiter* cl =
-        ConcurrencyLimiterExtension()->Find(amc.type().c_str());
-    if (cl == NULL) {
-        LOG(ERROR) << "Fail to find ConcurrencyLimiter by `" << amc.value() << "'";
-        return false;
-    }
-    ConcurrencyLimiter* cl_copy = cl->New(amc);
-    if (cl_copy == NULL) {
-        LOG(ERROR) << "Fail to new ConcurrencyLimiter";
-        return false;
-    }
-    *out = cl_copy;
-    return true;
-}
-
 static AdaptiveMaxConcurrency g_default_max_concurrency_of_method(0);
 
 int Server::StartInternal(const butil::ip_t& ip,
@@ -926,7 +914,7 @@ int Server::StartInternal(const butil::ip_t& ip,
                 amc = &_options.method_max_concurrency;
             }
             ConcurrencyLimiter* cl = NULL;
-            if (!CreateConcurrencyLimiter(*amc, &cl)) {
+            if (NewConcurrencyLimiter(*amc, &cl) != 0) {
                 LOG(ERROR) << "Fail to create ConcurrencyLimiter for method";
                 return -1;
             }
@@ -1198,6 +1186,20 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
         return -1;
     }
 
+    // Parse names of methods reading http requests progressively.
+    std::set<std::string> progressive_read_methods;
+    for (butil::StringMultiSplitter sp(svc_opt.progressive_read_methods.c_str(),
+                                       ", "); sp; ++sp) {
+        const std::string method_name(sp.field(), sp.length());
+        if (sd->FindMethodByName(method_name) == NULL) {
+            LOG(ERROR) << "Unknown method=`" << method_name
+                       << "' in progressive_read_methods of service="
+                       << sd->full_name();
+            return -1;
+        }
+        progressive_read_methods.insert(method_name);
+    }
+
     // defined `option (idl_support) = true' or not.
     const bool is_idl_support = sd->file()->options().GetExtension(idl_support);
 
@@ -1211,6 +1213,11 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
         mp.params.allow_default_url = svc_opt.allow_default_url;
         mp.params.allow_http_body_to_pb = svc_opt.allow_http_body_to_pb;
         mp.params.pb_bytes_to_base64 = svc_opt.pb_bytes_to_base64;
+        mp.params.read_request_progressively =
+            progressive_read_methods.count(md->name()) != 0;
+        if (mp.params.read_request_progressively) {
+            ++_progressive_read_method_count;
+        }
         mp.service = service;
         mp.method = md;
         mp.status = new MethodStatus;
@@ -1298,6 +1305,8 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
                 params.allow_default_url = svc_opt.allow_default_url;
                 params.allow_http_body_to_pb = svc_opt.allow_http_body_to_pb;
                 params.pb_bytes_to_base64 = svc_opt.pb_bytes_to_base64;
+                params.read_request_progressively =
+                    progressive_read_methods.count(mappings[i].method_name) != 0;
                 if (!_global_restful_map->AddMethod(
                         mappings[i].path, service, params,
                         mappings[i].method_name, mp->status)) {
@@ -1336,6 +1345,8 @@ int Server::AddServiceInternal(google::protobuf::Service* service,
             params.allow_default_url = svc_opt.allow_default_url;
             params.allow_http_body_to_pb = svc_opt.allow_http_body_to_pb;
             params.pb_bytes_to_base64 = svc_opt.pb_bytes_to_base64;
+            params.read_request_progressively =
+                progressive_read_methods.count(mappings[i].method_name) != 0;
             if (!m->AddMethod(mappings[i].path, service, params,
                               mappings[i].method_name, mp->status)) {
                 LOG(ERROR) << "Fail to map `" << mappings[i].path << "' to `"
@@ -1446,6 +1457,9 @@ void Server::RemoveMethodsOf(google::protobuf::Service* service) {
             LOG(ERROR) << "Fail to find method=" << md->full_name();
             continue;
         }
+        if (mp->params.read_request_progressively) {
+            --_progressive_read_method_count;
+        }
         if (mp->http_url) {
             butil::StringSplitter at_sp(mp->http_url->c_str(), '@');
             for (; at_sp; ++at_sp) {
@@ -1597,7 +1611,8 @@ void Server::GenerateVersionIfNeeded() {
         return;
     }
     int extra_count = !!_options.nshead_service + !!_options.rtmp_service +
-        !!_options.thrift_service + !!_options.redis_service;
+        !!_options.thrift_service + !!_options.redis_service +
+        !!_options.memcache_service;
     _version.reserve((extra_count + service_count()) * 20);
     for (ServiceMap::const_iterator it = _fullname_service_map.begin();
          it != _fullname_service_map.end(); ++it) {
@@ -1637,6 +1652,13 @@ void Server::GenerateVersionIfNeeded() {
         }
         _version.append(butil::class_name_str(*_options.redis_service));
     }
+
+    if (_options.memcache_service) {
+        if (!_version.empty()) {
+            _version.push_back('+');
+        }
+        _version.append(butil::class_name_str(*_options.memcache_service));
+    }
 }
 
 static std::string ExpandPath(const std::string &path) {
@@ -53,6 +53,7 @@ class MongoServiceAdaptor;
 class RestfulMap;
 class RtmpService;
 class RedisService;
+class MemcacheService;
 struct SocketSSLContext;
 
 struct ServerOptions {
@@ -241,6 +242,20 @@ struct ServerOptions {
     // Default: NULL (disabled)
     RedisService* redis_service;
 
+    // For processing memcache connections in the binary or text protocol.
+    // Read src/brpc/memcache_service.h for details.
+    // Owned by Server and deleted in server's destructor.
+    // Default: NULL (disabled)
+    MemcacheService* memcache_service;
+
+    // Allocate requests and responses of baidu_std in a protobuf Arena which
+    // is created for each RPC and destroyed after done->Run(), saving lots
+    // of allocations for messages with many sub-messages or strings.
+    // Requests and responses must not be used after done->Run().
+    // Ignored with protobuf 2.x.
+    // Default: false
+    bool use_pb_arena;
+
 private:
     // SSLOptions is large and not often used, allocate it on heap to
     // prevent ServerOptions from being bloated in most cases.
@@ -297,6 +312,15 @@ struct ServiceOptions {
     // option is turned on.
     // Default: false if BAIDU_INTERNAL is defined, otherwise true
     bool pb_bytes_to_base64;
+
+    // Comma-separated names of methods in the service which start running
+    // as soon as headers of a HTTP/1.x request are received, instead of
+    // after the whole body is buffered. Such methods read the body by
+    // Controller::ReadProgressiveAttachmentBy() and `request' is not
+    // converted from the body. Suitable for large uploads.
+    // Example: "Upload,Append"
+    // Default: empty
+    std::string progressive_read_methods;
 };
 
 // Represent ports inside [min_port, max_port]
@@ -346,6 +370,7 @@ public:
             bool allow_default_url;
             bool allow_http_body_to_pb;
             bool pb_bytes_to_base64;
+            bool read_request_progressively;
             OpaqueParams();
         };
         OpaqueParams params;        
@@ -635,6 +660,8 @@ friend class Controller;
     // number of the virtual services for mapping URL to methods.
     int _virtual_service_count;
     bool _failed_to_set_max_concurrency_of_method;
+    // Number of methods in _method_map with read_request_progressively.
+    int _progressive_read_method_count;
     Acceptor* _am;
     Acceptor* _internal_am;
     
@@ -41,6 +41,7 @@
 #include "brpc/socket.h"
 #include "brpc/describable.h"               // Describable
 #include "brpc/circuit_breaker.h"           // CircuitBreaker
+#include "brpc/concurrency_limiter.h"       // ConcurrencyLimiter
 #include "brpc/input_messenger.h"
 #include "brpc/details/sparse_minute_counter.h"
 #include "brpc/stream_impl.h"
@@ -105,7 +106,7 @@ const int WAIT_EPOLLOUT_TIMEOUT_MS = 50;
 class BAIDU_CACHELINE_ALIGNMENT SocketPool {
 friend class Socket;
 public:
-    explicit SocketPool(const SocketOptions& opt);
+    SocketPool(const SocketOptions& opt, const SocketPoolOptions& pool_opt);
     ~SocketPool();
 
     // Get an address-able socket. If the pool is empty, create one.
@@ -115,15 +116,33 @@ public:
     // Return a socket (which was returned by GetSocket) back to the pool,
     // if the pool is full, setfail the socket directly.
     void ReturnSocket(Socket* sock);
+
+    // Get a socket shared by pipelined RPCs, create one if all sockets are
+    // full. Returns 0 on success.
+    int GetPipelinedSocket(SocketUniquePtr* ptr);
+
+    // Called when a RPC using the socket returned by GetPipelinedSocket ends.
+    void ReturnPipelinedSocket(Socket* sock);
     
     // Get all pooled sockets inside.
     void ListSockets(std::vector<SocketId>* list, size_t max_count);
+
+    // Close unused sockets without data transmission for the idle timeout.
+    void ReleaseIdleSockets(int default_idle_seconds);
     
 private:
+    int max_idle_sockets() const {
+        return _pool_options.max_idle_sockets >= 0 ?
+            _pool_options.max_idle_sockets : FLAGS_max_connection_pool_size;
+    }
+
     // options used to create this instance
     SocketOptions _options;
+    const SocketPoolOptions _pool_options;
     butil::Mutex _mutex;
     std::vector<SocketId> _pool;
+    // Sockets got from GetPipelinedSocket() and number of RPCs using them.
+    std::vector<std::pair<SocketId, int> > _pipelined;
     butil::EndPoint _remote_side;
     butil::atomic<int> _numfree; // #free sockets in all sub pools.
     butil::atomic<int> _numinflight; // #inflight sockets in all sub pools.
@@ -187,6 +206,11 @@ public:
 
     butil::atomic<uint64_t> recent_error_count;
 
+    // Limiting concurrency of client-side RPCs to this server, created by
+    // the first RPC from a channel with `max_concurrency_per_server'.
+    butil::atomic<ConcurrencyLimiter*> client_cl;
+    butil::atomic<int> client_concurrency;
+
     explicit SharedPart(SocketId creator_socket_id);
     ~SharedPart();
 
@@ -203,13 +227,16 @@ Socket::SharedPart::SharedPart(SocketId creator_socket_id2)
     , out_size(0)
     , out_num_messages(0)
     , extended_stat(NULL)
-    , recent_error_count(0) {
+    , recent_error_count(0)
+    , client_cl(NULL)
+    , client_concurrency(0) {
 }
 
 Socket::SharedPart::~SharedPart() {
     delete extended_stat;
     extended_stat = NULL;
     delete socket_pool.exchange(NULL, butil::memory_order_relaxed);
+    delete client_cl.exchange(NULL, butil::memory_order_relaxed);
 }
 
 void Socket::SharedPart::UpdateStatsEverySecond(int64_t now_ms) {
@@ -883,6 +910,58 @@ void Socket::FeedbackCircuitBreaker(int error_code, int64_t latency_us) {
     }
 }
 
+bool Socket::OnClientRequested(const AdaptiveMaxConcurrency& amc,
+                               int* rejected_cc) {
+    SharedPart* sp = GetOrNewSharedPart();
+    ConcurrencyLimiter* cl = sp->client_cl.load(butil::memory_order_consume);
+    if (cl == NULL) {
+        ConcurrencyLimiter* new_cl = NULL;
+        if (NewConcurrencyLimiter(amc, &new_cl) != 0 || new_cl == NULL) {
+            // The option is validated at Channel.Init(), just let it go.
+            return true;
+        }
+        if (sp->client_cl.compare_exchange_strong(
+                cl, new_cl, butil::memory_order_acq_rel)) {
+            cl = new_cl;
+        } else {
+            // Created by another thread, use that one.
+            delete new_cl;
+        }
+    }
+    const int cc = sp->client_concurrency.fetch_add(
+        1, butil::memory_order_relaxed) + 1;
+    if (cl->OnRequested(cc)) {
+        return true;
+    }
+    if (rejected_cc) {
+        *rejected_cc = cc;
+    }
+    return false;
+}
+
+void Socket::OnClientResponded(int error_code, int64_t latency_us) {
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL) {
+        return;
+    }
+    sp->client_concurrency.fetch_sub(1, butil::memory_order_relaxed);
+    ConcurrencyLimiter* cl = sp->client_cl.load(butil::memory_order_consume);
+    if (cl) {
+        cl->OnResponded(error_code, latency_us);
+    }
+}
+
+int Socket::client_max_concurrency() const {
+    SharedPart* sp = GetSharedPart();
+    if (sp) {
+        ConcurrencyLimiter* cl = sp->client_cl.load(butil::memory_order_consume);
+        if (cl) {
+            return cl->MaxConcurrency();
+        }
+    }
+    return 0;
+}
+
 int Socket::ReleaseReferenceIfIdle(int idle_seconds) {
     const int64_t last_active_us = last_active_time_us();
     if (butil::cpuwide_time_us() - last_active_us <= idle_seconds * 1000000L) {
@@ -2264,8 +2343,10 @@ void SocketUser::AfterRevived(Socket* ptr) {
 
 ////////// SocketPool //////////////
 
-inline SocketPool::SocketPool(const SocketOptions& opt)
+inline SocketPool::SocketPool(const SocketOptions& opt,
+                              const SocketPoolOptions& pool_opt)
     : _options(opt)
+    , _pool_options(pool_opt)
     , _remote_side(opt.remote_side)
     , _numfree(0)
     , _numinflight(0) {
@@ -2279,10 +2360,16 @@ inline SocketPool::~SocketPool() {
             ptr->ReleaseAdditionalReference();
         }
     }
+    for (size_t i = 0; i < _pipelined.size(); ++i) {
+        SocketUniquePtr ptr;
+        if (Socket::Address(_pipelined[i].first, &ptr) == 0) {
+            ptr->ReleaseAdditionalReference();
+        }
+    }
 }
 
 inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
-    const int connection_pool_size = FLAGS_max_connection_pool_size;
+    const int connection_pool_size = max_idle_sockets();
 
     // In prev rev, SocketPool could be sharded into multiple SubSocketPools to
     // reduce thread contentions. The sharding key is mixed from pthread-id so
@@ -2331,7 +2418,7 @@ inline int SocketPool::GetSocket(SocketUniquePtr* ptr) {
 
 inline void SocketPool::ReturnSocket(Socket* sock) {
     // NOTE: save the gflag which may be reloaded at any time.
-    const int connection_pool_size = FLAGS_max_connection_pool_size;
+    const int connection_pool_size = max_idle_sockets();
 
     // Check if the pool is full.
     if (_numfree.fetch_add(1, butil::memory_order_relaxed) <
@@ -2347,6 +2434,111 @@ inline void SocketPool::ReturnSocket(Socket* sock) {
     _numinflight.fetch_sub(1, butil::memory_order_relaxed);
 }
 
+inline int SocketPool::GetPipelinedSocket(SocketUniquePtr* ptr) {
+    const int max_pipelined = _pool_options.max_pipelined_requests;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        // Entries before `i' are never moved by the removals below, so
+        // `best' stays valid.
+        bool found = false;
+        size_t best = 0;
+        for (size_t i = 0; i < _pipelined.size();) {
+            SocketUniquePtr tmp;
+            if (Socket::Address(_pipelined[i].first, &tmp) != 0) {
+                // Failed or closed for being idle. RPCs still using the
+                // socket are ended by the failure and find nothing when
+                // returning.
+                _pipelined[i] = _pipelined.back();
+                _pipelined.pop_back();
+                continue;
+            }
+            const int n = _pipelined[i].second;
+            if (n < max_pipelined &&
+                (!found || n < _pipelined[best].second)) {
+                found = true;
+                best = i;
+                ptr->reset(tmp.release());
+            }
+            ++i;
+        }
+        if (found) {
+            ++_pipelined[best].second;
+            _numinflight.fetch_add(1, butil::memory_order_relaxed);
+            return 0;
+        }
+    }
+    // All sockets are full. Concurrent callers may create more than one
+    // socket, which is harmless.
+    SocketOptions opt = _options;
+    opt.health_check_interval_s = -1;
+    SocketId sid = 0;
+    if (get_client_side_messenger()->Create(opt, &sid) != 0 ||
+        Socket::Address(sid, ptr) != 0) {
+        return -1;
+    }
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        _pipelined.push_back(std::make_pair(sid, 1));
+    }
+    _numinflight.fetch_add(1, butil::memory_order_relaxed);
+    return 0;
+}
+
+inline void SocketPool::ReturnPipelinedSocket(Socket* sock) {
+    const SocketId sid = sock->id();
+    const int max_idle = max_idle_sockets();
+    bool close_socket = false;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        int nidle = 0;
+        size_t index = _pipelined.size();
+        for (size_t i = 0; i < _pipelined.size(); ++i) {
+            if (_pipelined[i].first == sid) {
+                index = i;
+            } else if (_pipelined[i].second == 0) {
+                ++nidle;
+            }
+        }
+        if (index == _pipelined.size()) {
+            // Already removed after failing.
+            return;
+        }
+        _numinflight.fetch_sub(1, butil::memory_order_relaxed);
+        if (--_pipelined[index].second == 0 && nidle >= max_idle) {
+            _pipelined[index] = _pipelined.back();
+            _pipelined.pop_back();
+            close_socket = true;
+        }
+    }
+    if (close_socket) {
+        sock->SetFailed(EUNUSED, "Close unused pooled socket");
+    }
+}
+
+inline void SocketPool::ReleaseIdleSockets(int default_idle_seconds) {
+    const int idle_seconds = _pool_options.idle_timeout_s >= 0 ?
+        _pool_options.idle_timeout_s : default_idle_seconds;
+    if (idle_seconds <= 0) {
+        return;
+    }
+    std::vector<SocketId> idle_sockets;
+    ListSockets(&idle_sockets, 0);
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        for (size_t i = 0; i < _pipelined.size(); ++i) {
+            if (_pipelined[i].second == 0) {
+                idle_sockets.push_back(_pipelined[i].first);
+            }
+        }
+    }
+    for (size_t i = 0; i < idle_sockets.size(); ++i) {
+        SocketUniquePtr ptr;
+        if (Socket::Address(idle_sockets[i], &ptr) == 0) {
+            ptr->ReleaseReferenceIfIdle(idle_seconds);
+        }
+    }
+}
+
 inline void SocketPool::ListSockets(std::vector<SocketId>* out, size_t max_count) {
     out->clear();
     // NOTE: size() of vector is thread-unsafe and may return a very 
@@ -2398,15 +2590,11 @@ void Socket::ShareStats(Socket* main_socket) {
     }
 }
 
-int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket) {
-    if (pooled_socket == NULL) {
-        LOG(ERROR) << "pooled_socket is NULL";
-        return -1;
-    }
+SocketPool* Socket::GetOrNewSocketPool(const SocketPoolOptions* options) {
     SharedPart* main_sp = GetOrNewSharedPart();
     if (main_sp == NULL) {
         LOG(ERROR) << "_shared_part is NULL";
-        return -1;
+        return NULL;
     }
     // Create socket_pool optimistically.
     SocketPool* socket_pool = main_sp->socket_pool.load(butil::memory_order_consume);
@@ -2418,7 +2606,8 @@ int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket) {
         opt.initial_ssl_ctx = _ssl_ctx;
         opt.keytable_pool = _keytable_pool;
         opt.app_connect = _app_connect;
-        socket_pool = new SocketPool(opt);
+        socket_pool = new SocketPool(
+            opt, options ? *options : SocketPoolOptions());
         SocketPool* expected = NULL;
         if (!main_sp->socket_pool.compare_exchange_strong(
                 expected, socket_pool, butil::memory_order_acq_rel)) {
@@ -2427,6 +2616,19 @@ int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket) {
             socket_pool = expected;
         }
     }
+    return socket_pool;
+}
+
+int Socket::GetPooledSocket(SocketUniquePtr* pooled_socket,
+                            const SocketPoolOptions* options) {
+    if (pooled_socket == NULL) {
+        LOG(ERROR) << "pooled_socket is NULL";
+        return -1;
+    }
+    SocketPool* socket_pool = GetOrNewSocketPool(options);
+    if (socket_pool == NULL) {
+        return -1;
+    }
     if (socket_pool->GetSocket(pooled_socket) != 0) {
         return -1;
     }
@@ -2466,6 +2668,54 @@ int Socket::ReturnToPool() {
     return 0;
 }
 
+int Socket::GetPipelinedSocket(SocketUniquePtr* pipelined_socket,
+                               const SocketPoolOptions& options) {
+    if (pipelined_socket == NULL) {
+        LOG(ERROR) << "pipelined_socket is NULL";
+        return -1;
+    }
+    SocketPool* socket_pool = GetOrNewSocketPool(&options);
+    if (socket_pool == NULL) {
+        return -1;
+    }
+    if (socket_pool->GetPipelinedSocket(pipelined_socket) != 0) {
+        return -1;
+    }
+    // Unlike sockets got from GetPooledSocket(), _shared_part is not reset
+    // when the RPC ends since the socket is shared by other RPCs, and is
+    // used for finding the pool in ReturnPipelinedSocket().
+    SharedPart* main_sp = GetSharedPart();
+    if ((*pipelined_socket)->GetSharedPart() != main_sp) {
+        (*pipelined_socket)->ShareStats(this);
+    }
+    return 0;
+}
+
+void Socket::ReturnPipelinedSocket() {
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL) {
+        LOG(ERROR) << "_shared_part is NULL";
+        return;
+    }
+    SocketPool* pool = sp->socket_pool.load(butil::memory_order_consume);
+    if (pool == NULL) {
+        LOG(ERROR) << "_shared_part->socket_pool is NULL";
+        return;
+    }
+    pool->ReturnPipelinedSocket(this);
+}
+
+void Socket::ReleaseIdlePooledSockets(int default_idle_seconds) {
+    SharedPart* sp = GetSharedPart();
+    if (sp == NULL) {
+        return;
+    }
+    SocketPool* pool = sp->socket_pool.load(butil::memory_order_consume);
+    if (pool != NULL) {
+        pool->ReleaseIdleSockets(default_idle_seconds);
+    }
+}
+
 bool Socket::HasSocketPool() const {
     SharedPart* sp = GetSharedPart();
     if (sp != NULL) {
@@ -51,7 +51,9 @@ class ChannelBalancer;
 
 class Socket;
 class AuthContext;
+class AdaptiveMaxConcurrency;
 class EventDispatcher;
+class SocketPool;
 class Stream;
 
 // A special closure for processing the about-to-recycle socket. Socket does
@@ -161,6 +163,27 @@ struct PipelinedInfo {
     bthread_id_t id_wait;
 };
 
+// Options of the SocketPool of a main socket, fixed when the pool is created
+// by the first GetPooledSocket(). Channels with different options don't
+// share main sockets, check ChannelOptions for details.
+struct SocketPoolOptions {
+    SocketPoolOptions()
+        : idle_timeout_s(-1)
+        , max_idle_sockets(-1)
+        , max_pipelined_requests(1) {}
+
+    // Close pooled sockets without data transmission for so many seconds.
+    // Negative value means using -idle_timeout_second.
+    int idle_timeout_s;
+
+    // Keep at most so many unused sockets in the pool, others are closed.
+    // Negative value means using -max_connection_pool_size.
+    int max_idle_sockets;
+
+    // Max number of RPCs sharing a socket got from GetPipelinedSocket().
+    int max_pipelined_requests;
+};
+
 struct SocketSSLContext {
     SocketSSLContext();
     ~SocketSSLContext();
@@ -353,6 +376,19 @@ public:
 
     void FeedbackCircuitBreaker(int error_code, int64_t latency_us);
 
+    // [Client-side concurrency limiting]
+    // Call this method before sending a RPC to this server. The limiter is
+    // created from `amc' by the first call and shared by all channels
+    // connecting to this server with `max_concurrency_per_server'. Notice
+    // that this limiting is GLOBAL like the circuit breaker.
+    // Returns false when the server is overloaded. If rejected_cc is not
+    // NULL, it's set with the rejected concurrency.
+    // NOTE: OnClientResponded() must be called no matter what is returned.
+    bool OnClientRequested(const AdaptiveMaxConcurrency& amc, int* rejected_cc);
+    void OnClientResponded(int error_code, int64_t latency_us);
+    // Current max_concurrency to this server, 0 for unlimited.
+    int client_max_concurrency() const;
+
     bool Failed() const;
 
     bool DidReleaseAdditionalRereference() const
@@ -450,13 +486,33 @@ public:
     bool CreatedByConnect() const;
 
     // Get an UNUSED socket connecting to the same place as this socket
-    // from the SocketPool of this socket.
-    int GetPooledSocket(SocketUniquePtr* pooled_socket);
+    // from the SocketPool of this socket. `options' is only used when the
+    // pool is created, NULL means default options.
+    int GetPooledSocket(SocketUniquePtr* pooled_socket,
+                        const SocketPoolOptions* options = NULL);
 
     // Return this socket which MUST be got from GetPooledSocket to its
     // main_socket's pool.
     int ReturnToPool();
 
+    // Get a socket from the SocketPool of this socket which is shared by at
+    // most `options.max_pipelined_requests' RPCs at the same time. Responses
+    // are correlated with requests by their positions, namely the protocol
+    // must write requests with WriteOptions.pipelined_count and pop
+    // PipelinedInfo when receiving responses. Sockets with the fewest RPCs
+    // are preferred and a new socket is created only if all sockets are full.
+    int GetPipelinedSocket(SocketUniquePtr* pipelined_socket,
+                           const SocketPoolOptions& options);
+
+    // Called when a RPC using this socket got from GetPipelinedSocket() ends.
+    // Unlike ReturnToPool(), the socket may still be used by other RPCs.
+    void ReturnPipelinedSocket();
+
+    // Close pooled sockets of this (main) socket without data transmission
+    // for the idle timeout of the pool, or `default_idle_seconds' if the
+    // pool does not specify one. Sockets being used are not checked.
+    void ReleaseIdlePooledSockets(int default_idle_seconds);
+
     // True if this socket has SocketPool
     bool HasSocketPool() const;
 
@@ -646,6 +702,7 @@ friend void DereferenceSocket(Socket*);
 
     SharedPart* GetSharedPart() const;
     SharedPart* GetOrNewSharedPart();
+    SocketPool* GetOrNewSocketPool(const SocketPoolOptions* options);
     SharedPart* GetOrNewSharedPartSlower();
 
     void CheckEOFInternal();
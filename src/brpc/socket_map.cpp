@@ -352,7 +352,6 @@ void* SocketMap::RunWatchConnections(void* arg) {
 
 void SocketMap::WatchConnections() {
     std::vector<SocketId> main_sockets;
-    std::vector<SocketId> pooled_sockets;
     std::vector<SocketMapKey> orphan_sockets;
     const uint64_t CHECK_INTERVAL_US = 1000000UL;
     while (bthread_usleep(CHECK_INTERVAL_US) == 0) {
@@ -360,20 +359,13 @@ void SocketMap::WatchConnections() {
         const int idle_seconds = _options.idle_timeout_second_dynamic ?
             *_options.idle_timeout_second_dynamic
             : _options.idle_timeout_second;
-        if (idle_seconds > 0) {
-            // Check idle pooled connections
-            List(&main_sockets);
-            for (size_t i = 0; i < main_sockets.size(); ++i) {
-                SocketUniquePtr s;
-                if (Socket::Address(main_sockets[i], &s) == 0) {
-                    s->ListPooledSockets(&pooled_sockets);
-                    for (size_t i = 0; i < pooled_sockets.size(); ++i) {
-                        SocketUniquePtr s2;
-                        if (Socket::Address(pooled_sockets[i], &s2) == 0) {
-                            s2->ReleaseReferenceIfIdle(idle_seconds);
-                        }
-                    }
-                }
+        // Check idle pooled connections. Pools may have their own idle
+        // timeouts even if `idle_seconds' is non-positive.
+        List(&main_sockets);
+        for (size_t i = 0; i < main_sockets.size(); ++i) {
+            SocketUniquePtr s;
+            if (Socket::Address(main_sockets[i], &s) == 0) {
+                s->ReleaseIdlePooledSockets(idle_seconds);
             }
         }
 
@@ -16,10 +16,7 @@
 // under the License.
 
 
-#include <netinet/in.h>
 #include <gflags/gflags.h>
-#include <leveldb/db.h>
-#include <leveldb/comparator.h>
 #include "bthread/bthread.h"
 #include "butil/scoped_lock.h"
 #include "butil/thread_local.h"
@@ -32,6 +29,7 @@
 #include "brpc/shared_object.h"
 #include "brpc/reloadable_flags.h"
 #include "brpc/span.h"
+#include "brpc/details/span_store.h"
 
 #define BRPC_SPAN_INFO_SEP "\1"
 
@@ -303,51 +301,15 @@ void AnnotateSpan(const char* fmt, ...) {
     va_end(ap);
 }
 
-class SpanDB : public SharedObject {
-public:
-    leveldb::DB* id_db;
-    leveldb::DB* time_db;
-    std::string id_db_name;
-    std::string time_db_name;
-
-    SpanDB() : id_db(NULL), time_db(NULL) { }
-    static SpanDB* Open();
-    leveldb::Status Index(const Span* span, std::string* value_buf);
-    leveldb::Status RemoveSpansBefore(int64_t tm);
-
-private:
-    static void Swap(SpanDB& db1, SpanDB& db2) {
-        std::swap(db1.id_db, db2.id_db);
-        std::swap(db1.id_db_name, db2.id_db_name);
-        std::swap(db1.time_db, db2.time_db);
-        std::swap(db1.time_db_name, db2.time_db_name);
-    }
-    
-    ~SpanDB() {
-        if (id_db == NULL && time_db == NULL) {
-            return;
-        }
-        delete id_db;
-        delete time_db;
-        if (!FLAGS_rpcz_keep_span_db) {
-            std::string cmd = butil::string_printf("rm -rf %s %s",
-                                                  id_db_name.c_str(),
-                                                  time_db_name.c_str());
-            butil::ignore_result(system(cmd.c_str()));
-        }
-    }
-};
-
 static bool started_span_indexing = false;
 static pthread_once_t start_span_indexing_once = PTHREAD_ONCE_INIT;
-static int64_t g_last_time_key = 0;
 static int64_t g_last_delete_tm = 0;
 
 // Following variables are monitored by builtin services, thus non-static.
 static pthread_mutex_t g_span_db_mutex = PTHREAD_MUTEX_INITIALIZER;
 static bool g_span_ending = false;  // don't open span again if this var is true.
 // Can't use intrusive_ptr which has ctor/dtor issues.
-static SpanDB* g_span_db = NULL;
+static SpanStore* g_span_db = NULL;
 bool has_span_db() { return !!g_span_db; }
 bvar::CollectorSpeedLimit g_span_sl = BVAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
 static bvar::DisplaySamplingRatio s_display_sampling_ratio(
@@ -361,8 +323,8 @@ struct SpanEarlier {
 class SpanPreprocessor : public bvar::CollectorPreprocessor {
 public:
     void process(std::vector<bvar::Collected*> & list) {
-        // Sort spans by their starting time so that the code on making
-        // time monotonic in Span::Index works better.
+        // Sort spans by their starting time so that start times in
+        // segments are mostly ascending and delta-encoded compactly.
         std::sort(list.begin(), list.end(), SpanEarlier()); 
     }
 };
@@ -376,8 +338,8 @@ bvar::CollectorPreprocessor* Span::preprocessor() {
     return g_span_prep;
 }
 
-static void ResetSpanDB(SpanDB* db) {
-    SpanDB* old_db = NULL;
+static void ResetSpanDB(SpanStore* db) {
+    SpanStore* old_db = NULL;
     {
         BAIDU_SCOPED_LOCK(g_span_db_mutex);
         old_db = g_span_db;
@@ -409,7 +371,7 @@ static int StartIndexingIfNeeded() {
     return started_span_indexing ? 0 : -1;
 }
 
-inline int GetSpanDB(butil::intrusive_ptr<SpanDB>* db) {
+inline int GetSpanDB(butil::intrusive_ptr<SpanStore>* db) {
     BAIDU_SCOPED_LOCK(g_span_db_mutex);
     if (g_span_db != NULL) {
         *db = g_span_db;
@@ -448,18 +410,7 @@ static void Span2Proto(const Span* span, RpczSpan* out) {
     out->set_error_code(span->error_code());
 }
 
-inline void ToBigEndian(uint64_t n, uint32_t* buf) {
-    buf[0] = htonl(n >> 32);
-    buf[1] = htonl(n & 0xFFFFFFFFUL);
-}
-
-inline uint64_t ToLittleEndian(const uint32_t* buf) {
-    return (((uint64_t)ntohl(buf[0])) << 32) | ntohl(buf[1]);
-}
-
-SpanDB* SpanDB::Open() {
-    SpanDB local;
-    leveldb::Status st;
+static SpanStore* OpenSpanStore() {
     char prefix[64];
     time_t rawtime;
     time(&rawtime);
@@ -469,184 +420,24 @@ SpanDB* SpanDB::Open() {
                                "/%Y%m%d.%H%M%S", timeinfo);
     const int nw2 = snprintf(prefix + nw, sizeof(prefix) - nw, ".%d",
                              getpid());
-    leveldb::Options options;
-    options.create_if_missing = true;
-    options.error_if_exists = true;
-
-    local.id_db_name.append(FLAGS_rpcz_database_dir);
-    local.id_db_name.append(prefix, nw + nw2);
-    // Create the dir first otherwise leveldb fails.
-    butil::File::Error error;
-    const butil::FilePath dir(local.id_db_name);
-    if (!butil::CreateDirectoryAndGetError(dir, &error)) {
-        LOG(ERROR) << "Fail to create directory=`" << dir.value() << ", "
-                   << error;
-        return NULL;
-    }
-
-    local.id_db_name.append("/id.db");
-    st = leveldb::DB::Open(options, local.id_db_name.c_str(), &local.id_db);
-    if (!st.ok()) {
-        LOG(ERROR) << "Fail to open id_db: " << st.ToString();
-        return NULL;
-    }
-
-    local.time_db_name.append(FLAGS_rpcz_database_dir);
-    local.time_db_name.append(prefix, nw + nw2);
-    local.time_db_name.append("/time.db");
-    st = leveldb::DB::Open(options, local.time_db_name.c_str(), &local.time_db);
-    if (!st.ok()) {
-        LOG(ERROR) << "Fail to open time_db: " << st.ToString();
-        return NULL;
-    }
-    SpanDB* db = new (std::nothrow) SpanDB;
-    if (NULL == db) {
-        return NULL;
-    }
-    LOG(INFO) << "Opened " << local.id_db_name << " and "
-               << local.time_db_name;
-    Swap(local, *db);
-    return db;
+    std::string dir = FLAGS_rpcz_database_dir;
+    dir.append(prefix, nw + nw2);
+    return SpanStore::Open(dir, FLAGS_rpcz_keep_span_db);
 }
 
-leveldb::Status SpanDB::Index(const Span* span, std::string* value_buf) {
-    leveldb::WriteOptions options;
-    options.sync = false;
-
-    leveldb::Status st;
-    
-    // NOTE: Writing into time_db before id_db so that if the second write
-    // fails, the entry in time_db will be finally removed when it's out
-    // of time window.
-
-    const int64_t start_time = span->GetStartRealTimeUs();
-    BriefSpan brief;
-    brief.set_trace_id(span->trace_id());
-    brief.set_span_id(span->span_id());
-    brief.set_log_id(span->log_id());
-    brief.set_type(span->type());
-    brief.set_error_code(span->error_code());
-    brief.set_request_size(span->request_size());
-    brief.set_response_size(span->response_size());
-    brief.set_start_real_us(start_time);
-    brief.set_latency_us(span->GetEndRealTimeUs() - start_time);
-    brief.set_full_method_name(span->full_method_name());
-    if (!brief.SerializeToString(value_buf)) {
-        return leveldb::Status::InvalidArgument(
-            leveldb::Slice("Fail to serialize BriefSpan"));
-    }
-    // We need to make the time monotonic otherwise if older entries are
-    // overwritten by newer ones, entries in id_db associated with the older
-    // entries are not evicted. Surely we can call DB::Get() before Put(), but
-    // that would be too slow due to the storage model of leveldb. One feasible
-    // method is to maintain recent window of keys to time_db, when there's a
-    // conflict before Put(), try key+1us until an unused time is found. The
-    // window could be 5~10s. However this method needs a std::map(slow) or
-    // hashmap+queue(more memory: remember that we're just a framework), and
-    // this method can't guarantee no duplication when real time goes back
-    // significantly.
-    // Since the time to this method is ALMOST in ascending order, we use a
-    // very simple strategy: if the time is not greater than last-time, set
-    // it to be last-time + 1us. This works when time goes back because the
-    // real time is at least 1000000 / FLAGS_rpcz_max_span_per_second times faster
-    // and it will finally catch up with our time key. (provided the flag
-    // is less than 1000000).
-    int64_t time_key = start_time;
-    if (time_key <= g_last_time_key) {
-        time_key = g_last_time_key + 1;
-    }
-    g_last_time_key = time_key;
-    uint32_t time_data[2];
-    ToBigEndian(time_key, time_data);
-    st = time_db->Put(options,
-                      leveldb::Slice((char*)time_data, sizeof(time_data)),
-                      leveldb::Slice(value_buf->data(), value_buf->size()));
-    if (!st.ok()) {
-        return st;
-    }
-    
-    uint32_t key_data[4];
-    ToBigEndian(span->trace_id(), key_data);
-    ToBigEndian(span->span_id(), key_data + 2);
-    leveldb::Slice key((char*)key_data, sizeof(key_data));
-    RpczSpan value_proto;
-    Span2Proto(span, &value_proto);
-    // client spans should be reversed.
-    size_t client_span_count = span->CountClientSpans();
-    for (size_t i = 0; i < client_span_count; ++i) {
-        value_proto.add_client_spans();
-    }
-    size_t i = 0;
-    for (const Span* p = span->_next_client; p; p = p->_next_client, ++i) {
-        Span2Proto(p, value_proto.mutable_client_spans(client_span_count - i - 1));
-    }
-    if (!value_proto.SerializeToString(value_buf)) {
-        return leveldb::Status::InvalidArgument(
-            leveldb::Slice("Fail to serialize RpczSpan"));
-    }
-    leveldb::Slice value(value_buf->data(), value_buf->size());
-    st = id_db->Put(options, key, value);
-    return st;
-}
-
-// NOTE: may take more than 100ms
-leveldb::Status SpanDB::RemoveSpansBefore(int64_t tm) {
-    if (id_db == NULL || time_db == NULL) {
-        return leveldb::Status::InvalidArgument(leveldb::Slice("NULL param"));
-    }
-    leveldb::Status rc;
-    leveldb::WriteOptions options;
-    options.sync = false;
-    leveldb::Iterator* it = time_db->NewIterator(leveldb::ReadOptions());
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        if (it->key().size() != 8) {
-            LOG(ERROR) << "Invalid key size: " << it->key().size();
-            continue;
-        }
-        const int64_t realtime = 
-            ToLittleEndian((const uint32_t*)it->key().data());
-        if (realtime >= tm) {  // removal is done.
-            break;
-        }
-        BriefSpan brief;
-        if (brief.ParseFromArray(it->value().data(), it->value().size())) {
-            uint32_t key_data[4];
-            ToBigEndian(brief.trace_id(), key_data);
-            ToBigEndian(brief.span_id(), key_data + 2);
-            leveldb::Slice key((char*)key_data, sizeof(key_data));
-            rc = id_db->Delete(options, key);
-            if (!rc.ok()) {
-                LOG(ERROR) << "Fail to delete from id_db";
-                break;
-            }
-        } else {
-            LOG(ERROR) << "Fail to parse from value";
-        }
-        rc = time_db->Delete(options, it->key());
-        if (!rc.ok()) {
-            LOG(ERROR) << "Fail to delete from time_db";
-            break;
-        }
-    }
-    delete it;
-    return rc;
-}
-
-// Write span into leveldb.
+// Write span into the span store.
 void Span::dump_and_destroy(size_t /*round*/) {
     StartIndexingIfNeeded();
-    
-    std::string value_buf;
 
-    butil::intrusive_ptr<SpanDB> db;
+    butil::intrusive_ptr<SpanStore> db;
     if (GetSpanDB(&db) != 0) {
         if (g_span_ending) {
             destroy();
             return;
         }
-        SpanDB* db2 = SpanDB::Open();
+        SpanStore* db2 = OpenSpanStore();
         if (db2 == NULL) {
-            LOG(WARNING) << "Fail to open SpanDB";
+            LOG(WARNING) << "Fail to open SpanStore";
             destroy();
             return;
         }
@@ -654,148 +445,76 @@ void Span::dump_and_destroy(size_t /*round*/) {
         db.reset(db2);
     }
 
-    leveldb::Status st = db->Index(this, &value_buf);
+    const int64_t start_time = GetStartRealTimeUs();
+    BriefSpan brief;
+    brief.set_trace_id(trace_id());
+    brief.set_span_id(span_id());
+    brief.set_log_id(log_id());
+    brief.set_type(type());
+    brief.set_error_code(error_code());
+    brief.set_request_size(request_size());
+    brief.set_response_size(response_size());
+    brief.set_start_real_us(start_time);
+    brief.set_latency_us(GetEndRealTimeUs() - start_time);
+    brief.set_full_method_name(full_method_name());
+
+    RpczSpan value_proto;
+    Span2Proto(this, &value_proto);
+    // client spans should be reversed.
+    size_t client_span_count = CountClientSpans();
+    for (size_t i = 0; i < client_span_count; ++i) {
+        value_proto.add_client_spans();
+    }
+    size_t i = 0;
+    for (const Span* p = _next_client; p; p = p->_next_client, ++i) {
+        Span2Proto(p, value_proto.mutable_client_spans(client_span_count - i - 1));
+    }
     destroy();
-    if (!st.ok()) {
-        LOG(WARNING) << st.ToString();
-        if (st.IsNotFound() || st.IsIOError() || st.IsCorruption()) {
-            ResetSpanDB(NULL);
-            return;
-        }
+    if (db->Append(brief, value_proto) != 0) {
+        LOG(WARNING) << "Fail to store spans into " << db->dir();
     }
 
     // Remove old spans
     const int64_t now = butil::gettimeofday_us();
     if (now > g_last_delete_tm + SPAN_DELETE_INTERVAL_US) {
         g_last_delete_tm = now;
-        leveldb::Status st = db->RemoveSpansBefore(
-            now - FLAGS_rpcz_keep_span_seconds * 1000000L);
-        if (!st.ok()) {
-            LOG(ERROR) << st.ToString();
-            if (st.IsNotFound() || st.IsIOError() || st.IsCorruption()) {
-                ResetSpanDB(NULL);
-                return;
-            }
-        }
+        db->RemoveSpansBefore(now - FLAGS_rpcz_keep_span_seconds * 1000000L);
     }
 }
 
 int FindSpan(uint64_t trace_id, uint64_t span_id, RpczSpan* response) {
-    butil::intrusive_ptr<SpanDB> db;
+    butil::intrusive_ptr<SpanStore> db;
     if (GetSpanDB(&db) != 0) {
         return -1;
     }
-    uint32_t key_data[4];
-    ToBigEndian(trace_id, key_data);
-    ToBigEndian(span_id, key_data + 2);
-    leveldb::Slice key((char*)key_data, sizeof(key_data));
-    std::string value;
-    leveldb::Status st = db->id_db->Get(leveldb::ReadOptions(), key, &value);
-    if (!st.ok()) {
-        return -1;
-    }
-    if (!response->ParseFromString(value)) {
-        LOG(ERROR) << "Fail to parse from the value";
-        return -1;
-    }
-    return 0;
+    return db->FindSpan(trace_id, span_id, response);
 }
 
 void FindSpans(uint64_t trace_id, std::deque<RpczSpan>* out) {
     out->clear();
-    butil::intrusive_ptr<SpanDB> db;
+    butil::intrusive_ptr<SpanStore> db;
     if (GetSpanDB(&db) != 0) {
         return;
     }
-    leveldb::Iterator* it = db->id_db->NewIterator(leveldb::ReadOptions());
-    uint32_t key_data[4];
-    ToBigEndian(trace_id, key_data);
-    ToBigEndian(0, key_data + 2);
-    leveldb::Slice key((char*)key_data, sizeof(key_data));
-    for (it->Seek(key); it->Valid(); it->Next()) {
-        if (it->key().size() != sizeof(key_data)) {
-            LOG(ERROR) << "Invalid key size: " << it->key().size();
-            break;
-        }
-        const uint64_t stored_trace_id =
-            ToLittleEndian((const uint32_t*)it->key().data());
-        if (trace_id != stored_trace_id) {
-            break;
-        }
-        RpczSpan span;
-        if (span.ParseFromArray(it->value().data(), it->value().size())) {
-            out->push_back(span);
-        } else {
-            LOG(ERROR) << "Fail to parse from value";
-        }
-    }
-    delete it;
+    db->FindSpans(trace_id, out);
 }
 
 void ListSpans(int64_t starting_realtime, size_t max_scan,
                std::deque<BriefSpan>* out, SpanFilter* filter) {
     out->clear();
-    butil::intrusive_ptr<SpanDB> db;
+    butil::intrusive_ptr<SpanStore> db;
     if (GetSpanDB(&db) != 0) {
         return;
     }
-    leveldb::Iterator* it = db->time_db->NewIterator(leveldb::ReadOptions());
-    uint32_t time_data[2];
-    ToBigEndian(starting_realtime, time_data);
-    leveldb::Slice key((char*)time_data, sizeof(time_data));
-    it->Seek(key);
-    if (!it->Valid()) {
-        it->SeekToLast();
-    }
-    BriefSpan brief;
-    size_t nscan = 0;
-    for (size_t i = 0; nscan < max_scan && it->Valid(); ++i, it->Prev()) {
-        const int64_t key_tm = ToLittleEndian((const uint32_t*)it->key().data());
-        // May have some bigger time at the beginning, because leveldb returns
-        // keys >= starting_realtime.
-        if (key_tm > starting_realtime) {
-            continue;
-        }
-        brief.Clear();
-        if (brief.ParseFromArray(it->value().data(), it->value().size())) {
-            if (NULL == filter || filter->Keep(brief)) {
-                out->push_back(brief);
-            }
-            // We increase the count no matter filter passed or not to avoid
-            // scaning too many entries.
-            ++nscan;
-        } else {
-            LOG(ERROR) << "Fail to parse from value";
-        }
-    }
-    delete it;
+    db->ListSpans(starting_realtime, max_scan, out, filter);
 }
 
 void DescribeSpanDB(std::ostream& os) {
-    butil::intrusive_ptr<SpanDB> db;
+    butil::intrusive_ptr<SpanStore> db;
     if (GetSpanDB(&db) != 0) {
         return;
     }
-    
-    if (db->id_db != NULL) {
-        std::string val;
-        if (db->id_db->GetProperty(leveldb::Slice("leveldb.stats"), &val)) {
-            os << "[ " << db->id_db_name << " ]\n" << val;
-        }
-        if (db->id_db->GetProperty(leveldb::Slice("leveldb.sstables"), &val)) {
-            os << '\n' << val;
-        }
-    }
-    os << '\n';
-    if (db->time_db != NULL) {
-        std::string val;
-        if (db->time_db->GetProperty(leveldb::Slice("leveldb.stats"), &val)) {
-            os << "[ " << db->time_db_name << " ]\n" << val;
-        }
-        if (db->time_db->GetProperty(leveldb::Slice("leveldb.sstables"), &val)) {
-            os << '\n' << val;
-        }
-    }
+    db->Describe(os);
 }
 
 } // namespace brpc
@@ -23,6 +23,8 @@
 #include <execinfo.h>
 #include <dlfcn.h>                               // dlsym
 #include <fcntl.h>                               // O_RDONLY
+#include <algorithm>                             // std::sort
+#include <gflags/gflags.h>
 #include "butil/atomicops.h"
 #include "bvar/bvar.h"
 #include "bvar/collector.h"
@@ -37,6 +39,7 @@
 #include "butil/third_party/murmurhash3/murmurhash3.h"
 #include "butil/logging.h"
 #include "butil/object_pool.h"
+#include "butil/third_party/symbolize/symbolize.h" // google::Symbolize
 #include "bthread/butex.h"                       // butex_*
 #include "bthread/processor.h"                   // cpu_relax, barrier
 #include "bthread/mutex.h"                       // bthread_mutex_t
@@ -48,6 +51,25 @@ extern void* _dl_sym(void* handle, const char* symbol, void* caller);
 }
 
 namespace bthread {
+
+static bool validate_contention_stats(const char*, bool);
+DEFINE_bool(bthread_contention_stats, false, "Sample contended locks and "
+            "aggregate them by call site continuously, the result is viewable "
+            "as folded stacks in /hotspots/contention_stats");
+const bool ALLOW_UNUSED dummy_bthread_contention_stats =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bthread_contention_stats,
+                                       validate_contention_stats);
+
+static bool validate_contention_stats_max_sites(const char*, int32_t val) {
+    return val > 0;
+}
+DEFINE_int32(bthread_contention_stats_max_sites, 4096, "Max number of call "
+             "sites kept by -bthread_contention_stats, contentions at more "
+             "sites are dropped");
+const bool ALLOW_UNUSED dummy_bthread_contention_stats_max_sites =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bthread_contention_stats_max_sites,
+                                       validate_contention_stats_max_sites);
+
 // Warm up backtrace before main().
 void* dummy_buf[4];
 const int ALLOW_UNUSED dummy_bt = backtrace(dummy_buf, arraysize(dummy_buf));
@@ -251,6 +273,199 @@ void ContentionProfiler::flush_to_disk(bool ending) {
     } while (!_disk_buf.empty() && ending);
 }
 
+// Aggregate sampled contentions by call site for as long as
+// -bthread_contention_stats is on. Different from ContentionProfiler which
+// saves samples of one profiling session into a file for pprof, the stats
+// stay in memory and are printed as folded stacks on demand.
+class ContentionStats {
+public:
+    ContentionStats();
+    ~ContentionStats();
+
+    // Merge `c' into the site with the same stack. `c' is not owned.
+    void add(const SampledContention* c);
+
+    // Destroy all sites.
+    void reset();
+
+    // Print one line for each site: symbolized frames from the outermost
+    // to the innermost separated by ';', a space and total waiting time in
+    // nanoseconds (or count of contentions if `show_count' is true).
+    void print_folded(std::ostream& os, bool show_count);
+
+    size_t site_count();
+    int64_t dropped_count();
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ContentionStats);
+    void reset_locked();
+
+    pthread_mutex_t _mutex;
+    ContentionProfiler::ContentionMap _map;
+    int64_t _ndropped;
+};
+
+ContentionStats::ContentionStats() : _ndropped(0) {
+    pthread_mutex_init(&_mutex, NULL);
+}
+
+ContentionStats::~ContentionStats() {
+    reset_locked();
+    pthread_mutex_destroy(&_mutex);
+}
+
+void ContentionStats::add(const SampledContention* c) {
+    BAIDU_SCOPED_LOCK(_mutex);
+    if (!_map.initialized()) {
+        CHECK_EQ(0, _map.init(1024, 60));
+    }
+    SampledContention** p_c2 = _map.seek(const_cast<SampledContention*>(c));
+    if (p_c2) {
+        (*p_c2)->duration_ns += c->duration_ns;
+        (*p_c2)->count += c->count;
+        return;
+    }
+    if (_map.size() >= (size_t)FLAGS_bthread_contention_stats_max_sites) {
+        ++_ndropped;
+        return;
+    }
+    SampledContention* c2 = butil::get_object<SampledContention>();
+    if (c2 == NULL) {
+        ++_ndropped;
+        return;
+    }
+    c2->duration_ns = c->duration_ns;
+    c2->count = c->count;
+    c2->nframes = c->nframes;
+    memcpy(c2->stack, c->stack, sizeof(void*) * c->nframes);
+    _map.insert(c2, c2);
+}
+
+void ContentionStats::reset() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    reset_locked();
+}
+
+void ContentionStats::reset_locked() {
+    for (ContentionProfiler::ContentionMap::const_iterator
+             it = _map.begin(); it != _map.end(); ++it) {
+        it->second->destroy();
+    }
+    _map.clear();
+    _ndropped = 0;
+}
+
+size_t ContentionStats::site_count() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _map.size();
+}
+
+int64_t ContentionStats::dropped_count() {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _ndropped;
+}
+
+// Copy of a site in ContentionStats.
+struct ContentionSite {
+    int64_t duration_ns;
+    double count;
+    int nframes;
+    void* stack[26];      // same as SampledContention::stack
+};
+
+struct FoldedContention {
+    std::string stack;
+    int64_t value;
+    bool operator<(const FoldedContention& rhs) const {
+        return stack < rhs.stack;
+    }
+};
+
+static void append_symbol(std::string* out, void* pc,
+                          butil::FlatMap<void*, std::string>* cache) {
+    std::string* sym = cache->seek(pc);
+    if (sym == NULL) {
+        sym = &(*cache)[pc];
+        char buf[1024];
+        // pc is a return address, which points to the instruction after
+        // the call, subtract one to get the right function when the call is
+        // the last instruction of the function (noreturn).
+        if (google::Symbolize((char*)pc - 1, buf, sizeof(buf))) {
+            sym->assign(buf);
+            // ';' separates frames and ' ' separates the value.
+            std::replace(sym->begin(), sym->end(), ';', ',');
+            std::replace(sym->begin(), sym->end(), ' ', '_');
+        } else {
+            snprintf(buf, sizeof(buf), "%p", pc);
+            sym->assign(buf);
+        }
+    }
+    out->append(*sym);
+}
+
+void ContentionStats::print_folded(std::ostream& os, bool show_count) {
+    // Copy out the sites to symbolize them without holding the lock.
+    std::vector<ContentionSite> sites;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        sites.resize(_map.size());
+        size_t i = 0;
+        for (ContentionProfiler::ContentionMap::const_iterator
+                 it = _map.begin(); it != _map.end(); ++it, ++i) {
+            const SampledContention* c = it->second;
+            sites[i].duration_ns = c->duration_ns;
+            sites[i].count = c->count;
+            sites[i].nframes = c->nframes;
+            memcpy(sites[i].stack, c->stack, sizeof(void*) * c->nframes);
+        }
+    }
+    butil::FlatMap<void*, std::string> symbols;
+    CHECK_EQ(0, symbols.init(std::max(sites.size() * 4, (size_t)64)));
+    std::vector<FoldedContention> folded(sites.size());
+    for (size_t i = 0; i < sites.size(); ++i) {
+        const ContentionSite& c = sites[i];
+        std::string& stack = folded[i].stack;
+        for (int j = c.nframes - 1; j >= SKIPPED_STACK_FRAMES; --j) {
+            append_symbol(&stack, c.stack[j], &symbols);
+            if (j != SKIPPED_STACK_FRAMES) {
+                stack.push_back(';');
+            }
+        }
+        folded[i].value = (show_count ? (int64_t)ceil(c.count) : c.duration_ns);
+    }
+    // Sorted output is easier to diff.
+    std::sort(folded.begin(), folded.end());
+    for (size_t i = 0; i < folded.size(); ++i) {
+        if (folded[i].value > 0 && !folded[i].stack.empty()) {
+            os << folded[i].stack << ' ' << folded[i].value << '\n';
+        }
+    }
+}
+
+static ContentionStats* g_cs = NULL;
+static pthread_once_t g_cs_once = PTHREAD_ONCE_INIT;
+
+static int64_t get_contention_stats_site_count(void* arg) {
+    return static_cast<ContentionStats*>(arg)->site_count();
+}
+
+static int64_t get_contention_stats_dropped_count(void* arg) {
+    return static_cast<ContentionStats*>(arg)->dropped_count();
+}
+
+static void create_contention_stats() {
+    g_cs = new ContentionStats;
+    new bvar::PassiveStatus<int64_t>("contention_stats_site_count",
+                                     get_contention_stats_site_count, g_cs);
+    new bvar::PassiveStatus<int64_t>("contention_stats_dropped_count",
+                                     get_contention_stats_dropped_count, g_cs);
+}
+
+static ContentionStats* get_contention_stats() {
+    pthread_once(&g_cs_once, create_contention_stats);
+    return g_cs;
+}
+
 // If contention profiler is on, this variable will be set with a valid
 // instance. NULL otherwise.
 static ContentionProfiler* BAIDU_CACHELINE_ALIGNMENT g_cp = NULL;
@@ -280,6 +495,9 @@ struct BAIDU_CACHELINE_ALIGNMENT MutexMapEntry {
 static MutexMapEntry g_mutex_map[MUTEX_MAP_SIZE] = {}; // zero-initialize
 
 void SampledContention::dump_and_destroy(size_t /*round*/) {
+    if (FLAGS_bthread_contention_stats) {
+        get_contention_stats()->add(this);
+    }
     if (g_cp) {
         // Must be protected with mutex to avoid race with deletion of ctx.
         // dump_and_destroy is called from dumping thread only so this mutex
@@ -354,6 +572,37 @@ void ContentionProfilerStop() {
     LOG(ERROR) << "Contention profiler is not started!";
 }
 
+// Print aggregated contentions as folded stacks into `os'.
+// Returns 0 on success, -1 if -bthread_contention_stats is off.
+int ContentionStatsPrintFolded(std::ostream& os, bool show_count) {
+    if (!FLAGS_bthread_contention_stats) {
+        return -1;
+    }
+    get_contention_stats()->print_folded(os, show_count);
+    return 0;
+}
+
+// Forget all aggregated contentions.
+void ContentionStatsReset() {
+    if (g_cs) {
+        g_cs->reset();
+    }
+}
+
+static bool validate_contention_stats(const char*, bool) {
+    // Invalidate entries in g_mutex_map left by previous sampling, which is
+    // what ContentionProfilerStart does.
+    BAIDU_SCOPED_LOCK(g_cp_mutex);
+    ++g_cp_version;
+    return true;
+}
+
+// Contended locks are sampled when either the contention profiler or the
+// contention stats is on.
+BUTIL_FORCE_INLINE bool is_contention_sampled() {
+    return g_cp || FLAGS_bthread_contention_stats;
+}
+
 BUTIL_FORCE_INLINE bool
 is_contention_site_valid(const bthread_contention_site_t& cs) {
     return cs.sampling_range;
@@ -519,7 +768,7 @@ void submit_contention(const bthread_contention_site_t& csite, int64_t now_ns) {
 
 BUTIL_FORCE_INLINE int pthread_mutex_lock_impl(pthread_mutex_t* mutex) {
     // Don't change behavior of lock when profiler is off.
-    if (!g_cp ||
+    if (!is_contention_sampled() ||
         // collecting code including backtrace() and submit() may call
         // pthread_mutex_lock and cause deadlock. Don't sample.
         tls_inside_lock) {
@@ -571,7 +820,7 @@ BUTIL_FORCE_INLINE int pthread_mutex_lock_impl(pthread_mutex_t* mutex) {
 
 BUTIL_FORCE_INLINE int pthread_mutex_unlock_impl(pthread_mutex_t* mutex) {
     // Don't change behavior of unlock when profiler is off.
-    if (!g_cp || tls_inside_lock) {
+    if (!is_contention_sampled() || tls_inside_lock) {
         // This branch brings an issue that an entry created by
         // add_pthread_contention_site may not be cleared. Thus we add a 
         // 16-bit rolling version in the entry to find out such entry.
@@ -731,7 +980,7 @@ int bthread_mutex_lock(bthread_mutex_t* m) {
         return 0;
     }
     // Don't sample when contention profiler is off.
-    if (!bthread::g_cp) {
+    if (!bthread::is_contention_sampled()) {
         return bthread::mutex_lock_contended(m);
     }
     // Ask Collector if this (contended) locking should be sampled.
@@ -758,7 +1007,7 @@ int bthread_mutex_timedlock(bthread_mutex_t* __restrict m,
         return 0;
     }
     // Don't sample when contention profiler is off.
-    if (!bthread::g_cp) {
+    if (!bthread::is_contention_sampled()) {
         return bthread::mutex_timedlock_contended(m, abstime);
     }
     // Ask Collector if this (contended) locking should be sampled.
@@ -120,6 +120,18 @@ static int64_t get_cumulated_signal_count_from_this(void *arg) {
     return static_cast<TaskControl*>(arg)->get_cumulated_signal_count();
 }
 
+static int64_t get_cumulated_steal_count_from_this(void *arg) {
+    return static_cast<TaskControl*>(arg)->get_cumulated_steal_count();
+}
+
+static int64_t get_cumulated_steal_failure_count_from_this(void *arg) {
+    return static_cast<TaskControl*>(arg)->get_cumulated_steal_failure_count();
+}
+
+static void print_rq_depth_hists_in_the_tc(std::ostream &os, void *arg) {
+    static_cast<TaskControl*>(arg)->print_rq_depth_hists(os);
+}
+
 TaskControl::TaskControl()
     // NOTE: all fileds must be initialized before the vars.
     : _ngroup(0)
@@ -136,6 +148,13 @@ TaskControl::TaskControl()
     , _switch_per_second(&_cumulated_switch_count)
     , _cumulated_signal_count(get_cumulated_signal_count_from_this, this)
     , _signal_per_second(&_cumulated_signal_count)
+    , _cumulated_steal_count(get_cumulated_steal_count_from_this, this)
+    , _steal_per_second(&_cumulated_steal_count)
+    , _cumulated_steal_failure_count(
+        get_cumulated_steal_failure_count_from_this, this)
+    , _steal_failure_per_second(&_cumulated_steal_failure_count)
+    , _sched_latency(NULL)
+    , _rq_depth_status(print_rq_depth_hists_in_the_tc, this)
     , _status(print_rq_sizes_in_the_tc, this)
     , _nbthreads("bthread_count")
 {
@@ -171,6 +190,8 @@ int TaskControl::init(int concurrency) {
     _worker_usage_second.expose("bthread_worker_usage");
     _switch_per_second.expose("bthread_switch_second");
     _signal_per_second.expose("bthread_signal_second");
+    _steal_per_second.expose("bthread_steal_second");
+    _steal_failure_per_second.expose("bthread_steal_failure_second");
     _status.expose("bthread_group_status");
 
     // Wait for at least one group is added so that choose_one_group()
@@ -249,9 +270,13 @@ TaskControl::~TaskControl() {
     // NOTE: g_task_control is not destructed now because the situation
     //       is extremely racy.
     delete _pending_time.exchange(NULL, butil::memory_order_relaxed);
+    delete _sched_latency.exchange(NULL, butil::memory_order_relaxed);
     _worker_usage_second.hide();
     _switch_per_second.hide();
     _signal_per_second.hide();
+    _steal_per_second.hide();
+    _steal_failure_per_second.hide();
+    _rq_depth_status.hide();
     _status.hide();
     
     stop_and_join();
@@ -446,6 +471,87 @@ int64_t TaskControl::get_cumulated_signal_count() {
     return c;
 }
 
+int64_t TaskControl::get_cumulated_steal_count() {
+    int64_t c = 0;
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    const size_t ngroup = _ngroup.load(butil::memory_order_relaxed);
+    for (size_t i = 0; i < ngroup; ++i) {
+        if (_groups[i]) {
+            c += _groups[i]->_nsteal;
+        }
+    }
+    return c;
+}
+
+int64_t TaskControl::get_cumulated_steal_failure_count() {
+    int64_t c = 0;
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    const size_t ngroup = _ngroup.load(butil::memory_order_relaxed);
+    for (size_t i = 0; i < ngroup; ++i) {
+        if (_groups[i]) {
+            c += _groups[i]->_nsteal_failure;
+        }
+    }
+    return c;
+}
+
+void TaskControl::print_rq_depth_hists(std::ostream& os) {
+    const int N = TaskGroup::RQ_DEPTH_BUCKETS;
+    std::vector<int64_t> hists;
+    {
+        BAIDU_SCOPED_LOCK(_modify_group_mutex);
+        const size_t ngroup = _ngroup.load(butil::memory_order_relaxed);
+        hists.resize(ngroup * N);
+        for (size_t i = 0; i < ngroup; ++i) {
+            const TaskGroup* g = _groups[i];
+            if (g) {
+                for (int j = 0; j < N; ++j) {
+                    hists[i * N + j] = g->_rq_depth_hist[j] +
+                        g->_remote_rq_depth_hist[j];
+                }
+            }
+        }
+    }
+    // One line per group: "<lower bound of depth>:<count>" of non-empty
+    // buckets, "0:12 1:3 2:1 4:1" means 12 samples saw an empty runqueue,
+    // 3 saw one task, 1 saw 2~3 tasks and 1 saw 4~7 tasks.
+    for (size_t i = 0; i < hists.size() / N; ++i) {
+        if (i) {
+            os << '\n';
+        }
+        bool empty = true;
+        for (int j = 0; j < N; ++j) {
+            if (hists[i * N + j]) {
+                if (!empty) {
+                    os << ' ';
+                }
+                empty = false;
+                os << (j ? (1L << (j - 1)) : 0L) << ':' << hists[i * N + j];
+            }
+        }
+        if (empty) {
+            os << '-';
+        }
+    }
+}
+
+bvar::LatencyRecorder* TaskControl::create_exposed_sched_latency() {
+    bool is_creator = false;
+    _pending_time_mutex.lock();
+    bvar::LatencyRecorder* sl = _sched_latency.load(butil::memory_order_consume);
+    if (!sl) {
+        sl = new bvar::LatencyRecorder;
+        _sched_latency.store(sl, butil::memory_order_release);
+        is_creator = true;
+    }
+    _pending_time_mutex.unlock();
+    if (is_creator) {
+        sl->expose("bthread_sched");
+        _rq_depth_status.expose("bthread_group_rq_depth");
+    }
+    return sl;
+}
+
 bvar::LatencyRecorder* TaskControl::create_exposed_pending_time() {
     bool is_creator = false;
     _pending_time_mutex.lock();
@@ -65,10 +65,13 @@ public:
     { return _concurrency.load(butil::memory_order_acquire); }
 
     void print_rq_sizes(std::ostream& os);
+    void print_rq_depth_hists(std::ostream& os);
 
     double get_cumulated_worker_time();
     int64_t get_cumulated_switch_count();
     int64_t get_cumulated_signal_count();
+    int64_t get_cumulated_steal_count();
+    int64_t get_cumulated_steal_failure_count();
 
     // [Not thread safe] Add more worker threads.
     // Return the number of workers actually added, which may be less than |num|
@@ -90,6 +93,8 @@ private:
 
     bvar::LatencyRecorder& exposed_pending_time();
     bvar::LatencyRecorder* create_exposed_pending_time();
+    bvar::LatencyRecorder& exposed_sched_latency();
+    bvar::LatencyRecorder* create_exposed_sched_latency();
 
     butil::atomic<size_t> _ngroup;
     TaskGroup** _groups;
@@ -108,6 +113,12 @@ private:
     bvar::PerSecond<bvar::PassiveStatus<int64_t> > _switch_per_second;
     bvar::PassiveStatus<int64_t> _cumulated_signal_count;
     bvar::PerSecond<bvar::PassiveStatus<int64_t> > _signal_per_second;
+    bvar::PassiveStatus<int64_t> _cumulated_steal_count;
+    bvar::PerSecond<bvar::PassiveStatus<int64_t> > _steal_per_second;
+    bvar::PassiveStatus<int64_t> _cumulated_steal_failure_count;
+    bvar::PerSecond<bvar::PassiveStatus<int64_t> > _steal_failure_per_second;
+    butil::atomic<bvar::LatencyRecorder*> _sched_latency;
+    bvar::PassiveStatus<std::string> _rq_depth_status;
     bvar::PassiveStatus<std::string> _status;
     bvar::Adder<int64_t> _nbthreads;
 
@@ -123,6 +134,14 @@ inline bvar::LatencyRecorder& TaskControl::exposed_pending_time() {
     return *pt;
 }
 
+inline bvar::LatencyRecorder& TaskControl::exposed_sched_latency() {
+    bvar::LatencyRecorder* sl = _sched_latency.load(butil::memory_order_consume);
+    if (!sl) {
+        sl = create_exposed_sched_latency();
+    }
+    return *sl;
+}
+
 }  // namespace bthread
 
 #endif  // BTHREAD_TASK_CONTROL_H
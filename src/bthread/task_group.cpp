@@ -51,6 +51,19 @@ const bool ALLOW_UNUSED dummy_show_bthread_creation_in_vars =
     ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_show_bthread_creation_in_vars,
                                     pass_bool);
 
+static bool validate_bthread_sched_latency_sample_rate(const char*, int32_t val) {
+    return val >= 0;
+}
+
+DEFINE_int32(bthread_sched_latency_sample_rate, 0, "One in so many bthreads "
+             "pushed into runqueues is sampled: the time from being ready to "
+             "running is recorded in /vars/bthread_sched_latency and the depth "
+             "of the runqueue is counted in /vars/bthread_group_rq_depth. "
+             "0 disables sampling");
+const bool ALLOW_UNUSED dummy_bthread_sched_latency_sample_rate =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bthread_sched_latency_sample_rate,
+                                    validate_bthread_sched_latency_sample_rate);
+
 DEFINE_bool(show_per_worker_usage_in_vars, false,
             "Show per-worker usage in /vars/bthread_per_worker_usage_<tid>");
 const bool ALLOW_UNUSED dummy_show_per_worker_usage_in_vars =
@@ -185,6 +198,9 @@ TaskGroup::TaskGroup(TaskControl* c)
     , _last_run_ns(butil::cpuwide_time_ns())
     , _cumulated_cputime_ns(0)
     , _nswitch(0)
+    , _nsteal(0)
+    , _nsteal_failure(0)
+    , _nready_unsampled(0)
     , _last_context_remained(NULL)
     , _last_context_remained_arg(NULL)
     , _pl(NULL)
@@ -192,7 +208,10 @@ TaskGroup::TaskGroup(TaskControl* c)
     , _main_tid(0)
     , _remote_num_nosignal(0)
     , _remote_nsignaled(0)
+    , _remote_nready_unsampled(0)
 {
+    memset(_rq_depth_hist, 0, sizeof(_rq_depth_hist));
+    memset(_remote_rq_depth_hist, 0, sizeof(_remote_rq_depth_hist));
     _steal_seed = butil::fast_rand();
     _steal_offset = OFFSET_TABLE[_steal_seed % ARRAY_SIZE(OFFSET_TABLE)];
     _pl = &c->_pl[butil::fmix64(pthread_numeric_id()) % TaskControl::PARKING_LOT_NUM];
@@ -237,6 +256,7 @@ int TaskGroup::init(size_t runqueue_capacity) {
     m->local_storage = LOCAL_STORAGE_INIT;
     m->cpuwide_start_ns = butil::cpuwide_time_ns();
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->attr = BTHREAD_ATTR_TASKGROUP;
     m->tid = make_tid(*m->version_butex, slot);
     m->set_stack(stk);
@@ -381,6 +401,7 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     m->local_storage = LOCAL_STORAGE_INIT;
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->tid = make_tid(*m->version_butex, slot);
     *th = m->tid;
     if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
@@ -436,6 +457,7 @@ int TaskGroup::start_background(bthread_t* __restrict th,
     m->local_storage = LOCAL_STORAGE_INIT;
     m->cpuwide_start_ns = start_ns;
     m->stat = EMPTY_STAT;
+    m->ready_ns = 0;
     m->tid = make_tid(*m->version_butex, slot);
     *th = m->tid;
     if (using_attr.flags & BTHREAD_LOG_START_AND_FINISH) {
@@ -583,6 +605,10 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta) {
     }
     ++cur_meta->stat.nswitch;
     ++ g->_nswitch;
+    if (next_meta->ready_ns) {
+        g->_control->exposed_sched_latency() << (now - next_meta->ready_ns) / 1000L;
+        next_meta->ready_ns = 0;
+    }
     // Switch to the task
     if (__builtin_expect(next_meta != cur_meta, 1)) {
         g->_cur_meta = next_meta;
@@ -666,6 +692,11 @@ void TaskGroup::flush_nosignal_tasks() {
 
 void TaskGroup::ready_to_run_remote(bthread_t tid, bool nosignal) {
     _remote_rq._mutex.lock();
+    const int sample_rate = FLAGS_bthread_sched_latency_sample_rate;
+    if (sample_rate > 0 && ++_remote_nready_unsampled >= sample_rate) {
+        _remote_nready_unsampled = 0;
+        sample_ready_task(tid, _remote_rq._tasks.size(), _remote_rq_depth_hist);
+    }
     while (!_remote_rq.push_locked(tid)) {
         flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
         LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
@@ -22,6 +22,7 @@
 #ifndef BTHREAD_TASK_GROUP_H
 #define BTHREAD_TASK_GROUP_H
 
+#include <gflags/gflags.h>                          // DECLARE_int32
 #include "butil/time.h"                             // cpuwide_time_ns
 #include "bthread/task_control.h"
 #include "bthread/task_meta.h"                     // bthread_t, TaskMeta
@@ -218,9 +219,23 @@ friend class TaskControl;
 #ifndef BTHREAD_DONT_SAVE_PARKING_STATE
         _last_pl_state = _pl->get_state();
 #endif
-        return _control->steal_task(tid, &_steal_seed, _steal_offset);
+        if (_control->steal_task(tid, &_steal_seed, _steal_offset)) {
+            ++_nsteal;
+            return true;
+        }
+        ++_nsteal_failure;
+        return false;
     }
 
+    // Bucket 0 counts empty runqueues, bucket i (i > 0) counts depths in
+    // [2^(i-1), 2^i), the last bucket counts all deeper runqueues.
+    static const int RQ_DEPTH_BUCKETS = 16;
+    static int rq_depth_bucket(size_t depth);
+
+    // Mark `tid' as sampled for scheduling latency and count `depth', the
+    // number of tasks ahead of it in the runqueue, into `hist'.
+    void sample_ready_task(bthread_t tid, size_t depth, int64_t* hist);
+
 #ifndef NDEBUG
     int _sched_recursive_guard;
 #endif
@@ -236,6 +251,12 @@ friend class TaskControl;
     int64_t _cumulated_cputime_ns;
 
     size_t _nswitch;
+    // Successful and failed attempts to steal tasks from other groups.
+    int64_t _nsteal;
+    int64_t _nsteal_failure;
+    // Tasks pushed into _rq since last sampled one.
+    int _nready_unsampled;
+    int64_t _rq_depth_hist[RQ_DEPTH_BUCKETS];
     RemainedFn _last_context_remained;
     void* _last_context_remained_arg;
 
@@ -251,6 +272,9 @@ friend class TaskControl;
     RemoteTaskQueue _remote_rq;
     int _remote_num_nosignal;
     int _remote_nsignaled;
+    // Protected by _remote_rq._mutex.
+    int _remote_nready_unsampled;
+    int64_t _remote_rq_depth_hist[RQ_DEPTH_BUCKETS];
 };
 
 }  // namespace bthread
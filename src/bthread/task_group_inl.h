@@ -24,6 +24,8 @@
 
 namespace bthread {
 
+DECLARE_int32(bthread_sched_latency_sample_rate);
+
 // Utilities to manipulate bthread_t
 inline bthread_t make_tid(uint32_t version, butil::ResourceId<TaskMeta> slot) {
     return (((bthread_t)version) << 32) | (bthread_t)slot.value;
@@ -78,7 +80,26 @@ inline void TaskGroup::sched_to(TaskGroup** pg, bthread_t next_tid) {
     sched_to(pg, next_meta);
 }
 
+inline int TaskGroup::rq_depth_bucket(size_t depth) {
+    if (depth == 0) {
+        return 0;
+    }
+    const int b = 64 - __builtin_clzll(depth);
+    return b < RQ_DEPTH_BUCKETS ? b : RQ_DEPTH_BUCKETS - 1;
+}
+
+inline void TaskGroup::sample_ready_task(bthread_t tid, size_t depth,
+                                         int64_t* hist) {
+    address_meta(tid)->ready_ns = butil::cpuwide_time_ns();
+    ++hist[rq_depth_bucket(depth)];
+}
+
 inline void TaskGroup::push_rq(bthread_t tid) {
+    const int sample_rate = FLAGS_bthread_sched_latency_sample_rate;
+    if (sample_rate > 0 && ++_nready_unsampled >= sample_rate) {
+        _nready_unsampled = 0;
+        sample_ready_task(tid, _rq.volatile_size(), _rq_depth_hist);
+    }
     while (!_rq.push(tid)) {
         // Created too many bthreads: a promising approach is to insert the
         // task into another TaskGroup, but we don't use it because:
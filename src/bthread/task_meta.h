@@ -42,9 +42,12 @@ struct LocalStorage {
     KeyTable* keytable;
     void* assigned_data;
     void* rpcz_parent_span;
+    int64_t rpc_deadline_us;
+    // Attributed to cpu samples taken while this bthread is running.
+    const char* cpu_profiling_tag;
 };
 
-#define BTHREAD_LOCAL_STORAGE_INITIALIZER { NULL, NULL, NULL }
+#define BTHREAD_LOCAL_STORAGE_INITIALIZER { NULL, NULL, NULL, 0, NULL }
 
 const static LocalStorage LOCAL_STORAGE_INIT = BTHREAD_LOCAL_STORAGE_INITIALIZER;
 
@@ -86,6 +89,10 @@ struct TaskMeta {
     int64_t cpuwide_start_ns;
     TaskStatistics stat;
 
+    // Time when the task was pushed into a runqueue, set only for sampled
+    // tasks and cleared when the task starts running. 0 means not sampled.
+    int64_t ready_ns;
+
     // bthread local storage, sync with tls_bls (defined in task_group.cpp)
     // when the bthread is created or destroyed.
     // DO NOT use this field directly, use tls_bls instead.
@@ -526,6 +526,7 @@ OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
   // look into the symbol tables inside.
   char buf[1024];  // Big enough for line of sane /proc/self/maps
   int num_maps = 0;
+  uint64_t module_start_address = 0;
   LineReader reader(wrapped_maps_fd.get(), buf, sizeof(buf));
   while (true) {
     num_maps++;
@@ -557,11 +558,6 @@ OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
     }
     ++cursor;  // Skip ' '.
 
-    // Check start and end addresses.
-    if (!(start_address <= pc && pc < end_address)) {
-      continue;  // We skip this map.  PC isn't in this map.
-    }
-
     // Read flags.  Skip flags until we encounter a space or eol.
     const char * const flags_start = cursor;
     while (cursor < eol && *cursor != ' ') {
@@ -571,11 +567,6 @@ OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
     if (cursor == eol || cursor < flags_start + 4) {
       return -1;  // Malformed line.
     }
-
-    // Check flags.  We are only interested in "r-x" maps.
-    if (memcmp(flags_start, "r-x", 3) != 0) {  // Not a "r-x" map.
-      continue;  // We skip this map.
-    }
     ++cursor;  // Skip ' '.
 
     // Read file offset.
@@ -586,6 +577,24 @@ OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
     }
     ++cursor;  // Skip ' '.
 
+    // Modern linkers map the ELF headers and read-only data (offset 0) in
+    // a separate mapping before the code, remember where the module starts
+    // so that PIE executables and DSOs are relocated by the load address of
+    // the module rather than the start of the code mapping.
+    if (file_offset == 0) {
+      module_start_address = start_address;
+    }
+
+    // Check start and end addresses.
+    if (!(start_address <= pc && pc < end_address)) {
+      continue;  // We skip this map.  PC isn't in this map.
+    }
+
+    // Check flags.  We are only interested in "r-x" maps.
+    if (memcmp(flags_start, "r-x", 3) != 0) {  // Not a "r-x" map.
+      continue;  // We skip this map.
+    }
+
     // Don't subtract 'start_address' from the first entry:
     // * If a binary is compiled w/o -pie, then the first entry in
     //   process maps is likely the binary itself (all dynamic libs
@@ -599,6 +608,11 @@ OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
     //   first entry.
     base_address = ((num_maps == 1) ? 0U : start_address) - file_offset;
 
+    // ET_DYN objects(DSOs and PIE executables) are relocated by
+    // |start_address|, which is the load address of the module even if
+    // the module is the first entry.
+    start_address = module_start_address;
+
     // Skip to file name.  "cursor" now points to dev.  We need to
     // skip at least two spaces for dev and inode.
     int num_spaces = 0;
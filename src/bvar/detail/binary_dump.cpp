@@ -0,0 +1,405 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Date: 2026/10/18 16:02:47
+
+#include <errno.h>
+#include <fcntl.h>                      // open
+#include <inttypes.h>                   // PRId64
+#include <stdio.h>                      // rename
+#include <stdlib.h>                     // strtoll
+#include <unistd.h>                     // close
+#include <sys/uio.h>                    // writev
+#include <algorithm>                    // std::sort
+#include "butil/logging.h"
+#include "butil/errno.h"                // berror
+#include "butil/time.h"                 // gettimeofday_us
+#include "butil/file_util.h"            // CreateDirectoryAndGetError
+#include "butil/string_printf.h"        // string_appendf
+#include "bvar/detail/binary_dump.h"
+
+namespace bvar {
+namespace detail {
+
+static const char BINARY_DUMP_NAMES_META[] = "names";
+
+inline void put_varint(std::string* out, uint64_t v) {
+    while (v >= 0x80) {
+        out->push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out->push_back((char)v);
+}
+
+inline uint64_t zigzag_encode(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// Returns true if `s' is exactly the decimal form of *v, so that converting
+// *v back to text gets `s'.
+static bool parse_canonical_int(const butil::StringPiece& s, int64_t* v) {
+    const size_t neg = (!s.empty() && s[0] == '-');
+    const size_t ndigit = s.size() - neg;
+    if (ndigit == 0 || ndigit > 19) {
+        return false;
+    }
+    if (s[neg] == '0' && (ndigit > 1 || neg)) {
+        // Leading zeros or -0.
+        return false;
+    }
+    for (size_t i = neg; i < s.size(); ++i) {
+        if (s[i] < '0' || s[i] > '9') {
+            return false;
+        }
+    }
+    char buf[24];
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = '\0';
+    errno = 0;
+    *v = strtoll(buf, NULL, 10);
+    return errno == 0;
+}
+
+class VarintReader {
+public:
+    VarintReader(const std::string& buf)
+        : _p(buf.data()), _end(buf.data() + buf.size()) {}
+
+    bool read(uint64_t* v) {
+        uint64_t result = 0;
+        for (int shift = 0; shift < 64 && _p != _end; shift += 7) {
+            const uint8_t b = (uint8_t)*_p++;
+            result |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                *v = result;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool read_string(std::string* s) {
+        uint64_t len = 0;
+        if (!read(&len) || len > (uint64_t)(_end - _p)) {
+            return false;
+        }
+        s->assign(_p, len);
+        _p += len;
+        return true;
+    }
+
+    bool read_byte(uint8_t* b) {
+        if (_p == _end) {
+            return false;
+        }
+        *b = (uint8_t)*_p++;
+        return true;
+    }
+
+    bool eof() const { return _p == _end; }
+
+private:
+    const char* _p;
+    const char* _end;
+};
+
+BinaryDumpEncoder::BinaryDumpEncoder(const std::string& prefix)
+    : _prefix(prefix)
+    , _round(0)
+    , _payload_time_us(0)
+    , _last_time_us(0) {
+    CHECK_EQ(0, _ids.init(1024, 80));
+}
+
+void BinaryDumpEncoder::reset() {
+    _ids.clear();
+    _slots.clear();
+    _changed.clear();
+    _new_names.clear();
+    _last_time_us = 0;
+}
+
+void BinaryDumpEncoder::begin_round(int64_t time_us) {
+    ++_round;
+    _changed.clear();
+    _new_names.clear();
+    _payload_time_us = time_us;
+}
+
+bool BinaryDumpEncoder::dump(const std::string& name,
+                             const butil::StringPiece& desc) {
+    _name_buf.assign(_prefix);
+    _name_buf.append(name);
+    uint32_t id = 0;
+    uint32_t* pid = _ids.seek(_name_buf);
+    if (pid != NULL) {
+        id = *pid;
+    } else {
+        id = _slots.size();
+        _ids[_name_buf] = id;
+        put_varint(&_new_names, _name_buf.size());
+        _new_names.append(_name_buf);
+        Slot s;
+        s.present = false;
+        s.is_int = false;
+        s.int_value = 0;
+        s.int_delta = 0;
+        s.round = 0;
+        _slots.push_back(s);
+    }
+    Slot& s = _slots[id];
+    if (s.round == _round) {
+        // Dumped twice in one round, keep the first one.
+        return true;
+    }
+    s.round = _round;
+    int64_t v = 0;
+    if (parse_canonical_int(desc, &v)) {
+        if (!s.present || !s.is_int || v != s.int_value) {
+            s.int_delta = (int64_t)((uint64_t)v - (uint64_t)s.int_value);
+            s.int_value = v;
+            s.is_int = true;
+            _changed.push_back(id);
+        }
+    } else if (!s.present || s.is_int || desc != s.str_value) {
+        desc.CopyToString(&s.str_value);
+        s.is_int = false;
+        _changed.push_back(id);
+    }
+    s.present = true;
+    return true;
+}
+
+void BinaryDumpEncoder::end_round(butil::Record* rec) {
+    rec->Clear();
+    for (size_t i = 0; i < _slots.size(); ++i) {
+        Slot& s = _slots[i];
+        if (s.present && s.round != _round) {
+            s.present = false;
+            _changed.push_back(i);
+        }
+    }
+    std::sort(_changed.begin(), _changed.end());
+
+    std::string payload;
+    put_varint(&payload, zigzag_encode(_payload_time_us - _last_time_us));
+    _last_time_us = _payload_time_us;
+    put_varint(&payload, _changed.size());
+    int64_t last_id = -1;
+    for (size_t i = 0; i < _changed.size(); ++i) {
+        const uint32_t id = _changed[i];
+        const Slot& s = _slots[id];
+        put_varint(&payload, id - last_id - 1);
+        last_id = id;
+        if (!s.present) {
+            payload.push_back((char)BINARY_DUMP_REMOVED);
+        } else if (s.is_int) {
+            payload.push_back((char)BINARY_DUMP_INT);
+            put_varint(&payload, zigzag_encode(s.int_delta));
+        } else {
+            payload.push_back((char)BINARY_DUMP_STRING);
+            put_varint(&payload, s.str_value.size());
+            payload.append(s.str_value);
+        }
+    }
+    if (!_new_names.empty()) {
+        rec->MutableMeta(BINARY_DUMP_NAMES_META)->append(_new_names);
+    }
+    rec->MutablePayload()->append(payload);
+}
+
+int BinaryDumpDecoder::apply(const butil::Record& rec) {
+    for (size_t i = 0; i < _values.size(); ++i) {
+        _values[i].changed = false;
+    }
+    const butil::IOBuf* names = rec.Meta(BINARY_DUMP_NAMES_META);
+    if (names != NULL) {
+        const std::string buf = names->to_string();
+        VarintReader r(buf);
+        std::string name;
+        while (!r.eof()) {
+            if (!r.read_string(&name)) {
+                LOG(ERROR) << "Fail to read names";
+                return -1;
+            }
+            _names.push_back(name);
+            Value v;
+            v.present = false;
+            v.changed = false;
+            v.is_int = false;
+            v.int_value = 0;
+            _values.push_back(v);
+        }
+    }
+    const std::string buf = rec.Payload().to_string();
+    VarintReader r(buf);
+    uint64_t time_delta = 0;
+    uint64_t n = 0;
+    if (!r.read(&time_delta) || !r.read(&n)) {
+        LOG(ERROR) << "Fail to read header of payload";
+        return -1;
+    }
+    _time_us += zigzag_decode(time_delta);
+    uint64_t id = (uint64_t)-1;
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t id_delta = 0;
+        uint8_t tag = 0;
+        if (!r.read(&id_delta) || !r.read_byte(&tag)) {
+            LOG(ERROR) << "Fail to read entry";
+            return -1;
+        }
+        id += id_delta + 1;
+        if (id >= _values.size()) {
+            LOG(ERROR) << "Unknown id=" << id;
+            return -1;
+        }
+        Value& v = _values[id];
+        v.changed = true;
+        switch (tag) {
+        case BINARY_DUMP_INT: {
+            uint64_t delta = 0;
+            if (!r.read(&delta)) {
+                LOG(ERROR) << "Fail to read value of " << _names[id];
+                return -1;
+            }
+            v.int_value = (int64_t)((uint64_t)v.int_value +
+                                    (uint64_t)zigzag_decode(delta));
+            v.is_int = true;
+            v.present = true;
+            break;
+        }
+        case BINARY_DUMP_STRING:
+            if (!r.read_string(&v.str_value)) {
+                LOG(ERROR) << "Fail to read value of " << _names[id];
+                return -1;
+            }
+            v.is_int = false;
+            v.present = true;
+            break;
+        case BINARY_DUMP_REMOVED:
+            v.present = false;
+            break;
+        default:
+            LOG(ERROR) << "Unknown tag=" << (int)tag;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void BinaryDumpDecoder::get_value(size_t id, std::string* out) const {
+    const Value& v = _values[id];
+    if (v.is_int) {
+        out->clear();
+        butil::string_appendf(out, "%" PRId64, v.int_value);
+    } else {
+        *out = v.str_value;
+    }
+}
+
+class FdWriter : public butil::IWriter {
+public:
+    explicit FdWriter(int fd) : _fd(fd) {}
+    ssize_t WriteV(const iovec* iov, int iovcnt) override {
+        return ::writev(_fd, iov, iovcnt);
+    }
+private:
+    int _fd;
+};
+
+BinaryFileDumper::BinaryFileDumper(const std::string& filename,
+                                   const std::string& prefix,
+                                   size_t max_file_size)
+    : _filename(filename)
+    , _prefix(prefix)
+    , _max_file_size(max_file_size)
+    , _fd(-1)
+    , _file_size(0)
+    , _encoder(prefix) {
+}
+
+BinaryFileDumper::~BinaryFileDumper() {
+    close_file();
+}
+
+int BinaryFileDumper::open_file() {
+    butil::File::Error error;
+    butil::FilePath dir = butil::FilePath(_filename).DirName();
+    if (!butil::CreateDirectoryAndGetError(dir, &error)) {
+        LOG(ERROR) << "Fail to create directory=`" << dir.value()
+                   << "', " << error;
+        return -1;
+    }
+    _fd = ::open(_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0644);
+    if (_fd < 0) {
+        PLOG(ERROR) << "Fail to open " << _filename;
+        return -1;
+    }
+    _file_size = 0;
+    // Records before are gone, start with a complete dictionary.
+    _encoder.reset();
+    return 0;
+}
+
+void BinaryFileDumper::close_file() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+int BinaryFileDumper::dump_exposed(const DumpOptions* options) {
+    if (_fd >= 0 && _file_size >= _max_file_size) {
+        close_file();
+        const std::string old_filename = _filename + ".old";
+        if (::rename(_filename.c_str(), old_filename.c_str()) != 0) {
+            PLOG(WARNING) << "Fail to rename " << _filename << " to "
+                          << old_filename;
+        }
+    }
+    if (_fd < 0 && open_file() != 0) {
+        return -1;
+    }
+    _encoder.begin_round(butil::gettimeofday_us());
+    const int n = Variable::dump_exposed(&_encoder, options);
+    butil::Record rec;
+    _encoder.end_round(&rec);
+    if (n < 0) {
+        close_file();
+        return -1;
+    }
+    FdWriter fw(_fd);
+    butil::RecordWriter writer(&fw);
+    const int rc = writer.Write(rec);
+    if (rc != 0) {
+        LOG(ERROR) << "Fail to write into " << _filename << ": " << berror(rc);
+        // Reopen the file in next round to keep the records decodable.
+        close_file();
+        return -1;
+    }
+    _file_size += rec.ByteSize();
+    return n;
+}
+
+}  // namespace detail
+}  // namespace bvar
@@ -0,0 +1,163 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Date: 2026/10/18 16:02:47
+
+#ifndef  BVAR_DETAIL_BINARY_DUMP_H
+#define  BVAR_DETAIL_BINARY_DUMP_H
+
+#include <stdint.h>                     // int64_t
+#include <string>
+#include <vector>
+#include "butil/macros.h"               // DISALLOW_COPY_AND_ASSIGN
+#include "butil/reader_writer.h"        // butil::IReader, butil::IWriter
+#include "butil/recordio.h"             // butil::RecordWriter
+#include "butil/containers/flat_map.h"  // butil::FlatMap
+#include "bvar/variable.h"              // Dumper
+
+namespace bvar {
+namespace detail {
+
+// Binary, incremental format of dumped bvar, which is a sequence of
+// butil::Record, one for each round of dumping:
+//   meta "names": names first seen in this round, encoded as
+//                 varint(length) + bytes. The i-th name ever written has
+//                 id = i, so the dictionary is written only once.
+//   payload: zigzag varint(time_us - time_us of last round)
+//            varint(number of entries)
+//            entries sorted by id, each is varint(id - last_id - 1) + tag:
+//              BINARY_DUMP_INT:     zigzag varint of delta to the last
+//                                   integral value of the variable.
+//              BINARY_DUMP_STRING:  varint(length) + bytes.
+//              BINARY_DUMP_REMOVED: the variable is not dumped anymore.
+// Variables unchanged since last round are not written.
+enum BinaryDumpTag {
+    BINARY_DUMP_INT = 0,
+    BINARY_DUMP_STRING = 1,
+    BINARY_DUMP_REMOVED = 2,
+};
+
+// Encode rounds of Variable::dump_exposed() into butil::Record. Usage:
+//   encoder.begin_round(now_us);
+//   Variable::dump_exposed(&encoder, &options);
+//   encoder.end_round(&record);
+class BinaryDumpEncoder : public Dumper {
+public:
+    explicit BinaryDumpEncoder(const std::string& prefix);
+
+    void begin_round(int64_t time_us);
+    bool dump(const std::string& name, const butil::StringPiece& desc) override;
+    // Fill `rec' with changes since last round.
+    void end_round(butil::Record* rec);
+
+    // Forget all names and values so that next round is self-contained.
+    void reset();
+
+    // Number of distinct names ever seen.
+    size_t name_count() const { return _slots.size(); }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(BinaryDumpEncoder);
+
+    struct Slot {
+        bool present;
+        bool is_int;
+        int64_t int_value;
+        // delta of int_value written in this round.
+        int64_t int_delta;
+        std::string str_value;
+        int64_t round;
+    };
+
+    std::string _prefix;
+    std::string _name_buf;
+    int64_t _round;
+    int64_t _payload_time_us;
+    int64_t _last_time_us;
+    butil::FlatMap<std::string, uint32_t> _ids;
+    std::vector<Slot> _slots;
+    std::vector<uint32_t> _changed;
+    std::string _new_names;
+};
+
+// Decode records written by BinaryDumpEncoder and reconstruct the values.
+class BinaryDumpDecoder {
+public:
+    BinaryDumpDecoder() : _time_us(0) {}
+
+    // Apply a record. Returns 0 on success, -1 on corrupted data.
+    int apply(const butil::Record& rec);
+
+    // Timestamp of last applied record.
+    int64_t time_us() const { return _time_us; }
+
+    size_t name_count() const { return _names.size(); }
+    const std::string& name(size_t id) const { return _names[id]; }
+    // Present in the last applied record.
+    bool present(size_t id) const { return _values[id].present; }
+    // Changed by the last applied record.
+    bool changed(size_t id) const { return _values[id].changed; }
+    // Value of the variable in text form.
+    void get_value(size_t id, std::string* out) const;
+
+private:
+    struct Value {
+        bool present;
+        bool changed;
+        bool is_int;
+        int64_t int_value;
+        std::string str_value;
+    };
+    int64_t _time_us;
+    std::vector<std::string> _names;
+    std::vector<Value> _values;
+};
+
+// Append rounds of dumped bvar to a file in the format above. The file is
+// truncated when it's opened and moved to `<filename>.old' after growing
+// over `max_file_size' bytes.
+class BinaryFileDumper {
+public:
+    BinaryFileDumper(const std::string& filename, const std::string& prefix,
+                     size_t max_file_size);
+    ~BinaryFileDumper();
+
+    const std::string& filename() const { return _filename; }
+    const std::string& prefix() const { return _prefix; }
+
+    // Dump variables selected by `options' as one record.
+    // Returns number of dumped variables, -1 on error.
+    int dump_exposed(const DumpOptions* options);
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(BinaryFileDumper);
+    int open_file();
+    void close_file();
+
+    std::string _filename;
+    std::string _prefix;
+    size_t _max_file_size;
+    int _fd;
+    size_t _file_size;
+    BinaryDumpEncoder _encoder;
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  //BVAR_DETAIL_BINARY_DUMP_H
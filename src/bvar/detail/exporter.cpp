@@ -0,0 +1,556 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Date: 2026/10/18 17:10:05
+
+#include <inttypes.h>                            // PRId64
+#include <netinet/in.h>                          // sockaddr_in
+#include <sys/socket.h>                          // socket
+#include <sys/time.h>                            // timeval
+#include <unistd.h>                              // close
+#include <algorithm>                             // std::min
+#include <memory>                                // std::unique_ptr
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "butil/errno.h"                         // berror
+#include "butil/time.h"                          // gettimeofday_us
+#include "butil/fd_guard.h"                      // butil::fd_guard
+#include "butil/string_printf.h"                 // string_printf
+#include "butil/containers/flat_map.h"           // butil::FlatMap
+#include "bvar/gflag.h"
+#include "bvar/variable.h"
+#include "bvar/detail/exporter.h"
+
+namespace bvar {
+namespace detail {
+
+StatsdSink::StatsdSink() : _fd(-1) {}
+
+StatsdSink::~StatsdSink() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+int StatsdSink::init(const char* ip_and_port) {
+    if (butil::hostname2endpoint(ip_and_port, &_remote) != 0) {
+        LOG(ERROR) << "Invalid address=" << ip_and_port;
+        return -1;
+    }
+    _fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fd < 0) {
+        PLOG(ERROR) << "Fail to create UDP socket";
+        return -1;
+    }
+    return 0;
+}
+
+int StatsdSink::send(const char* data, size_t len) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr = _remote.ip;
+    addr.sin_port = htons(_remote.port);
+    if (::sendto(_fd, data, len, 0, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        PLOG_EVERY_SECOND(WARNING) << "Fail to send to " << _remote;
+        return -1;
+    }
+    return 0;
+}
+
+int OpenMetricsSink::init(const char* host_and_port, const std::string& path,
+                          int timeout_ms) {
+    if (butil::hostname2endpoint(host_and_port, &_remote) != 0) {
+        LOG(ERROR) << "Invalid address=" << host_and_port;
+        return -1;
+    }
+    _timeout_ms = timeout_ms;
+    _header_prefix.clear();
+    butil::string_appendf(&_header_prefix,
+                          "POST %s HTTP/1.1\r\n"
+                          "Host: %s\r\n"
+                          "Content-Type: application/openmetrics-text; "
+                          "version=1.0.0; charset=utf-8\r\n"
+                          "Connection: close\r\n",
+                          (path.empty() ? "/" : path.c_str()), host_and_port);
+    return 0;
+}
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        const ssize_t nw = ::write(fd, data, len);
+        if (nw < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += nw;
+        len -= nw;
+    }
+    return 0;
+}
+
+int OpenMetricsSink::send(const char* data, size_t len) {
+    butil::fd_guard fd(butil::tcp_connect(_remote, NULL));
+    if (fd < 0) {
+        PLOG_EVERY_SECOND(WARNING) << "Fail to connect to " << _remote;
+        return -1;
+    }
+    struct timeval tv;
+    tv.tv_sec = _timeout_ms / 1000;
+    tv.tv_usec = (_timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    std::string header = _header_prefix;
+    butil::string_appendf(&header, "Content-Length: %lu\r\n\r\n",
+                          (unsigned long)len);
+    if (write_all(fd, header.data(), header.size()) != 0 ||
+        write_all(fd, data, len) != 0) {
+        PLOG_EVERY_SECOND(WARNING) << "Fail to write to " << _remote;
+        return -1;
+    }
+    // Only the status line matters.
+    char buf[64];
+    size_t nr = 0;
+    while (nr < sizeof(buf) - 1) {
+        const ssize_t n = ::read(fd, buf + nr, sizeof(buf) - 1 - nr);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        nr += n;
+        if (memchr(buf, '\n', nr) != NULL) {
+            break;
+        }
+    }
+    buf[nr] = '\0';
+    int status = 0;
+    if (sscanf(buf, "HTTP/%*d.%*d %d", &status) != 1 ||
+        status < 200 || status >= 300) {
+        LOG_EVERY_SECOND(WARNING) << "Bad response from " << _remote
+                                  << ": " << buf;
+        return -1;
+    }
+    return 0;
+}
+
+ExporterOptions::ExporterOptions()
+    : format(EXPORT_FORMAT_STATSD)
+    , max_payload_size(1432)
+    , max_pending_payloads(256) {
+}
+
+MetricExporter::MetricExporter(const ExporterOptions& options)
+    : _options(options)
+    , _value_streambuf(_value_buf, MAX_VALUE_SIZE)
+    , _value_stream(&_value_streambuf)
+    , _ndropped(0) {
+    if (_options.max_pending_payloads == 0) {
+        _options.max_pending_payloads = 1;
+    }
+    const size_t n = _options.max_pending_payloads;
+    _payload_mem.resize(n * _options.max_payload_size);
+    _payloads.resize(n);
+    butil::BoundedQueue<Payload*> free_q(n);
+    butil::BoundedQueue<Payload*> ready_q(n);
+    _free_q.swap(free_q);
+    _ready_q.swap(ready_q);
+    for (size_t i = 0; i < n; ++i) {
+        _payloads[i].size = 0;
+        _payloads[i].data = &_payload_mem[i * _options.max_payload_size];
+        _free_q.push(&_payloads[i]);
+    }
+}
+
+MetricExporter::~MetricExporter() {}
+
+// Collect numeric variables selected by DumpOptions.
+class NumericVariableCollector : public Dumper {
+public:
+    explicit NumericVariableCollector(std::vector<std::string>* names)
+        : _names(names) {}
+    bool dump(const std::string& name, const butil::StringPiece& desc) override {
+        if (desc.empty() || desc.size() > 31) {
+            return true;
+        }
+        char buf[32];
+        memcpy(buf, desc.data(), desc.size());
+        buf[desc.size()] = '\0';
+        char* endptr = NULL;
+        strtod(buf, &endptr);
+        if (endptr == buf + desc.size()) {
+            _names->push_back(name);
+        }
+        return true;
+    }
+private:
+    std::vector<std::string>* _names;
+};
+
+static void encode_name(std::string* out, const std::string& name,
+                        ExportFormat format) {
+    out->reserve(name.size() + 1);
+    for (size_t i = 0; i < name.size(); ++i) {
+        const char c = name[i];
+        if (format == EXPORT_FORMAT_STATSD) {
+            // `:' `|' `@' and spaces are separators in StatsD.
+            out->push_back((c == ':' || c == '|' || c == '@' || isspace(c)) ?
+                           '_' : c);
+        } else if (isalnum(c) || c == '_' || c == ':') {
+            if (i == 0 && isdigit(c)) {
+                out->push_back('_');
+            }
+            out->push_back(c);
+        } else {
+            out->push_back('_');
+        }
+    }
+    out->push_back(format == EXPORT_FORMAT_STATSD ? ':' : ' ');
+}
+
+size_t MetricExporter::refresh_variables() {
+    std::vector<std::string> names;
+    NumericVariableCollector collector(&names);
+    DumpOptions dump_options;
+    dump_options.white_wildcards = _options.white_wildcards;
+    dump_options.black_wildcards = _options.black_wildcards;
+    if (Variable::dump_exposed(&collector, &dump_options) < 0) {
+        LOG(ERROR) << "Fail to list variables";
+        return _entries.size();
+    }
+    std::vector<Entry> entries(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        Entry& e = entries[i];
+        e.name.swap(names[i]);
+        encode_name(&e.line_prefix, e.name, _options.format);
+        e.value_size = 0;
+    }
+    // Keep last values so that unchanged variables are not exported again.
+    // Both lists are sorted by names.
+    for (size_t i = 0, j = 0; i < entries.size() && j < _entries.size();) {
+        const int rc = entries[i].name.compare(_entries[j].name);
+        if (rc == 0) {
+            memcpy(entries[i].value, _entries[j].value,
+                   _entries[j].value_size);
+            entries[i].value_size = _entries[j].value_size;
+            ++i;
+            ++j;
+        } else if (rc < 0) {
+            ++i;
+        } else {
+            ++j;
+        }
+    }
+    _entries.swap(entries);
+    return _entries.size();
+}
+
+MetricExporter::Payload* MetricExporter::get_free_payload() {
+    Payload* p = NULL;
+    if (!_free_q.pop(&p)) {
+        ++_ndropped;
+        return NULL;
+    }
+    p->size = 0;
+    return p;
+}
+
+void MetricExporter::take_sample() {
+    const int64_t now_us = butil::gettimeofday_us();
+    // Suffix of each line.
+    char suffix[32];
+    int suffix_size = 0;
+    if (_options.format == EXPORT_FORMAT_STATSD) {
+        memcpy(suffix, "|g\n", 3);
+        suffix_size = 3;
+    } else {
+        suffix_size = snprintf(suffix, sizeof(suffix), " %" PRId64 ".%03d\n",
+                               now_us / 1000000L,
+                               (int)(now_us / 1000L % 1000L));
+    }
+    Payload* p = NULL;
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        Entry& e = _entries[i];
+        _value_streambuf.reset();
+        _value_stream.clear();
+        if (Variable::describe_exposed(e.name, _value_stream) != 0) {
+            continue;
+        }
+        const size_t value_size = _value_streambuf.size();
+        if (_value_stream.bad() || value_size == 0 ||
+            value_size >= MAX_VALUE_SIZE) {
+            // Truncated or empty.
+            continue;
+        }
+        if (value_size == e.value_size &&
+            memcmp(e.value, _value_buf, value_size) == 0) {
+            continue;
+        }
+        const size_t line_size =
+            e.line_prefix.size() + value_size + suffix_size;
+        if (line_size > _options.max_payload_size) {
+            continue;
+        }
+        if (p != NULL && p->size + line_size > _options.max_payload_size) {
+            _ready_q.push(p);
+            p = NULL;
+        }
+        if (p == NULL) {
+            p = get_free_payload();
+            if (p == NULL) {
+                // Too many pending payloads, remaining variables are
+                // exported next time.
+                break;
+            }
+        }
+        char* out = p->data + p->size;
+        memcpy(out, e.line_prefix.data(), e.line_prefix.size());
+        out += e.line_prefix.size();
+        memcpy(out, _value_buf, value_size);
+        out += value_size;
+        memcpy(out, suffix, suffix_size);
+        p->size += line_size;
+        memcpy(e.value, _value_buf, value_size);
+        e.value_size = value_size;
+    }
+    if (p != NULL) {
+        _ready_q.push(p);
+    }
+}
+
+int MetricExporter::flush(ExportSink* sink) {
+    std::vector<Payload*> ready;
+    Payload* p = NULL;
+    while (_ready_q.pop(&p)) {
+        ready.push_back(p);
+    }
+    if (ready.empty()) {
+        return 0;
+    }
+    int nsent = 0;
+    if (_options.format == EXPORT_FORMAT_STATSD) {
+        for (size_t i = 0; i < ready.size(); ++i) {
+            if (sink->send(ready[i]->data, ready[i]->size) == 0) {
+                ++nsent;
+            }
+        }
+    } else {
+        std::string body;
+        for (size_t i = 0; i < ready.size(); ++i) {
+            body.append(ready[i]->data, ready[i]->size);
+        }
+        body.append("# EOF\n");
+        if (sink->send(body.data(), body.size()) == 0) {
+            nsent = ready.size();
+        }
+    }
+    for (size_t i = 0; i < ready.size(); ++i) {
+        _free_q.push(ready[i]);
+    }
+    return nsent;
+}
+
+}  // namespace detail
+
+DEFINE_string(bvar_export_format, "", "Push numeric bvar changed since last "
+              "export to bvar_export_address periodically in this format: "
+              "statsd(UDP) or openmetrics(HTTP POST), empty means disabled");
+DEFINE_string(bvar_export_address, "127.0.0.1:8125", "host:port of the "
+              "StatsD or OpenMetrics receiver");
+DEFINE_string(bvar_export_path, "/metrics", "Path of the HTTP request when "
+              "-bvar_export_format=openmetrics");
+DEFINE_int32(bvar_export_interval_ms, 1000, "Milliseconds between consecutive "
+             "exports");
+DEFINE_string(bvar_export_include, "", "Export bvar matching these wildcards, "
+              "separated by semicolon(;), empty means including all");
+DEFINE_string(bvar_export_exclude, "", "Export bvar excluded from these "
+              "wildcards, separated by semicolon(;), empty means no exclusion");
+DEFINE_int32(bvar_export_max_payload_size, 1432, "Max bytes of a UDP packet "
+             "or a part of the HTTP body");
+
+// Seconds between consecutive selections of exported variables.
+static const int64_t EXPORT_REFRESH_INTERVAL_US = 10 * 1000000L;
+
+struct ExportConfig {
+    std::string format;
+    std::string address;
+    std::string path;
+    std::string include;
+    std::string exclude;
+    int interval_ms;
+    int max_payload_size;
+
+    bool operator==(const ExportConfig& rhs) const {
+        return format == rhs.format && address == rhs.address &&
+            path == rhs.path && include == rhs.include &&
+            exclude == rhs.exclude && interval_ms == rhs.interval_ms &&
+            max_payload_size == rhs.max_payload_size;
+    }
+};
+
+static bool read_export_config(ExportConfig* c) {
+    // We can't access string flags directly because it's thread-unsafe.
+    if (!GFLAGS_NS::GetCommandLineOption("bvar_export_format", &c->format) ||
+        !GFLAGS_NS::GetCommandLineOption("bvar_export_address", &c->address) ||
+        !GFLAGS_NS::GetCommandLineOption("bvar_export_path", &c->path) ||
+        !GFLAGS_NS::GetCommandLineOption("bvar_export_include", &c->include) ||
+        !GFLAGS_NS::GetCommandLineOption("bvar_export_exclude", &c->exclude)) {
+        LOG(ERROR) << "Fail to get gflags bvar_export_*";
+        return false;
+    }
+    c->interval_ms = FLAGS_bvar_export_interval_ms;
+    c->max_payload_size = FLAGS_bvar_export_max_payload_size;
+    return true;
+}
+
+// The background thread sending exported variables.
+static void* exporting_thread(void*) {
+    ExportConfig config;
+    detail::MetricExporter* exporter = NULL;
+    std::unique_ptr<detail::ExportSink> sink;
+    int64_t last_refresh_us = 0;
+    int64_t next_export_us = 0;
+    while (1) {
+        ExportConfig new_config;
+        if (!read_export_config(&new_config)) {
+            break;
+        }
+        if (exporter == NULL || !(new_config == config)) {
+            delete exporter;
+            exporter = NULL;
+            sink.reset();
+            config = new_config;
+            detail::ExporterOptions options;
+            if (config.format == "statsd") {
+                detail::StatsdSink* s = new detail::StatsdSink;
+                sink.reset(s);
+                options.format = detail::EXPORT_FORMAT_STATSD;
+                if (s->init(config.address.c_str()) != 0) {
+                    sink.reset();
+                }
+            } else if (config.format == "openmetrics") {
+                detail::OpenMetricsSink* s = new detail::OpenMetricsSink;
+                sink.reset(s);
+                options.format = detail::EXPORT_FORMAT_OPENMETRICS;
+                if (s->init(config.address.c_str(), config.path,
+                            std::max(config.interval_ms, 1000)) != 0) {
+                    sink.reset();
+                }
+            }
+            if (sink != NULL) {
+                options.white_wildcards = config.include;
+                options.black_wildcards = config.exclude;
+                options.max_payload_size = config.max_payload_size;
+                exporter = new detail::MetricExporter(options);
+                exporter->refresh_variables();
+                last_refresh_us = butil::gettimeofday_us();
+                next_export_us = last_refresh_us;
+                LOG(INFO) << "Export bvar to " << config.address << " in "
+                          << config.format << " every " << config.interval_ms
+                          << "ms";
+            }
+        }
+        if (exporter == NULL) {
+            // Disabled or misconfigured, check flags later.
+            usleep(1000000L);
+            continue;
+        }
+        int64_t now_us = butil::gettimeofday_us();
+        if (now_us < next_export_us) {
+            // Wake up at least once per second to check the flags.
+            usleep(std::min(next_export_us - now_us, 1000000L));
+            continue;
+        }
+        // Values are read and encoded in this thread rather than the
+        // sampling thread, which shouldn't be blocked by the registry lock
+        // or allocations in describe_exposed().
+        exporter->take_sample();
+        exporter->flush(sink.get());
+        next_export_us += config.interval_ms * 1000L;
+        now_us = butil::gettimeofday_us();
+        if (next_export_us < now_us) {
+            // Sending took too long, don't try to catch up.
+            next_export_us = now_us + config.interval_ms * 1000L;
+        }
+        if (now_us - last_refresh_us >= EXPORT_REFRESH_INTERVAL_US) {
+            last_refresh_us = now_us;
+            exporter->refresh_variables();
+        }
+    }
+    delete exporter;
+    return NULL;
+}
+
+static pthread_once_t exporting_thread_once = PTHREAD_ONCE_INIT;
+static bool created_exporting_thread = false;
+
+static void launch_exporting_thread() {
+    pthread_t thread_id;
+    int rc = pthread_create(&thread_id, NULL, exporting_thread, NULL);
+    if (rc != 0) {
+        LOG(FATAL) << "Fail to launch exporting thread: " << berror(rc);
+        return;
+    }
+    // Detach the thread because no one would join it.
+    CHECK_EQ(0, pthread_detach(thread_id));
+    created_exporting_thread = true;
+}
+
+static bool validate_bvar_export_format(const char*, const std::string& v) {
+    if (v.empty()) {
+        return true;
+    }
+    if (v != "statsd" && v != "openmetrics") {
+        LOG(ERROR) << "Invalid bvar_export_format=" << v;
+        return false;
+    }
+    pthread_once(&exporting_thread_once, launch_exporting_thread);
+    return created_exporting_thread;
+}
+const bool ALLOW_UNUSED dummy_bvar_export_format = ::GFLAGS_NS::RegisterFlagValidator(
+    &FLAGS_bvar_export_format, validate_bvar_export_format);
+
+static bool validate_bvar_export_interval_ms(const char*, int32_t v) {
+    if (v <= 0) {
+        LOG(ERROR) << "Invalid bvar_export_interval_ms=" << v;
+        return false;
+    }
+    return true;
+}
+const bool ALLOW_UNUSED dummy_bvar_export_interval_ms = ::GFLAGS_NS::RegisterFlagValidator(
+    &FLAGS_bvar_export_interval_ms, validate_bvar_export_interval_ms);
+
+static bool validate_bvar_export_max_payload_size(const char*, int32_t v) {
+    if (v < 64) {
+        LOG(ERROR) << "Invalid bvar_export_max_payload_size=" << v;
+        return false;
+    }
+    return true;
+}
+const bool ALLOW_UNUSED dummy_bvar_export_max_payload_size =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bvar_export_max_payload_size,
+                                       validate_bvar_export_max_payload_size);
+
+// Referenced by variable.cpp so that the flags above are always linked.
+int do_link_exporter = 0;
+
+}  // namespace bvar
@@ -0,0 +1,162 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Date: 2026/10/18 17:10:05
+
+#ifndef  BVAR_DETAIL_EXPORTER_H
+#define  BVAR_DETAIL_EXPORTER_H
+
+#include <stdint.h>                              // int64_t
+#include <streambuf>                             // std::streambuf
+#include <ostream>                               // std::ostream
+#include <string>
+#include <vector>
+#include "butil/macros.h"                        // DISALLOW_COPY_AND_ASSIGN
+#include "butil/endpoint.h"                      // butil::EndPoint
+#include "butil/containers/bounded_queue.h"      // butil::BoundedQueue
+
+namespace bvar {
+namespace detail {
+
+enum ExportFormat {
+    // name:value|g, one line per variable, lines are packed into UDP packets.
+    EXPORT_FORMAT_STATSD = 0,
+    // name value timestamp, payloads of a flush are POSTed in one body.
+    EXPORT_FORMAT_OPENMETRICS = 1,
+};
+
+// Where exported payloads go, called in the exporting thread only.
+class ExportSink {
+public:
+    virtual ~ExportSink() {}
+    // Returns 0 on success, -1 otherwise.
+    virtual int send(const char* data, size_t len) = 0;
+};
+
+// Send each payload as a UDP datagram.
+class StatsdSink : public ExportSink {
+public:
+    StatsdSink();
+    ~StatsdSink();
+    // Returns 0 on success, -1 otherwise.
+    int init(const char* ip_and_port);
+    int send(const char* data, size_t len) override;
+private:
+    DISALLOW_COPY_AND_ASSIGN(StatsdSink);
+    int _fd;
+    butil::EndPoint _remote;
+};
+
+// POST payloads to an HTTP server(e.g. a pushgateway) with a short-lived
+// connection. bvar does not depend on brpc, so a minimal HTTP/1.1 client
+// is used.
+class OpenMetricsSink : public ExportSink {
+public:
+    OpenMetricsSink() {}
+    // Returns 0 on success, -1 otherwise.
+    int init(const char* host_and_port, const std::string& path,
+             int timeout_ms);
+    int send(const char* data, size_t len) override;
+private:
+    DISALLOW_COPY_AND_ASSIGN(OpenMetricsSink);
+    butil::EndPoint _remote;
+    std::string _header_prefix;
+    int _timeout_ms;
+};
+
+struct ExporterOptions {
+    ExporterOptions();
+
+    ExportFormat format;
+    // Same as DumpOptions.
+    std::string white_wildcards;
+    std::string black_wildcards;
+    // Max bytes of a payload.
+    size_t max_payload_size;
+    // Payloads are dropped when so many of them are not flushed yet.
+    size_t max_pending_payloads;
+};
+
+// Encodes numeric variables changed since last export into payloads.
+// Values are read by Variable::describe_exposed() which takes the global
+// registry lock and allocates, so the exporter runs in its own thread
+// instead of the sampling thread of bvar. Methods are not thread-safe and
+// should be called in the exporting thread only.
+class MetricExporter {
+public:
+    explicit MetricExporter(const ExporterOptions& options);
+    ~MetricExporter();
+
+    // Select exported variables again. Call this periodically to catch new
+    // variables. Returns number of selected variables.
+    size_t refresh_variables();
+
+    // Encode selected variables changed since last call into payloads.
+    void take_sample();
+
+    // Send all pending payloads into `sink'.
+    // Returns number of payloads sent successfully.
+    int flush(ExportSink* sink);
+
+    // Number of payloads dropped because of too many pending payloads.
+    int64_t dropped_count() const { return _ndropped; }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(MetricExporter);
+
+    static const size_t MAX_VALUE_SIZE = 31;
+
+    struct Entry {
+        std::string name;
+        // Encoded name ended with the separator.
+        std::string line_prefix;
+        char value[MAX_VALUE_SIZE + 1];
+        uint8_t value_size;
+    };
+
+    struct Payload {
+        size_t size;
+        char* data;
+    };
+
+    // A streambuf writing into a fixed buffer without allocations.
+    class FixedStreamBuf : public std::streambuf {
+    public:
+        FixedStreamBuf(char* buf, size_t size) { setp(buf, buf + size); }
+        void reset() { setp(pbase(), epptr()); }
+        size_t size() const { return pptr() - pbase(); }
+    };
+
+    Payload* get_free_payload();
+
+    ExporterOptions _options;
+    std::vector<Entry> _entries;
+    char _value_buf[MAX_VALUE_SIZE + 1];
+    FixedStreamBuf _value_streambuf;
+    std::ostream _value_stream;
+    std::vector<char> _payload_mem;
+    std::vector<Payload> _payloads;
+    butil::BoundedQueue<Payload*> _free_q;
+    butil::BoundedQueue<Payload*> _ready_q;
+    int64_t _ndropped;
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  //BVAR_DETAIL_EXPORTER_H
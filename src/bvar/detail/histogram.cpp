@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Date: 2026/10/18 14:20:31
+
+#include <limits>
+#include "butil/logging.h"
+#include "bvar/detail/histogram.h"
+
+namespace bvar {
+namespace detail {
+
+class AddToHistogram {
+public:
+    AddToHistogram(uint32_t latency) : _latency(latency) {}
+
+    void operator()(GlobalValue<Histogram::combiner_type>& global_value,
+                    ThreadLocalHistogramBuckets& local_value) const {
+        const size_t index = histogram_bucket_index(_latency);
+        if (BAIDU_UNLIKELY(local_value.counts[index] ==
+                           std::numeric_limits<uint32_t>::max())) {
+            // Move the count to global before overflowing.
+            GlobalHistogramBuckets* g = global_value.lock();
+            g->counts[index] += local_value.counts[index];
+            global_value.unlock();
+            local_value.counts[index] = 0;
+        }
+        ++local_value.counts[index];
+        local_value.sum += _latency;
+    }
+private:
+    uint32_t _latency;
+};
+
+Histogram::Histogram() : _combiner(NULL), _sampler(NULL) {
+    _combiner = new combiner_type;
+}
+
+Histogram::~Histogram() {
+    // Have to destroy sampler first to avoid the race between destruction and
+    // sampler
+    if (_sampler != NULL) {
+        _sampler->destroy();
+        _sampler = NULL;
+    }
+    delete _combiner;
+}
+
+Histogram::value_type Histogram::reset() {
+    return _combiner->reset_all_agents();
+}
+
+Histogram::value_type Histogram::get_value() const {
+    return _combiner->combine_agents();
+}
+
+Histogram& Histogram::operator<<(int64_t latency) {
+    agent_type* agent = _combiner->get_or_create_tls_agent();
+    if (BAIDU_UNLIKELY(!agent)) {
+        LOG(FATAL) << "Fail to create agent";
+        return *this;
+    }
+    if (latency < 0) {
+        if (!_debug_name.empty()) {
+            LOG(WARNING) << "Input=" << latency << " to `" << _debug_name
+                       << "' is negative, drop";
+        } else {
+            LOG(WARNING) << "Input=" << latency << " to Histogram("
+                       << (void*)this << ") is negative, drop";
+        }
+        return *this;
+    }
+    // Values beyond uint32 are put into the last bucket.
+    if (latency > std::numeric_limits<uint32_t>::max()) {
+        latency = std::numeric_limits<uint32_t>::max();
+    }
+    agent->merge_global(AddToHistogram(latency));
+    return *this;
+}
+
+}  // namespace detail
+}  // namespace bvar
@@ -0,0 +1,251 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Date: 2026/10/18 14:20:31
+
+#ifndef  BVAR_DETAIL_HISTOGRAM_H
+#define  BVAR_DETAIL_HISTOGRAM_H
+
+#include <string.h>                     // memset
+#include <stdint.h>                     // uint32_t
+#include <ostream>                      // std::ostream
+#include "butil/macros.h"               // DISALLOW_COPY_AND_ASSIGN
+#include "bvar/reducer.h"               // Reducer
+#include "bvar/window.h"                // Window
+#include "bvar/detail/combiner.h"       // AgentCombiner
+#include "bvar/detail/sampler.h"        // ReducerSampler
+
+namespace bvar {
+namespace detail {
+
+// Log-linear buckets(the layout of HdrHistogram) covering [0, 2^32):
+// values less than 2^HISTOGRAM_SUB_BITS have their own buckets, and every
+// [2^e, 2^(e+1)) above is divided into 2^HISTOGRAM_SUB_BITS equal buckets,
+// so that relative error of any percentile is bounded by 2^-(SUB_BITS+1).
+const size_t HISTOGRAM_SUB_BITS = 4;
+const size_t HISTOGRAM_SUB_COUNT = 1 << HISTOGRAM_SUB_BITS;
+const size_t HISTOGRAM_NBUCKET =
+    HISTOGRAM_SUB_COUNT * (32 - HISTOGRAM_SUB_BITS + 1);
+
+// Index of the bucket containing `value'.
+inline size_t histogram_bucket_index(uint32_t value) {
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return value;
+    }
+    const size_t e = 31 - __builtin_clz(value);
+    return (e - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT +
+        ((value >> (e - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_COUNT - 1));
+}
+
+// Smallest value in the bucket at `index'.
+inline uint64_t histogram_bucket_lower(size_t index) {
+    if (index < HISTOGRAM_SUB_COUNT) {
+        return index;
+    }
+    const size_t e = index / HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_BITS - 1;
+    return (HISTOGRAM_SUB_COUNT + index % HISTOGRAM_SUB_COUNT)
+        << (e - HISTOGRAM_SUB_BITS);
+}
+
+// Number of values in the bucket at `index'.
+inline uint64_t histogram_bucket_width(size_t index) {
+    if (index < 2 * HISTOGRAM_SUB_COUNT) {
+        return 1;
+    }
+    return 1UL << (index / HISTOGRAM_SUB_COUNT - 1);
+}
+
+// Counts of values in each bucket. T is uint32_t in thread-local agents
+// and uint64_t after being combined.
+template <typename T>
+struct HistogramBuckets {
+    HistogramBuckets() : sum(0) { memset(counts, 0, sizeof(counts)); }
+
+    template <typename T2>
+    void merge(const HistogramBuckets<T2>& rhs) {
+        for (size_t i = 0; i < HISTOGRAM_NBUCKET; ++i) {
+            counts[i] += rhs.counts[i];
+        }
+        sum += rhs.sum;
+    }
+
+    // `rhs' must be an earlier snapshot of this histogram.
+    void subtract(const HistogramBuckets& rhs) {
+        for (size_t i = 0; i < HISTOGRAM_NBUCKET; ++i) {
+            counts[i] -= rhs.counts[i];
+        }
+        sum -= rhs.sum;
+    }
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (size_t i = 0; i < HISTOGRAM_NBUCKET; ++i) {
+            n += counts[i];
+        }
+        return n;
+    }
+
+    // Get the |ratio|-ile value, which is the middle of the bucket.
+    int64_t get_number(double ratio) const;
+
+    // Get number of values less than 2^i into out[i] for i in [0, n), where
+    // n is the minimum making out[n-1] equal to count(). Returns n.
+    size_t get_power2_cumulative_counts(uint64_t out[33]) const;
+
+    void describe(std::ostream& os) const;
+
+    T counts[HISTOGRAM_NBUCKET];
+    int64_t sum;
+};
+
+template <typename T>
+int64_t HistogramBuckets<T>::get_number(double ratio) const {
+    const uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(ratio * total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    } else if (rank > total) {
+        rank = total;
+    }
+    uint64_t n = 0;
+    for (size_t i = 0; i < HISTOGRAM_NBUCKET; ++i) {
+        n += counts[i];
+        if (n >= rank) {
+            return histogram_bucket_lower(i) +
+                (histogram_bucket_width(i) - 1) / 2;
+        }
+    }
+    return histogram_bucket_lower(HISTOGRAM_NBUCKET - 1);
+}
+
+template <typename T>
+size_t HistogramBuckets<T>::get_power2_cumulative_counts(uint64_t out[33]) const {
+    const uint64_t total = count();
+    uint64_t n = 0;
+    size_t index = 0;
+    for (size_t i = 0; i <= 32; ++i) {
+        // Buckets below `end' are all less than 2^i.
+        const size_t end = (i <= HISTOGRAM_SUB_BITS ? (1UL << i) :
+                            (i - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT);
+        for (; index < end; ++index) {
+            n += counts[index];
+        }
+        out[i] = n;
+        if (n == total) {
+            return i + 1;
+        }
+    }
+    return 33;
+}
+
+template <typename T>
+void HistogramBuckets<T>::describe(std::ostream& os) const {
+    uint64_t cumulative[33];
+    const size_t n = get_power2_cumulative_counts(cumulative);
+    os << "{\"sum\":" << sum << ",\"buckets\":[";
+    for (size_t i = 0; i < n; ++i) {
+        if (i) {
+            os << ',';
+        }
+        os << cumulative[i];
+    }
+    os << "]}";
+}
+
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const HistogramBuckets<T>& h) {
+    h.describe(os);
+    return os;
+}
+
+typedef HistogramBuckets<uint64_t> GlobalHistogramBuckets;
+typedef HistogramBuckets<uint32_t> ThreadLocalHistogramBuckets;
+
+// A specialized reducer to put latencies into log-linear buckets, which
+// gives percentiles with bounded errors and is cheap to merge. Unlike
+// Percentile, values are accumulated and windows are got by subtraction.
+// NOTE: DON'T use it directly, use LatencyRecorder instead.
+class Histogram {
+public:
+    struct AddHistogramBuckets {
+        template <typename T1, typename T2>
+        void operator()(HistogramBuckets<T1>& b1,
+                        const HistogramBuckets<T2>& b2) const {
+            b1.merge(b2);
+        }
+    };
+    struct MinusHistogramBuckets {
+        void operator()(GlobalHistogramBuckets& b1,
+                        const GlobalHistogramBuckets& b2) const {
+            b1.subtract(b2);
+        }
+    };
+
+    typedef GlobalHistogramBuckets                          value_type;
+    typedef ReducerSampler<Histogram,
+                           GlobalHistogramBuckets,
+                           AddHistogramBuckets,
+                           MinusHistogramBuckets>           sampler_type;
+    typedef AgentCombiner <GlobalHistogramBuckets,
+                           ThreadLocalHistogramBuckets,
+                           AddHistogramBuckets>             combiner_type;
+    typedef combiner_type::Agent                            agent_type;
+    Histogram();
+    ~Histogram();
+
+    AddHistogramBuckets op() const { return AddHistogramBuckets(); }
+    MinusHistogramBuckets inv_op() const { return MinusHistogramBuckets(); }
+
+    // The sampler for windows over histogram.
+    sampler_type* get_sampler() {
+        if (NULL == _sampler) {
+            _sampler = new sampler_type(this);
+            _sampler->schedule();
+        }
+        return _sampler;
+    }
+
+    value_type reset();
+
+    // Get all values added so far.
+    value_type get_value() const;
+
+    Histogram& operator<<(int64_t latency);
+
+    bool valid() const { return _combiner != NULL && _combiner->valid(); }
+
+    // This name is useful for warning negative latencies in operator<<
+    void set_debug_name(const butil::StringPiece& name) {
+        _debug_name.assign(name.data(), name.size());
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(Histogram);
+
+    combiner_type*          _combiner;
+    sampler_type*           _sampler;
+    std::string _debug_name;
+};
+
+}  // namespace detail
+}  // namespace bvar
+
+#endif  //BVAR_DETAIL_HISTOGRAM_H
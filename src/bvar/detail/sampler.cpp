@@ -43,10 +43,6 @@ struct CombineSampler {
     }
 };
 
-// True iff pthread_atfork was called. The callback to atfork works for child
-// of child as well, no need to register in the child again.
-static bool registered_atfork = false;
-
 // Call take_sample() of all scheduled samplers.
 // This can be done with regular timer thread, but it's way too slow(global
 // contention + log(N) heap manipulations). We need it to be super fast so that
@@ -60,12 +56,7 @@ static bool registered_atfork = false;
 // deletion is taken place in the thread as well.
 class SamplerCollector : public bvar::Reducer<Sampler*, CombineSampler> {
 public:
-    SamplerCollector()
-        : _created(false)
-        , _stop(false)
-        , _cumulated_time_us(0) {
-        create_sampling_thread();
-    }
+    SamplerCollector() : SamplerCollector(1000000L, (SamplerCollector*)NULL) {}
     ~SamplerCollector() {
         if (_created) {
             _stop = true;
@@ -82,8 +73,9 @@ private:
     //   be registered and the sampling thread will be re-created.
     // * A forked program can be forked again.
 
+    template <typename Collector>
     static void child_callback_atfork() {
-        butil::get_leaky_singleton<SamplerCollector>()->after_forked_as_child();
+        butil::get_leaky_singleton<Collector>()->after_forked_as_child();
     }
 
     void create_sampling_thread() {
@@ -92,9 +84,11 @@ private:
             LOG(FATAL) << "Fail to create sampling_thread, " << berror(rc);
         } else {
             _created = true;
-            if (!registered_atfork) {
-                registered_atfork = true;
-                pthread_atfork(NULL, NULL, child_callback_atfork);
+            // The callback to atfork works for child of child as well, no
+            // need to register in the child again.
+            if (!_registered_atfork) {
+                _registered_atfork = true;
+                pthread_atfork(NULL, NULL, _child_callback_atfork);
             }
         }
     }
@@ -115,13 +109,37 @@ private:
         return static_cast<SamplerCollector*>(arg)->_cumulated_time_us / 1000.0 / 1000.0;
     }
 
+protected:
+    template <typename Collector>
+    SamplerCollector(int64_t interval_us, Collector*)
+        : _created(false)
+        , _stop(false)
+        , _registered_atfork(false)
+        , _interval_us(interval_us)
+        , _cumulated_time_us(0)
+        , _child_callback_atfork(child_callback_atfork<Collector>) {
+        create_sampling_thread();
+    }
+
 private:
     bool _created;
     bool _stop;
+    bool _registered_atfork;
+    const int64_t _interval_us;
     int64_t _cumulated_time_us;
+    void (*_child_callback_atfork)();
     pthread_t _tid;
 };
 
+// Samplers scheduled by Sampler::schedule_high_resolution() are collected
+// in a separate thread.
+class HighResolutionSamplerCollector : public SamplerCollector {
+public:
+    HighResolutionSamplerCollector()
+        : SamplerCollector(HIGH_RESOLUTION_SAMPLING_INTERVAL_US,
+                           (HighResolutionSamplerCollector*)NULL) {}
+};
+
 #ifndef UNIT_TEST
 static PassiveStatus<double>* s_cumulated_time_bvar = NULL;
 static bvar::PerSecond<bvar::PassiveStatus<double> >* s_sampling_thread_usage_bvar = NULL;
@@ -134,11 +152,11 @@ void SamplerCollector::run() {
     //   may be adandoned at any time after forking.
     // * They can't created inside the constructor of SamplerCollector as well,
     //   which results in deadlock.
-    if (s_cumulated_time_bvar == NULL) {
+    if (_interval_us == 1000000L && s_cumulated_time_bvar == NULL) {
         s_cumulated_time_bvar =
             new PassiveStatus<double>(get_cumulated_time, this);
     }
-    if (s_sampling_thread_usage_bvar == NULL) {
+    if (_interval_us == 1000000L && s_sampling_thread_usage_bvar == NULL) {
         s_sampling_thread_usage_bvar =
             new bvar::PerSecond<bvar::PassiveStatus<double> >(
                     "bvar_sampler_collector_usage", s_cumulated_time_bvar, 10);
@@ -175,7 +193,7 @@ void SamplerCollector::run() {
         bool slept = false;
         int64_t now = butil::gettimeofday_us();
         _cumulated_time_us += now - abstime;
-        abstime += 1000000L;
+        abstime += _interval_us;
         while (abstime > now) {
             ::usleep(abstime - now);
             slept = true;
@@ -201,6 +219,10 @@ void Sampler::schedule() {
     *butil::get_leaky_singleton<SamplerCollector>() << this;
 }
 
+void Sampler::schedule_high_resolution() {
+    *butil::get_leaky_singleton<HighResolutionSamplerCollector>() << this;
+}
+
 void Sampler::destroy() {
     _mutex.lock();
     _used = false;
@@ -32,6 +32,10 @@
 namespace bvar {
 namespace detail {
 
+// Interval between consecutive calls to take_sample() of samplers scheduled
+// by Sampler::schedule_high_resolution().
+const int64_t HIGH_RESOLUTION_SAMPLING_INTERVAL_US = 100000L;
+
 template <typename T>
 struct Sample {
     T data;
@@ -54,6 +58,11 @@ public:
     // periodically.
     void schedule();
 
+    // Like schedule() but take_sample() is called every
+    // HIGH_RESOLUTION_SAMPLING_INTERVAL_US in another thread, so that
+    // high-resolution samplers don't slow down others.
+    void schedule_high_resolution();
+
     // Call this function instead of delete to destroy the sampler. Deletion
     // of the sampler may be delayed for seconds.
     void destroy();
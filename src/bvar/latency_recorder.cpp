@@ -39,11 +39,18 @@ const bool ALLOW_UNUSED dummy_bvar_latency_p2 = ::GFLAGS_NS::RegisterFlagValidat
 const bool ALLOW_UNUSED dummy_bvar_latency_p3 = ::GFLAGS_NS::RegisterFlagValidator(
     &FLAGS_bvar_latency_p3, valid_percentile);
 
+DEFINE_bool(bvar_latency_histogram, false,
+            "Compute percentiles of LatencyRecorders created afterwards with "
+            "log-linear histograms which have bounded errors at high "
+            "percentiles, and expose the histograms as <prefix>_latency_histogram");
+
 namespace detail {
 
 typedef PercentileSamples<1022> CombinedPercentileSamples;
 
-CDF::CDF(PercentileWindow* w) : _w(w) {}
+CDF::CDF(PercentileWindow* w) : _w(w), _hw(NULL) {}
+
+CDF::CDF(PercentileWindow* w, HistogramWindow* hw) : _w(w), _hw(hw) {}
 
 CDF::~CDF() {
     hide();
@@ -61,22 +68,34 @@ int CDF::describe_series(
     if (options.test_only) {
         return 0;
     }
-    std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
-    std::vector<GlobalPercentileSamples> buckets;
-    _w->get_samples(&buckets);
-    for (size_t i = 0; i < buckets.size(); ++i) {
-        cb->combine_of(buckets.begin(), buckets.end());
-    }
     std::pair<int, int> values[20];
     size_t n = 0;
-    for (int i = 1; i < 10; ++i) {
-        values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
-    }
-    for (int i = 91; i < 100; ++i) {
-        values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+    if (_hw != NULL) {
+        const GlobalHistogramBuckets h = _hw->get_value();
+        for (int i = 1; i < 10; ++i) {
+            values[n++] = std::make_pair(i*10, h.get_number(i * 0.1));
+        }
+        for (int i = 91; i < 100; ++i) {
+            values[n++] = std::make_pair(i, h.get_number(i * 0.01));
+        }
+        values[n++] = std::make_pair(100, h.get_number(0.999));
+        values[n++] = std::make_pair(101, h.get_number(0.9999));
+    } else {
+        std::unique_ptr<CombinedPercentileSamples> cb(new CombinedPercentileSamples);
+        std::vector<GlobalPercentileSamples> buckets;
+        _w->get_samples(&buckets);
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            cb->combine_of(buckets.begin(), buckets.end());
+        }
+        for (int i = 1; i < 10; ++i) {
+            values[n++] = std::make_pair(i*10, cb->get_number(i * 0.1));
+        }
+        for (int i = 91; i < 100; ++i) {
+            values[n++] = std::make_pair(i, cb->get_number(i * 0.01));
+        }
+        values[n++] = std::make_pair(100, cb->get_number(0.999));
+        values[n++] = std::make_pair(101, cb->get_number(0.9999));
     }
-    values[n++] = std::make_pair(100, cb->get_number(0.999));
-    values[n++] = std::make_pair(101, cb->get_number(0.9999));
     CHECK_EQ(n, arraysize(values));
     os << "{\"label\":\"cdf\",\"data\":[";
     for (size_t i = 0; i < n; ++i) {
@@ -89,6 +108,16 @@ int CDF::describe_series(
     return 0;
 }
 
+CumulativeHistogram::CumulativeHistogram(Histogram* h) : _h(h) {}
+
+CumulativeHistogram::~CumulativeHistogram() {
+    hide();
+}
+
+void CumulativeHistogram::describe(std::ostream& os, bool) const {
+    os << _h->get_value();
+}
+
 static int64_t get_window_recorder_qps(void* arg) {
     detail::Sample<Stat> s;
     static_cast<RecorderWindow*>(arg)->get_span(1, &s);
@@ -131,22 +160,41 @@ static int64_t get_p3(void* arg) {
     return lr->latency_percentile(FLAGS_bvar_latency_p3 / 100.0);
 }
 
-static Vector<int64_t, 4> get_latencies(void *arg) {
-    std::unique_ptr<CombinedPercentileSamples> cb(
-        combine((PercentileWindow*)arg));
+template <typename Samples>
+static Vector<int64_t, 4> get_latencies_of(Samples& s) {
     // NOTE: We don't show 99.99% since it's often significantly larger than
     // other values and make other curves on the plotted graph small and
     // hard to read.
     Vector<int64_t, 4> result;
-    result[0] = cb->get_number(FLAGS_bvar_latency_p1 / 100.0);
-    result[1] = cb->get_number(FLAGS_bvar_latency_p2 / 100.0);
-    result[2] = cb->get_number(FLAGS_bvar_latency_p3 / 100.0);
-    result[3] = cb->get_number(0.999);
+    result[0] = s.get_number(FLAGS_bvar_latency_p1 / 100.0);
+    result[1] = s.get_number(FLAGS_bvar_latency_p2 / 100.0);
+    result[2] = s.get_number(FLAGS_bvar_latency_p3 / 100.0);
+    result[3] = s.get_number(0.999);
     return result;
 }
 
+static Vector<int64_t, 4> get_latencies(void *arg) {
+    std::unique_ptr<CombinedPercentileSamples> cb(
+        combine((PercentileWindow*)arg));
+    return get_latencies_of(*cb);
+}
+
+static Vector<int64_t, 4> get_histogram_latencies(void *arg) {
+    GlobalHistogramBuckets h = ((HistogramWindow*)arg)->get_value();
+    return get_latencies_of(h);
+}
+
+static HistogramWindow* new_histogram_window(Histogram* h, time_t window_size) {
+    return h ? new HistogramWindow(h, window_size) : NULL;
+}
+
 LatencyRecorderBase::LatencyRecorderBase(time_t window_size)
-    : _max_latency(0)
+    : _latency_histogram(FLAGS_bvar_latency_histogram ? new Histogram : NULL)
+    , _latency_histogram_window(
+        new_histogram_window(_latency_histogram.get(), window_size))
+    , _latency_histogram_var(_latency_histogram ?
+                             new CumulativeHistogram(_latency_histogram.get()) : NULL)
+    , _max_latency(0)
     , _latency_window(&_latency, window_size)
     , _max_latency_window(&_max_latency, window_size)
     , _count(get_recorder_count, &_latency)
@@ -157,13 +205,20 @@ LatencyRecorderBase::LatencyRecorderBase(time_t window_size)
     , _latency_p3(get_p3, this)
     , _latency_999(get_percetile<999, 1000>, this)
     , _latency_9999(get_percetile<9999, 10000>, this)
-    , _latency_cdf(&_latency_percentile_window)
-    , _latency_percentiles(get_latencies, &_latency_percentile_window)
+    , _latency_cdf(&_latency_percentile_window, _latency_histogram_window.get())
+    , _latency_percentiles(
+        _latency_histogram ? get_histogram_latencies : get_latencies,
+        _latency_histogram ? (void*)_latency_histogram_window.get() :
+                             (void*)&_latency_percentile_window)
 {}
 
 }  // namespace detail
 
 Vector<int64_t, 4> LatencyRecorder::latency_percentiles() const {
+    if (_latency_histogram_window) {
+        detail::GlobalHistogramBuckets h = _latency_histogram_window->get_value();
+        return detail::get_latencies_of(h);
+    }
     // const_cast here is just to adapt parameter type and safe.
     return detail::get_latencies(
         const_cast<detail::PercentileWindow*>(&_latency_percentile_window));
@@ -206,6 +261,9 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
     // set debug names for printing helpful error log.
     _latency.set_debug_name(prefix);
     _latency_percentile.set_debug_name(prefix);
+    if (_latency_histogram) {
+        _latency_histogram->set_debug_name(prefix);
+    }
 
     if (_latency_window.expose_as(prefix, "latency") != 0) {
         return -1;
@@ -244,6 +302,11 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
     if (_latency_percentiles.expose_as(prefix, "latency_percentiles", DISPLAY_ON_HTML) != 0) {
         return -1;
     }
+    if (_latency_histogram_var &&
+        _latency_histogram_var->expose_as(prefix, "latency_histogram",
+                                          DISPLAY_ON_PLAIN_TEXT) != 0) {
+        return -1;
+    }
     snprintf(namebuf, sizeof(namebuf), "%d%%,%d%%,%d%%,99.9%%",
              (int)FLAGS_bvar_latency_p1, (int)FLAGS_bvar_latency_p2,
              (int)FLAGS_bvar_latency_p3);
@@ -252,6 +315,9 @@ int LatencyRecorder::expose(const butil::StringPiece& prefix1,
 }
 
 int64_t LatencyRecorder::latency_percentile(double ratio) const {
+    if (_latency_histogram_window) {
+        return _latency_histogram_window->get_value().get_number(ratio);
+    }
     std::unique_ptr<detail::CombinedPercentileSamples> cb(
         combine((detail::PercentileWindow*)&_latency_percentile_window));
     return cb->get_number(ratio);
@@ -269,12 +335,24 @@ void LatencyRecorder::hide() {
     _latency_9999.hide();
     _latency_cdf.hide();
     _latency_percentiles.hide();
+    if (_latency_histogram_var) {
+        _latency_histogram_var->hide();
+    }
+}
+
+const std::string& LatencyRecorder::latency_histogram_name() const {
+    static const std::string s_empty;
+    return _latency_histogram_var ? _latency_histogram_var->name() : s_empty;
 }
 
 LatencyRecorder& LatencyRecorder::operator<<(int64_t latency) {
     _latency << latency;
     _max_latency << latency;
-    _latency_percentile << latency;
+    if (_latency_histogram) {
+        *_latency_histogram << latency;
+    } else {
+        _latency_percentile << latency;
+    }
     return *this;
 }
 
@@ -20,10 +20,12 @@
 #ifndef  BVAR_LATENCY_RECORDER_H
 #define  BVAR_LATENCY_RECORDER_H
 
+#include <memory>                          // std::unique_ptr
 #include "bvar/recorder.h"
 #include "bvar/reducer.h"
 #include "bvar/passive_status.h"
 #include "bvar/detail/percentile.h"
+#include "bvar/detail/histogram.h"
 
 namespace bvar {
 namespace detail {
@@ -32,17 +34,33 @@ class Percentile;
 typedef Window<IntRecorder, SERIES_IN_SECOND> RecorderWindow;
 typedef Window<Maxer<int64_t>, SERIES_IN_SECOND> MaxWindow;
 typedef Window<Percentile, SERIES_IN_SECOND> PercentileWindow;
+typedef Window<Histogram, SERIES_IN_SECOND> HistogramWindow;
 
 // NOTE: Always use int64_t in the interfaces no matter what the impl. is.
 
 class CDF : public Variable {
 public:
     explicit CDF(PercentileWindow* w);
+    CDF(PercentileWindow* w, HistogramWindow* hw);
     ~CDF();
     void describe(std::ostream& os, bool quote_string) const override;
     int describe_series(std::ostream& os, const SeriesOptions& options) const override;
 private:
     PercentileWindow* _w; 
+    // Used instead of _w if it's not NULL.
+    HistogramWindow* _hw;
+};
+
+// All latencies recorded by a histogram in the form of
+// {"sum":S,"buckets":[c0,c1,...]} where c_i is the number of latencies
+// less than 2^i, which is exported as a histogram to prometheus.
+class CumulativeHistogram : public Variable {
+public:
+    explicit CumulativeHistogram(Histogram* h);
+    ~CumulativeHistogram();
+    void describe(std::ostream& os, bool quote_string) const override;
+private:
+    Histogram* _h;
 };
 
 // For mimic constructor inheritance.
@@ -51,6 +69,13 @@ public:
     explicit LatencyRecorderBase(time_t window_size);
     time_t window_size() const { return _latency_window.window_size(); }
 protected:
+    // Percentiles are computed from a log-linear histogram instead of
+    // _latency_percentile when -bvar_latency_histogram was on at creation.
+    // Declared first to be destroyed after variables referencing them.
+    std::unique_ptr<Histogram> _latency_histogram;
+    std::unique_ptr<HistogramWindow> _latency_histogram_window;
+    std::unique_ptr<CumulativeHistogram> _latency_histogram_var;
+
     IntRecorder _latency;
     Maxer<int64_t> _max_latency;
     Percentile _latency_percentile;
@@ -111,6 +136,8 @@ public:
     //                                    // foo_bar_read_max_latency
     //                                    // foo_bar_read_count
     //                                    // foo_bar_read_qps
+    //   With -bvar_latency_histogram on, foo_bar_write_latency_histogram
+    //   is exposed as well.
     int expose(const butil::StringPiece& prefix) {
         return expose(butil::StringPiece(), prefix);
     }
@@ -151,6 +178,8 @@ public:
     const std::string& latency_percentiles_name() const
     { return _latency_percentiles.name(); }
     const std::string& latency_cdf_name() const { return _latency_cdf.name(); }
+    // Empty if histogram is not enabled.
+    const std::string& latency_histogram_name() const;
     const std::string& max_latency_name() const
     { return _max_latency_window.name(); }
     const std::string& count_name() const { return _count.name(); }
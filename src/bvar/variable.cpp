@@ -18,6 +18,7 @@
 // Date: 2014/09/22 19:04:47
 
 #include <pthread.h>
+#include <memory>                               // std::unique_ptr
 #include <set>                                  // std::set
 #include <fstream>                              // std::ifstream
 #include <sstream>                              // std::ostringstream
@@ -31,6 +32,7 @@
 #include "butil/file_util.h"                     // butil::FilePath
 #include "bvar/gflag.h"
 #include "bvar/variable.h"
+#include "bvar/detail/binary_dump.h"                 // BinaryFileDumper
 
 namespace bvar {
 
@@ -452,6 +454,43 @@ private:
     std::set<std::string> _exact;
 };
 
+DEFINE_string(bvar_high_resolution_series, "", "Windows(including PerSecond) "
+              "with names matching these wildcards(separated by semicolon) "
+              "save values of every 100ms in last minute when they're "
+              "exposed, see /vars/<name>?series&high_resolution");
+
+namespace detail {
+bool is_high_resolution_series_selected(const std::string& name) {
+    // We can't access string flags directly because it's thread-unsafe.
+    std::string wildcards;
+    if (!GFLAGS_NS::GetCommandLineOption("bvar_high_resolution_series",
+                                         &wildcards) || wildcards.empty()) {
+        return false;
+    }
+    WildcardMatcher matcher(wildcards, '?', false);
+    return matcher.match(name);
+}
+}  // namespace detail
+
+// Location of a described variable inside the buffer shared by all
+// variables dumped in one pass.
+struct DumpedEntry {
+    size_t name_offset;
+    size_t name_size;
+    size_t desc_size;
+};
+
+class DumpedEntryLess {
+public:
+    explicit DumpedEntryLess(const std::string& packed) : _packed(packed) {}
+    bool operator()(const DumpedEntry& e1, const DumpedEntry& e2) const {
+        return butil::StringPiece(_packed.data() + e1.name_offset, e1.name_size)
+            < butil::StringPiece(_packed.data() + e2.name_offset, e2.name_size);
+    }
+private:
+    const std::string& _packed;
+};
+
 DumpOptions::DumpOptions()
     : quote_string(true)
     , question_mark('?')
@@ -502,28 +541,70 @@ int Variable::dump_exposed(Dumper* dumper, const DumpOptions* poptions) {
             }
         }
     } else {
-        // Have to iterate all variables.
-        std::vector<std::string> varnames;
-        bvar::Variable::list_exposed(&varnames, opt.display_filter);
-        // Sort the names to make them more readable.
-        std::sort(varnames.begin(), varnames.end());
-        for (std::vector<std::string>::const_iterator
-                 it = varnames.begin(); it != varnames.end(); ++it) {
-            const std::string& name = *it;
-            if (white_matcher.match(name) && !black_matcher.match(name)) {
-                if (bvar::Variable::describe_exposed(
-                        name, os, opt.quote_string, opt.display_filter) != 0) {
-                    continue;
+        // Have to iterate all variables. Describe matched variables while
+        // walking each sub-map so that every variable is looked up only
+        // once, names and descriptions are packed into one buffer and only
+        // the small offset entries are sorted.
+        std::string packed;
+        std::vector<DumpedEntry> entries;
+        entries.reserve(count_exposed());
+        VarMapWithLock* var_maps = get_var_maps();
+        for (size_t i = 0; i < SUB_MAP_COUNT; ++i) {
+            VarMapWithLock& m = var_maps[i];
+            const size_t entries_begin = entries.size();
+            const size_t packed_begin = packed.size();
+            std::unique_lock<pthread_mutex_t> mu(m.mutex);
+            size_t n = 0;
+            for (VarMap::const_iterator it = m.begin(); it != m.end(); ++it) {
+                if (++n >= 256/*max iterated one pass*/) {
+                    VarMap::PositionHint hint;
+                    m.save_iterator(it, &hint);
+                    n = 0;
+                    mu.unlock();  // yield
+                    mu.lock();
+                    it = m.restore_iterator(hint);
+                    if (it == m.begin()) { // resized
+                        entries.resize(entries_begin);
+                        packed.resize(packed_begin);
+                    }
+                    if (it == m.end()) {
+                        break;
+                    }
                 }
-                if (log_dummped) {
-                    dumpped_info << '\n' << name << ": " << streambuf.data();
+                if (!(it->second.display_filter & opt.display_filter)) {
+                    continue;
                 }
-                if (!dumper->dump(name, streambuf.data())) {
-                    return -1;
+                const std::string& name = it->first;
+                if (!white_matcher.match(name) || black_matcher.match(name)) {
+                    continue;
                 }
                 streambuf.reset();
-                ++count;
+                it->second.var->describe(os, opt.quote_string);
+                const butil::StringPiece desc = streambuf.data();
+                DumpedEntry e;
+                e.name_offset = packed.size();
+                e.name_size = name.size();
+                e.desc_size = desc.size();
+                packed.append(name);
+                packed.append(desc.data(), desc.size());
+                entries.push_back(e);
+            }
+        }
+        // Sort the names to make them more readable.
+        std::sort(entries.begin(), entries.end(), DumpedEntryLess(packed));
+        std::string name;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const DumpedEntry& e = entries[i];
+            name.assign(packed, e.name_offset, e.name_size);
+            const butil::StringPiece desc(
+                packed.data() + e.name_offset + e.name_size, e.desc_size);
+            if (log_dummped) {
+                dumpped_info << '\n' << name << ": " << desc;
             }
+            if (!dumper->dump(name, desc)) {
+                return -1;
+            }
+            ++count;
         }
     }
     if (log_dummped) {
@@ -561,22 +642,26 @@ std::string read_command_name() {
     return s;
 }
 
+static void normalize_dump_prefix(std::string* out, butil::StringPiece s) {
+    out->clear();
+    // remove trailing spaces.
+    const char* p = s.data() + s.size();
+    for (; p != s.data() && isspace(p[-1]); --p) {}
+    s.remove_suffix(s.data() + s.size() - p);
+    // normalize it.
+    if (!s.empty()) {
+        to_underscored_name(out, s);
+        if (butil::back_char(*out) != '_') {
+            out->push_back('_');
+        }
+    }
+}
+
 class FileDumper : public Dumper {
 public:
     FileDumper(const std::string& filename, butil::StringPiece s/*prefix*/)
         : _filename(filename), _fp(NULL) {
-        // setting prefix.
-        // remove trailing spaces.
-        const char* p = s.data() + s.size();
-        for (; p != s.data() && isspace(p[-1]); --p) {}
-        s.remove_suffix(s.data() + s.size() - p);
-        // normalize it.
-        if (!s.empty()) {
-            to_underscored_name(&_prefix, s);
-            if (butil::back_char(_prefix) != '_') {
-                _prefix.push_back('_');
-            }
-        }
+        normalize_dump_prefix(&_prefix, s);
     }
 
     ~FileDumper() {
@@ -683,6 +768,13 @@ DEFINE_string(bvar_dump_tabs, "latency=*_latency*"
                               "; system=*process_*,*malloc_*,*kernel_*",
               "Dump bvar into different tabs according to the filters (seperated by semicolon), "
               "format: *(tab_name=wildcards;)");
+DEFINE_string(bvar_dump_format, "text", "Format of dumped bvar: text or binary. "
+              "`binary' appends values changed since last dump to a .bdata "
+              "file, which can be converted to text by tools/bvar_dump_reader. "
+              "bvar_dump_tabs is not effective for `binary'");
+DEFINE_int32(bvar_dump_binary_max_file_size, 64, "Move the binary dump file "
+             "to <file>.old and write a new one after it grows over so many "
+             "megabytes");
 
 #if !defined(BVAR_NOT_LINK_DEFAULT_VARIABLES)
 // Expose bvar-releated gflags so that they're collected by noah.
@@ -696,6 +788,7 @@ static void* dumping_thread(void*) {
     // destructed when program exits and caused coredumps.
     const std::string command_name = read_command_name();
     std::string last_filename;
+    std::unique_ptr<detail::BinaryFileDumper> binary_dumper;
     while (1) {
         // We can't access string flags directly because it's thread-unsafe.
         std::string filename;
@@ -724,6 +817,20 @@ static void* dumping_thread(void*) {
             LOG(ERROR) << "Fail to get gflags bvar_dump_tabs";
             return NULL;
         }
+        std::string format;
+        if (!GFLAGS_NS::GetCommandLineOption("bvar_dump_format", &format)) {
+            LOG(ERROR) << "Fail to get gflags bvar_dump_format";
+            return NULL;
+        }
+        const bool binary = (format == "binary");
+        if (binary) {
+            // Don't overwrite the text file which may be read by others.
+            butil::FilePath path(filename);
+            if (path.FinalExtension() == ".data") {
+                path = path.RemoveFinalExtension();
+            }
+            filename = path.AddExtension("bdata").value();
+        }
 
         if (FLAGS_bvar_dump && !filename.empty()) {
             // Replace first <app> in filename with program name. We can't use
@@ -744,11 +851,28 @@ static void* dumping_thread(void*) {
             if (pos2 != std::string::npos) {
                 prefix.replace(pos2, 5/*<app>*/, command_name);
             }            
-            FileDumperGroup dumper(tabs, filename, prefix);
-            int nline = Variable::dump_exposed(&dumper, &options);
+            int nline = 0;
+            if (binary) {
+                std::string normalized_prefix;
+                normalize_dump_prefix(&normalized_prefix, prefix);
+                if (binary_dumper == NULL ||
+                    binary_dumper->filename() != filename ||
+                    binary_dumper->prefix() != normalized_prefix) {
+                    binary_dumper.reset(new detail::BinaryFileDumper(
+                            filename, normalized_prefix,
+                            (size_t)FLAGS_bvar_dump_binary_max_file_size << 20));
+                }
+                nline = binary_dumper->dump_exposed(&options);
+            } else {
+                binary_dumper.reset();
+                FileDumperGroup dumper(tabs, filename, prefix);
+                nline = Variable::dump_exposed(&dumper, &options);
+            }
             if (nline < 0) {
                 LOG(ERROR) << "Fail to dump vars into " << filename;
             }
+        } else {
+            binary_dumper.reset();
         }
 
         // We need to separate the sleeping into a long interruptible sleep
@@ -833,6 +957,28 @@ const bool ALLOW_UNUSED dummy_bvar_dump_prefix = ::GFLAGS_NS::RegisterFlagValida
 const bool ALLOW_UNUSED dummy_bvar_dump_tabs = ::GFLAGS_NS::RegisterFlagValidator(
     &FLAGS_bvar_dump_tabs, wakeup_dumping_thread);
 
+static bool validate_bvar_dump_format(const char* flagname,
+                                      const std::string& v) {
+    if (v != "text" && v != "binary") {
+        LOG(ERROR) << "Invalid " << flagname << "=" << v;
+        return false;
+    }
+    return wakeup_dumping_thread(flagname, v);
+}
+const bool ALLOW_UNUSED dummy_bvar_dump_format = ::GFLAGS_NS::RegisterFlagValidator(
+    &FLAGS_bvar_dump_format, validate_bvar_dump_format);
+
+static bool validate_bvar_dump_binary_max_file_size(const char*, int32_t v) {
+    if (v < 1) {
+        LOG(ERROR) << "Invalid bvar_dump_binary_max_file_size=" << v;
+        return false;
+    }
+    return true;
+}
+const bool ALLOW_UNUSED dummy_bvar_dump_binary_max_file_size =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_bvar_dump_binary_max_file_size,
+                                       validate_bvar_dump_binary_max_file_size);
+
 void to_underscored_name(std::string* name, const butil::StringPiece& src) {
     name->reserve(name->size() + src.size() + 8/*just guess*/);
     for (const char* p = src.data(); p != src.data() + src.size(); ++p) {
@@ -854,6 +1000,10 @@ void to_underscored_name(std::string* name, const butil::StringPiece& src) {
     }
 }
 
+// Without this, flags of the exporter are stripped.
+extern int do_link_exporter;
+int dummy_link_exporter = do_link_exporter;
+
 // UT don't need default variables.
 #if !defined(BVAR_NOT_LINK_DEFAULT_VARIABLES)
 // Without these, default_variables.o are stripped.
@@ -78,10 +78,14 @@ struct DumpOptions {
 };
 
 struct SeriesOptions {
-    SeriesOptions() : fixed_length(true), test_only(false) {}
+    SeriesOptions()
+        : fixed_length(true), test_only(false), high_resolution(false) {}
     
     bool fixed_length; // useless now
     bool test_only;
+    // Describe the series sampled every 100ms instead, which exists only
+    // for windows enabled high-resolution series.
+    bool high_resolution;
 };
 
 // Base class of all bvar.
@@ -21,6 +21,8 @@
 #define  BVAR_WINDOW_H
 
 #include <limits>                                 // std::numeric_limits
+#include <vector>                                 // std::vector
+#include <algorithm>                              // std::min
 #include <math.h>                                 // round
 #include <gflags/gflags_declare.h>
 #include "butil/logging.h"                         // LOG
@@ -38,6 +40,38 @@ enum SeriesFrequency {
 };
 
 namespace detail {
+
+// Number of samples kept by high-resolution series, namely 60 seconds.
+const size_t HIGH_RESOLUTION_SERIES_SIZE = 600;
+
+// True if `name' matches -bvar_high_resolution_series.
+bool is_high_resolution_series_selected(const std::string& name);
+
+inline bool is_void_op(const VoidOp&) { return true; }
+template <typename Op> inline bool is_void_op(const Op&) { return false; }
+
+// Convert the difference between two samples into a per-second value.
+template <typename T, typename Enabler = void>
+struct PerSecondValue {
+    static T get(const T& delta, int64_t /*time_us*/) { return delta; }
+};
+
+template <typename T>
+struct PerSecondValue<T, typename butil::enable_if<
+                             butil::is_integral<T>::value>::type> {
+    static T get(const T& delta, int64_t time_us) {
+        return static_cast<T>(round(delta * 1000000.0 / time_us));
+    }
+};
+
+template <typename T>
+struct PerSecondValue<T, typename butil::enable_if<
+                             butil::is_floating_point<T>::value>::type> {
+    static T get(const T& delta, int64_t time_us) {
+        return static_cast<T>(delta * 1000000.0 / time_us);
+    }
+};
+
 // Just for constructor reusing of Window<>
 template <typename R, SeriesFrequency series_freq>
 class WindowBase : public Variable {
@@ -76,11 +110,62 @@ public:
         detail::Series<value_type, Op> _series;
     };
     
+    // Sample `var' every HIGH_RESOLUTION_SAMPLING_INTERVAL_US and keep the
+    // latest HIGH_RESOLUTION_SERIES_SIZE differences between samples, which
+    // reveals bursts hidden by the one-second sampling.
+    class HighResolutionSampler : public detail::Sampler {
+    public:
+        explicit HighResolutionSampler(R* var) : _var(var), _n(0) {}
+        ~HighResolutionSampler() {}
+        void take_sample() override {
+            // Called with _mutex locked.
+            _samples[_n % arraysize(_samples)] =
+                Sample<value_type>(_var->get_value(), butil::gettimeofday_us());
+            ++_n;
+        }
+        void describe(std::ostream& os) {
+            std::vector<Sample<value_type> > samples;
+            {
+                BAIDU_SCOPED_LOCK(this->_mutex);
+                const size_t n = std::min(_n, arraysize(_samples));
+                samples.reserve(n);
+                for (size_t i = _n - n; i < _n; ++i) {
+                    samples.push_back(_samples[i % arraysize(_samples)]);
+                }
+            }
+            os << "{\"label\":\"high_resolution\",\"data\":[";
+            for (size_t i = 1; i < samples.size(); ++i) {
+                if (i != 1) {
+                    os << ',';
+                }
+                value_type delta = samples[i].data;
+                _var->inv_op()(delta, samples[i - 1].data);
+                const int64_t time_us =
+                    samples[i].time_us - samples[i - 1].time_us;
+                // Seconds before the latest sample.
+                os << '[' << (samples[i].time_us - samples.back().time_us) / 1000
+                   / 1000.0 << ',';
+                if (series_freq == SERIES_IN_SECOND && time_us > 0) {
+                    os << PerSecondValue<value_type>::get(delta, time_us);
+                } else {
+                    os << delta;
+                }
+                os << ']';
+            }
+            os << "]}";
+        }
+    private:
+        R* _var;
+        size_t _n;
+        Sample<value_type> _samples[HIGH_RESOLUTION_SERIES_SIZE + 1];
+    };
+
     WindowBase(R* var, time_t window_size)
         : _var(var)
         , _window_size(window_size > 0 ? window_size : FLAGS_bvar_dump_interval)
         , _sampler(var->get_sampler())
-        , _series_sampler(NULL) {
+        , _series_sampler(NULL)
+        , _high_resolution_sampler(NULL) {
         CHECK_EQ(0, _sampler->set_window_size(_window_size));
     }
     
@@ -90,6 +175,30 @@ public:
             _series_sampler->destroy();
             _series_sampler = NULL;
         }
+        if (_high_resolution_sampler) {
+            _high_resolution_sampler->destroy();
+            _high_resolution_sampler = NULL;
+        }
+    }
+
+    // Save differences of the underlying variable in every 100ms within
+    // last minute, which are shown by /vars/<name>?series&high_resolution.
+    // Values of PerSecond<> are divided by the duration as well.
+    // Variables with names matching -bvar_high_resolution_series call this
+    // method automatically when they're exposed.
+    // Returns 0 on success, -1 when the reducer can't be inversed(e.g. Maxer)
+    // thus sampling more frequently is impossible.
+    int enable_high_resolution_series() {
+        if (is_void_op(_var->inv_op())) {
+            LOG(ERROR) << "High-resolution series of `" << this->name()
+                       << "' requires a reducer with inverse operator";
+            return -1;
+        }
+        if (_high_resolution_sampler == NULL) {
+            _high_resolution_sampler = new HighResolutionSampler(_var);
+            _high_resolution_sampler->schedule_high_resolution();
+        }
+        return 0;
     }
 
     bool get_span(time_t window_size, detail::Sample<value_type>* result) const {
@@ -125,6 +234,15 @@ public:
     time_t window_size() const { return _window_size; }
 
     int describe_series(std::ostream& os, const SeriesOptions& options) const override {
+        if (options.high_resolution) {
+            if (_high_resolution_sampler == NULL) {
+                return 1;
+            }
+            if (!options.test_only) {
+                _high_resolution_sampler->describe(os);
+            }
+            return 0;
+        }
         if (_series_sampler == NULL) {
             return 1;
         }
@@ -151,6 +269,11 @@ protected:
             _series_sampler = new SeriesSampler(this, _var);
             _series_sampler->schedule();
         }
+        if (rc == 0 &&
+            _high_resolution_sampler == NULL &&
+            is_high_resolution_series_selected(this->name())) {
+            enable_high_resolution_series();
+        }
         return rc;
     }
 
@@ -158,6 +281,7 @@ protected:
     time_t _window_size;
     sampler_type* _sampler;
     SeriesSampler* _series_sampler;
+    HighResolutionSampler* _high_resolution_sampler;
 };
 
 }  // namespace detail
@@ -193,7 +193,7 @@ protected:
                                    brpc::policy::PackRpcRequest,
                                    NULL, ProcessRpcRequest,
                                    VerifyMyRequest, NULL, NULL,
-                                   brpc::CONNECTION_TYPE_ALL, "baidu_std" };
+                                   brpc::CONNECTION_TYPE_ALL, "baidu_std", NULL };
         ASSERT_EQ(0,  RegisterProtocol((brpc::ProtocolType)30, dummy_protocol));
     }
 
@@ -1186,6 +1186,55 @@ protected:
         StopAndJoin();
     }
 
+    void TestMaxConcurrency(bool single_server, bool per_server) {
+        std::cout << " *** single=" << single_server
+                  << " per_server=" << per_server << std::endl;
+        ASSERT_EQ(0, StartAccept(_ep));
+        brpc::ChannelOptions opt;
+        opt.max_retry = 0;
+        if (per_server) {
+            opt.max_concurrency_per_server = 1;
+        } else {
+            opt.max_concurrency = 1;
+        }
+        brpc::Channel channel;
+        if (single_server) {
+            ASSERT_EQ(0, channel.Init(_ep, &opt));
+        } else {
+            ASSERT_EQ(0, channel.Init(_naming_url.c_str(), "rr", &opt));
+        }
+
+        brpc::Controller cntl1;
+        test::EchoRequest req1;
+        test::EchoResponse res1;
+        req1.set_message(__FUNCTION__);
+        req1.set_sleep_us(50000); // 50ms
+        const brpc::CallId cid1 = cntl1.call_id();
+        ::test::EchoService::Stub(&channel).Echo(
+            &cntl1, &req1, &res1, brpc::DoNothing());
+
+        // Rejected locally and immediately while the first RPC is running.
+        brpc::Controller cntl2;
+        test::EchoRequest req2;
+        test::EchoResponse res2;
+        req2.set_message(__FUNCTION__);
+        butil::Timer tm;
+        tm.start();
+        CallMethod(&channel, &cntl2, &req2, &res2, false);
+        tm.stop();
+        EXPECT_EQ(brpc::ELIMIT, cntl2.ErrorCode()) << cntl2.ErrorText();
+        EXPECT_LT(tm.m_elapsed(), 20);
+
+        bthread_id_join(cid1);
+        EXPECT_EQ(0, cntl1.ErrorCode()) << cntl1.ErrorText();
+
+        // Concurrency is released after the first RPC ends.
+        brpc::Controller cntl3;
+        CallMethod(&channel, &cntl3, &req2, &res2, false);
+        EXPECT_EQ(0, cntl3.ErrorCode()) << cntl3.ErrorText();
+        StopAndJoin();
+    }
+
     void TestRPCTimeoutParallel(
         bool single_server, bool async, bool short_connection) {
         std::cout << " *** single=" << single_server
@@ -2250,6 +2299,21 @@ TEST_F(ChannelTest, timeout) {
     }
 }
 
+TEST_F(ChannelTest, max_concurrency) {
+    for (int i = 0; i <= 1; ++i) { // Flag SingleServer
+        for (int j = 0; j <= 1; ++j) { // Flag PerServer
+            TestMaxConcurrency(i, j);
+        }
+    }
+}
+
+TEST_F(ChannelTest, invalid_max_concurrency) {
+    brpc::ChannelOptions opt;
+    opt.max_concurrency = "not_exist_limiter";
+    brpc::Channel channel;
+    ASSERT_EQ(-1, channel.Init(_ep, &opt));
+}
+
 TEST_F(ChannelTest, timeout_parallel) {
     for (int i = 0; i <= 1; ++i) { // Flag SingleServer 
         for (int j = 0; j <= 1; ++j) { // Flag Asynchronous
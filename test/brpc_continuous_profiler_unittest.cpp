@@ -0,0 +1,107 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <sstream>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/time.h"
+#include "bthread/bthread.h"
+#include "brpc/builtin/flame_graph.h"
+#include "brpc/details/continuous_profiler.h"
+
+namespace brpc {
+DECLARE_int32(cpu_continuous_profiling_hz);
+}
+
+extern "C" {
+int64_t __attribute__((noinline)) continuous_profiler_test_burn(int64_t ms) {
+    const int64_t end_us = butil::cpuwide_time_us() + ms * 1000;
+    volatile int64_t x = 0;
+    while (butil::cpuwide_time_us() < end_us) {
+        for (int i = 0; i < 1000; ++i) {
+            x = x + i;
+        }
+    }
+    return x;
+}
+}
+
+namespace {
+
+void* burn_in_bthread(void*) {
+    brpc::ScopedCpuProfilingTag tag("test.BurnService.Burn");
+    continuous_profiler_test_burn(500);
+    return NULL;
+}
+
+TEST(ContinuousProfilerTest, sanity) {
+    brpc::FoldedStacks empty;
+    ASSERT_EQ(-1, brpc::GetContinuousCpuProfile(0, &empty));
+    ASSERT_EQ("", google::SetCommandLineOption("cpu_continuous_profiling_hz", "2000"));
+    ASSERT_NE("", google::SetCommandLineOption("cpu_continuous_profiling_hz", "997"));
+    ASSERT_EQ(997, brpc::FLAGS_cpu_continuous_profiling_hz);
+
+    bthread_t th;
+    ASSERT_EQ(0, bthread_start_background(&th, NULL, burn_in_bthread, NULL));
+    ASSERT_EQ(0, bthread_join(th, NULL));
+    // Untagged samples.
+    continuous_profiler_test_burn(200);
+    // Wait for samples to be aggregated.
+    usleep(300000);
+
+    brpc::FoldedStacks stacks;
+    ASSERT_EQ(0, brpc::GetContinuousCpuProfile(60, &stacks));
+    ASSERT_EQ("samples", stacks.unit());
+    std::ostringstream os;
+    stacks.PrintFolded(os);
+    const std::string folded = os.str();
+    size_t tagged = 0;
+    size_t untagged = 0;
+    std::istringstream is(folded);
+    std::string line;
+    while (std::getline(is, line)) {
+        if (line.find("continuous_profiler_test_burn") == std::string::npos) {
+            continue;
+        }
+        if (line.compare(0, 22, "test.BurnService.Burn;") == 0) {
+            ++tagged;
+        } else {
+            ++untagged;
+        }
+    }
+    ASSERT_GT(tagged, 0u) << folded;
+    ASSERT_GT(untagged, 0u) << folded;
+
+    // No samples are taken when suspended or turned off.
+    brpc::SuspendContinuousCpuProfiling();
+    const int64_t total = stacks.total();
+    continuous_profiler_test_burn(200);
+    usleep(300000);
+    brpc::FoldedStacks stacks2;
+    ASSERT_EQ(0, brpc::GetContinuousCpuProfile(0, &stacks2));
+    ASSERT_LE(stacks2.total(), total + 2);
+    brpc::ResumeContinuousCpuProfiling();
+
+    ASSERT_NE("", google::SetCommandLineOption("cpu_continuous_profiling_hz", "0"));
+    continuous_profiler_test_burn(200);
+    usleep(300000);
+    brpc::FoldedStacks stacks3;
+    ASSERT_EQ(0, brpc::GetContinuousCpuProfile(0, &stacks3));
+    ASSERT_LE(stacks3.total(), stacks2.total() + 2);
+}
+
+} // namespace
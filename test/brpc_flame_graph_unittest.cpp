@@ -0,0 +1,196 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <sstream>
+#include <gtest/gtest.h>
+#include "butil/file_util.h"
+#include "butil/string_printf.h"
+#include "butil/time.h"
+#include "brpc/details/symbolizer.h"
+#include "brpc/builtin/flame_graph.h"
+
+extern "C" {
+void __attribute__((noinline)) flame_graph_test_outer() { asm volatile(""); }
+void __attribute__((noinline)) flame_graph_test_inner() { asm volatile(""); }
+}
+
+namespace {
+
+uint64_t addr_of(void (*fn)()) {
+    return reinterpret_cast<uint64_t>(fn);
+}
+
+std::string self_maps() {
+    std::string maps;
+    EXPECT_TRUE(butil::ReadFileToString(butil::FilePath("/proc/self/maps"), &maps));
+    return maps;
+}
+
+TEST(FlameGraphTest, folded) {
+    brpc::FoldedStacks stacks;
+    stacks.ParseFolded("main;b;c 3\n"
+                       "main;a 2\n"
+                       "malformed\n"
+                       "main;b;c 4\n"
+                       "main;a;x 1\n");
+    ASSERT_EQ(3u, stacks.size());
+    ASSERT_EQ(10, stacks.total());
+    std::ostringstream os;
+    stacks.PrintFolded(os);
+    ASSERT_EQ("main;a 2\nmain;a;x 1\nmain;b;c 7\n", os.str());
+
+    brpc::FoldedStacks base;
+    base.Add("main;a", 5);
+    base.Add("main;b;c", 3);
+    stacks.Subtract(base);
+    os.str("");
+    stacks.PrintFolded(os);
+    ASSERT_EQ("main;a;x 1\nmain;b;c 4\n", os.str());
+}
+
+TEST(FlameGraphTest, symbolize_relocated) {
+    brpc::Symbolizer s;
+    const uint64_t outer = addr_of(flame_graph_test_outer);
+    ASSERT_EQ("flame_graph_test_outer", s.Symbolize(outer, false));
+    ASSERT_EQ("flame_graph_test_outer", s.Symbolize(outer + 1, true));
+
+    // Pretend that the profile was written by another run of the program
+    // whose code was loaded at a different address.
+    const uint64_t delta = 0x100000000ULL;
+    std::string maps;
+    std::istringstream is(self_maps());
+    std::string line;
+    while (std::getline(is, line)) {
+        unsigned long long start = 0;
+        unsigned long long end = 0;
+        int n = 0;
+        ASSERT_EQ(2, sscanf(line.c_str(), "%llx-%llx%n", &start, &end, &n));
+        maps.append(butil::string_printf("%llx-%llx", start + delta, end + delta));
+        maps.append(line, n, std::string::npos);
+        maps.push_back('\n');
+    }
+    brpc::Symbolizer s2;
+    s2.SetMappings(maps);
+    ASSERT_EQ("flame_graph_test_outer", s2.Symbolize(outer + delta, false));
+    ASSERT_EQ("0x1234", s2.Symbolize(0x1234, false));
+}
+
+TEST(FlameGraphTest, contention_profile) {
+    const std::string profile = butil::string_printf(
+        "--- contention\n"
+        "cycles/second=1000000000\n"
+        "1000 3 @ 0x%" PRIx64 " 0x%" PRIx64 "\n"
+        "500 1 @ 0x%" PRIx64 "\n",
+        addr_of(flame_graph_test_inner) + 1, addr_of(flame_graph_test_outer) + 1,
+        addr_of(flame_graph_test_outer) + 1) + self_maps();
+    brpc::Symbolizer s;
+    std::string error;
+    brpc::FoldedStacks stacks;
+    ASSERT_EQ(0, stacks.ParseProfile(profile, false, &s, &error)) << error;
+    std::ostringstream os;
+    stacks.PrintFolded(os);
+    ASSERT_EQ("flame_graph_test_outer 500\n"
+              "flame_graph_test_outer;flame_graph_test_inner 1000\n", os.str());
+    ASSERT_EQ("nanoseconds", stacks.unit());
+
+    brpc::FoldedStacks counts;
+    ASSERT_EQ(0, counts.ParseProfile(profile, true, &s, &error)) << error;
+    ASSERT_EQ(4, counts.total());
+    ASSERT_EQ("contentions", counts.unit());
+}
+
+TEST(FlameGraphTest, cpu_profile) {
+    std::vector<uintptr_t> slots = { 0, 3, 0, 10000, 0 };
+    // Frames of cpu profiles start with the exact pc.
+    slots.insert(slots.end(), { 7, 2, (uintptr_t)addr_of(flame_graph_test_inner),
+                                (uintptr_t)addr_of(flame_graph_test_outer) + 1 });
+    slots.insert(slots.end(), { 5, 1, (uintptr_t)addr_of(flame_graph_test_outer) });
+    slots.insert(slots.end(), { 0, 1, 0 });
+    std::string profile((const char*)&slots[0], slots.size() * sizeof(uintptr_t));
+    profile.append(self_maps());
+    brpc::Symbolizer s;
+    std::string error;
+    brpc::FoldedStacks stacks;
+    ASSERT_EQ(0, stacks.ParseProfile(profile, false, &s, &error)) << error;
+    std::ostringstream os;
+    stacks.PrintFolded(os);
+    ASSERT_EQ("flame_graph_test_outer 5\n"
+              "flame_graph_test_outer;flame_graph_test_inner 7\n", os.str());
+
+    profile.resize(sizeof(uintptr_t) * 8);
+    ASSERT_EQ(-1, stacks.ParseProfile(profile, false, &s, &error));
+    ASSERT_FALSE(error.empty());
+}
+
+TEST(FlameGraphTest, heap_profile) {
+    const std::string profile = butil::string_printf(
+        "heap profile:    3:     3072 [     3:     3072] @ growthz\n"
+        "     2:     2048 [     2:     2048] @ 0x%" PRIx64 " 0x%" PRIx64 "\n"
+        "     1:     1024 [     1:     1024] @ 0x%" PRIx64 "\n"
+        "\nMAPPED_LIBRARIES:\n",
+        addr_of(flame_graph_test_inner) + 1, addr_of(flame_graph_test_outer) + 1,
+        addr_of(flame_graph_test_outer) + 1) + self_maps();
+    brpc::Symbolizer s;
+    std::string error;
+    brpc::FoldedStacks stacks;
+    ASSERT_EQ(0, stacks.ParseProfile(profile, false, &s, &error)) << error;
+    std::ostringstream os;
+    stacks.PrintFolded(os);
+    ASSERT_EQ("flame_graph_test_outer 1024\n"
+              "flame_graph_test_outer;flame_graph_test_inner 2048\n", os.str());
+    brpc::FoldedStacks objects;
+    ASSERT_EQ(0, objects.ParseProfile(profile, true, &s, &error)) << error;
+    ASSERT_EQ(3, objects.total());
+    ASSERT_EQ("objects", objects.unit());
+}
+
+TEST(FlameGraphTest, render) {
+    brpc::FoldedStacks stacks;
+    stacks.set_unit("samples");
+    stacks.Add("main;std::vector<int>::push_back", 30);
+    stacks.Add("main;tiny", 0);
+    stacks.Add("main;run;work", 70);
+    std::ostringstream os;
+    stacks.RenderFlameGraph(os, "cpu <test>");
+    const std::string svg = os.str();
+    ASSERT_NE(std::string::npos, svg.find("<svg "));
+    ASSERT_NE(std::string::npos, svg.find("FlameGraph"));
+    ASSERT_NE(std::string::npos, svg.find("cpu &lt;test&gt;"));
+    ASSERT_NE(std::string::npos, svg.find("data-n=\"std::vector&lt;int&gt;::push_back\""));
+    ASSERT_NE(std::string::npos, svg.find("<title>work (70 samples, 70.00%)</title>"));
+    ASSERT_NE(std::string::npos, svg.find("<title>all (100 samples, 100.00%)</title>"));
+    ASSERT_EQ(std::string::npos, svg.find("data-n=\"tiny\""));
+    ASSERT_NE(std::string::npos, svg.find("</svg>"));
+}
+
+TEST(FlameGraphTest, symbolize_perf) {
+    // Symbolize many distinct addresses of this binary, which is what
+    // pprof spends most of its time on.
+    const uint64_t outer = addr_of(flame_graph_test_outer);
+    butil::Timer tm;
+    tm.start();
+    brpc::Symbolizer s;
+    size_t found = 0;
+    for (uint64_t i = 0; i < 20000; ++i) {
+        found += (s.Symbolize(outer + i * 16, false)[0] != '0');
+    }
+    tm.stop();
+    LOG(INFO) << "Symbolized 20000 addresses in " << tm.m_elapsed() << "ms";
+    ASSERT_GT(found, 0u);
+}
+
+} // namespace
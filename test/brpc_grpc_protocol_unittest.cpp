@@ -22,9 +22,17 @@
 #include "brpc/server.h"
 #include "brpc/channel.h"
 #include "brpc/grpc.h"
+#include "bthread/countdown_event.h"
 #include "butil/time.h"
 #include "grpc.pb.h"
 
+namespace brpc {
+namespace policy {
+DECLARE_int32(h2_client_stream_window_size);
+DECLARE_int32(h2_client_connection_window_size);
+}
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
@@ -47,6 +55,89 @@ const std::string g_req = "wyt";
 const int64_t g_timeout_ms = 1000;
 const std::string g_protocol = "h2:grpc";
 
+// Reply each message of the client with "Hello, <message>", or a message
+// joining all messages when the client half-closes the stream if
+// `reply_at_close' is true.
+class ServerStreamHandler : public brpc::GrpcStreamHandler {
+public:
+    explicit ServerStreamHandler(bool reply_at_close)
+        : _reply_at_close(reply_at_close) {}
+
+    void OnReceivedMessages(brpc::GrpcStream* stream,
+                            butil::IOBuf* const messages[],
+                            size_t size) override {
+        for (size_t i = 0; i < size; ++i) {
+            test::GrpcRequest req;
+            butil::IOBufAsZeroCopyInputStream wrapper(*messages[i]);
+            EXPECT_TRUE(req.ParseFromZeroCopyStream(&wrapper));
+            if (_reply_at_close) {
+                if (!_joined.empty()) {
+                    _joined.push_back(',');
+                }
+                _joined.append(req.message());
+                continue;
+            }
+            test::GrpcResponse res;
+            res.set_message(g_prefix + req.message());
+            int rc = stream->Write(res);
+            while (rc == EAGAIN) {
+                EXPECT_EQ(0, stream->Wait(NULL));
+                rc = stream->Write(res);
+            }
+            EXPECT_EQ(0, rc);
+        }
+    }
+
+    void OnClosed(brpc::GrpcStream* stream, int error_code,
+                  const std::string&) override {
+        if (_reply_at_close && error_code == 0) {
+            test::GrpcResponse res;
+            res.set_message(g_prefix + _joined);
+            EXPECT_EQ(0, stream->Write(res));
+        }
+        stream->Close();
+        delete this;
+    }
+
+private:
+    bool _reply_at_close;
+    std::string _joined;
+};
+
+class ClientStreamHandler : public brpc::GrpcStreamHandler {
+public:
+    ClientStreamHandler() : _closed(1), _received_bytes(0), _error_code(-1) {}
+
+    void OnReceivedMessages(brpc::GrpcStream*,
+                            butil::IOBuf* const messages[],
+                            size_t size) override {
+        for (size_t i = 0; i < size; ++i) {
+            _received_bytes.fetch_add(messages[i]->size(),
+                                      butil::memory_order_relaxed);
+            test::GrpcResponse res;
+            butil::IOBufAsZeroCopyInputStream wrapper(*messages[i]);
+            EXPECT_TRUE(res.ParseFromZeroCopyStream(&wrapper));
+            _messages.push_back(res.message());
+        }
+    }
+
+    void OnClosed(brpc::GrpcStream*, int error_code,
+                  const std::string& error_text) override {
+        _error_code = error_code;
+        _error_text = error_text;
+        _closed.signal();
+    }
+
+    void WaitClosed() { _closed.wait(); }
+
+    bthread::CountdownEvent _closed;
+    butil::atomic<int64_t> _received_bytes;
+    // Only accessed in the handler before _closed is signalled.
+    std::vector<std::string> _messages;
+    int _error_code;
+    std::string _error_text;
+};
+
 class MyGrpcService : public ::test::GrpcService {
 public:
     void Method(::google::protobuf::RpcController* cntl_base,
@@ -86,6 +177,54 @@ public:
         res->set_message(g_prefix + req->message());
         return;
     }
+
+    // Reply `req->timeout_us()' (3 if absent) messages, or fail the call
+    // with EINTERNAL after accepting the stream if `req->return_error()'.
+    void ServerStream(::google::protobuf::RpcController* cntl_base,
+                      const ::test::GrpcRequest* req,
+                      ::test::GrpcResponse*,
+                      ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        butil::intrusive_ptr<brpc::GrpcStream> stream;
+        brpc::GrpcStreamOptions options;
+        // Write() never fails with EAGAIN.
+        options.max_buf_size = 0;
+        ASSERT_EQ(0, brpc::GrpcStreamAccept(&stream, cntl_base, &options));
+        if (req->return_error()) {
+            EXPECT_EQ(0, stream->Close(brpc::EINTERNAL, g_prefix));
+            return;
+        }
+        const int n = req->has_timeout_us() ? req->timeout_us() : 3;
+        for (int i = 0; i < n; ++i) {
+            test::GrpcResponse res;
+            res.set_message(g_prefix + req->message());
+            // Buffered until the response headers are sent.
+            EXPECT_EQ(0, stream->Write(res));
+        }
+        EXPECT_EQ(0, stream->Close());
+    }
+
+    void ClientStream(::google::protobuf::RpcController* cntl_base,
+                      const ::test::GrpcRequest*,
+                      ::test::GrpcResponse*,
+                      ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        butil::intrusive_ptr<brpc::GrpcStream> stream;
+        brpc::GrpcStreamOptions options;
+        options.handler = new ServerStreamHandler(true);
+        ASSERT_EQ(0, brpc::GrpcStreamAccept(&stream, cntl_base, &options));
+    }
+
+    void BidiStream(::google::protobuf::RpcController* cntl_base,
+                    const ::test::GrpcRequest*,
+                    ::test::GrpcResponse*,
+                    ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        butil::intrusive_ptr<brpc::GrpcStream> stream;
+        brpc::GrpcStreamOptions options;
+        options.handler = new ServerStreamHandler(false);
+        ASSERT_EQ(0, brpc::GrpcStreamAccept(&stream, cntl_base, &options));
+    }
 };
 
 class GrpcTest : public ::testing::Test {
@@ -272,4 +411,223 @@ TEST_F(GrpcTest, GrpcTimeOut) {
     }
 }
 
+static void MakeRequest(test::GrpcRequest* req, const std::string& message) {
+    req->set_message(message);
+    req->set_gzip(false);
+    req->set_return_error(false);
+}
+
+TEST_F(GrpcTest, server_streaming) {
+    ClientStreamHandler handler;
+    brpc::GrpcStreamOptions options;
+    options.handler = &handler;
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::GrpcStream> stream;
+    ASSERT_EQ(0, brpc::GrpcStreamCreate(&stream, &cntl, &options));
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    MakeRequest(&req, g_req);
+    test::GrpcService_Stub stub(&_channel);
+    stub.ServerStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    // Half-closed after the request already.
+    EXPECT_EQ(EINVAL, stream->Write(req));
+    handler.WaitClosed();
+    EXPECT_EQ(0, handler._error_code) << handler._error_text;
+    ASSERT_EQ(3u, handler._messages.size());
+    for (size_t i = 0; i < handler._messages.size(); ++i) {
+        EXPECT_EQ(g_prefix + g_req, handler._messages[i]);
+    }
+}
+
+TEST_F(GrpcTest, server_streaming_error) {
+    ClientStreamHandler handler;
+    brpc::GrpcStreamOptions options;
+    options.handler = &handler;
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::GrpcStream> stream;
+    ASSERT_EQ(0, brpc::GrpcStreamCreate(&stream, &cntl, &options));
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    MakeRequest(&req, g_req);
+    req.set_return_error(true);
+    test::GrpcService_Stub stub(&_channel);
+    stub.ServerStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    handler.WaitClosed();
+    EXPECT_EQ(brpc::EINTERNAL, handler._error_code);
+    EXPECT_EQ(g_prefix, handler._error_text);
+    EXPECT_TRUE(handler._messages.empty());
+}
+
+TEST_F(GrpcTest, client_streaming) {
+    ClientStreamHandler handler;
+    brpc::GrpcStreamOptions options;
+    options.handler = &handler;
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::GrpcStream> stream;
+    ASSERT_EQ(0, brpc::GrpcStreamCreate(&stream, &cntl, &options));
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    MakeRequest(&req, "a");
+    test::GrpcService_Stub stub(&_channel);
+    stub.ClientStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    MakeRequest(&req, "b");
+    ASSERT_EQ(0, stream->Write(req));
+    MakeRequest(&req, "c");
+    ASSERT_EQ(0, stream->Write(req));
+    ASSERT_EQ(0, stream->Close());
+    EXPECT_EQ(EINVAL, stream->Close());
+    handler.WaitClosed();
+    EXPECT_EQ(0, handler._error_code) << handler._error_text;
+    ASSERT_EQ(1u, handler._messages.size());
+    EXPECT_EQ(g_prefix + "a,b,c", handler._messages[0]);
+}
+
+TEST_F(GrpcTest, bidi_streaming) {
+    ClientStreamHandler handler;
+    brpc::GrpcStreamOptions options;
+    options.handler = &handler;
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::GrpcStream> stream;
+    ASSERT_EQ(0, brpc::GrpcStreamCreate(&stream, &cntl, &options));
+    // Messages written before the call are sent after the request.
+    test::GrpcRequest req;
+    MakeRequest(&req, "1");
+    ASSERT_EQ(0, stream->Write(req));
+    test::GrpcResponse res;
+    MakeRequest(&req, "0");
+    test::GrpcService_Stub stub(&_channel);
+    stub.BidiStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    EXPECT_EQ(_server.listen_address(), stream->remote_side());
+    for (int i = 2; i < 10; ++i) {
+        MakeRequest(&req, butil::string_printf("%d", i));
+        ASSERT_EQ(0, stream->Write(req));
+    }
+    ASSERT_EQ(0, stream->Close());
+    handler.WaitClosed();
+    EXPECT_EQ(0, handler._error_code) << handler._error_text;
+    ASSERT_EQ(10u, handler._messages.size());
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(g_prefix + butil::string_printf("%d", i), handler._messages[i]);
+    }
+}
+
+TEST_F(GrpcTest, bidi_streaming_flow_control) {
+    // Much more bytes than windows of streams and connections.
+    const size_t message_size = 100 * 1024;
+    const int count = 100;
+    ClientStreamHandler handler;
+    brpc::GrpcStreamOptions options;
+    options.handler = &handler;
+    options.max_buf_size = 4 * message_size;
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::GrpcStream> stream;
+    ASSERT_EQ(0, brpc::GrpcStreamCreate(&stream, &cntl, &options));
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    MakeRequest(&req, std::string(message_size, 'a'));
+    test::GrpcService_Stub stub(&_channel);
+    stub.BidiStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    for (int i = 1; i < count; ++i) {
+        int rc = stream->Write(req);
+        while (rc == EAGAIN) {
+            timespec due_time = butil::seconds_from_now(5);
+            ASSERT_EQ(0, stream->Wait(&due_time));
+            rc = stream->Write(req);
+        }
+        ASSERT_EQ(0, rc);
+    }
+    ASSERT_EQ(0, stream->Close());
+    handler.WaitClosed();
+    EXPECT_EQ(0, handler._error_code) << handler._error_text;
+    ASSERT_EQ((size_t)count, handler._messages.size());
+    for (int i = 0; i < count; ++i) {
+        EXPECT_EQ(g_prefix + req.message(), handler._messages[i]);
+    }
+}
+
+TEST_F(GrpcTest, unary_calls_not_starved_by_stream) {
+    // Windows large enough for the server to send the whole stream at once.
+    const int32_t saved_stream_window =
+        brpc::policy::FLAGS_h2_client_stream_window_size;
+    const int32_t saved_connection_window =
+        brpc::policy::FLAGS_h2_client_connection_window_size;
+    brpc::policy::FLAGS_h2_client_stream_window_size = 64 * 1024 * 1024;
+    brpc::policy::FLAGS_h2_client_connection_window_size = 64 * 1024 * 1024;
+
+    const size_t message_size = 64 * 1024;
+    const int count = 1024;
+    ClientStreamHandler handler;
+    brpc::GrpcStreamOptions options;
+    options.handler = &handler;
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::GrpcStream> stream;
+    ASSERT_EQ(0, brpc::GrpcStreamCreate(&stream, &cntl, &options));
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    MakeRequest(&req, std::string(message_size, 'a'));
+    req.set_timeout_us(count);
+    test::GrpcService_Stub stub(&_channel);
+    stub.ServerStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+
+    // Responses of unary calls are interleaved with the stream instead of
+    // waiting for all the 64MB to be sent.
+    for (int i = 0; i < 10; ++i) {
+        const int64_t received_before =
+            handler._received_bytes.load(butil::memory_order_relaxed);
+        CallMethod(false, false);
+        const int64_t received_during =
+            handler._received_bytes.load(butil::memory_order_relaxed)
+            - received_before;
+        EXPECT_LT(received_during, 32 * 1024 * 1024);
+    }
+    handler.WaitClosed();
+    EXPECT_EQ(0, handler._error_code) << handler._error_text;
+    EXPECT_EQ((size_t)count, handler._messages.size());
+
+    brpc::policy::FLAGS_h2_client_stream_window_size = saved_stream_window;
+    brpc::policy::FLAGS_h2_client_connection_window_size = saved_connection_window;
+}
+
+TEST_F(GrpcTest, invalid_stream_weight) {
+    brpc::GrpcStreamOptions options;
+    options.weight = 0;
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::GrpcStream> stream;
+    ASSERT_NE(0, brpc::GrpcStreamCreate(&stream, &cntl, &options));
+    options.weight = 257;
+    ASSERT_NE(0, brpc::GrpcStreamCreate(&stream, &cntl, &options));
+}
+
+TEST_F(GrpcTest, cancel_stream) {
+    ClientStreamHandler handler;
+    brpc::GrpcStreamOptions options;
+    options.handler = &handler;
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::GrpcStream> stream;
+    ASSERT_EQ(0, brpc::GrpcStreamCreate(&stream, &cntl, &options));
+    test::GrpcRequest req;
+    test::GrpcResponse res;
+    MakeRequest(&req, g_req);
+    test::GrpcService_Stub stub(&_channel);
+    stub.BidiStream(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(0, stream->Close(ECANCELED, "canceled by user"));
+    handler.WaitClosed();
+    EXPECT_EQ(ECANCELED, handler._error_code);
+    EXPECT_EQ(EINVAL, stream->Write(req));
+}
+
+TEST_F(GrpcTest, create_stream_twice) {
+    brpc::Controller cntl;
+    butil::intrusive_ptr<brpc::GrpcStream> stream;
+    ASSERT_EQ(0, brpc::GrpcStreamCreate(&stream, &cntl, NULL));
+    ASSERT_NE(0, brpc::GrpcStreamCreate(&stream, &cntl, NULL));
+}
+
 } // namespace 
@@ -22,6 +22,7 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <thread>
 #include <gtest/gtest.h>
 #include <gflags/gflags.h>
 #include <google/protobuf/descriptor.h>
@@ -29,6 +30,8 @@
 #include "butil/macros.h"
 #include "butil/files/scoped_file.h"
 #include "butil/fd_guard.h"
+#include "butil/string_printf.h"
+#include "bthread/countdown_event.h"
 #include "brpc/socket.h"
 #include "brpc/acceptor.h"
 #include "brpc/server.h"
@@ -41,6 +44,7 @@
 #include "json2pb/pb_to_json.h"
 #include "json2pb/json_to_pb.h"
 #include "brpc/details/method_status.h"
+#include "brpc/details/controller_private_accessor.h"
 
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
@@ -291,6 +295,42 @@ TEST_F(HttpTest, parse_http_address) {
     }
 }
 
+TEST_F(HttpTest, remaining_timeout_header) {
+    brpc::Controller cntl;
+    brpc::ControllerPrivateAccessor accessor(&cntl);
+    const std::string header_name = "x-bd-timeout-ms";
+    // Not a call to pb services.
+    accessor.set_deadline_us(butil::gettimeofday_us() + 1000000);
+    brpc::policy::SetRemainingTimeoutHeader(&cntl);
+    ASSERT_TRUE(cntl.http_request().GetHeader(header_name) == NULL);
+
+    accessor.set_method(test::EchoService::descriptor()->method(0));
+    brpc::policy::SetRemainingTimeoutHeader(&cntl);
+    const std::string* value = cntl.http_request().GetHeader(header_name);
+    ASSERT_TRUE(value != NULL);
+    const int64_t timeout_ms = strtoll(value->c_str(), NULL, 10);
+    ASSERT_GT(timeout_ms, 900);
+    ASSERT_LE(timeout_ms, 1000);
+
+    // Later attempts send less time.
+    accessor.set_deadline_us(butil::gettimeofday_us() + 300000);
+    brpc::policy::SetRemainingTimeoutHeader(&cntl);
+    value = cntl.http_request().GetHeader(header_name);
+    ASSERT_TRUE(value != NULL);
+    ASSERT_LE(strtoll(value->c_str(), NULL, 10), 300);
+
+    // Reached deadline.
+    accessor.set_deadline_us(butil::gettimeofday_us() - 1000);
+    brpc::policy::SetRemainingTimeoutHeader(&cntl);
+    ASSERT_TRUE(cntl.http_request().GetHeader(header_name) == NULL);
+
+    // gRPC carries the deadline in grpc-timeout.
+    accessor.set_deadline_us(butil::gettimeofday_us() + 1000000);
+    cntl.http_request().set_content_type("application/grpc");
+    brpc::policy::SetRemainingTimeoutHeader(&cntl);
+    ASSERT_TRUE(cntl.http_request().GetHeader(header_name) == NULL);
+}
+
 TEST_F(HttpTest, verify_request) {
     {
         brpc::policy::HttpContext* msg =
@@ -1480,4 +1520,296 @@ TEST_F(HttpTest, spring_protobuf_content_type) {
     ASSERT_EQ("application/x-protobuf", cntl.http_response().content_type());
 }
 
+// A HTTP/1.1 server replying the path of each request after `delay_ms'.
+// Responses of a connection are in the same order as the requests, which
+// is required by pipelining.
+class InOrderHttpServer {
+public:
+    explicit InOrderHttpServer(int delay_ms)
+        : _delay_ms(delay_ms), _listen_fd(-1), _nconn(0), _nactive(0) {}
+    ~InOrderHttpServer() { Stop(); }
+
+    int Start(int port) {
+        _listen_fd = butil::tcp_listen(butil::EndPoint(butil::IP_ANY, port));
+        if (_listen_fd < 0) {
+            return -1;
+        }
+        _accept_thread = std::thread(&InOrderHttpServer::AcceptConnections, this);
+        return 0;
+    }
+
+    void Stop() {
+        if (_listen_fd < 0) {
+            return;
+        }
+        shutdown(_listen_fd, SHUT_RDWR);
+        _accept_thread.join();
+        close(_listen_fd);
+        _listen_fd = -1;
+        {
+            std::unique_lock<std::mutex> mu(_mutex);
+            for (size_t i = 0; i < _fds.size(); ++i) {
+                shutdown(_fds[i], SHUT_RDWR);
+            }
+        }
+        for (size_t i = 0; i < _threads.size(); ++i) {
+            _threads[i].join();
+        }
+        _threads.clear();
+    }
+
+    // Number of accepted connections.
+    int connection_count() const { return _nconn.load(); }
+    // Number of connections not closed yet.
+    int active_connection_count() const { return _nactive.load(); }
+
+private:
+    void AcceptConnections() {
+        while (true) {
+            const int fd = accept(_listen_fd, NULL, NULL);
+            if (fd < 0) {
+                return;
+            }
+            _nconn.fetch_add(1);
+            _nactive.fetch_add(1);
+            std::unique_lock<std::mutex> mu(_mutex);
+            _fds.push_back(fd);
+            _threads.push_back(
+                std::thread(&InOrderHttpServer::ServeConnection, this, fd));
+        }
+    }
+
+    void ServeConnection(int fd) {
+        std::string buf;
+        char tmp[4096];
+        ssize_t nr = 0;
+        while ((nr = read(fd, tmp, sizeof(tmp))) > 0) {
+            buf.append(tmp, nr);
+            size_t end = buf.find("\r\n\r\n");
+            for (; end != std::string::npos; end = buf.find("\r\n\r\n")) {
+                // Requests are GET without body: "GET <path> HTTP/1.1".
+                const size_t sp1 = buf.find(' ');
+                const size_t sp2 = buf.find(' ', sp1 + 1);
+                const std::string path = buf.substr(sp1 + 1, sp2 - sp1 - 1);
+                buf.erase(0, end + 4);
+                usleep(_delay_ms * 1000);
+                const std::string res = butil::string_printf(
+                    "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s",
+                    (int)path.size(), path.c_str());
+                if (write(fd, res.data(), res.size()) != (ssize_t)res.size()) {
+                    break;
+                }
+            }
+        }
+        _nactive.fetch_sub(1);
+    }
+
+    int _delay_ms;
+    int _listen_fd;
+    std::thread _accept_thread;
+    std::mutex _mutex;
+    std::vector<int> _fds;
+    std::vector<std::thread> _threads;
+    std::atomic<int> _nconn;
+    std::atomic<int> _nactive;
+};
+
+struct PipelinedCall {
+    brpc::Controller cntl;
+    std::string path;
+};
+
+static void OnPipelinedCallDone(bthread::CountdownEvent* event) {
+    event->signal();
+}
+
+TEST_F(HttpTest, pipelining_on_pooled_connections) {
+    const int port = 8925;
+    InOrderHttpServer server(10);
+    ASSERT_EQ(0, server.Start(port));
+
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.protocol = "http";
+    options.connection_type = "pooled";
+    options.max_retry = 0;
+    options.timeout_ms = 5000;
+    options.http_max_pipelined_requests = 8;
+    options.idle_timeout_s = 1;
+    ASSERT_EQ(0, channel.Init(butil::EndPoint(butil::my_ip(), port), &options));
+
+    const int ncall = 32;
+    std::vector<PipelinedCall> calls(ncall);
+    bthread::CountdownEvent event(ncall);
+    for (int i = 0; i < ncall; ++i) {
+        calls[i].path = butil::string_printf("/%d", i);
+        calls[i].cntl.http_request().uri() = calls[i].path;
+        channel.CallMethod(NULL, &calls[i].cntl, NULL, NULL,
+                           brpc::NewCallback(OnPipelinedCallDone, &event));
+    }
+    event.wait();
+    for (int i = 0; i < ncall; ++i) {
+        ASSERT_FALSE(calls[i].cntl.Failed()) << calls[i].cntl.ErrorText();
+        // Responses are correlated with requests correctly.
+        ASSERT_EQ(calls[i].path, calls[i].cntl.response_attachment().to_string());
+    }
+    // A connection is created only when all connections are full.
+    EXPECT_LE(server.connection_count(), ncall / 8);
+
+    // Idle connections are closed according to ChannelOptions.idle_timeout_s
+    // rather than -idle_timeout_second which is 10 seconds by default.
+    for (int i = 0; i < 50 && server.active_connection_count() > 0; ++i) {
+        bthread_usleep(100000);
+    }
+    EXPECT_EQ(0, server.active_connection_count());
+    server.Stop();
+}
+
+TEST_F(HttpTest, pipelining_requires_pooled_http) {
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.protocol = "http";
+    options.connection_type = "short";
+    options.http_max_pipelined_requests = 8;
+    ASSERT_EQ(-1, channel.Init("127.0.0.1:8925", &options));
+    options.protocol = "h2";
+    options.connection_type = "";
+    ASSERT_EQ(-1, channel.Init("127.0.0.1:8925", &options));
+}
+
+class CountingReader : public brpc::ProgressiveReader {
+public:
+    CountingReader() : _nread(0), _event(1) {}
+
+    butil::Status OnReadOnePart(const void* /*data*/, size_t length) {
+        _nread += length;
+        return butil::Status::OK();
+    }
+    void OnEndOfMessage(const butil::Status& st) {
+        _status = st;
+        _event.signal();
+    }
+
+    void Wait() { _event.wait(); }
+    size_t read_bytes() const { return _nread; }
+    const butil::Status& status() const { return _status; }
+
+private:
+    size_t _nread;
+    butil::Status _status;
+    bthread::CountdownEvent _event;
+};
+
+// ListNames reads request bodies progressively, Touch does not.
+class UploadServiceImpl : public ::test::UserNamingService {
+public:
+    UploadServiceImpl() : _read_body(true) {}
+
+    void ListNames(::google::protobuf::RpcController* cntl_base,
+                   const ::test::HttpRequest*,
+                   ::test::HttpResponse*,
+                   ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        EXPECT_TRUE(cntl->is_request_read_progressively());
+        EXPECT_TRUE(cntl->request_attachment().empty());
+        if (!_read_body) {
+            cntl->SetFailed("Intentionally not read the body");
+            return;
+        }
+        CountingReader reader;
+        cntl->ReadProgressiveAttachmentBy(&reader);
+        reader.Wait();
+        if (!reader.status().ok()) {
+            cntl->SetFailed(reader.status().error_str());
+            return;
+        }
+        cntl->response_attachment().append(
+            butil::string_printf("%lu", (unsigned long)reader.read_bytes()));
+    }
+
+    void Touch(::google::protobuf::RpcController* cntl_base,
+               const ::test::HttpRequest*,
+               ::test::HttpResponse*,
+               ::google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = static_cast<brpc::Controller*>(cntl_base);
+        EXPECT_FALSE(cntl->is_request_read_progressively());
+        cntl->response_attachment().append(butil::string_printf(
+            "%lu", (unsigned long)cntl->request_attachment().size()));
+    }
+
+    void set_read_body(bool read_body) { _read_body = read_body; }
+
+private:
+    bool _read_body;
+};
+
+TEST_F(HttpTest, read_request_progressively) {
+    const int port = 8923;
+    brpc::Server server;
+    UploadServiceImpl svc;
+    brpc::ServiceOptions svc_opt;
+    svc_opt.ownership = brpc::SERVER_DOESNT_OWN_SERVICE;
+    svc_opt.progressive_read_methods = "ListNames";
+    EXPECT_EQ(0, server.AddService(&svc, svc_opt));
+    EXPECT_EQ(0, server.Start(port, NULL));
+
+    brpc::Channel channel;
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_HTTP;
+    options.timeout_ms = 10000;
+    ASSERT_EQ(0, channel.Init(butil::EndPoint(butil::my_ip(), port), &options));
+    // Larger than -socket_max_unwritten_bytes which limits the body buffered
+    // before the reader is set.
+    const size_t body_size = 128 * 1024 * 1024;
+    std::string body(1024 * 1024, 'x');
+    for (const char* method : { "ListNames", "Touch" }) {
+        brpc::Controller cntl;
+        cntl.http_request().uri() =
+            butil::string_printf("/UserNamingService/%s", method);
+        cntl.http_request().set_method(brpc::HTTP_METHOD_POST);
+        for (size_t i = 0; i < body_size / body.size(); ++i) {
+            cntl.request_attachment().append(body);
+        }
+        channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+        ASSERT_FALSE(cntl.Failed()) << method << ": " << cntl.ErrorText();
+        ASSERT_EQ(butil::string_printf("%lu", (unsigned long)body_size),
+                  cntl.response_attachment().to_string()) << method;
+    }
+
+    // The body is drained when the method does not read it, following
+    // requests on the connection are not affected.
+    svc.set_read_body(false);
+    {
+        brpc::Controller cntl;
+        cntl.http_request().uri() = "/UserNamingService/ListNames";
+        cntl.http_request().set_method(brpc::HTTP_METHOD_POST);
+        cntl.request_attachment().append(body);
+        channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+        ASSERT_TRUE(cntl.Failed());
+    }
+    {
+        brpc::Controller cntl;
+        cntl.http_request().uri() = "/UserNamingService/Touch";
+        cntl.http_request().set_method(brpc::HTTP_METHOD_POST);
+        cntl.request_attachment().append(body);
+        channel.CallMethod(NULL, &cntl, NULL, NULL, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(butil::string_printf("%lu", (unsigned long)body.size()),
+                  cntl.response_attachment().to_string());
+    }
+}
+
+TEST_F(HttpTest, unknown_progressive_read_method) {
+    brpc::Server server;
+    UploadServiceImpl svc;
+    brpc::ServiceOptions svc_opt;
+    svc_opt.ownership = brpc::SERVER_DOESNT_OWN_SERVICE;
+    svc_opt.progressive_read_methods = "ListNames,NoSuchMethod";
+    ASSERT_EQ(-1, server.AddService(&svc, svc_opt));
+    svc_opt.progressive_read_methods = "ListNames, Touch";
+    ASSERT_EQ(0, server.AddService(&svc, svc_opt));
+}
+
 } //namespace
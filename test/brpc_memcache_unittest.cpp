@@ -16,10 +16,17 @@
 // under the License.
 
 #include <iostream>
+#include <map>
 #include "butil/time.h"
 #include "butil/logging.h"
+#include "butil/string_printf.h"
+#include "butil/strings/string_number_conversions.h"
+#include "bthread/bthread.h"
 #include <brpc/memcache.h>
+#include <brpc/memcache_text.h>
+#include <brpc/memcache_service.h>
 #include <brpc/channel.h>
+#include <brpc/server.h>
 #include <gtest/gtest.h>
 
 namespace brpc {
@@ -222,4 +229,419 @@ TEST_F(MemcacheTest, version) {
     ASSERT_TRUE(response.PopVersion(&version)) << response.LastError();
     std::cout << "version=" << version << std::endl;
 }
+
+TEST_F(MemcacheTest, text_request_and_response) {
+    brpc::MemcacheTextRequest request;
+    ASSERT_TRUE(request.Get("hello"));
+    const butil::StringPiece keys[] = { "k1", "k2", "k3" };
+    ASSERT_TRUE(request.MultiGet(keys, 3));
+    ASSERT_TRUE(request.Set("hello", "world", 7, 10, 0));
+    ASSERT_TRUE(request.Set("hello", "world", 7, 10, 12345));
+    ASSERT_TRUE(request.Delete("hello"));
+    ASSERT_TRUE(request.MetaGet("hello", "v f c"));
+    ASSERT_TRUE(request.MetaSet("hello", "world", "T60 F5"));
+    ASSERT_TRUE(request.MetaDelete("hello", ""));
+    ASSERT_TRUE(request.MetaNoop());
+    ASSERT_EQ(9, request.pipelined_count());
+    ASSERT_EQ("gets hello\r\n"
+              "gets k1 k2 k3\r\n"
+              "set hello 7 10 5\r\nworld\r\n"
+              "cas hello 7 10 5 12345\r\nworld\r\n"
+              "delete hello\r\n"
+              "mg hello v f c\r\n"
+              "ms hello 5 T60 F5\r\nworld\r\n"
+              "md hello\r\n"
+              "mn\r\n", request.raw_buffer().to_string());
+
+    // Invalid keys and quiet mode are rejected.
+    ASSERT_FALSE(request.Get(""));
+    ASSERT_FALSE(request.Get("hello world"));
+    ASSERT_FALSE(request.Get(std::string(251, 'a')));
+    ASSERT_FALSE(request.MetaGet("hello", "v q"));
+    ASSERT_FALSE(request.MetaSet("hello", "world", "T1\r\n"));
+    ASSERT_EQ(9, request.pipelined_count());
+
+    brpc::MemcacheTextResponse response;
+    response.raw_buffer().append(
+        "VALUE hello 7 5 100\r\nworld\r\nEND\r\n"
+        "VALUE k1 0 2 1\r\nv1\r\nVALUE k3 1 4 3\r\nv\r\n3\r\nEND\r\n"
+        "STORED\r\n"
+        "EXISTS\r\n"
+        "NOT_FOUND\r\n"
+        "VA 5 f7 c100\r\nworld\r\n"
+        "HD\r\n"
+        "SERVER_ERROR out of memory\r\n"
+        "MN\r\n"
+        "END\r\n"
+        "EN\r\n");
+    std::string value;
+    uint32_t flags = 0;
+    uint64_t cas_value = 0;
+    ASSERT_TRUE(response.PopGet(&value, &flags, &cas_value));
+    ASSERT_EQ("world", value);
+    ASSERT_EQ(7u, flags);
+    ASSERT_EQ(100u, cas_value);
+    std::vector<brpc::MemcacheTextResponse::Item> items;
+    ASSERT_TRUE(response.PopMultiGet(&items));
+    ASSERT_EQ(2u, items.size());
+    ASSERT_EQ("k1", items[0].key);
+    ASSERT_EQ("v1", items[0].value.to_string());
+    ASSERT_EQ("k3", items[1].key);
+    ASSERT_EQ("v\r\n3", items[1].value.to_string());
+    ASSERT_EQ(1u, items[1].flags);
+    ASSERT_EQ(3u, items[1].cas_value);
+    ASSERT_TRUE(response.PopSet());
+    ASSERT_FALSE(response.PopSet());
+    ASSERT_EQ("EXISTS", response.LastError());
+    ASSERT_FALSE(response.PopDelete());
+    ASSERT_EQ("Not found", response.LastError());
+    butil::IOBuf buf;
+    std::string return_flags;
+    ASSERT_TRUE(response.PopMetaGet(&buf, &return_flags));
+    ASSERT_EQ("world", buf.to_string());
+    ASSERT_EQ("f7 c100", return_flags);
+    ASSERT_TRUE(response.PopMetaSet(&return_flags));
+    ASSERT_EQ("", return_flags);
+    ASSERT_FALSE(response.PopMetaDelete(NULL));
+    ASSERT_EQ("SERVER_ERROR out of memory", response.LastError());
+    ASSERT_TRUE(response.PopMetaNoop());
+    ASSERT_FALSE(response.PopGet(&value, &flags, &cas_value));
+    ASSERT_EQ("Not found", response.LastError());
+    ASSERT_FALSE(response.PopMetaGet(&buf, NULL));
+    ASSERT_EQ("Not found", response.LastError());
+    ASSERT_FALSE(response.PopMetaNoop());
+}
+
+TEST_F(MemcacheTest, text_sanity) {
+    if (g_mc_pid < 0) {
+        puts("Skipped due to absence of memcached");
+        return;
+    }
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_MEMCACHE_TEXT;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("0.0.0.0:" MEMCACHED_PORT, &options));
+    brpc::MemcacheTextRequest request;
+    brpc::MemcacheTextResponse response;
+    brpc::Controller cntl;
+    ASSERT_TRUE(request.Delete("text_k1"));
+    ASSERT_TRUE(request.Delete("text_k2"));
+    ASSERT_TRUE(request.Set("text_k1", "v1", 0xdeadbeef, 10, 0));
+    ASSERT_TRUE(request.MetaSet("text_k3", "v3", "F3 T10"));
+    const butil::StringPiece keys[] = { "text_k1", "text_k2", "text_k3" };
+    ASSERT_TRUE(request.MultiGet(keys, 3));
+    ASSERT_TRUE(request.MetaGet("text_k3", "v f"));
+    ASSERT_TRUE(request.MetaGet("text_k2", "v"));
+    ASSERT_TRUE(request.MetaNoop());
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    response.PopDelete();
+    response.PopDelete();
+    ASSERT_TRUE(response.PopSet()) << response.LastError();
+    ASSERT_TRUE(response.PopMetaSet(NULL)) << response.LastError();
+    std::vector<brpc::MemcacheTextResponse::Item> items;
+    ASSERT_TRUE(response.PopMultiGet(&items)) << response.LastError();
+    ASSERT_EQ(2u, items.size());
+    ASSERT_EQ("text_k1", items[0].key);
+    ASSERT_EQ("v1", items[0].value.to_string());
+    ASSERT_EQ(0xdeadbeef, items[0].flags);
+    ASSERT_EQ("text_k3", items[1].key);
+    butil::IOBuf value;
+    std::string return_flags;
+    ASSERT_TRUE(response.PopMetaGet(&value, &return_flags)) << response.LastError();
+    ASSERT_EQ("v3", value.to_string());
+    ASSERT_EQ("f3", return_flags);
+    ASSERT_FALSE(response.PopMetaGet(&value, &return_flags));
+    ASSERT_EQ("Not found", response.LastError());
+    ASSERT_TRUE(response.PopMetaNoop());
+}
+
+struct BatchGetArg {
+    brpc::MemcacheGetBatcher* batcher;
+    int index;
+    int rc;
+    std::string value;
+};
+
+static void* BatchGet(void* void_arg) {
+    BatchGetArg* arg = (BatchGetArg*)void_arg;
+    butil::IOBuf value;
+    uint32_t flags = 0;
+    arg->rc = arg->batcher->Get(
+        butil::string_printf("batch_k%d", arg->index % 20), &value, &flags);
+    arg->value = value.to_string();
+    return NULL;
+}
+
+TEST_F(MemcacheTest, get_batcher) {
+    if (g_mc_pid < 0) {
+        puts("Skipped due to absence of memcached");
+        return;
+    }
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_MEMCACHE_TEXT;
+    options.connection_type = "pooled";
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("0.0.0.0:" MEMCACHED_PORT, &options));
+    brpc::MemcacheTextRequest request;
+    brpc::MemcacheTextResponse response;
+    brpc::Controller cntl;
+    // Only even keys exist.
+    for (int i = 0; i < 20; ++i) {
+        const std::string key = butil::string_printf("batch_k%d", i);
+        if (i % 2 == 0) {
+            ASSERT_TRUE(request.Set(key, butil::string_printf("v%d", i), 0, 0, 0));
+        } else {
+            ASSERT_TRUE(request.Delete(key));
+        }
+    }
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+
+    brpc::MemcacheGetBatcherOptions batch_options;
+    batch_options.window_us = 1000;
+    batch_options.max_keys = 16;
+    brpc::MemcacheGetBatcher batcher;
+    ASSERT_EQ(0, batcher.Init(&channel, &batch_options));
+    const int N = 100;
+    BatchGetArg args[N];
+    bthread_t th[N];
+    for (int i = 0; i < N; ++i) {
+        args[i].batcher = &batcher;
+        args[i].index = i;
+        args[i].rc = -1;
+        ASSERT_EQ(0, bthread_start_background(&th[i], NULL, BatchGet, &args[i]));
+    }
+    for (int i = 0; i < N; ++i) {
+        bthread_join(th[i], NULL);
+        const int k = i % 20;
+        if (k % 2 == 0) {
+            ASSERT_EQ(0, args[i].rc) << i;
+            ASSERT_EQ(butil::string_printf("v%d", k), args[i].value);
+        } else {
+            ASSERT_EQ(ENOENT, args[i].rc) << i;
+        }
+    }
+}
+
+// Expiration is ignored.
+class MemcacheServiceImpl : public brpc::MemcacheService {
+public:
+    MemcacheServiceImpl() : _next_cas(1) {}
+
+    Status Get(const butil::StringPiece& key, butil::IOBuf* value,
+               uint32_t* flags, uint64_t* cas_value) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::map<std::string, Item>::const_iterator it = _items.find(key.as_string());
+        if (it == _items.end()) {
+            return brpc::MemcacheResponse::STATUS_KEY_ENOENT;
+        }
+        *value = it->second.value;
+        *flags = it->second.flags;
+        *cas_value = it->second.cas_value;
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+    Status Store(brpc::MemcacheStoreMode mode, const butil::StringPiece& key,
+                 const butil::IOBuf& value, uint32_t flags, uint32_t,
+                 uint64_t cas_value, uint64_t* new_cas_value) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::map<std::string, Item>::iterator it = _items.find(key.as_string());
+        if (cas_value) {
+            if (it == _items.end()) {
+                return brpc::MemcacheResponse::STATUS_KEY_ENOENT;
+            }
+            if (it->second.cas_value != cas_value) {
+                return brpc::MemcacheResponse::STATUS_KEY_EEXISTS;
+            }
+        }
+        const bool exists = (it != _items.end());
+        if ((mode == brpc::MEMCACHE_STORE_ADD && exists) ||
+            (mode != brpc::MEMCACHE_STORE_ADD &&
+             mode != brpc::MEMCACHE_STORE_SET && !exists)) {
+            return brpc::MemcacheResponse::STATUS_NOT_STORED;
+        }
+        Item& item = _items[key.as_string()];
+        if (mode == brpc::MEMCACHE_STORE_APPEND) {
+            item.value.append(value);
+        } else if (mode == brpc::MEMCACHE_STORE_PREPEND) {
+            butil::IOBuf tmp = value;
+            tmp.append(item.value);
+            item.value.swap(tmp);
+        } else {
+            item.value = value;
+            item.flags = flags;
+        }
+        item.cas_value = _next_cas++;
+        *new_cas_value = item.cas_value;
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+    Status Delete(const butil::StringPiece& key, uint64_t cas_value) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::map<std::string, Item>::iterator it = _items.find(key.as_string());
+        if (it == _items.end()) {
+            return brpc::MemcacheResponse::STATUS_KEY_ENOENT;
+        }
+        if (cas_value && cas_value != it->second.cas_value) {
+            return brpc::MemcacheResponse::STATUS_KEY_EEXISTS;
+        }
+        _items.erase(it);
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+    Status Counter(bool increment, const butil::StringPiece& key,
+                   uint64_t delta, uint64_t initial_value, uint32_t exptime,
+                   uint64_t* new_value, uint64_t* new_cas_value) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        std::map<std::string, Item>::iterator it = _items.find(key.as_string());
+        uint64_t v = initial_value;
+        if (it == _items.end()) {
+            if (exptime == 0xFFFFFFFF) {
+                return brpc::MemcacheResponse::STATUS_KEY_ENOENT;
+            }
+        } else {
+            if (!butil::StringToUint64(it->second.value.to_string(), &v)) {
+                return brpc::MemcacheResponse::STATUS_DELTA_BADVAL;
+            }
+            v = (increment ? v + delta : (v > delta ? v - delta : 0));
+        }
+        Item& item = _items[key.as_string()];
+        item.value.clear();
+        item.value.append(butil::string_printf("%" PRIu64, v));
+        item.cas_value = _next_cas++;
+        *new_value = v;
+        *new_cas_value = item.cas_value;
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+    Status Flush(uint32_t) {
+        BAIDU_SCOPED_LOCK(_mutex);
+        _items.clear();
+        return brpc::MemcacheResponse::STATUS_SUCCESS;
+    }
+
+private:
+    struct Item {
+        Item() : flags(0), cas_value(0) {}
+        butil::IOBuf value;
+        uint32_t flags;
+        uint64_t cas_value;
+    };
+    butil::Mutex _mutex;
+    uint64_t _next_cas;
+    std::map<std::string, Item> _items;
+};
+
+TEST_F(MemcacheTest, server_binary) {
+    brpc::Server server;
+    brpc::ServerOptions server_options;
+    server_options.memcache_service = new MemcacheServiceImpl;
+    brpc::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_MEMCACHE;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+    brpc::MemcacheRequest request;
+    brpc::MemcacheResponse response;
+    brpc::Controller cntl;
+    ASSERT_TRUE(request.Get("hello"));
+    ASSERT_TRUE(request.Set("hello", "world", 0xdeadbeef, 10, 0));
+    ASSERT_TRUE(request.Add("hello", "world2", 0, 10, 0));
+    ASSERT_TRUE(request.Append("hello", "!", 0, 10, 0));
+    ASSERT_TRUE(request.Get("hello"));
+    ASSERT_TRUE(request.Increment("counter", 2, 10, 10));
+    ASSERT_TRUE(request.Increment("counter", 3, 10, 10));
+    ASSERT_TRUE(request.Decrement("hello", 1, 10, 10));
+    ASSERT_TRUE(request.Version());
+    ASSERT_TRUE(request.Delete("hello"));
+    ASSERT_TRUE(request.Delete("hello"));
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    std::string value;
+    uint32_t flags = 0;
+    uint64_t cas_value = 0;
+    ASSERT_FALSE(response.PopGet(&value, &flags, &cas_value));
+    ASSERT_EQ("Not found", response.LastError());
+    ASSERT_TRUE(response.PopSet(&cas_value)) << response.LastError();
+    ASSERT_FALSE(response.PopAdd(NULL));
+    ASSERT_TRUE(response.PopAppend(NULL)) << response.LastError();
+    uint64_t cas_value2 = 0;
+    ASSERT_TRUE(response.PopGet(&value, &flags, &cas_value2));
+    ASSERT_EQ("world!", value);
+    ASSERT_EQ(0xdeadbeef, flags);
+    ASSERT_LT(cas_value, cas_value2);
+    uint64_t new_value = 0;
+    ASSERT_TRUE(response.PopIncrement(&new_value, NULL));
+    ASSERT_EQ(10ul, new_value);
+    ASSERT_TRUE(response.PopIncrement(&new_value, NULL));
+    ASSERT_EQ(13ul, new_value);
+    ASSERT_FALSE(response.PopDecrement(&new_value, NULL));
+    std::string version;
+    ASSERT_TRUE(response.PopVersion(&version));
+    ASSERT_EQ("brpc", version);
+    ASSERT_TRUE(response.PopDelete());
+    ASSERT_FALSE(response.PopDelete());
+}
+
+TEST_F(MemcacheTest, server_text) {
+    brpc::Server server;
+    brpc::ServerOptions server_options;
+    server_options.memcache_service = new MemcacheServiceImpl;
+    brpc::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_MEMCACHE_TEXT;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+    brpc::MemcacheTextRequest request;
+    brpc::MemcacheTextResponse response;
+    brpc::Controller cntl;
+    ASSERT_TRUE(request.Set("k1", "v1", 0xdeadbeef, 10, 0));
+    ASSERT_TRUE(request.MetaSet("k3", "v3", "F3 T10 c"));
+    const butil::StringPiece keys[] = { "k1", "k2", "k3" };
+    ASSERT_TRUE(request.MultiGet(keys, 3));
+    ASSERT_TRUE(request.MetaGet("k3", "v f k"));
+    ASSERT_TRUE(request.MetaGet("k2", "v"));
+    ASSERT_TRUE(request.MetaSet("k1", "x", "ME"));
+    ASSERT_TRUE(request.MetaDelete("k1", "C99"));
+    ASSERT_TRUE(request.Delete("k1"));
+    ASSERT_TRUE(request.MetaNoop());
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_TRUE(response.PopSet()) << response.LastError();
+    std::string return_flags;
+    ASSERT_TRUE(response.PopMetaSet(&return_flags)) << response.LastError();
+    ASSERT_EQ("c2", return_flags);
+    std::vector<brpc::MemcacheTextResponse::Item> items;
+    ASSERT_TRUE(response.PopMultiGet(&items)) << response.LastError();
+    ASSERT_EQ(2u, items.size());
+    ASSERT_EQ("k1", items[0].key);
+    ASSERT_EQ("v1", items[0].value.to_string());
+    ASSERT_EQ(0xdeadbeef, items[0].flags);
+    ASSERT_EQ(1u, items[0].cas_value);
+    ASSERT_EQ("k3", items[1].key);
+    ASSERT_EQ("v3", items[1].value.to_string());
+    butil::IOBuf value;
+    ASSERT_TRUE(response.PopMetaGet(&value, &return_flags)) << response.LastError();
+    ASSERT_EQ("v3", value.to_string());
+    ASSERT_EQ("f3 kk3", return_flags);
+    ASSERT_FALSE(response.PopMetaGet(&value, &return_flags));
+    ASSERT_EQ("Not found", response.LastError());
+    ASSERT_FALSE(response.PopMetaSet(NULL));
+    ASSERT_FALSE(response.PopMetaDelete(NULL));
+    ASSERT_TRUE(response.PopDelete()) << response.LastError();
+    ASSERT_TRUE(response.PopMetaNoop());
+
+    brpc::MemcacheGetBatcher batcher;
+    ASSERT_EQ(0, batcher.Init(&channel, NULL));
+    uint32_t flags = 0;
+    ASSERT_EQ(0, batcher.Get("k3", &value, &flags));
+    ASSERT_EQ("v3", value.to_string());
+    ASSERT_EQ(3u, flags);
+    ASSERT_EQ(ENOENT, batcher.Get("k1", &value, &flags));
+}
 } //namespace
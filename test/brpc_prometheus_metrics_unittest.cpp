@@ -21,9 +21,15 @@
 #include "brpc/server.h"
 #include "brpc/channel.h"
 #include "brpc/controller.h"
+#include "brpc/builtin/prometheus_metrics_service.h"
 #include "butil/strings/string_piece.h"
+#include "bvar/latency_recorder.h"
 #include "echo.pb.h"
 
+namespace bvar {
+DECLARE_bool(bvar_latency_histogram);
+}
+
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -142,3 +148,27 @@ TEST(PrometheusMetrics, sanity) {
     ASSERT_EQ(0, server.Stop(0));
     ASSERT_EQ(0, server.Join());
 }
+
+TEST(PrometheusMetrics, latency_histogram) {
+    bvar::FLAGS_bvar_latency_histogram = true;
+    bvar::LatencyRecorder rec("prometheus_test");
+    bvar::FLAGS_bvar_latency_histogram = false;
+    for (int i = 0; i < 100; ++i) {
+        rec << i;
+    }
+    butil::IOBuf buf;
+    ASSERT_EQ(0, brpc::DumpPrometheusMetricsToIOBuf(&buf));
+    const std::string res = buf.to_string();
+    const char* expected[] = {
+        "# TYPE prometheus_test_latency_histogram histogram\n",
+        "prometheus_test_latency_histogram_bucket{le=\"0\"} 1\n",
+        "prometheus_test_latency_histogram_bucket{le=\"63\"} 64\n",
+        "prometheus_test_latency_histogram_bucket{le=\"127\"} 100\n",
+        "prometheus_test_latency_histogram_bucket{le=\"+Inf\"} 100\n",
+        "prometheus_test_latency_histogram_sum 4950\n",
+        "prometheus_test_latency_histogram_count 100\n",
+    };
+    for (size_t i = 0; i < arraysize(expected); ++i) {
+        ASSERT_NE(std::string::npos, res.find(expected[i])) << expected[i];
+    }
+}
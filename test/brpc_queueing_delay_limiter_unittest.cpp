@@ -0,0 +1,97 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "bthread/bthread.h"
+#include "brpc/details/queueing_delay_limiter.h"
+
+namespace brpc {
+DECLARE_int32(codel_target_delay_ms);
+DECLARE_int32(codel_interval_ms);
+} // namespace brpc
+
+int main(int argc, char* argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    return RUN_ALL_TESTS();
+}
+
+namespace {
+
+const int kTargetDelayMs = 10;
+const int kIntervalMs = 20;
+
+class QueueingDelayLimiterTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        _saved_target_delay_ms = brpc::FLAGS_codel_target_delay_ms;
+        _saved_interval_ms = brpc::FLAGS_codel_interval_ms;
+        brpc::FLAGS_codel_target_delay_ms = kTargetDelayMs;
+        brpc::FLAGS_codel_interval_ms = kIntervalMs;
+    }
+    void TearDown() override {
+        brpc::FLAGS_codel_target_delay_ms = _saved_target_delay_ms;
+        brpc::FLAGS_codel_interval_ms = _saved_interval_ms;
+    }
+
+private:
+    int _saved_target_delay_ms;
+    int _saved_interval_ms;
+};
+
+TEST_F(QueueingDelayLimiterTest, disabled) {
+    brpc::FLAGS_codel_target_delay_ms = 0;
+    brpc::QueueingDelayLimiter limiter;
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(limiter.OnRequested(1000000L));
+        bthread_usleep(kIntervalMs * 1000L);
+    }
+    ASSERT_FALSE(limiter.overloaded());
+}
+
+TEST_F(QueueingDelayLimiterTest, reject_when_standing_queue_is_long) {
+    const int64_t long_delay_us = 3 * kTargetDelayMs * 1000L;
+    const int64_t medium_delay_us = 1.5 * kTargetDelayMs * 1000L;
+    const int64_t short_delay_us = kTargetDelayMs * 1000L / 10;
+    brpc::QueueingDelayLimiter limiter;
+
+    // Nothing is rejected in the first interval.
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(limiter.OnRequested(long_delay_us));
+    }
+    ASSERT_FALSE(limiter.overloaded());
+
+    // The minimum delay of last interval exceeded the target.
+    bthread_usleep((kIntervalMs + 5) * 1000L);
+    ASSERT_TRUE(limiter.OnRequested(long_delay_us));
+    ASSERT_TRUE(limiter.overloaded());
+    ASSERT_FALSE(limiter.OnRequested(long_delay_us));
+    ASSERT_TRUE(limiter.OnRequested(medium_delay_us));
+
+    // One short delay in an interval is enough for leaving the
+    // overloaded state.
+    ASSERT_TRUE(limiter.OnRequested(short_delay_us));
+    ASSERT_FALSE(limiter.OnRequested(long_delay_us));
+    bthread_usleep((kIntervalMs + 5) * 1000L);
+    ASSERT_TRUE(limiter.OnRequested(long_delay_us));
+    ASSERT_FALSE(limiter.overloaded());
+    ASSERT_TRUE(limiter.OnRequested(long_delay_us));
+}
+
+} // namespace
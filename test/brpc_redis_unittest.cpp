@@ -16,15 +16,18 @@
 // under the License.
 
 
+#include <cmath>
 #include <iostream>
 #include <unordered_map>
 #include <butil/time.h>
 #include <butil/logging.h>
+#include <butil/string_printf.h>
 #include <brpc/redis.h>
 #include <brpc/channel.h>
 #include <brpc/policy/redis_authenticator.h>
 #include <brpc/server.h>
 #include <brpc/redis_command.h>
+#include <brpc/redis_cluster.h>
 #include <gtest/gtest.h>
 
 namespace brpc {
@@ -113,6 +116,14 @@ void AssertReplyEqual(const brpc::RedisReply& reply1,
     CHECK_EQ(reply1.type(), reply2.type());
     switch (reply1.type()) {
     case brpc::REDIS_REPLY_ARRAY:
+        // fall through
+    case brpc::REDIS_REPLY_MAP:
+        // fall through
+    case brpc::REDIS_REPLY_SET:
+        // fall through
+    case brpc::REDIS_REPLY_PUSH:
+        // fall through
+    case brpc::REDIS_REPLY_ATTRIBUTE:
         ASSERT_EQ(reply1.size(), reply2.size());
         for (size_t j = 0; j < reply1.size(); ++j) {
             ASSERT_NE(&reply1[j], &reply2[j]); // from different arena
@@ -124,9 +135,19 @@ void AssertReplyEqual(const brpc::RedisReply& reply1,
         break;
     case brpc::REDIS_REPLY_NIL:
         break;
+    case brpc::REDIS_REPLY_DOUBLE:
+        ASSERT_EQ(reply1.real(), reply2.real());
+        break;
+    case brpc::REDIS_REPLY_BOOLEAN:
+        ASSERT_EQ(reply1.boolean(), reply2.boolean());
+        break;
     case brpc::REDIS_REPLY_STRING:
         // fall through
     case brpc::REDIS_REPLY_STATUS:
+        // fall through
+    case brpc::REDIS_REPLY_BIG_NUMBER:
+        // fall through
+    case brpc::REDIS_REPLY_VERBATIM:
         ASSERT_NE(reply1.c_str(), reply2.c_str()); // from different arena
         ASSERT_EQ(reply1.data(), reply2.data());
         break;
@@ -807,6 +828,149 @@ TEST_F(RedisTest, redis_reply_codec) {
     }
 }
 
+class CountingPushHandler : public brpc::RedisPushHandler {
+public:
+    void OnPush(const brpc::RedisReply& push) {
+        ASSERT_TRUE(push.is_push());
+        pushes.push_back(butil::string_printf("%d", (int)push.size()));
+        if (push.size() > 0 && push[0].is_string()) {
+            pushes.back().append(push[0].c_str());
+        }
+    }
+    std::vector<std::string> pushes;
+};
+
+TEST_F(RedisTest, redis_reply_resp3) {
+    butil::Arena arena;
+    // map, set, double, boolean, big number and verbatim string
+    {
+        brpc::RedisReply r(&arena);
+        r.SetMap(2);
+        r[0].SetString("pi");
+        r[1].SetDouble(3.5);
+        r[2].SetStatus("items");
+        r[3].SetSet(4);
+        r[3][0].SetBoolean(true);
+        r[3][1].SetBoolean(false);
+        r[3][2].SetBigNumber("-3492890328409238509324850943850943825024385");
+        r[3][3].SetVerbatim("txt", "Some string");
+        ASSERT_TRUE(r.is_map());
+        ASSERT_EQ(4ul, r.size());
+        butil::IOBuf buf;
+        butil::IOBufAppender appender;
+        ASSERT_TRUE(r.SerializeTo(&appender));
+        appender.move_to(buf);
+        ASSERT_EQ("%2\r\n$2\r\npi\r\n,3.5\r\n+items\r\n~4\r\n#t\r\n#f\r\n"
+                  "(-3492890328409238509324850943850943825024385\r\n"
+                  "=15\r\ntxt:Some string\r\n", buf.to_string());
+
+        // Parse byte by byte.
+        brpc::RedisReply r2(&arena);
+        const std::string data = buf.to_string();
+        butil::IOBuf partial;
+        for (size_t i = 0; i < data.size(); ++i) {
+            partial.push_back(data[i]);
+            brpc::ParseError err = r2.ConsumePartialIOBuf(partial);
+            if (i + 1 < data.size()) {
+                ASSERT_EQ(brpc::PARSE_ERROR_NOT_ENOUGH_DATA, err);
+            } else {
+                ASSERT_EQ(brpc::PARSE_OK, err);
+            }
+        }
+        ASSERT_TRUE(partial.empty());
+        ASSERT_TRUE(r2.is_map());
+        ASSERT_EQ(4ul, r2.size());
+        ASSERT_STREQ("pi", r2[0].c_str());
+        ASSERT_TRUE(r2[1].is_double());
+        ASSERT_EQ(3.5, r2[1].real());
+        ASSERT_TRUE(r2[3].is_set());
+        ASSERT_EQ(4ul, r2[3].size());
+        ASSERT_TRUE(r2[3][0].boolean());
+        ASSERT_FALSE(r2[3][1].boolean());
+        ASSERT_EQ(brpc::REDIS_REPLY_BIG_NUMBER, r2[3][2].type());
+        ASSERT_STREQ("-3492890328409238509324850943850943825024385", r2[3][2].c_str());
+        ASSERT_EQ(brpc::REDIS_REPLY_VERBATIM, r2[3][3].type());
+        ASSERT_EQ("txt:Some string", r2[3][3].data());
+
+        std::ostringstream os;
+        os << r2;
+        ASSERT_EQ("{\"pi\": (double) 3.5, items: (set)[(true), (false), "
+                  "(big number) -3492890328409238509324850943850943825024385, "
+                  "\"txt:Some string\"]}", os.str());
+
+        brpc::RedisReply r3(&arena);
+        r3.CopyFromDifferentArena(r2);
+        ASSERT_TRUE(r3.SerializeTo(&appender));
+        appender.move_to(buf);
+        ASSERT_EQ(data, buf.to_string());
+    }
+    // null, blob error, special doubles
+    {
+        butil::IOBuf buf;
+        buf.append("_\r\n!21\r\nSYNTAX invalid syntax\r\n,inf\r\n,-1.5e3\r\n");
+        brpc::RedisReply r(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r.is_nil());
+        brpc::RedisReply r2(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r2.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r2.is_error());
+        ASSERT_STREQ("SYNTAX invalid syntax", r2.error_message());
+        brpc::RedisReply r3(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r3.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(r3.is_double());
+        ASSERT_TRUE(std::isinf(r3.real()));
+        brpc::RedisReply r4(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r4.ConsumePartialIOBuf(buf));
+        ASSERT_EQ(-1500, r4.real());
+        ASSERT_TRUE(buf.empty());
+
+        buf.append("#x\r\n");
+        brpc::RedisReply r5(&arena);
+        ASSERT_EQ(brpc::PARSE_ERROR_ABSOLUTELY_WRONG, r5.ConsumePartialIOBuf(buf));
+    }
+    // attributes are skipped
+    {
+        butil::IOBuf buf;
+        buf.append("|1\r\n+key-popularity\r\n%1\r\n$1\r\na\r\n,0.19\r\n"
+                   "*2\r\n:2039123\r\n:9543892\r\n");
+        brpc::RedisReply r(&arena);
+        ASSERT_EQ(brpc::PARSE_OK, r.ConsumePartialIOBuf(buf));
+        ASSERT_TRUE(buf.empty());
+        ASSERT_TRUE(r.is_array());
+        ASSERT_EQ(2ul, r.size());
+        ASSERT_EQ(9543892, r[1].integer());
+    }
+    // push messages between replies
+    {
+        CountingPushHandler handler;
+        brpc::SetRedisPushHandler(&handler);
+        butil::IOBuf buf;
+        buf.append(">2\r\n$10\r\ninvalidate\r\n*1\r\n$3\r\nfoo\r\n"
+                   "+OK\r\n"
+                   ">3\r\n$7\r\nmessage\r\n$2\r\nch\r\n$2\r\nhi\r\n"
+                   ":42\r\n>1\r\n$4\r\npong");
+        brpc::RedisResponse response;
+        ASSERT_EQ(brpc::PARSE_OK, response.ConsumePartialIOBuf(buf, 2));
+        ASSERT_EQ(2, response.reply_size());
+        ASSERT_STREQ("OK", response.reply(0).c_str());
+        ASSERT_EQ(42, response.reply(1).integer());
+        ASSERT_EQ(2u, handler.pushes.size());
+        ASSERT_EQ("2invalidate", handler.pushes[0]);
+        ASSERT_EQ("3message", handler.pushes[1]);
+
+        // Pushes without replies.
+        brpc::RedisResponse response2;
+        ASSERT_EQ(brpc::PARSE_ERROR_NOT_ENOUGH_DATA,
+                  response2.ConsumePartialIOBuf(buf, 0));
+        buf.append("\r\n");
+        ASSERT_EQ(brpc::PARSE_OK, response2.ConsumePartialIOBuf(buf, 0));
+        ASSERT_EQ(0, response2.reply_size());
+        ASSERT_EQ(3u, handler.pushes.size());
+        ASSERT_EQ("1pong", handler.pushes[2]);
+        brpc::SetRedisPushHandler(NULL);
+    }
+}
+
 butil::Mutex s_mutex;
 std::unordered_map<std::string, std::string> m;
 std::unordered_map<std::string, int64_t> int_map;
@@ -1201,6 +1365,203 @@ TEST_F(RedisTest, server_command_continue) {
     }
 }
 
+// Echo args[1] after sleeping args[2] milliseconds in another bthread.
+class AsyncEchoCommandHandler : public brpc::AsyncRedisCommandHandler {
+public:
+    struct Call {
+        const std::vector<butil::StringPiece>* args;
+        brpc::RedisReply* output;
+        google::protobuf::Closure* done;
+    };
+
+    static void* RunCall(void* arg) {
+        std::unique_ptr<Call> call(static_cast<Call*>(arg));
+        const std::vector<butil::StringPiece>& args = *call->args;
+        bthread_usleep(strtol(args[2].as_string().c_str(), NULL, 10) * 1000L);
+        call->output->SetString(args[1]);
+        call->done->Run();
+        return NULL;
+    }
+
+    void RunAsync(const std::vector<butil::StringPiece>& args,
+                  brpc::RedisReply* output,
+                  google::protobuf::Closure* done) override {
+        if (args.size() < 3) {
+            output->SetError("ERR wrong number of arguments for 'aecho' command");
+            return done->Run();
+        }
+        Call* call = new Call{ &args, output, done };
+        bthread_t th;
+        EXPECT_EQ(0, bthread_start_background(&th, NULL, RunCall, call));
+    }
+};
+
+TEST_F(RedisTest, server_async_command) {
+    brpc::Server server;
+    brpc::ServerOptions server_options;
+    RedisServiceImpl* rsimpl = new RedisServiceImpl;
+    rsimpl->AddCommandHandler("aecho", new AsyncEchoCommandHandler);
+    rsimpl->AddCommandHandler("get", new GetCommandHandler(rsimpl));
+    rsimpl->AddCommandHandler("set", new SetCommandHandler(rsimpl));
+    server_options.redis_service = rsimpl;
+    brpc::PortRange pr(8081, 8900);
+    ASSERT_EQ(0, server.Start("127.0.0.1", pr, &server_options));
+
+    brpc::ChannelOptions options;
+    options.protocol = brpc::PROTOCOL_REDIS;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", server.listen_address().port, &options));
+
+    brpc::RedisRequest request;
+    brpc::RedisResponse response;
+    brpc::Controller cntl;
+    const int N = 20;
+    ASSERT_TRUE(request.AddCommand("set async sync"));
+    for (int i = 0; i < N; ++i) {
+        // Later commands finish earlier.
+        ASSERT_TRUE(request.AddCommand("aecho v%d %d", i, (N - i) * 10));
+        if (i % 5 == 0) {
+            ASSERT_TRUE(request.AddCommand("get async"));
+        }
+    }
+    ASSERT_TRUE(request.AddCommand("aecho"));
+    const int64_t start_us = butil::gettimeofday_us();
+    channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+    const int64_t elapsed_us = butil::gettimeofday_us() - start_us;
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(1 + N + N / 5 + 1, response.reply_size());
+    ASSERT_STREQ("OK", response.reply(0).c_str());
+    int index = 1;
+    for (int i = 0; i < N; ++i) {
+        ASSERT_STREQ(butil::string_printf("v%d", i).c_str(),
+                     response.reply(index++).c_str());
+        if (i % 5 == 0) {
+            ASSERT_STREQ("sync", response.reply(index++).c_str());
+        }
+    }
+    ASSERT_EQ(brpc::REDIS_REPLY_ERROR, response.reply(index).type());
+    // Commands ran concurrently.
+    ASSERT_LT(elapsed_us, N * 10 * 1000L * 2);
+}
+
+TEST_F(RedisTest, cluster_slot) {
+    ASSERT_EQ(12739, brpc::RedisClusterSlot("123456789"));
+    ASSERT_EQ(12182, brpc::RedisClusterSlot("foo"));
+    ASSERT_EQ(5061, brpc::RedisClusterSlot("bar"));
+    ASSERT_EQ(brpc::RedisClusterSlot("user1000"),
+              brpc::RedisClusterSlot("{user1000}.following"));
+    ASSERT_EQ(brpc::RedisClusterSlot("{}.following"),
+              brpc::RedisClusterSlot("{}.following"));
+    ASSERT_NE(brpc::RedisClusterSlot("{}.following"),
+              brpc::RedisClusterSlot(""));
+}
+
+// A fake cluster of two nodes: slots before `split' are served by
+// ports[0], others are served by ports[1].
+struct FakeCluster {
+    int split;
+    int ports[2];
+    butil::Mutex mutex;
+    std::map<std::string, std::string> kv[2];
+};
+
+class ClusterCommandHandler : public brpc::RedisCommandHandler {
+public:
+    ClusterCommandHandler(FakeCluster* c, int index) : _c(c), _index(index) {}
+
+    brpc::RedisCommandHandlerResult Run(const std::vector<butil::StringPiece>& args,
+                                        brpc::RedisReply* output,
+                                        bool) override {
+        BAIDU_SCOPED_LOCK(_c->mutex);
+        if (args[0] == "cluster") {
+            // CLUSTER SLOTS
+            const int first = (_c->split == 0 ? 1 : 0);
+            output->SetArray(2 - first);
+            for (int i = first; i < 2; ++i) {
+                brpc::RedisReply& range = (*output)[i - first];
+                range.SetArray(3);
+                range[0].SetInteger(i == 0 ? 0 : _c->split);
+                range[1].SetInteger(i == 0 ? _c->split - 1 : 16383);
+                range[2].SetArray(2);
+                range[2][0].SetString("127.0.0.1");
+                range[2][1].SetInteger(_c->ports[i]);
+            }
+            return brpc::REDIS_CMD_HANDLED;
+        }
+        const int slot = brpc::RedisClusterSlot(args[1]);
+        const int owner = (slot < _c->split ? 0 : 1);
+        if (owner != _index) {
+            output->FormatError("MOVED %d 127.0.0.1:%d", slot, _c->ports[owner]);
+        } else if (args[0] == "set") {
+            _c->kv[_index][args[1].as_string()] = args[2].as_string();
+            output->SetStatus("OK");
+        } else {
+            auto it = _c->kv[_index].find(args[1].as_string());
+            if (it != _c->kv[_index].end()) {
+                output->SetString(it->second);
+            } else {
+                output->SetNullString();
+            }
+        }
+        return brpc::REDIS_CMD_HANDLED;
+    }
+
+private:
+    FakeCluster* _c;
+    int _index;
+};
+
+TEST_F(RedisTest, cluster_channel) {
+    FakeCluster c;
+    c.split = 8192;
+    brpc::Server servers[2];
+    for (int i = 0; i < 2; ++i) {
+        brpc::RedisService* rs = new brpc::RedisService;
+        rs->AddCommandHandler("cluster", new ClusterCommandHandler(&c, i));
+        rs->AddCommandHandler("get", new ClusterCommandHandler(&c, i));
+        rs->AddCommandHandler("set", new ClusterCommandHandler(&c, i));
+        brpc::ServerOptions server_options;
+        server_options.redis_service = rs;
+        brpc::PortRange pr(8081, 8900);
+        ASSERT_EQ(0, servers[i].Start("127.0.0.1", pr, &server_options));
+        c.ports[i] = servers[i].listen_address().port;
+    }
+
+    brpc::RedisClusterChannel channel;
+    ASSERT_EQ(0, channel.Init(butil::string_printf(
+                "127.0.0.1:%d", c.ports[0]).c_str(), NULL));
+
+    const int N = 32;
+    for (int round = 0; round < 2; ++round) {
+        brpc::RedisRequest request;
+        brpc::RedisResponse response;
+        brpc::Controller cntl;
+        for (int i = 0; i < N; ++i) {
+            ASSERT_TRUE(request.AddCommand("set key%d value%d_%d", i, i, round));
+            ASSERT_TRUE(request.AddCommand("get key%d", i));
+        }
+        channel.CallMethod(NULL, &cntl, &request, &response, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(2 * N, response.reply_size());
+        for (int i = 0; i < N; ++i) {
+            ASSERT_STREQ("OK", response.reply(2 * i).c_str());
+            ASSERT_EQ(butil::string_printf("value%d_%d", i, round),
+                      response.reply(2 * i + 1).data());
+        }
+        {
+            BAIDU_SCOPED_LOCK(c.mutex);
+            ASSERT_FALSE(c.kv[0].empty());
+            ASSERT_FALSE(c.kv[1].empty());
+            // All slots are moved to the second node, the channel should
+            // follow MOVED redirections.
+            c.split = 0;
+            c.kv[0].clear();
+            c.kv[1].clear();
+        }
+    }
+    ASSERT_EQ(N, (int)c.kv[1].size());
+}
+
 TEST_F(RedisTest, server_handle_pipeline) {
     brpc::Server server;
     brpc::ServerOptions server_options;
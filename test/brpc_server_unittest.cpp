@@ -54,6 +54,7 @@
 #include "echo.pb.h"
 #include "v1.pb.h"
 #include "v2.pb.h"
+#include "no_arena.pb.h"
 
 int main(int argc, char* argv[]) {
     testing::InitGoogleTest(&argc, argv);
@@ -64,6 +65,9 @@ int main(int argc, char* argv[]) {
 namespace brpc {
 DECLARE_bool(enable_threads_service);
 DECLARE_bool(enable_dir_service);
+namespace policy {
+DECLARE_bool(baidu_std_propagate_cancel);
+}
 }
 
 namespace {
@@ -1401,4 +1405,301 @@ TEST_F(ServerTest, max_concurrency) {
     stub.Echo(&cntl4, &req, NULL, NULL);
     ASSERT_FALSE(cntl4.Failed()) << cntl4.ErrorText();
 }
+
+// Forwards requests to `downstream' and records what it sees.
+class CascadedEchoService : public test::EchoService {
+public:
+    explicit CascadedEchoService(brpc::Channel* downstream)
+        : _downstream(downstream)
+        , deadline_us(-1)
+        , child_timeout_ms(-1)
+        , child_error_code(-1) {}
+
+    virtual void Echo(google::protobuf::RpcController* cntl_base,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = (brpc::Controller*)cntl_base;
+        deadline_us = cntl->deadline_us();
+        brpc::Controller sub_cntl;
+        test::EchoService_Stub stub(_downstream);
+        stub.Echo(&sub_cntl, request, response, NULL);
+        child_timeout_ms = sub_cntl.timeout_ms();
+        child_error_code = sub_cntl.ErrorCode();
+    }
+
+private:
+    brpc::Channel* _downstream;
+public:
+    int64_t deadline_us;
+    int64_t child_timeout_ms;
+    int child_error_code;
+};
+
+TEST_F(ServerTest, deadline_propagation) {
+    const int downstream_port = 9201;
+    const int upstream_port = 9202;
+    brpc::Server downstream_server;
+    EchoServiceImpl echo_svc;
+    ASSERT_EQ(0, downstream_server.AddService(
+                  &echo_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, downstream_server.Start(downstream_port, NULL));
+
+    brpc::Channel downstream_channel;
+    brpc::ChannelOptions options;
+    options.timeout_ms = 10000;
+    ASSERT_EQ(0, downstream_channel.Init("127.0.0.1", downstream_port, &options));
+
+    brpc::Server upstream_server;
+    CascadedEchoService cascaded_svc(&downstream_channel);
+    ASSERT_EQ(0, upstream_server.AddService(
+                  &cascaded_svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, upstream_server.Start(upstream_port, NULL));
+
+    const char* protocols[] = { "baidu_std", "http", "h2:grpc" };
+    for (size_t i = 0; i < ARRAY_SIZE(protocols); ++i) {
+        brpc::Channel channel;
+        brpc::ChannelOptions chan_options;
+        chan_options.protocol = protocols[i];
+        ASSERT_EQ(0, channel.Init("127.0.0.1", upstream_port, &chan_options));
+        test::EchoService_Stub stub(&channel);
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+
+        // Timeout of the child RPC is clamped to the time left.
+        brpc::Controller cntl;
+        cntl.set_timeout_ms(500);
+        const int64_t start_us = butil::gettimeofday_us();
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << protocols[i] << ": " << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+        ASSERT_GT(cascaded_svc.deadline_us, start_us) << protocols[i];
+        ASSERT_LE(cascaded_svc.deadline_us, start_us + 501000) << protocols[i];
+        ASSERT_GT(cascaded_svc.child_timeout_ms, 0) << protocols[i];
+        ASSERT_LE(cascaded_svc.child_timeout_ms, 500) << protocols[i];
+        ASSERT_EQ(0, cascaded_svc.child_error_code) << protocols[i];
+
+        // The child RPC times out along with the upstream RPC.
+        cntl.Reset();
+        cntl.set_timeout_ms(100);
+        req.set_sleep_us(1000000);
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_EQ(brpc::ERPCTIMEDOUT, cntl.ErrorCode()) << protocols[i];
+        bthread_usleep(200000);
+        ASSERT_EQ(brpc::ERPCTIMEDOUT, cascaded_svc.child_error_code)
+            << protocols[i];
+        ASSERT_LE(cascaded_svc.child_timeout_ms, 100) << protocols[i];
+    }
+
+    // No deadline without timeout.
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", upstream_port, NULL));
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+    brpc::Controller cntl;
+    cntl.set_timeout_ms(-1);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+    ASSERT_EQ(-1, cascaded_svc.deadline_us);
+    ASSERT_EQ(10000, cascaded_svc.child_timeout_ms);
+}
+
+static void SetAtomicFlag(butil::atomic<bool>* flag) {
+    flag->store(true);
+}
+
+class CancelAwareEchoService : public test::EchoService {
+public:
+    CancelAwareEchoService() : notified(false), canceled(false), nfinished(0) {}
+
+    virtual void Echo(google::protobuf::RpcController* cntl_base,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        brpc::Controller* cntl = (brpc::Controller*)cntl_base;
+        cntl->NotifyOnCancel(brpc::NewCallback(&SetAtomicFlag, &notified));
+        const int64_t end_us = butil::gettimeofday_us() + 2000000L;
+        while (!(cntl->IsCanceled() && notified.load()) &&
+               butil::gettimeofday_us() < end_us) {
+            bthread_usleep(1000);
+        }
+        canceled = cntl->IsCanceled();
+        response->set_message(request->message());
+        nfinished.fetch_add(1);
+    }
+
+    void Reset() {
+        notified.store(false);
+        canceled.store(false);
+    }
+
+    // Wait for the handler to finish `n' RPCs.
+    void WaitFinished(int n) {
+        for (int i = 0; i < 300 && nfinished.load() < n; ++i) {
+            bthread_usleep(10000);
+        }
+    }
+
+    butil::atomic<bool> notified;
+    butil::atomic<bool> canceled;
+    butil::atomic<int> nfinished;
+};
+
+TEST_F(ServerTest, cancel_propagation) {
+    const bool saved_propagate_cancel =
+        brpc::policy::FLAGS_baidu_std_propagate_cancel;
+    brpc::policy::FLAGS_baidu_std_propagate_cancel = true;
+    const int port = 9203;
+    brpc::Server server;
+    CancelAwareEchoService svc;
+    ASSERT_EQ(0, server.AddService(&svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    ASSERT_EQ(0, server.Start(port, NULL));
+
+    int nrpc = 0;
+    const char* protocols[] = { "baidu_std", "h2:grpc" };
+    for (size_t i = 0; i < ARRAY_SIZE(protocols); ++i) {
+        brpc::Channel channel;
+        brpc::ChannelOptions options;
+        options.protocol = protocols[i];
+        ASSERT_EQ(0, channel.Init("127.0.0.1", port, &options));
+        test::EchoService_Stub stub(&channel);
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+
+        // Canceled by timeout.
+        svc.Reset();
+        brpc::Controller cntl;
+        cntl.set_timeout_ms(100);
+        const int64_t start_us = butil::gettimeofday_us();
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_EQ(brpc::ERPCTIMEDOUT, cntl.ErrorCode()) << protocols[i];
+        svc.WaitFinished(++nrpc);
+        ASSERT_EQ(nrpc, svc.nfinished.load()) << protocols[i];
+        ASSERT_LT(butil::gettimeofday_us() - start_us, 1000000L) << protocols[i];
+        ASSERT_TRUE(svc.canceled.load()) << protocols[i];
+        ASSERT_TRUE(svc.notified.load()) << protocols[i];
+
+        // Canceled by StartCancel.
+        svc.Reset();
+        cntl.Reset();
+        cntl.set_timeout_ms(-1);
+        const brpc::CallId cid = cntl.call_id();
+        stub.Echo(&cntl, &req, &res, brpc::DoNothing());
+        bthread_usleep(50000);
+        brpc::StartCancel(cid);
+        brpc::Join(cid);
+        ASSERT_EQ(ECANCELED, cntl.ErrorCode()) << protocols[i];
+        svc.WaitFinished(++nrpc);
+        ASSERT_EQ(nrpc, svc.nfinished.load()) << protocols[i];
+        ASSERT_TRUE(svc.canceled.load()) << protocols[i];
+        ASSERT_TRUE(svc.notified.load()) << protocols[i];
+    }
+
+    // Not canceled without the flag.
+    brpc::policy::FLAGS_baidu_std_propagate_cancel = false;
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", port, NULL));
+    test::EchoService_Stub stub(&channel);
+    test::EchoRequest req;
+    test::EchoResponse res;
+    req.set_message(EXP_REQUEST);
+    svc.Reset();
+    brpc::Controller cntl;
+    cntl.set_timeout_ms(100);
+    stub.Echo(&cntl, &req, &res, NULL);
+    ASSERT_EQ(brpc::ERPCTIMEDOUT, cntl.ErrorCode());
+    svc.WaitFinished(++nrpc);
+    ASSERT_EQ(nrpc, svc.nfinished.load());
+    ASSERT_FALSE(svc.canceled.load());
+    brpc::policy::FLAGS_baidu_std_propagate_cancel = saved_propagate_cancel;
+}
+
+class ArenaCheckingEchoService : public test::EchoService {
+public:
+    ArenaCheckingEchoService() : on_arena(false) {}
+
+    virtual void Echo(google::protobuf::RpcController*,
+                      const test::EchoRequest* request,
+                      test::EchoResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+#if GOOGLE_PROTOBUF_VERSION >= 3000000
+        on_arena = (request->GetArena() != NULL &&
+                    request->GetArena() == response->GetArena());
+#endif
+        response->set_message(request->message());
+    }
+
+    bool on_arena;
+};
+
+TEST_F(ServerTest, pb_arena) {
+    const int port = 9204;
+    brpc::Server server;
+    ArenaCheckingEchoService svc;
+    ASSERT_EQ(0, server.AddService(&svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions options;
+    options.use_pb_arena = true;
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", port, NULL));
+    test::EchoService_Stub stub(&channel);
+    for (int i = 0; i < 10; ++i) {
+        test::EchoRequest req;
+        test::EchoResponse res;
+        req.set_message(EXP_REQUEST);
+        brpc::Controller cntl;
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_RESPONSE, res.message());
+        // Arenas are enabled for all messages since protobuf 3.14, echo.proto
+        // does not set cc_enable_arenas for older versions.
+#if GOOGLE_PROTOBUF_VERSION >= 3014000
+        ASSERT_TRUE(svc.on_arena);
+#endif
+    }
+}
+
+class NoArenaEchoServiceImpl : public test::NoArenaEchoService {
+public:
+    virtual void Echo(google::protobuf::RpcController*,
+                      const test::NoArenaRequest* request,
+                      test::NoArenaResponse* response,
+                      google::protobuf::Closure* done) {
+        brpc::ClosureGuard done_guard(done);
+        response->set_message(request->message());
+    }
+};
+
+// Messages of types without arena support are owned by the Arena as well
+// and must not be deleted again.
+TEST_F(ServerTest, pb_arena_with_types_not_supporting_arena) {
+    const int port = 9204;
+    brpc::Server server;
+    NoArenaEchoServiceImpl svc;
+    ASSERT_EQ(0, server.AddService(&svc, brpc::SERVER_DOESNT_OWN_SERVICE));
+    brpc::ServerOptions options;
+    options.use_pb_arena = true;
+    ASSERT_EQ(0, server.Start(port, &options));
+
+    brpc::Channel channel;
+    ASSERT_EQ(0, channel.Init("127.0.0.1", port, NULL));
+    test::NoArenaEchoService_Stub stub(&channel);
+    for (int i = 0; i < 10; ++i) {
+        test::NoArenaRequest req;
+        test::NoArenaResponse res;
+        req.set_message(EXP_REQUEST);
+        brpc::Controller cntl;
+        stub.Echo(&cntl, &req, &res, NULL);
+        ASSERT_FALSE(cntl.Failed()) << cntl.ErrorText();
+        ASSERT_EQ(EXP_REQUEST, res.message());
+    }
+}
 } //namespace
@@ -66,7 +66,7 @@ int main(int argc, char* argv[]) {
                                brpc::policy::PackHuluRequest,
                                EchoProcessHuluRequest, EchoProcessHuluRequest,
                                NULL, NULL, NULL,
-                               brpc::CONNECTION_TYPE_ALL, "dummy_hulu" };
+                               brpc::CONNECTION_TYPE_ALL, "dummy_hulu", NULL };
     EXPECT_EQ(0,  RegisterProtocol((brpc::ProtocolType)30, dummy_protocol));
     return RUN_ALL_TESTS();
 }
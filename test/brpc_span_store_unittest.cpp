@@ -0,0 +1,194 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <sstream>
+#include <gtest/gtest.h>
+#include "butil/file_util.h"
+#include "butil/string_printf.h"
+#include "butil/time.h"
+#include "brpc/span.h"
+#include "brpc/details/span_store.h"
+
+namespace {
+
+const char* const TEST_DIR = "./span_store_test";
+const int64_t BASE_US = 1600000000000000L;
+
+void MakeSpan(uint64_t trace_id, uint64_t span_id, int64_t start_us,
+              int error_code, brpc::BriefSpan* brief, brpc::RpczSpan* span) {
+    brief->set_trace_id(trace_id);
+    brief->set_span_id(span_id);
+    brief->set_log_id(span_id * 3);
+    brief->set_type(brpc::SPAN_TYPE_SERVER);
+    brief->set_error_code(error_code);
+    brief->set_request_size(100 + span_id % 7);
+    brief->set_response_size(-1);
+    brief->set_start_real_us(start_us);
+    brief->set_latency_us(span_id % 1000);
+    brief->set_full_method_name(
+        butil::string_printf("test.EchoService.Echo%d", (int)(span_id % 3)));
+
+    span->set_trace_id(trace_id);
+    span->set_span_id(span_id);
+    span->set_parent_span_id(0);
+    span->set_received_real_us(start_us);
+    span->set_full_method_name(brief->full_method_name());
+    span->set_info(butil::string_printf("request #%llu", (unsigned long long)span_id));
+    brpc::RpczSpan* client = span->add_client_spans();
+    client->set_trace_id(trace_id);
+    client->set_span_id(span_id + 1000000);
+    client->set_parent_span_id(span_id);
+}
+
+class ErrorOnly : public brpc::SpanFilter {
+public:
+    bool Keep(const brpc::BriefSpan& brief) { return brief.error_code() != 0; }
+};
+
+class SpanStoreTest : public ::testing::Test {
+protected:
+    void SetUp() {
+        butil::DeleteFile(butil::FilePath(TEST_DIR), true);
+        _store.reset(brpc::SpanStore::Open(TEST_DIR, false));
+        ASSERT_TRUE(_store != NULL);
+    }
+    void TearDown() {
+        _store.reset();
+        ASSERT_FALSE(butil::PathExists(butil::FilePath(TEST_DIR)));
+    }
+    // Span i starts at BASE_US + i * 10 and belongs to trace i / 4.
+    void AppendSpans(int begin, int end) {
+        brpc::BriefSpan brief;
+        brpc::RpczSpan span;
+        for (int i = begin; i < end; ++i) {
+            brief.Clear();
+            span.Clear();
+            MakeSpan(i / 4 + 1, i + 1, BASE_US + i * 10L, (i % 5 == 0 ? 1003 : 0),
+                     &brief, &span);
+            ASSERT_EQ(0, _store->Append(brief, span));
+        }
+    }
+
+    butil::intrusive_ptr<brpc::SpanStore> _store;
+};
+
+TEST_F(SpanStoreTest, list_spans) {
+    // More than one segment plus spans in memory.
+    const int N = 20000;
+    AppendSpans(0, N);
+    std::deque<brpc::BriefSpan> out;
+    _store->ListSpans(BASE_US + N * 10L, 100, &out, NULL);
+    ASSERT_EQ(100u, out.size());
+    for (size_t i = 0; i < out.size(); ++i) {
+        ASSERT_EQ(BASE_US + (N - 1 - (int64_t)i) * 10, out[i].start_real_us());
+        ASSERT_EQ((uint64_t)(N - i), out[i].span_id());
+    }
+    brpc::BriefSpan brief;
+    brpc::RpczSpan span;
+    MakeSpan(out[0].trace_id(), out[0].span_id(), out[0].start_real_us(),
+             out[0].error_code(), &brief, &span);
+    ASSERT_EQ(brief.SerializeAsString(), out[0].SerializeAsString());
+
+    // Across segments.
+    const int64_t before = BASE_US + 8200 * 10L;
+    _store->ListSpans(before, 500, &out, NULL);
+    ASSERT_EQ(500u, out.size());
+    for (size_t i = 0; i < out.size(); ++i) {
+        ASSERT_EQ(before - (int64_t)i * 10, out[i].start_real_us());
+    }
+
+    // Spans filtered out are scanned as well.
+    ErrorOnly filter;
+    _store->ListSpans(before, 500, &out, &filter);
+    ASSERT_EQ(100u, out.size());
+    for (size_t i = 0; i < out.size(); ++i) {
+        ASSERT_EQ(1003, out[i].error_code());
+    }
+
+    _store->ListSpans(BASE_US - 1, 100, &out, NULL);
+    ASSERT_TRUE(out.empty());
+}
+
+TEST_F(SpanStoreTest, find_spans) {
+    AppendSpans(0, 10000);
+    ASSERT_EQ(0, _store->Flush());
+    AppendSpans(10000, 10010);
+
+    for (uint64_t trace_id = 1; trace_id <= 2503; trace_id += 833) {
+        std::deque<brpc::RpczSpan> spans;
+        _store->FindSpans(trace_id, &spans);
+        ASSERT_EQ(4u, spans.size()) << trace_id;
+        for (size_t i = 0; i < spans.size(); ++i) {
+            ASSERT_EQ(trace_id, spans[i].trace_id());
+            ASSERT_EQ((trace_id - 1) * 4 + i + 1, spans[i].span_id());
+            ASSERT_EQ(1, spans[i].client_spans_size());
+        }
+    }
+    brpc::RpczSpan span;
+    // In a sealed segment.
+    ASSERT_EQ(0, _store->FindSpan(3, 10, &span));
+    ASSERT_EQ("request #10", span.info());
+    // In memory.
+    ASSERT_EQ(0, _store->FindSpan(2501, 10002, &span));
+    ASSERT_EQ("request #10002", span.info());
+    ASSERT_EQ(-1, _store->FindSpan(3, 100, &span));
+    ASSERT_EQ(-1, _store->FindSpan(100000, 1, &span));
+}
+
+TEST_F(SpanStoreTest, remove_spans) {
+    AppendSpans(0, 30000);
+    ASSERT_EQ(0, _store->Flush());
+    _store->RemoveSpansBefore(BASE_US + 20000 * 10L);
+    std::deque<brpc::BriefSpan> out;
+    _store->ListSpans(BASE_US + 30000 * 10L, 30000, &out, NULL);
+    // Whole segments are removed.
+    ASSERT_LT(out.size(), 30000u);
+    ASSERT_GE(out.size(), 10000u);
+    ASSERT_EQ(BASE_US + 29999 * 10L, out.front().start_real_us());
+    brpc::RpczSpan span;
+    ASSERT_EQ(-1, _store->FindSpan(1, 1, &span));
+    ASSERT_EQ(0, _store->FindSpan(7000, 28000, &span));
+
+    std::ostringstream os;
+    _store->Describe(os);
+    LOG(INFO) << os.str();
+    ASSERT_NE(std::string::npos, os.str().find("compressed_bytes"));
+}
+
+TEST_F(SpanStoreTest, append_perf) {
+    const int N = 200000;
+    std::vector<std::pair<brpc::BriefSpan, brpc::RpczSpan> > spans(1000);
+    for (size_t i = 0; i < spans.size(); ++i) {
+        MakeSpan(i / 4 + 1, i + 1, BASE_US + i * 10L, 0,
+                 &spans[i].first, &spans[i].second);
+    }
+    butil::Timer tm;
+    tm.start();
+    for (int i = 0; i < N; ++i) {
+        const std::pair<brpc::BriefSpan, brpc::RpczSpan>& s = spans[i % spans.size()];
+        ASSERT_EQ(0, _store->Append(s.first, s.second));
+    }
+    ASSERT_EQ(0, _store->Flush());
+    tm.stop();
+    std::ostringstream os;
+    _store->Describe(os);
+    LOG(INFO) << "Appended " << N << " spans in " << tm.m_elapsed() << "ms, "
+              << N * 1000L / std::max(tm.m_elapsed(), (int64_t)1)
+              << " spans/s\n" << os.str();
+}
+
+} // namespace
@@ -27,6 +27,12 @@
 #include "bthread/mutex.h"
 #include "butil/gperftools_profiler.h"
 
+namespace bthread {
+DECLARE_bool(bthread_contention_stats);
+int ContentionStatsPrintFolded(std::ostream& os, bool show_count);
+void ContentionStatsReset();
+}
+
 namespace {
 inline unsigned* get_butex(bthread_mutex_t & m) {
     return m.butex;
@@ -266,4 +272,37 @@ TEST(MutexTest, mix_thread_types) {
         pthread_join(pthreads[i], NULL);
     }
 }
+
+TEST(MutexTest, contention_stats) {
+    std::ostringstream oss;
+    ASSERT_EQ(-1, bthread::ContentionStatsPrintFolded(oss, false));
+    bthread::FLAGS_bthread_contention_stats = true;
+    g_stopped = false;
+    bthread::Mutex m;
+    pthread_t th[8];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, loop_until_stopped, &m));
+    }
+    // Wait for the collector to pass samples to the stats.
+    for (int i = 0; i < 30 && oss.str().empty(); ++i) {
+        usleep(100000);
+        oss.str("");
+        ASSERT_EQ(0, bthread::ContentionStatsPrintFolded(oss, false));
+    }
+    g_stopped = true;
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        pthread_join(th[i], NULL);
+    }
+    bthread::FLAGS_bthread_contention_stats = false;
+    LOG(INFO) << "Folded contentions:\n" << oss.str();
+    ASSERT_NE(std::string::npos, oss.str().find("loop_until_stopped"))
+        << oss.str();
+
+    std::ostringstream oss2;
+    bthread::ContentionStatsReset();
+    bthread::FLAGS_bthread_contention_stats = true;
+    ASSERT_EQ(0, bthread::ContentionStatsPrintFolded(oss2, true));
+    bthread::FLAGS_bthread_contention_stats = false;
+    ASSERT_TRUE(oss2.str().empty()) << oss2.str();
+}
 } // namespace
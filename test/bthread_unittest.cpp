@@ -25,6 +25,11 @@
 #include "bthread/bthread.h"
 #include "bthread/unstable.h"
 #include "bthread/task_meta.h"
+#include "bvar/variable.h"
+
+namespace bthread {
+DECLARE_int32(bthread_sched_latency_sample_rate);
+}
 
 namespace {
 class BthreadTest : public ::testing::Test{
@@ -531,4 +536,34 @@ TEST_F(BthreadTest, yield_single_thread) {
     ASSERT_EQ(0, bthread_join(tid, NULL));
 }
 
+TEST_F(BthreadTest, sched_latency_sampling) {
+    const int saved_rate = bthread::FLAGS_bthread_sched_latency_sample_rate;
+    bthread::FLAGS_bthread_sched_latency_sample_rate = 1;
+    const int N = 1000;
+    std::vector<bthread_t> tids(N);
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_start_background(&tids[i], NULL, do_nothing, NULL));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, bthread_join(tids[i], NULL));
+    }
+    bthread::FLAGS_bthread_sched_latency_sample_rate = saved_rate;
+
+    const std::string count =
+        bvar::Variable::describe_exposed("bthread_sched_count");
+    ASSERT_FALSE(count.empty());
+    ASSERT_LT(0, atoi(count.c_str()));
+    const std::string depth =
+        bvar::Variable::describe_exposed("bthread_group_rq_depth");
+    ASSERT_NE(std::string::npos, depth.find(':')) << depth;
+    LOG(INFO) << "sched_count=" << count
+              << " sched_latency_99="
+              << bvar::Variable::describe_exposed("bthread_sched_latency_99")
+              << " rq_depth=\n" << depth;
+    ASSERT_FALSE(bvar::Variable::describe_exposed(
+                     "bthread_steal_second").empty());
+    ASSERT_FALSE(bvar::Variable::describe_exposed(
+                     "bthread_steal_failure_second").empty());
+}
+
 } // namespace
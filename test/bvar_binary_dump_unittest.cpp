@@ -0,0 +1,223 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Date: 2026/10/18 16:40:12
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <map>
+#include <gtest/gtest.h>
+#include "butil/file_util.h"
+#include "butil/recordio.h"
+#include "bvar/bvar.h"
+#include "bvar/detail/binary_dump.h"
+
+namespace {
+
+class StringWriter : public butil::IWriter {
+public:
+    ssize_t WriteV(const iovec* iov, int iovcnt) override {
+        const size_t old_size = _str.size();
+        for (int i = 0; i < iovcnt; ++i) {
+            _str.append((char*)iov[i].iov_base, iov[i].iov_len);
+        }
+        return _str.size() - old_size;
+    }
+    const std::string& str() const { return _str; }
+private:
+    std::string _str;
+};
+
+class FdReader : public butil::IReader {
+public:
+    explicit FdReader(int fd) : _fd(fd) {}
+    ssize_t ReadV(const iovec* iov, int iovcnt) override {
+        return readv(_fd, iov, iovcnt);
+    }
+private:
+    int _fd;
+};
+
+typedef std::map<std::string, std::string> ValueMap;
+
+void get_present_values(const bvar::detail::BinaryDumpDecoder& d,
+                        ValueMap* out) {
+    out->clear();
+    std::string value;
+    for (size_t i = 0; i < d.name_count(); ++i) {
+        if (d.present(i)) {
+            d.get_value(i, &value);
+            (*out)[d.name(i)] = value;
+        }
+    }
+}
+
+TEST(BinaryDumpTest, encode_and_decode) {
+    bvar::DumpOptions options;
+    options.white_wildcards = "binary_dump_test_*";
+    bvar::detail::BinaryDumpEncoder encoder("app_");
+    bvar::detail::BinaryDumpDecoder decoder;
+    butil::Record rec;
+
+    bvar::Adder<int64_t> a("binary_dump_test_a");
+    bvar::Status<std::string> s("binary_dump_test_s", "hello");
+    bvar::Status<double> d("binary_dump_test_d", 1.5);
+    a << -3;
+
+    encoder.begin_round(1000000);
+    ASSERT_EQ(3, bvar::Variable::dump_exposed(&encoder, &options));
+    encoder.end_round(&rec);
+    ASSERT_TRUE(rec.Meta("names") != NULL);
+    ASSERT_EQ(0, decoder.apply(rec));
+    ASSERT_EQ(1000000, decoder.time_us());
+    ValueMap m;
+    get_present_values(decoder, &m);
+    ASSERT_EQ(3UL, m.size());
+    ASSERT_EQ("-3", m["app_binary_dump_test_a"]);
+    ASSERT_EQ("\"hello\"", m["app_binary_dump_test_s"]);
+    ASSERT_EQ("1.5", m["app_binary_dump_test_d"]);
+
+    // Nothing changed: no names and no entries.
+    encoder.begin_round(2000000);
+    ASSERT_EQ(3, bvar::Variable::dump_exposed(&encoder, &options));
+    encoder.end_round(&rec);
+    ASSERT_TRUE(rec.Meta("names") == NULL);
+    ASSERT_LE(rec.Payload().size(), 4UL);
+    ASSERT_EQ(0, decoder.apply(rec));
+    ASSERT_EQ(2000000, decoder.time_us());
+    for (size_t i = 0; i < decoder.name_count(); ++i) {
+        ASSERT_FALSE(decoder.changed(i));
+    }
+
+    // Change values, add and remove variables.
+    a << 1000000;
+    s.set_value("world");
+    d.hide();
+    bvar::Adder<int> b("binary_dump_test_b");
+    b << 7;
+    encoder.begin_round(3000000);
+    ASSERT_EQ(3, bvar::Variable::dump_exposed(&encoder, &options));
+    encoder.end_round(&rec);
+    ASSERT_EQ(0, decoder.apply(rec));
+    get_present_values(decoder, &m);
+    ASSERT_EQ(3UL, m.size());
+    ASSERT_EQ("999997", m["app_binary_dump_test_a"]);
+    ASSERT_EQ("\"world\"", m["app_binary_dump_test_s"]);
+    ASSERT_EQ("7", m["app_binary_dump_test_b"]);
+    ASSERT_EQ(4UL, decoder.name_count());
+
+    // A removed variable comes back.
+    d.expose("binary_dump_test_d");
+    encoder.begin_round(4000000);
+    ASSERT_EQ(4, bvar::Variable::dump_exposed(&encoder, &options));
+    encoder.end_round(&rec);
+    ASSERT_EQ(0, decoder.apply(rec));
+    get_present_values(decoder, &m);
+    ASSERT_EQ(4UL, m.size());
+    ASSERT_EQ("1.5", m["app_binary_dump_test_d"]);
+}
+
+TEST(BinaryDumpTest, non_canonical_integers_are_kept_as_strings) {
+    bvar::detail::BinaryDumpEncoder encoder("");
+    bvar::detail::BinaryDumpDecoder decoder;
+    butil::Record rec;
+    const char* const values[] = {
+        "007", "-0", "+1", "1.0", "99999999999999999999", "",
+        "-9223372036854775808", "9223372036854775807", "0", "-1" };
+    encoder.begin_round(0);
+    for (size_t i = 0; i < ARRAY_SIZE(values); ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "v%d", (int)i);
+        ASSERT_TRUE(encoder.dump(name, values[i]));
+    }
+    encoder.end_round(&rec);
+    ASSERT_EQ(0, decoder.apply(rec));
+    ASSERT_EQ(ARRAY_SIZE(values), decoder.name_count());
+    std::string value;
+    for (size_t i = 0; i < ARRAY_SIZE(values); ++i) {
+        decoder.get_value(i, &value);
+        ASSERT_EQ(values[i], value);
+    }
+}
+
+TEST(BinaryDumpTest, records_are_smaller_than_text) {
+    bvar::detail::BinaryDumpEncoder encoder("some_app_");
+    butil::Record rec;
+    StringWriter sw;
+    butil::RecordWriter writer(&sw);
+    size_t text_size = 0;
+    char name[64];
+    for (int round = 0; round < 10; ++round) {
+        encoder.begin_round(round * 1000000L);
+        for (int i = 0; i < 1000; ++i) {
+            snprintf(name, sizeof(name), "rpc_server_method_%d_latency", i);
+            // 10% of variables change in each round.
+            const int value = (i % 10 == round % 10 ? round * 100 : 0) + i;
+            char desc[32];
+            snprintf(desc, sizeof(desc), "%d", value);
+            ASSERT_TRUE(encoder.dump(name, desc));
+            text_size += strlen("some_app_") + strlen(name) + 3 +
+                strlen(desc) + 2;
+        }
+        encoder.end_round(&rec);
+        ASSERT_EQ(0, writer.Write(rec));
+    }
+    ASSERT_LT(sw.str().size() * 5, text_size);
+}
+
+TEST(BinaryDumpTest, file_dumper) {
+    const std::string filename = "binary_dump_test_dir/bvar.bdata";
+    butil::DeleteFile(butil::FilePath("binary_dump_test_dir"), true);
+    bvar::DumpOptions options;
+    options.white_wildcards = "binary_dump_test_*";
+    bvar::Adder<int> a("binary_dump_test_a");
+    // Rotate after every record.
+    bvar::detail::BinaryFileDumper dumper(filename, "", 1);
+    for (int i = 0; i < 3; ++i) {
+        a << 1;
+        ASSERT_EQ(1, dumper.dump_exposed(&options));
+    }
+    ASSERT_TRUE(butil::PathExists(butil::FilePath(filename + ".old")));
+
+    // Every file is self-contained.
+    const char* const files[] = { ".old", "" };
+    for (size_t i = 0; i < ARRAY_SIZE(files); ++i) {
+        const int fd = open((filename + files[i]).c_str(), O_RDONLY);
+        ASSERT_GE(fd, 0);
+        FdReader fr(fd);
+        butil::RecordReader reader(&fr);
+        bvar::detail::BinaryDumpDecoder decoder;
+        butil::Record rec;
+        int nrec = 0;
+        while (reader.ReadNext(&rec)) {
+            ASSERT_EQ(0, decoder.apply(rec));
+            ++nrec;
+        }
+        ASSERT_EQ((int)butil::RecordReader::END_OF_READER, reader.last_error());
+        close(fd);
+        ASSERT_EQ(1, nrec);
+        ASSERT_EQ(1UL, decoder.name_count());
+        ASSERT_EQ("binary_dump_test_a", decoder.name(0));
+        std::string value;
+        decoder.get_value(0, &value);
+        ASSERT_EQ(i == 0 ? "2" : "3", value);
+    }
+    butil::DeleteFile(butil::FilePath("binary_dump_test_dir"), true);
+}
+
+} // namespace
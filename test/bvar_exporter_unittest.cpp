@@ -0,0 +1,165 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Date: 2026/10/18 17:52:20
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include "butil/endpoint.h"
+#include "butil/string_printf.h"
+#include "bvar/bvar.h"
+#include "bvar/detail/exporter.h"
+
+namespace {
+
+class StringSink : public bvar::detail::ExportSink {
+public:
+    int send(const char* data, size_t len) override {
+        payloads.push_back(std::string(data, len));
+        return 0;
+    }
+    std::vector<std::string> payloads;
+};
+
+bvar::detail::MetricExporter* new_exporter(bvar::detail::ExportFormat format,
+                                           size_t max_payload_size = 1432) {
+    bvar::detail::ExporterOptions options;
+    options.format = format;
+    options.white_wildcards = "exporter_test_*";
+    options.max_payload_size = max_payload_size;
+    options.max_pending_payloads = 4;
+    return new bvar::detail::MetricExporter(options);
+}
+
+TEST(ExporterTest, statsd_exports_changed_numbers_only) {
+    bvar::Adder<int> a("exporter_test_a");
+    bvar::Status<double> d("exporter_test_d", 1.5);
+    bvar::Status<std::string> s("exporter_test_s", "not a number");
+    a << 3;
+    bvar::detail::MetricExporter* exporter =
+        new_exporter(bvar::detail::EXPORT_FORMAT_STATSD);
+    ASSERT_EQ(2UL, exporter->refresh_variables());
+    StringSink sink;
+    exporter->take_sample();
+    ASSERT_EQ(1, exporter->flush(&sink));
+    ASSERT_EQ(1UL, sink.payloads.size());
+    ASSERT_EQ("exporter_test_a:3|g\nexporter_test_d:1.5|g\n", sink.payloads[0]);
+
+    // Nothing changed.
+    exporter->take_sample();
+    ASSERT_EQ(0, exporter->flush(&sink));
+
+    a << 4;
+    exporter->take_sample();
+    ASSERT_EQ(1, exporter->flush(&sink));
+    ASSERT_EQ("exporter_test_a:7|g\n", sink.payloads[1]);
+
+    // Values are kept after refreshing.
+    ASSERT_EQ(2UL, exporter->refresh_variables());
+    exporter->take_sample();
+    ASSERT_EQ(0, exporter->flush(&sink));
+    delete exporter;
+}
+
+TEST(ExporterTest, openmetrics) {
+    bvar::Adder<int> a("exporter_test_a");
+    bvar::Adder<int> b("exporter_test_b");
+    a << 1;
+    b << 2;
+    bvar::detail::MetricExporter* exporter =
+        new_exporter(bvar::detail::EXPORT_FORMAT_OPENMETRICS);
+    ASSERT_EQ(2UL, exporter->refresh_variables());
+    StringSink sink;
+    exporter->take_sample();
+    ASSERT_EQ(1, exporter->flush(&sink));
+    const std::string& body = sink.payloads[0];
+    ASSERT_EQ(0UL, body.find("exporter_test_a 1 ")) << body;
+    ASSERT_NE(std::string::npos, body.find("\nexporter_test_b 2 ")) << body;
+    ASSERT_EQ(body.size() - 6, body.find("# EOF\n")) << body;
+    delete exporter;
+}
+
+TEST(ExporterTest, split_and_drop_payloads) {
+    std::vector<bvar::Adder<int>*> adders;
+    for (int i = 0; i < 100; ++i) {
+        adders.push_back(new bvar::Adder<int>(
+                    butil::string_printf("exporter_test_%03d", i)));
+        *adders.back() << i + 1;
+    }
+    bvar::detail::MetricExporter* exporter =
+        new_exporter(bvar::detail::EXPORT_FORMAT_STATSD, 64);
+    ASSERT_EQ(100UL, exporter->refresh_variables());
+    StringSink sink;
+    // 4 payloads are not enough for all variables.
+    exporter->take_sample();
+    ASSERT_EQ(4, exporter->flush(&sink));
+    ASSERT_EQ(1, exporter->dropped_count());
+    size_t nline = 0;
+    for (size_t i = 0; i < sink.payloads.size(); ++i) {
+        ASSERT_LE(sink.payloads[i].size(), 64UL);
+        nline += std::count(sink.payloads[i].begin(),
+                            sink.payloads[i].end(), '\n');
+    }
+    // Remaining variables are exported next time.
+    while (nline < 100UL) {
+        const size_t old_npayload = sink.payloads.size();
+        exporter->take_sample();
+        ASSERT_LT(0, exporter->flush(&sink));
+        for (size_t i = old_npayload; i < sink.payloads.size(); ++i) {
+            nline += std::count(sink.payloads[i].begin(),
+                                sink.payloads[i].end(), '\n');
+        }
+    }
+    ASSERT_EQ(100UL, nline);
+    delete exporter;
+    for (size_t i = 0; i < adders.size(); ++i) {
+        delete adders[i];
+    }
+}
+
+TEST(ExporterTest, statsd_over_udp) {
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(fd, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(0, bind(fd, (sockaddr*)&addr, sizeof(addr)));
+    socklen_t len = sizeof(addr);
+    ASSERT_EQ(0, getsockname(fd, (sockaddr*)&addr, &len));
+    bvar::detail::StatsdSink sink;
+    ASSERT_EQ(0, sink.init(butil::string_printf(
+                    "127.0.0.1:%d", ntohs(addr.sin_port)).c_str()));
+
+    bvar::Adder<int> a("exporter_test_a");
+    a << 5;
+    bvar::detail::MetricExporter* exporter =
+        new_exporter(bvar::detail::EXPORT_FORMAT_STATSD);
+    exporter->refresh_variables();
+    exporter->take_sample();
+    ASSERT_EQ(1, exporter->flush(&sink));
+    char buf[128];
+    const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    ASSERT_EQ("exporter_test_a:5|g\n", std::string(buf, n));
+    delete exporter;
+    close(fd);
+}
+
+} // namespace
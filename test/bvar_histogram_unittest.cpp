@@ -0,0 +1,147 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "butil/logging.h"
+#include "bvar/detail/histogram.h"
+#include "bvar/latency_recorder.h"
+
+namespace bvar {
+DECLARE_bool(bvar_latency_histogram);
+}
+
+namespace {
+
+class HistogramTest : public testing::Test {
+protected:
+    void SetUp() {}
+    void TearDown() {}
+};
+
+TEST_F(HistogramTest, buckets) {
+    using namespace bvar::detail;
+    ASSERT_EQ(0UL, histogram_bucket_index(0));
+    ASSERT_EQ(15UL, histogram_bucket_index(15));
+    ASSERT_EQ(31UL, histogram_bucket_index(31));
+    ASSERT_EQ(HISTOGRAM_NBUCKET - 1, histogram_bucket_index(0xFFFFFFFF));
+    size_t last_index = 0;
+    for (uint64_t v = 1; v <= 0xFFFFFFFFULL; v = v * 5 / 4 + 1) {
+        const size_t index = histogram_bucket_index(v);
+        ASSERT_GE(index, last_index);
+        last_index = index;
+        const uint64_t lower = histogram_bucket_lower(index);
+        const uint64_t width = histogram_bucket_width(index);
+        ASSERT_LE(lower, v);
+        ASSERT_LT(v, lower + width);
+        // Relative error is bounded.
+        ASSERT_TRUE(width == 1 || width * HISTOGRAM_SUB_COUNT <= lower) << v;
+    }
+    // Buckets are contiguous.
+    for (size_t i = 1; i < HISTOGRAM_NBUCKET; ++i) {
+        ASSERT_EQ(histogram_bucket_lower(i - 1) + histogram_bucket_width(i - 1),
+                  histogram_bucket_lower(i));
+    }
+}
+
+TEST_F(HistogramTest, add) {
+    bvar::detail::Histogram h;
+    for (int i = 0; i < 10000; ++i) {
+        h << (i + 1);
+    }
+    h << -1;  // dropped
+    bvar::detail::GlobalHistogramBuckets b = h.get_value();
+    ASSERT_EQ(10000UL, b.count());
+    ASSERT_EQ(10000L * 10001 / 2, b.sum);
+    for (int k = 1; k <= 10; ++k) {
+        const int64_t value = b.get_number(k / 10.0);
+        EXPECT_GE(value, k * 1000 * 31 / 32) << "k=" << k;
+        EXPECT_LE(value, k * 1000 * 33 / 32) << "k=" << k;
+    }
+    // Exact for small values.
+    bvar::detail::Histogram h2;
+    for (int i = 0; i < 100; ++i) {
+        h2 << (i % 10);
+    }
+    b = h2.get_value();
+    ASSERT_EQ(0, b.get_number(0.01));
+    ASSERT_EQ(4, b.get_number(0.5));
+    ASSERT_EQ(9, b.get_number(1));
+
+    uint64_t cumulative[33];
+    ASSERT_EQ(5UL, b.get_power2_cumulative_counts(cumulative));
+    ASSERT_EQ(10UL, cumulative[0]);   // < 1
+    ASSERT_EQ(20UL, cumulative[1]);   // < 2
+    ASSERT_EQ(40UL, cumulative[2]);   // < 4
+    ASSERT_EQ(80UL, cumulative[3]);   // < 8
+    ASSERT_EQ(100UL, cumulative[4]);  // < 16
+    std::ostringstream os;
+    os << b;
+    ASSERT_EQ("{\"sum\":450,\"buckets\":[10,20,40,80,100]}", os.str());
+}
+
+static void* add_in_thread(void* arg) {
+    bvar::detail::Histogram* h = (bvar::detail::Histogram*)arg;
+    for (int i = 0; i < 100000; ++i) {
+        *h << i % 1000;
+    }
+    return NULL;
+}
+
+TEST_F(HistogramTest, multiple_threads) {
+    bvar::detail::Histogram h;
+    pthread_t th[8];
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, add_in_thread, &h));
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        pthread_join(th[i], NULL);
+    }
+    bvar::detail::GlobalHistogramBuckets b = h.get_value();
+    ASSERT_EQ(800000UL, b.count());
+    const int64_t p999 = b.get_number(0.999);
+    EXPECT_GE(p999, 999 * 31 / 32);
+    EXPECT_LE(p999, 999 * 33 / 32);
+}
+
+TEST_F(HistogramTest, latency_recorder) {
+    bvar::FLAGS_bvar_latency_histogram = true;
+    bvar::LatencyRecorder rec("histogram_test");
+    bvar::FLAGS_bvar_latency_histogram = false;
+    ASSERT_EQ("histogram_test_latency_histogram", rec.latency_histogram_name());
+    for (int i = 0; i < 1000; ++i) {
+        rec << i;
+    }
+    // Windows are updated by the sampler every second.
+    usleep(1100000);
+    const int64_t p90 = rec.latency_percentile(0.9);
+    EXPECT_GE(p90, 900 * 31 / 32);
+    EXPECT_LE(p90, 900 * 33 / 32);
+    const bvar::Vector<int64_t, 4> ps = rec.latency_percentiles();
+    EXPECT_LE(ps[0], ps[1]);
+    EXPECT_LE(ps[1], ps[2]);
+    EXPECT_LE(ps[2], ps[3]);
+    std::string desc = bvar::Variable::describe_exposed(
+        "histogram_test_latency_histogram");
+    ASSERT_EQ(0UL, desc.find("{\"sum\":499500,\"buckets\":[")) << desc;
+
+    bvar::LatencyRecorder rec2("histogram_test2");
+    ASSERT_TRUE(rec2.latency_histogram_name().empty());
+}
+
+} // namespace
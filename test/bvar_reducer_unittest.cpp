@@ -17,7 +17,10 @@
 
 #include <limits>                           //std::numeric_limits
 
+#include <sstream>
+#include <gflags/gflags.h>
 #include "bvar/reducer.h"
+#include "bvar/window.h"
 
 #include "butil/time.h"
 #include "butil/macros.h"
@@ -342,4 +345,64 @@ TEST_F(ReducerTest, simple_window) {
     const int64_t v = w.get_value();
     ASSERT_EQ(100, v) << "v=" << v;
 }
+
+TEST_F(ReducerTest, high_resolution_series) {
+    bvar::Adder<int64_t> a;
+    bvar::PerSecond<bvar::Adder<int64_t> > ps("reducer_test_hr_ps", &a);
+    bvar::SeriesOptions options;
+    options.high_resolution = true;
+    std::ostringstream os;
+    ASSERT_EQ(1, ps.describe_series(os, options));
+    ASSERT_EQ(0, ps.enable_high_resolution_series());
+    ASSERT_EQ(0, ps.describe_series(os, options));
+    usleep(350000);
+    a << 100;
+    usleep(350000);
+    os.str("");
+    ASSERT_EQ(0, ps.describe_series(os, options));
+    const std::string s = os.str();
+    ASSERT_EQ(0UL, s.find("{\"label\":\"high_resolution\",\"data\":[[")) << s;
+    // 100 in one 100ms interval is shown as 1000/s while the one-second
+    // window smooths it.
+    int64_t max_value = 0;
+    int nzero = 0;
+    for (butil::StringSplitter sp(s.c_str(), ']'); sp; ++sp) {
+        // Each field is like `,[x,v'.
+        const std::string field(sp.field(), sp.length());
+        const size_t comma = field.rfind(',');
+        if (field.find('[') == std::string::npos ||
+            comma == std::string::npos || comma == field.size() - 1) {
+            continue;
+        }
+        const int64_t v = strtoll(field.c_str() + comma + 1, NULL, 10);
+        max_value = std::max(max_value, v);
+        nzero += (v == 0);
+    }
+    ASSERT_GT(max_value, 500) << s;
+    ASSERT_LT(max_value, 2000) << s;
+    ASSERT_GT(nzero, 2) << s;
+
+    // Not invertible.
+    bvar::Maxer<int> m;
+    bvar::Window<bvar::Maxer<int> > mw(&m, 1);
+    ASSERT_EQ(-1, mw.enable_high_resolution_series());
+}
+
+TEST_F(ReducerTest, high_resolution_series_selected_by_flag) {
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+                     "bvar_high_resolution_series", "reducer_test_hr_*").empty());
+    bvar::Adder<int64_t> a;
+    bvar::Window<bvar::Adder<int64_t> > w1("reducer_test_hr_w", &a, 10);
+    bvar::Window<bvar::Adder<int64_t> > w2("reducer_test_w", &a, 10);
+    bvar::SeriesOptions options;
+    options.high_resolution = true;
+    options.test_only = true;
+    std::ostringstream os;
+    ASSERT_EQ(0, bvar::Variable::describe_series_exposed(
+                  "reducer_test_hr_w", os, options));
+    ASSERT_EQ(1, bvar::Variable::describe_series_exposed(
+                  "reducer_test_w", os, options));
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+                     "bvar_high_resolution_series", "").empty());
+}
 } // namespace
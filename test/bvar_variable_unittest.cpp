@@ -387,6 +387,69 @@ TEST_F(VariableTest, recursive_mutex) {
     LOG(INFO) << "Each recursive mutex lock/unlock pair take "
               << timer.n_elapsed() / N << "ns";
 }
+
+class CountingDumper : public bvar::Dumper {
+public:
+    CountingDumper() : _count(0), _bytes(0), _sorted(true) {}
+    bool dump(const std::string& name,
+              const butil::StringPiece& description) {
+        if (_count != 0 && name < _last_name) {
+            _sorted = false;
+        }
+        _last_name = name;
+        ++_count;
+        _bytes += name.size() + description.size();
+        return true;
+    }
+
+    size_t _count;
+    size_t _bytes;
+    bool _sorted;
+    std::string _last_name;
+};
+
+TEST_F(VariableTest, dump_perf) {
+    const size_t counts[] = { 1000, 10000, 50000 };
+    std::ostringstream oss;
+    for (size_t i = 0; i < arraysize(counts); ++i) {
+        const size_t N = counts[i];
+        std::vector<bvar::Adder<int>*> vars;
+        vars.reserve(N);
+        char name[64];
+        for (size_t j = 0; j < N; ++j) {
+            vars.push_back(new bvar::Adder<int>);
+            *vars.back() << (int)j;
+            snprintf(name, sizeof(name), "dump_perf_%zu_count", j);
+            ASSERT_EQ(0, vars.back()->expose(name));
+        }
+        const int ROUNDS = 5;
+        CountingDumper d;
+        butil::Timer timer;
+        timer.start();
+        for (int k = 0; k < ROUNDS; ++k) {
+            d._count = 0;
+            ASSERT_LE((int)N, bvar::Variable::dump_exposed(&d, NULL));
+        }
+        timer.stop();
+        ASSERT_TRUE(d._sorted);
+
+        bvar::DumpOptions opts;
+        opts.white_wildcards = "dump_perf_1*";
+        CountingDumper fd;
+        butil::Timer filtered_timer;
+        filtered_timer.start();
+        ASSERT_LT(0, bvar::Variable::dump_exposed(&fd, &opts));
+        filtered_timer.stop();
+
+        oss << N << "\t" << timer.u_elapsed() / ROUNDS << "us\t"
+            << filtered_timer.u_elapsed() << "us\n";
+        for (size_t j = 0; j < N; ++j) {
+            delete vars[j];
+        }
+    }
+    LOG(INFO) << "Scrape cost (variables, full dump, filtered dump):\n"
+              << oss.str();
+}
 } // namespace
 
 int main(int argc, char** argv) {
@@ -0,0 +1,147 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+
+// Convert files written with -bvar_dump_format=binary back to text or csv.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <gflags/gflags.h>
+#include <butil/logging.h>
+#include <butil/recordio.h>
+#include <butil/errno.h>
+#include <bvar/detail/binary_dump.h>
+
+DEFINE_string(format, "text", "Output format: text or csv. `text' prints "
+              "`name : value' of all variables for each dump, `csv' prints "
+              "`time_us,name,value' of changed variables for each dump");
+DEFINE_bool(last_only, false, "Print the last dump only");
+
+class FdReader : public butil::IReader {
+public:
+    explicit FdReader(int fd) : _fd(fd) {}
+    ssize_t ReadV(const iovec* iov, int iovcnt) override {
+        return readv(_fd, iov, iovcnt);
+    }
+private:
+    int _fd;
+};
+
+static void print_csv_field(const std::string& s) {
+    if (s.find_first_of(",\"\r\n") == std::string::npos) {
+        fwrite(s.data(), 1, s.size(), stdout);
+        return;
+    }
+    putchar('"');
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == '"') {
+            putchar('"');
+        }
+        putchar(s[i]);
+    }
+    putchar('"');
+}
+
+static void print_dump(const bvar::detail::BinaryDumpDecoder& decoder,
+                       bool all) {
+    std::string value;
+    if (FLAGS_format == "csv") {
+        for (size_t i = 0; i < decoder.name_count(); ++i) {
+            if ((all && decoder.present(i)) ||
+                (!all && decoder.changed(i))) {
+                if (decoder.present(i)) {
+                    decoder.get_value(i, &value);
+                } else {
+                    // Empty value means the variable was removed.
+                    value.clear();
+                }
+                printf("%" PRId64 ",", decoder.time_us());
+                print_csv_field(decoder.name(i));
+                putchar(',');
+                print_csv_field(value);
+                putchar('\n');
+            }
+        }
+        return;
+    }
+    char timebuf[64];
+    const time_t tm_s = decoder.time_us() / 1000000L;
+    struct tm lt;
+    strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S",
+             localtime_r(&tm_s, &lt));
+    printf("# %s.%06d\n", timebuf, (int)(decoder.time_us() % 1000000L));
+    for (size_t i = 0; i < decoder.name_count(); ++i) {
+        if (decoder.present(i)) {
+            decoder.get_value(i, &value);
+            printf("%s : %s\n", decoder.name(i).c_str(), value.c_str());
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    GFLAGS_NS::SetUsageMessage("Usage: bvar_dump_reader [options] <file>");
+    GFLAGS_NS::ParseCommandLineFlags(&argc, &argv, true);
+    if (argc != 2) {
+        LOG(ERROR) << "Usage: bvar_dump_reader [-format=text|csv] "
+            "[-last_only] <file>";
+        return -1;
+    }
+    if (FLAGS_format != "text" && FLAGS_format != "csv") {
+        LOG(ERROR) << "Unknown -format=" << FLAGS_format;
+        return -1;
+    }
+    const int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        PLOG(ERROR) << "Fail to open " << argv[1];
+        return -1;
+    }
+    FdReader fr(fd);
+    butil::RecordReader reader(&fr);
+    bvar::detail::BinaryDumpDecoder decoder;
+    butil::Record rec;
+    bool first = true;
+    bool has_dump = false;
+    if (FLAGS_format == "csv") {
+        printf("time_us,name,value\n");
+    }
+    while (reader.ReadNext(&rec)) {
+        if (decoder.apply(rec) != 0) {
+            LOG(ERROR) << "Fail to decode record at offset=" << reader.offset();
+            close(fd);
+            return -1;
+        }
+        has_dump = true;
+        if (!FLAGS_last_only) {
+            print_dump(decoder, first);
+            first = false;
+        }
+    }
+    if (FLAGS_last_only && has_dump) {
+        print_dump(decoder, true);
+    }
+    const int rc = reader.last_error();
+    close(fd);
+    if (rc != butil::RecordReader::END_OF_READER) {
+        LOG(ERROR) << "Fail to read " << argv[1] << ": " << berror(rc);
+        return -1;
+    }
+    return 0;
+}